@@ -1,6 +1,7 @@
 #include "DS1820.h"
 #include "OneWire.h"
-#include "stdio.h"
+#include "dlog.h"
+#include "string.h"
 
 /* DS1820 specific commands */
 #define SCRATCHPAD_READ     0xBE
@@ -8,175 +9,594 @@
 #define SCRATCHPAD_WRITE    0x4E
 #define SCRATCHPAD_RECALL   0xB8
 #define POWER_SUPPLY_READ   0xB4
+#define TEMPERATURE_CONVERT 0x44
 
 /* DS1820 scratchpad length in bytes */
 #define SCRATCHPAD_LENGTH   9
 #define SCRATCHPAD_CRC_POS  (SCRATCHPAD_LENGTH - 1)
 
+/* DS1820 scratchpad layout */
+#define SCRATCHPAD_TH_POS       2
+#define SCRATCHPAD_TL_POS       3
+#define SCRATCHPAD_CONFIG_POS   4
+
+/* Configuration register, resolution 9 to 12 bits in bits 5-6 */
+#define CONFIG_RESOLUTION(bits) ((((bits) - 9) << 5) | 0x1F)
+#define CONFIG_BITS(config)     ((((config) >> 5) & 0x03) + 9)
+#define CONFIG_DEFAULT          CONFIG_RESOLUTION(12)
+
+/* DS18S20 has no configuration register */
+#define DS18S20_FAMILY_CODE     0x10
+
 /* Internal functions */
 
 
 
-static void TemperatureConvert(void);
+static void CO_TemperatureConvert(OW_Co *pCo);
+static void CO_Measure(OW_Co *pCo);
+static void SensorDecode(DS1820_Sensor *pSensor, OW_Transaction *pTransaction);
+static DS1820_State SensorSubmit(OW_Bus *pBus, DS1820_Sensor *pSensor, uint8_t iCommand,
+        uint8_t iWriteLength, uint8_t iReadLength, uint8_t iFlags, DS1820_SensorCallback callback);
+static DS1820_State SensorScratchpadWrite(OW_Bus *pBus, DS1820_Sensor *pSensor, DS1820_SensorCallback callback);
+static DS1820_State SensorWait(DS1820_Sensor *pSensor);
+static DS1820_Sensor *BlockingSensor(OW_Bus *pBus, uint64_t iAddress);
+static void CB_Sensor(OW_Bus *pBus, OW_Transaction *pTransaction);
 
-static int CRC_Right_flag=0;
-static float iTemp_buffer=0;
+/* Sensor read by DS1820_TemperatureGet and its last valid result */
+static DS1820_Sensor stReadSensor[OW_BUS_COUNT];
+static int32_t iLastTemperature[OW_BUS_COUNT];
+static uint64_t iLastAddress[OW_BUS_COUNT];
+static uint8_t bLastValid[OW_BUS_COUNT];
+
+/* Sensor used by the blocking configuration functions */
+static DS1820_Sensor stBlockingSensor[OW_BUS_COUNT];
 
 /**
  * Initalizes and resets OneWire communication.
  */
 void DS1820_Init(void) {
+    int i;
+
     OW_Init();
-    OW_Reset();
+    for (i = 0; i < OW_BUS_COUNT; i++)
+        OW_Reset(OW_BUS(i));
 }
 
 /**
  * Initializes temperature measurement on DS1820 chip.
  * @warning This function sets communication pin in StrongPullUp state.
  * @warning The bus has to be in StrongPullUp state at least for 500 ms.
+ * @param pBus Bus the device is connected to.
  * @param iAddress 64bit device address, use DS1820_ADDRESS_ALL for all 
  * devices.
- * @return DS1820_OK if successfull, DS1820_ERROR if failed.
+ * @return DS1820_OK if queued, DS1820_ERROR if failed.
  */
-DS1820_State DS1820_TemperatureConvert(uint64_t iAddress) {
+DS1820_State DS1820_TemperatureConvert(OW_Bus *pBus, uint64_t iAddress) {
+    OW_Co *pCo = OW_CoCreate(pBus, CO_TemperatureConvert, 0);
 
-    /* Ready bus for communcation */
-    OW_WeakPullUp();
-    OW_ROMMatch(iAddress,TemperatureConvert);
+    if (pCo == 0)
+        return DS1820_ERROR;
+
+    pCo->iAddress = iAddress;
+    OW_CoStart(pCo);
+    return DS1820_OK;
+}
 
+/**
+ * Convert and read one sensor, pSensor->iTemperature is valid when
+ * DS1820_SensorResult gives DS1820_OK. The bus is free during the
+ * conversion, every sensor runs its own measurement so several can overlap.
+ * Sensors on a parasite powered bus need the strong pull-up for the whole
+ * conversion, use the snapshot for them.
+ * @param pBus Bus the device is connected to.
+ * @param pSensor Sensor descriptor, has to stay valid until the callback.
+ * @param callback Called from interrupt when done, may be 0.
+ * @return DS1820_OK if started, DS1820_ERROR if no coroutine frame is free.
+ */
+DS1820_State DS1820_Measure_As(OW_Bus *pBus, DS1820_Sensor *pSensor, DS1820_SensorCallback callback) {
+    OW_Co *pCo = OW_CoCreate(pBus, CO_Measure, pSensor);
+
+    if (pCo == 0)
+        return DS1820_ERROR;
+
+    pSensor->callback = callback;
+    pSensor->stTransaction.iStatus = OW_TR_PENDING;
+    OW_CoStart(pCo);
     return DS1820_OK;
 }
 
+/**
+ * Read scratchpad and decode temperature into pSensor->iTemperature, cached
+ * alarm thresholds and configuration are updated as well. You have to use
+ * TemperatureConvert function before. Every sensor has its own descriptor,
+ * so reads of several sensors can be queued at once.
+ * @param pBus Bus the device is connected to.
+ * @param pSensor Sensor descriptor, has to stay valid until the callback.
+ * @param callback Called from interrupt when done, may be 0.
+ * @return DS1820_OK if queued, DS1820_ERROR if failed.
+ */
+DS1820_State DS1820_TemperatureRead_As(OW_Bus *pBus, DS1820_Sensor *pSensor, DS1820_SensorCallback callback) {
+    return SensorSubmit(pBus, pSensor, SCRATCHPAD_READ, 0, SCRATCHPAD_LENGTH, OW_TR_CRC8, callback);
+}
+
 /**
  * Reads tepmerature from specific device. You have to use TemperatureConvert 
- * function before calling TemperatureGet.
+ * function before calling TemperatureGet. Result is fetched by
+ * DS1820_TemperatureResult, one read per bus can be in flight.
+ * @param pBus Bus the device is connected to.
  * @param iAddress 64bit device address, use DS1820_ADDRESS_ALL to skip 
  * address match (only for single device on the bus).
- * @return Temperature in degrees of Celsius * 10 or DS1820_TEMP_ERROR in case 
- * of an error.
+ * @return DS1820_OK if queued, DS1820_ERROR if failed or previous read is
+ * still running.
  */
- 
-static volatile int state_TemperatureGet;
- 
-void DS1820_TemperatureGet(uint64_t iAddress) {
-    /* Ready bus for communcation */
-    OW_WeakPullUp();
-	state_TemperatureGet = 0;
-	OW_ROMMatch(iAddress, CB_TemperatureGet);
-}
-
-
-void CB_TemperatureGet(void)
-{
-	static int i = 0;
-	static volatile uint8_t iCRC = 0;
-	static uint8_t iSPad[SCRATCHPAD_LENGTH];
-	if(state_TemperatureGet == 0){
-		if(OW_ROMMatch_GetResult() == OW_NO_DEV){
-			return;
-		}else if(OW_ROMMatch_GetResult() == OW_OK){
-			state_TemperatureGet = 1;
-			OW_ByteWrite_As(SCRATCHPAD_READ,CB_TemperatureGet);
-		}
-	}else if(state_TemperatureGet == 1){
-	    state_TemperatureGet = 2;
-	    i=0;
-		OW_ByteRead_As(CB_TemperatureGet);
-
-
-	}else if(state_TemperatureGet == 2){
-		iSPad[i] = OW_GetByteReadResult();
-		iCRC = OW_CRCCalculate(iCRC, iSPad[i]);
-		i++;
-		if(i < 9){
-			OW_ByteRead_As(CB_TemperatureGet);
-		}else{
-			state_TemperatureGet = 3;
-			if(iCRC == 0){
-			    CRC_Right_flag=1;
-			}else{
-			    CRC_Right_flag=0;
-			}
-			i=0;
-			iTemp_buffer = (float)iBinaryToIntTemperature(iSPad)/10;
-		}
-	}else{
-	    i=0;
-	}
+DS1820_State DS1820_TemperatureGet(OW_Bus *pBus, uint64_t iAddress) {
+    DS1820_Sensor *pSensor = &stReadSensor[pBus->iIndex];
+
+    if (OW_QueueQueued(pBus, &pSensor->stTransaction))
+        return DS1820_ERROR;
+
+    DS1820_SensorInit(pSensor, iAddress);
+    return DS1820_TemperatureRead_As(pBus, pSensor, 0);
 }
 
+/**
+ * Convert DS18B20 format scratchpad to degrees of Celsius * 10.
+ * @param iSPad Scratchpad read from the device.
+ * @return Temperature rounded toward zero.
+ */
 int iBinaryToIntTemperature(uint8_t *iSPad) {
+    int32_t iTemp16;
+
+    ds18_decode(DS18_FAMILY_DS18B20, iSPad, &iTemp16);
+    return DS18_TEMP16_TO_TENTHS(iTemp16);
+}
+
+/**
+ * Result of DS1820_TemperatureGet, last valid value of the device if the
+ * read failed or is still running.
+ * @return Temperature in 1/16 degrees of Celsius, DS1820_TEMP_ERROR if the
+ * device was not read.
+ */
+int32_t DS1820_TemperatureResult(OW_Bus *pBus, uint64_t iAddress) {
+    DS1820_Sensor *pSensor = &stReadSensor[pBus->iIndex];
+    int b = pBus->iIndex;
+
+    if (pSensor->iAddress != iAddress || pSensor->stTransaction.callback == 0)
+        return DS1820_TEMP_ERROR;
+
+    switch (pSensor->stTransaction.iStatus) {
+        case OW_TR_PENDING:
+            break;
+        case OW_TR_DONE:
+            /* More than 5 degrees since last read */
+            if (bLastValid[b] && iLastAddress[b] == iAddress
+                    && (pSensor->iTemperature - iLastTemperature[b] > 5 * 16
+                    || iLastTemperature[b] - pSensor->iTemperature > 5 * 16))
+                DLOG2(DLOG_DS1820_JUMP, iLastTemperature[b], pSensor->iTemperature);
+            iLastTemperature[b] = pSensor->iTemperature;
+            iLastAddress[b] = iAddress;
+            bLastValid[b] = 1;
+            break;
+        default:
+            DLOG1(DLOG_DS1820_CRC_ERROR, b);
+            break;
+    }
 
-	//most and least significant bits
-	uint8_t lsb = iSPad[0];
-	uint8_t msb = iSPad[1];
-	//integer part
-    int temperature  = ((lsb >> 4) | ((msb << 4) )) & 0b01111111;
-
-    //negative part
-    if ( (( msb >> 3 ) & 0b1 ) == 1 )
-    	temperature = (~temperature & 0b01111111) * -1;
-
-    //avoid decimal
-    temperature *= 10;
-
-    /* "Decimal" part */
-    lsb &= 0xF;
-    temperature += (lsb == 0) ? 0 : (( lsb ) * 10 / 16) ;
-
-    return temperature;
-}
-float DS1820_TemperatureResult(uint64_t iAddress){
-    static volatile float temp_last = 0;
-    static volatile float temp = 0;
-    static volatile int t=0;
-    if(CRC_Right_flag == 1){
-    	if(t>0){
-    		if(iTemp_buffer-temp_last>5||temp_last-iTemp_buffer>5){
-    			printf("the temperature changs too much:%f and %f \n",temp_last,iTemp_buffer);
-    		}
-    	}
-         t=1;
-	     temp=iTemp_buffer;
-	}else{
-		     printf("CRC is wrong:%f\n",iTemp_buffer);
-		     temp=temp_last;  //right temperature
-		 }
-    temp_last=temp;
-    return temp;
+    if (!bLastValid[b] || iLastAddress[b] != iAddress)
+        return DS1820_TEMP_ERROR;
+    return iLastTemperature[b];
 }
 
 /**
  * Function searches for DS1820 devices on the bus and stores them in to array.
+ * @param pBus Bus to be searched.
  * @param Addresses Pointer to array for device addresses to be stored. 
  * @param iMaxDevices Maximum of devices to be searched.
  * @return Number of devices found.
  */
-int DS1820_Search(uint64_t *Addresses, int iMaxDevices) {
+int DS1820_Search(OW_Bus *pBus, uint64_t *Addresses, int iMaxDevices) {
     int iCount = 0;
     uint64_t iAddress;
 
     /* Ready bus for communcation */
-    OW_WeakPullUp();
+    OW_WeakPullUp(pBus);
 
     /* Search for first DS1820 device */
-    iAddress = OW_SearchFirst(0);
+    iAddress = OW_SearchFirst(pBus, 0);
     /* Store all device addresses into a array */
     while ((iAddress) && (iCount < iMaxDevices)) {
         iCount++;
         Addresses[iCount - 1] = iAddress;
-        iAddress = OW_SearchNext();
+        iAddress = OW_SearchNext(pBus);
     }
 
     /* Reset communication */
-    OW_Reset();
+    OW_Reset(pBus);
 
     return iCount;
 }
 
 /**
- * Starts temperature conversion.
+ * Prepare sensor descriptor with power-on defaults.
+ * @param pSensor Sensor descriptor.
+ * @param iAddress 64bit device address, use DS1820_ADDRESS_ALL for single
+ * device on the bus.
+ */
+void DS1820_SensorInit(DS1820_Sensor *pSensor, uint64_t iAddress) {
+    memset(pSensor, 0, sizeof(DS1820_Sensor));
+    pSensor->iAddress = iAddress;
+    pSensor->iConfig = CONFIG_DEFAULT;
+    pSensor->iPowerType = DS1820_ERROR;
+}
+
+/**
+ * Write temperature alarm thresholds into the scratchpad, configuration
+ * register keeps the cached value.
+ * @param pBus Bus the device is connected to.
+ * @param pSensor Sensor descriptor, has to stay valid until the callback.
+ * @param iHigh High threshold in degrees of Celsius.
+ * @param iLow Low threshold in degrees of Celsius.
+ * @param callback Called from interrupt when done, may be 0.
+ * @return DS1820_OK if queued, DS1820_ERROR if failed.
+ */
+DS1820_State DS1820_TemperatureAlarmSet_As(OW_Bus *pBus, DS1820_Sensor *pSensor, int iHigh, int iLow, DS1820_SensorCallback callback) {
+    pSensor->iAlarmHigh = iHigh;
+    pSensor->iAlarmLow = iLow;
+
+    return SensorScratchpadWrite(pBus, pSensor, callback);
+}
+
+/**
+ * Read scratchpad and update cached alarm thresholds and configuration.
+ * @param pBus Bus the device is connected to.
+ * @param pSensor Sensor descriptor, has to stay valid until the callback.
+ * @param callback Called from interrupt when done, may be 0.
+ * @return DS1820_OK if queued, DS1820_ERROR if failed.
  */
-void TemperatureConvert(void) {
-    OW_ByteWrite_As(0x44,OW_StrongPullUp);
+DS1820_State DS1820_TemperatureAlarmGet_As(OW_Bus *pBus, DS1820_Sensor *pSensor, DS1820_SensorCallback callback) {
+    return SensorSubmit(pBus, pSensor, SCRATCHPAD_READ, 0, SCRATCHPAD_LENGTH, OW_TR_CRC8, callback);
+}
+
+/**
+ * Set conversion resolution, alarm thresholds keep the cached values.
+ * Has no effect on DS18S20, which always converts in 750 ms.
+ * @param pBus Bus the device is connected to.
+ * @param pSensor Sensor descriptor, has to stay valid until the callback.
+ * @param iBits Resolution, 9 to 12 bits.
+ * @param callback Called from interrupt when done, may be 0.
+ * @return DS1820_OK if queued, DS1820_ERROR if failed.
+ */
+DS1820_State DS1820_ResolutionSet_As(OW_Bus *pBus, DS1820_Sensor *pSensor, int iBits, DS1820_SensorCallback callback) {
+    if (iBits < 9 || iBits > 12)
+        return DS1820_ERROR;
+
+    pSensor->iConfig = CONFIG_RESOLUTION(iBits);
+
+    return SensorScratchpadWrite(pBus, pSensor, callback);
+}
+
+/**
+ * Copy alarm thresholds and configuration from scratchpad to EEPROM.
+ * @warning Bus is left in StrongPullUp state, keep it idle for at least
+ * 10 ms when the sensor is parasite powered.
+ * @param pBus Bus the device is connected to.
+ * @param pSensor Sensor descriptor, has to stay valid until the callback.
+ * @param callback Called from interrupt when done, may be 0.
+ * @return DS1820_OK if queued, DS1820_ERROR if failed.
+ */
+DS1820_State DS1820_ConfigurationStore_As(OW_Bus *pBus, DS1820_Sensor *pSensor, DS1820_SensorCallback callback) {
+    return SensorSubmit(pBus, pSensor, SCRATCHPAD_STORE, 0, 0, OW_TR_PULLUP, callback);
+}
+
+/**
+ * Reload alarm thresholds and configuration from EEPROM into scratchpad.
+ * Use DS1820_TemperatureAlarmGet_As to refresh the cached values.
+ * @param pBus Bus the device is connected to.
+ * @param pSensor Sensor descriptor, has to stay valid until the callback.
+ * @param callback Called from interrupt when done, may be 0.
+ * @return DS1820_OK if queued, DS1820_ERROR if failed.
+ */
+DS1820_State DS1820_ConfigurationRecall_As(OW_Bus *pBus, DS1820_Sensor *pSensor, DS1820_SensorCallback callback) {
+    return SensorSubmit(pBus, pSensor, SCRATCHPAD_RECALL, 0, 0, 0, callback);
+}
+
+/**
+ * Read power supply type into pSensor->iPowerType. With DS1820_ADDRESS_ALL
+ * any parasite powered device on the bus reports DS1820_PARASITE_POWER.
+ * @param pBus Bus the device is connected to.
+ * @param pSensor Sensor descriptor, has to stay valid until the callback.
+ * @param callback Called from interrupt when done, may be 0.
+ * @return DS1820_OK if queued, DS1820_ERROR if failed.
+ */
+DS1820_State DS1820_PowerTypeGet_As(OW_Bus *pBus, DS1820_Sensor *pSensor, DS1820_SensorCallback callback) {
+    return SensorSubmit(pBus, pSensor, POWER_SUPPLY_READ, 0, 1, 0, callback);
+}
+
+/**
+ * @return Result of the last sensor operation, DS1820_OK, DS1820_CRC_ERROR
+ * or DS1820_ERROR.
+ */
+DS1820_State DS1820_SensorResult(DS1820_Sensor *pSensor) {
+    switch (pSensor->stTransaction.iStatus) {
+        case OW_TR_DONE:
+            return DS1820_OK;
+        case OW_TR_CRC_ERROR:
+            return DS1820_CRC_ERROR;
+        default:
+            return DS1820_ERROR;
+    }
+}
+
+/**
+ * @return Cached conversion resolution in bits.
+ */
+int DS1820_ResolutionGet(DS1820_Sensor *pSensor) {
+    if ((uint8_t) pSensor->iAddress == DS18S20_FAMILY_CODE)
+        return 9;
+    return CONFIG_BITS(pSensor->iConfig);
+}
+
+/**
+ * Conversion time matching the sensor resolution.
+ * @param iFamilyCode Family code of the device, 0 if not known.
+ * @param iConfig Configuration register of the device.
+ * @return Conversion time in ms.
+ */
+int DS1820_ConversionTime(uint8_t iFamilyCode, uint8_t iConfig) {
+    if (iFamilyCode == DS18S20_FAMILY_CODE)
+        return DS1820_CONVERSION_TIME_12BIT_MS;
+
+    switch (CONFIG_BITS(iConfig)) {
+        case 9:
+            return DS1820_CONVERSION_TIME_9BIT_MS;
+        case 10:
+            return DS1820_CONVERSION_TIME_10BIT_MS;
+        case 11:
+            return DS1820_CONVERSION_TIME_11BIT_MS;
+        default:
+            return DS1820_CONVERSION_TIME_12BIT_MS;
+    }
+}
+
+/**
+ * Set temperature alarm thresholds, blocking.
+ * @return DS1820_OK if successfull, DS1820_ERROR or DS1820_CRC_ERROR if failed.
+ */
+DS1820_State DS1820_TemperatureAlarmSet(OW_Bus *pBus, uint64_t iAddress, int iHigh, int iLow) {
+    DS1820_Sensor *pSensor = BlockingSensor(pBus, iAddress);
+    DS1820_State iState;
+
+    /* Configuration register has to be preserved */
+    if (pSensor == 0)
+        return DS1820_ERROR;
+    if (DS1820_TemperatureAlarmGet_As(pBus, pSensor, 0) != DS1820_OK)
+        return DS1820_ERROR;
+    if ((iState = SensorWait(pSensor)) != DS1820_OK)
+        return iState;
+
+    if (DS1820_TemperatureAlarmSet_As(pBus, pSensor, iHigh, iLow, 0) != DS1820_OK)
+        return DS1820_ERROR;
+    return SensorWait(pSensor);
+}
+
+/**
+ * Read temperature alarm thresholds, blocking.
+ * @return DS1820_OK if successfull, DS1820_ERROR or DS1820_CRC_ERROR if failed.
+ */
+DS1820_State DS1820_TemperatureAlarmGet(OW_Bus *pBus, uint64_t iAddress, int *iHigh, int *iLow) {
+    DS1820_Sensor *pSensor = BlockingSensor(pBus, iAddress);
+    DS1820_State iState;
+
+    if (pSensor == 0)
+        return DS1820_ERROR;
+    if (DS1820_TemperatureAlarmGet_As(pBus, pSensor, 0) != DS1820_OK)
+        return DS1820_ERROR;
+    if ((iState = SensorWait(pSensor)) != DS1820_OK)
+        return iState;
+
+    *iHigh = pSensor->iAlarmHigh;
+    *iLow = pSensor->iAlarmLow;
+    return DS1820_OK;
+}
+
+/**
+ * Set conversion resolution, blocking.
+ * @return DS1820_OK if successfull, DS1820_ERROR or DS1820_CRC_ERROR if failed.
+ */
+DS1820_State DS1820_ResolutionSet(OW_Bus *pBus, uint64_t iAddress, int iBits) {
+    DS1820_Sensor *pSensor = BlockingSensor(pBus, iAddress);
+    DS1820_State iState;
+
+    /* Alarm thresholds have to be preserved */
+    if (pSensor == 0)
+        return DS1820_ERROR;
+    if (DS1820_TemperatureAlarmGet_As(pBus, pSensor, 0) != DS1820_OK)
+        return DS1820_ERROR;
+    if ((iState = SensorWait(pSensor)) != DS1820_OK)
+        return iState;
+
+    if (DS1820_ResolutionSet_As(pBus, pSensor, iBits, 0) != DS1820_OK)
+        return DS1820_ERROR;
+    return SensorWait(pSensor);
+}
+
+/**
+ * Store configuration into EEPROM, blocking.
+ * @warning Bus is left in StrongPullUp state, see DS1820_ConfigurationStore_As.
+ * @return DS1820_OK if successfull, DS1820_ERROR if failed.
+ */
+DS1820_State DS1820_ConfigurationStore(OW_Bus *pBus, uint64_t iAddress) {
+    DS1820_Sensor *pSensor = BlockingSensor(pBus, iAddress);
+
+    if (pSensor == 0)
+        return DS1820_ERROR;
+    if (DS1820_ConfigurationStore_As(pBus, pSensor, 0) != DS1820_OK)
+        return DS1820_ERROR;
+    return SensorWait(pSensor);
+}
+
+/**
+ * Recall configuration from EEPROM, blocking.
+ * @return DS1820_OK if successfull, DS1820_ERROR if failed.
+ */
+DS1820_State DS1820_ConfigurationRecall(OW_Bus *pBus, uint64_t iAddress) {
+    DS1820_Sensor *pSensor = BlockingSensor(pBus, iAddress);
+
+    if (pSensor == 0)
+        return DS1820_ERROR;
+    if (DS1820_ConfigurationRecall_As(pBus, pSensor, 0) != DS1820_OK)
+        return DS1820_ERROR;
+    return SensorWait(pSensor);
+}
+
+/**
+ * Read power supply type, blocking.
+ * @return DS1820_PARASITE_POWER, DS1820_EXTERNAL_POWER or DS1820_ERROR.
+ */
+DS1820_State DS1820_PowerTypeGet(OW_Bus *pBus, uint64_t iAddress) {
+    DS1820_Sensor *pSensor = BlockingSensor(pBus, iAddress);
+
+    if (pSensor == 0)
+        return DS1820_ERROR;
+    if (DS1820_PowerTypeGet_As(pBus, pSensor, 0) != DS1820_OK)
+        return DS1820_ERROR;
+    if (SensorWait(pSensor) != DS1820_OK)
+        return DS1820_ERROR;
+    return pSensor->iPowerType;
+}
+
+/**
+ * Queue one addressed command of a sensor.
+ */
+static DS1820_State SensorSubmit(OW_Bus *pBus, DS1820_Sensor *pSensor, uint8_t iCommand,
+        uint8_t iWriteLength, uint8_t iReadLength, uint8_t iFlags, DS1820_SensorCallback callback) {
+    OW_Transaction *pTr = &pSensor->stTransaction;
+
+    /* Previous operation still on the bus, its descriptor must not change */
+    if (OW_QueueQueued(pBus, pTr))
+        return DS1820_ERROR;
+
+    memset(pTr, 0, sizeof(OW_Transaction));
+    pTr->iFlags = OW_TR_SELECT | OW_TR_COMMAND | iFlags;
+    pTr->iAddress = pSensor->iAddress;
+    pTr->iCommand = iCommand;
+    pTr->pWrite = pSensor->iWrite;
+    pTr->iWriteLength = iWriteLength;
+    pTr->pRead = pSensor->iScratchpad;
+    pTr->iReadLength = iReadLength;
+    pTr->callback = CB_Sensor;
+    pTr->pContext = pSensor;
+    pSensor->callback = callback;
+
+    if (OW_QueueSubmit(pBus, pTr) != OW_OK)
+        return DS1820_ERROR;
+    return DS1820_OK;
+}
+
+/**
+ * Write cached thresholds and configuration into the scratchpad.
+ */
+static DS1820_State SensorScratchpadWrite(OW_Bus *pBus, DS1820_Sensor *pSensor, DS1820_SensorCallback callback) {
+    uint8_t iLength = 3;
+
+    pSensor->iWrite[0] = pSensor->iAlarmHigh;
+    pSensor->iWrite[1] = pSensor->iAlarmLow;
+    pSensor->iWrite[2] = pSensor->iConfig;
+    if ((uint8_t) pSensor->iAddress == DS18S20_FAMILY_CODE)
+        iLength = 2;
+
+    return SensorSubmit(pBus, pSensor, SCRATCHPAD_WRITE, iLength, 0, 0, callback);
+}
+
+/**
+ * Descriptor of the blocking functions, 0 while an operation that timed
+ * out is still queued.
+ */
+static DS1820_Sensor *BlockingSensor(OW_Bus *pBus, uint64_t iAddress) {
+    DS1820_Sensor *pSensor = &stBlockingSensor[pBus->iIndex];
+
+    if (OW_QueueQueued(pBus, &pSensor->stTransaction))
+        return 0;
+    DS1820_SensorInit(pSensor, iAddress);
+    return pSensor;
+}
+
+/**
+ * Wait for the sensor operation to complete. On timeout the transaction
+ * may still be queued, the descriptor is refused until it is done.
+ */
+static DS1820_State SensorWait(DS1820_Sensor *pSensor) {
+    volatile int t = 0xffffff;
+
+    while (pSensor->stTransaction.iStatus == OW_TR_PENDING && t > 0)
+        t--;
+
+    return DS1820_SensorResult(pSensor);
+}
+
+static void CB_Sensor(OW_Bus *pBus, OW_Transaction *pTransaction) {
+    DS1820_Sensor *pSensor = pTransaction->pContext;
+
+    SensorDecode(pSensor, pTransaction);
+    if (pSensor->callback)
+        pSensor->callback(pBus, pSensor);
+}
+
+/**
+ * Update sensor from the data of a completed command, iStatus of the
+ * transaction is set to OW_TR_FAILED if the data is not valid.
+ */
+static void SensorDecode(DS1820_Sensor *pSensor, OW_Transaction *pTransaction) {
+    if (pTransaction->iStatus == OW_TR_DONE) {
+        if (pTransaction->iCommand == SCRATCHPAD_READ) {
+            if (!ds18_decode((uint8_t) pSensor->iAddress, pSensor->iScratchpad, &pSensor->iTemperature))
+                pTransaction->iStatus = OW_TR_FAILED;
+            pSensor->iAlarmHigh = pSensor->iScratchpad[SCRATCHPAD_TH_POS];
+            pSensor->iAlarmLow = pSensor->iScratchpad[SCRATCHPAD_TL_POS];
+            if ((uint8_t) pSensor->iAddress != DS18S20_FAMILY_CODE)
+                pSensor->iConfig = pSensor->iScratchpad[SCRATCHPAD_CONFIG_POS];
+        } else if (pTransaction->iCommand == POWER_SUPPLY_READ) {
+            /* Parasite powered device pulls the read slot low */
+            pSensor->iPowerType = (pSensor->iScratchpad[0] & 0x01) ?
+                    DS1820_EXTERNAL_POWER : DS1820_PARASITE_POWER;
+        }
+    }
+}
+
+/**
+ * Starts temperature conversion, the bus is left in strong pull-up.
+ */
+static void CO_TemperatureConvert(OW_Co *pCo) {
+    OW_CO_BEGIN(pCo);
+
+    OW_CO_TRANSACT(pCo, OW_TR_SELECT | OW_TR_COMMAND | OW_TR_PULLUP, pCo->iAddress,
+            TEMPERATURE_CONVERT, 0, 0, 0, 0);
+    if (pCo->iStatus != OW_TR_DONE)
+        DLOG1(DLOG_OW_NO_DEVICE, pCo->pBus->iIndex);
+
+    OW_CO_END(pCo);
+}
+
+/**
+ * Measurement of DS1820_Measure_As.
+ */
+static void CO_Measure(OW_Co *pCo) {
+    DS1820_Sensor *pSensor = pCo->pContext;
+
+    OW_CO_BEGIN(pCo);
+
+    OW_CO_TRANSACT(pCo, OW_TR_SELECT | OW_TR_COMMAND, pSensor->iAddress,
+            TEMPERATURE_CONVERT, 0, 0, 0, 0);
+    if (pCo->iStatus == OW_TR_DONE) {
+        OW_CO_DELAY(pCo, DS1820_ConversionTime((uint8_t) pSensor->iAddress, pSensor->iConfig));
+        OW_CO_TRANSACT(pCo, OW_TR_SELECT | OW_TR_COMMAND | OW_TR_CRC8, pSensor->iAddress,
+                SCRATCHPAD_READ, 0, 0, pSensor->iScratchpad, SCRATCHPAD_LENGTH);
+        SensorDecode(pSensor, &pCo->stTransaction);
+    }
+
+    pSensor->stTransaction.iStatus = pCo->stTransaction.iStatus;
+    if (pSensor->callback)
+        pSensor->callback(pCo->pBus, pSensor);
+
+    OW_CO_END(pCo);
 }
@@ -23,6 +23,8 @@ extern "C" {
 #endif
 
 #include "stdint.h"
+#include "OneWire.h"
+#include "ds18temp.h"
 
     /* Public DS1820 constants */
 #define DS1820_ADDRESS_ALL      0
@@ -39,28 +41,122 @@ extern "C" {
         DS1820_EXTERNAL_POWER = 0x20
     } DS1820_State;
 
+    /* Resolution dependent conversion time, DS18S20 always converts 750 ms */
+#define DS1820_CONVERSION_TIME_9BIT_MS  94
+#define DS1820_CONVERSION_TIME_10BIT_MS 188
+#define DS1820_CONVERSION_TIME_11BIT_MS 375
+#define DS1820_CONVERSION_TIME_12BIT_MS 750
+
+    typedef struct _DS1820_Sensor DS1820_Sensor;
+    typedef void (*DS1820_SensorCallback)(OW_Bus *pBus, DS1820_Sensor *pSensor);
+
+    /* Cached configuration of one sensor and its pending operation */
+    struct _DS1820_Sensor {
+        uint64_t iAddress;
+        int8_t iAlarmHigh;
+        int8_t iAlarmLow;
+        uint8_t iConfig;            /* Configuration register, resolution in bits 5-6 */
+        DS1820_State iPowerType;    /* DS1820_PARASITE_POWER or DS1820_EXTERNAL_POWER */
+        int32_t iTemperature;       /* 1/16 degrees of Celsius, see DS1820_TemperatureRead_As */
+
+        uint8_t iScratchpad[9];
+        uint8_t iWrite[3];
+        DS1820_SensorCallback callback;
+        OW_Transaction stTransaction;
+    };
+
+    /* Snapshot acquisition configuration */
+#define DS1820_SNAPSHOT_MAX_SENSORS     20
+#define DS1820_CONVERSION_TIME_MS       750
+
+    /* Snapshot acquisition state */
+    typedef enum _DS1820_SnapshotState {
+        DS1820_SNAP_IDLE = 0,
+        DS1820_SNAP_CONVERTING,
+        DS1820_SNAP_CONVERTED,
+        DS1820_SNAP_READING,
+        DS1820_SNAP_READY,
+        DS1820_SNAP_FAILED
+    } DS1820_SnapshotState;
+
+    /* One sensor of a snapshot */
+    typedef struct _DS1820_Reading {
+        uint64_t iAddress;
+        uint8_t iScratchpad[9];
+        OW_TrStatus iStatus;        /* OW_TR_PENDING if not read in this snapshot */
+        int32_t iTemperature;       /* 1/16 degrees of Celsius, if iStatus is OW_TR_DONE */
+        uint8_t bAlarm;             /* Found by alarm search, see DS1820_SnapshotReadAlarms */
+        uint8_t iConfig;            /* Configuration register of the last good read, 0 until then */
+    } DS1820_Reading;
+
+    typedef struct _DS1820_Snapshot DS1820_Snapshot;
+    typedef void (*DS1820_SnapshotCallback)(DS1820_Snapshot *pSnapshot);
+
+    /* All sensors of one bus converted at once and read back to back */
+    struct _DS1820_Snapshot {
+        OW_Bus *pBus;
+        uint8_t iCount;
+        uint8_t iIndex;
+        volatile DS1820_SnapshotState iState;
+        uint32_t iTimestamp;        /* Time of the conversion start in ms, given by caller */
+        uint32_t iSequence;         /* Number of completed snapshots */
+        int iConversionTime;        /* Worst case conversion time in ms */
+        DS1820_State iPowerType;    /* Bus power, DS1820_ERROR until detected */
+        volatile uint8_t bConvertStarted;
+        volatile uint8_t bPollPending;
+        uint8_t iPoll;
+        uint8_t bAlarmOnly;
+        uint8_t bSingleDevice;      /* Set by the caller if a full search found no other device */
+        DS1820_SnapshotCallback callback;
+        OW_Transaction stTransaction;
+        DS1820_Reading stReading[DS1820_SNAPSHOT_MAX_SENSORS];
+    };
+
     /* Function headers */
     void DS1820_Init(void);
 
     /* Temperature measurement */
-    DS1820_State DS1820_TemperatureConvert(uint64_t iAddress);
-    void DS1820_TemperatureGet(uint64_t iAddress);
-    void CB_TemperatureGet(void);
+    DS1820_State DS1820_TemperatureConvert(OW_Bus *pBus, uint64_t iAddress);
+    DS1820_State DS1820_TemperatureRead_As(OW_Bus *pBus, DS1820_Sensor *pSensor, DS1820_SensorCallback callback);
+    DS1820_State DS1820_Measure_As(OW_Bus *pBus, DS1820_Sensor *pSensor, DS1820_SensorCallback callback);
+    DS1820_State DS1820_TemperatureGet(OW_Bus *pBus, uint64_t iAddress);
     int iBinaryToIntTemperature(uint8_t *iSPad);
-    float DS1820_TemperatureResult(uint64_t iAddress);
+    int32_t DS1820_TemperatureResult(OW_Bus *pBus, uint64_t iAddress);
+    /* Sensor configuration, asynchronous */
+    void DS1820_SensorInit(DS1820_Sensor *pSensor, uint64_t iAddress);
+    DS1820_State DS1820_TemperatureAlarmSet_As(OW_Bus *pBus, DS1820_Sensor *pSensor, int iHigh, int iLow, DS1820_SensorCallback callback);
+    DS1820_State DS1820_TemperatureAlarmGet_As(OW_Bus *pBus, DS1820_Sensor *pSensor, DS1820_SensorCallback callback);
+    DS1820_State DS1820_ResolutionSet_As(OW_Bus *pBus, DS1820_Sensor *pSensor, int iBits, DS1820_SensorCallback callback);
+    DS1820_State DS1820_ConfigurationStore_As(OW_Bus *pBus, DS1820_Sensor *pSensor, DS1820_SensorCallback callback);
+    DS1820_State DS1820_ConfigurationRecall_As(OW_Bus *pBus, DS1820_Sensor *pSensor, DS1820_SensorCallback callback);
+    DS1820_State DS1820_PowerTypeGet_As(OW_Bus *pBus, DS1820_Sensor *pSensor, DS1820_SensorCallback callback);
+    DS1820_State DS1820_SensorResult(DS1820_Sensor *pSensor);
+    int DS1820_ResolutionGet(DS1820_Sensor *pSensor);
+    int DS1820_ConversionTime(uint8_t iFamilyCode, uint8_t iConfig);
+
     /* Alarms */
-    DS1820_State DS1820_TemperatureAlarmSet(uint64_t iAddress, int iHigh, int iLow);
-    DS1820_State DS1820_TemperatureAlarmGet(uint64_t iAddress, int *iHigh, int *iLow);
+    DS1820_State DS1820_TemperatureAlarmSet(OW_Bus *pBus, uint64_t iAddress, int iHigh, int iLow);
+    DS1820_State DS1820_TemperatureAlarmGet(OW_Bus *pBus, uint64_t iAddress, int *iHigh, int *iLow);
+    DS1820_State DS1820_ResolutionSet(OW_Bus *pBus, uint64_t iAddress, int iBits);
 
     /* Configuration */
-    DS1820_State DS1820_ConfigurationStore(uint64_t iAddress);
-    DS1820_State DS1820_ConfigurationRecall(uint64_t iAddress);
+    DS1820_State DS1820_ConfigurationStore(OW_Bus *pBus, uint64_t iAddress);
+    DS1820_State DS1820_ConfigurationRecall(OW_Bus *pBus, uint64_t iAddress);
 
     /* Device info */
-    DS1820_State DS1820_PowerTypeGet(uint64_t iAddress);
+    DS1820_State DS1820_PowerTypeGet(OW_Bus *pBus, uint64_t iAddress);
 
     /* Device discovery */
-    int DS1820_Search(uint64_t *Addresses, int iMaxDevices);
+    int DS1820_Search(OW_Bus *pBus, uint64_t *Addresses, int iMaxDevices);
+
+    /* Snapshot acquisition */
+    void DS1820_SnapshotInit(DS1820_Snapshot *pSnapshot, OW_Bus *pBus, const uint64_t *Addresses, int iCount);
+    DS1820_State DS1820_SnapshotConvert(DS1820_Snapshot *pSnapshot, uint32_t iTimestamp);
+    int DS1820_SnapshotPoll(DS1820_Snapshot *pSnapshot, uint32_t iNow);
+    DS1820_State DS1820_SnapshotRead(DS1820_Snapshot *pSnapshot, DS1820_SnapshotCallback callback);
+    int DS1820_SnapshotReady(DS1820_Snapshot *pSnapshot);
+    DS1820_State DS1820_SnapshotAlarmSet(DS1820_Snapshot *pSnapshot, int iHigh, int iLow);
+    DS1820_State DS1820_SnapshotReadAlarms(DS1820_Snapshot *pSnapshot, DS1820_SnapshotCallback callback);
     
 	void GetLastValidTemp(int *temp);
 	int GetLastTemp(int *temp);
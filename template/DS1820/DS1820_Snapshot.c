@@ -0,0 +1,385 @@
+/**
+ *******************************************************************************
+ * @file    DS1820_Snapshot.c
+ * @brief   Convert-all then read-all acquisition cycle.
+ *
+ * @section info Additional Information
+ *          One Skip ROM + Convert T starts the conversion in every sensor of
+ *          the bus, so a whole bus needs a single conversion time. After the
+ *          conversion all scratchpads are read back to back through the
+ *          transaction queue, each read is started from the completion
+ *          callback of the previous one. Reads use Match ROM, Skip ROM only
+ *          if the caller set bSingleDevice after a full search found the
+ *          one sensor alone on the bus. A single sensor in the snapshot says
+ *          nothing about other devices.
+ *
+ *          Typical cycle:
+ *              DS1820_SnapshotConvert(&stSnap, iNow);
+ *              wait for DS1820_SnapshotPoll(&stSnap, iNow)
+ *              DS1820_SnapshotRead(&stSnap, 0);
+ *              wait for DS1820_SnapshotReady(&stSnap)
+ *
+ *          All readings of a snapshot belong to the same conversion and carry
+ *          its timestamp. Readings must not be used while the snapshot is
+ *          being read.
+ *
+ *          Power supply of the bus is detected by Read Power Supply before
+ *          the first conversion. If any sensor is parasite powered the bus
+ *          stays in strong pull-up for the whole conversion time. Otherwise
+ *          read time slots are polled and the snapshot is read as soon as
+ *          the slowest sensor reports conversion done. Polling assumes no
+ *          other transaction addresses the bus while the sensors convert.
+ *
+ *          In monitoring mode every sensor gets the same TH/TL window by
+ *          DS1820_SnapshotAlarmSet and DS1820_SnapshotReadAlarms replaces the
+ *          full read: one alarm search (0xEC) finds the sensors out of the
+ *          window and only their scratchpads are read. Readings of sensors
+ *          inside the window stay OW_TR_PENDING.
+ *
+ *          The conversion time follows the slowest sensor resolution, each
+ *          sensor counts with the configuration of its last good read. A
+ *          sensor never read counts with DS1820_CONVERSION_TIME_MS, sensors
+ *          skipped by an alarm-only read keep their last configuration.
+ *******************************************************************************
+ */
+
+#include "DS1820.h"
+#include "string.h"
+
+/* DS1820 specific commands */
+#define TEMPERATURE_CONVERT 0x44
+#define SCRATCHPAD_READ     0xBE
+#define POWER_SUPPLY_READ   0xB4
+
+static int SnapshotConversionTime(DS1820_Snapshot *pSnapshot);
+static OW_State SnapshotSubmit(DS1820_Snapshot *pSnapshot, uint8_t iFlags, uint8_t iCommand,
+        uint8_t *pRead, uint8_t iReadLength, OW_TrCallback callback);
+static void CB_SnapshotPower(OW_Bus *pBus, OW_Transaction *pTransaction);
+static void CB_SnapshotPoll(OW_Bus *pBus, OW_Transaction *pTransaction);
+static void CB_SnapshotAlarm(OW_Bus *pBus, uint64_t iROM);
+
+/* Snapshot running alarm search on every bus, search callback has no context */
+static DS1820_Snapshot *pAlarmSnapshot[OW_BUS_COUNT];
+static void SnapshotReadNext(DS1820_Snapshot *pSnapshot);
+static void CB_SnapshotConvert(OW_Bus *pBus, OW_Transaction *pTransaction);
+static void CB_SnapshotRead(OW_Bus *pBus, OW_Transaction *pTransaction);
+
+/**
+ * Prepare snapshot for a set of sensors on one bus.
+ * @param pSnapshot Snapshot to be initialized.
+ * @param pBus Bus the sensors are connected to.
+ * @param Addresses Addresses of the sensors, see DS1820_Search.
+ * @param iCount Number of sensors, at most DS1820_SNAPSHOT_MAX_SENSORS are
+ * used.
+ */
+void DS1820_SnapshotInit(DS1820_Snapshot *pSnapshot, OW_Bus *pBus, const uint64_t *Addresses, int iCount) {
+    int i;
+
+    if (iCount > DS1820_SNAPSHOT_MAX_SENSORS)
+        iCount = DS1820_SNAPSHOT_MAX_SENSORS;
+
+    memset(pSnapshot, 0, sizeof(DS1820_Snapshot));
+    pSnapshot->pBus = pBus;
+    pSnapshot->iCount = iCount;
+    for (i = 0; i < iCount; i++)
+        pSnapshot->stReading[i].iAddress = Addresses[i];
+}
+
+/**
+ * Start temperature conversion in all sensors of the bus at once.
+ * @warning With parasite powered sensors the bus is left in StrongPullUp
+ * state for the conversion.
+ * @param pSnapshot Snapshot to be acquired.
+ * @param iTimestamp Time of the measurement in ms, stored in the snapshot.
+ * @return DS1820_OK if queued, DS1820_ERROR if a cycle is in progress or
+ * the queue is full.
+ */
+DS1820_State DS1820_SnapshotConvert(DS1820_Snapshot *pSnapshot, uint32_t iTimestamp) {
+    OW_State iState;
+
+    if (pSnapshot->iState == DS1820_SNAP_CONVERTING || pSnapshot->iState == DS1820_SNAP_READING)
+        return DS1820_ERROR;
+
+    pSnapshot->iTimestamp = iTimestamp;
+    pSnapshot->iConversionTime = SnapshotConversionTime(pSnapshot);
+    pSnapshot->bConvertStarted = 0;
+    pSnapshot->bPollPending = 0;
+    pSnapshot->iState = DS1820_SNAP_CONVERTING;
+
+    if (pSnapshot->iPowerType == DS1820_ERROR)
+        iState = SnapshotSubmit(pSnapshot, 0, POWER_SUPPLY_READ, &pSnapshot->iPoll, 1, CB_SnapshotPower);
+    else
+        iState = SnapshotSubmit(pSnapshot, pSnapshot->iPowerType == DS1820_PARASITE_POWER ? OW_TR_PULLUP : 0,
+                TEMPERATURE_CONVERT, 0, 0, CB_SnapshotConvert);
+
+    if (iState != OW_OK) {
+        pSnapshot->iState = DS1820_SNAP_FAILED;
+        return DS1820_ERROR;
+    }
+    return DS1820_OK;
+}
+
+/**
+ * Check for conversion done, call periodically after DS1820_SnapshotConvert.
+ * Externally powered sensors are polled by read time slots, parasite
+ * powered ones are done when the conversion time has elapsed.
+ * @param pSnapshot Snapshot being acquired.
+ * @param iNow Current time in ms, same timebase as the conversion timestamp.
+ * @return 1 if the snapshot can be read by DS1820_SnapshotRead.
+ */
+int DS1820_SnapshotPoll(DS1820_Snapshot *pSnapshot, uint32_t iNow) {
+    if (pSnapshot->iState == DS1820_SNAP_CONVERTED)
+        return 1;
+    if (pSnapshot->iState != DS1820_SNAP_CONVERTING || !pSnapshot->bConvertStarted
+            || pSnapshot->bPollPending)
+        return 0;
+
+    /* Worst case deadline for both power types */
+    if (iNow - pSnapshot->iTimestamp >= (uint32_t) pSnapshot->iConversionTime) {
+        pSnapshot->iState = DS1820_SNAP_CONVERTED;
+        return 1;
+    }
+
+    if (pSnapshot->iPowerType == DS1820_EXTERNAL_POWER) {
+        pSnapshot->bPollPending = 1;
+        if (SnapshotSubmit(pSnapshot, 0, 0, &pSnapshot->iPoll, 1, CB_SnapshotPoll) != OW_OK)
+            pSnapshot->bPollPending = 0;
+    }
+    return 0;
+}
+
+/**
+ * Read scratchpads of all sensors, call only after the conversion time
+ * has elapsed.
+ * @param pSnapshot Snapshot to be read.
+ * @param callback Called from interrupt when all sensors are read, may be 0.
+ * @return DS1820_OK if started, DS1820_ERROR if conversion was not started
+ * or failed.
+ */
+DS1820_State DS1820_SnapshotRead(DS1820_Snapshot *pSnapshot, DS1820_SnapshotCallback callback) {
+    int i;
+
+    if (pSnapshot->iState != DS1820_SNAP_CONVERTED)
+        return DS1820_ERROR;
+
+    for (i = 0; i < pSnapshot->iCount; i++)
+        pSnapshot->stReading[i].iStatus = OW_TR_PENDING;
+
+    pSnapshot->callback = callback;
+    pSnapshot->bAlarmOnly = 0;
+    pSnapshot->iIndex = 0;
+    pSnapshot->iState = DS1820_SNAP_READING;
+    SnapshotReadNext(pSnapshot);
+
+    return DS1820_OK;
+}
+
+/**
+ * Program the same alarm window into all sensors of the snapshot, blocking.
+ * Resolution of the sensors is preserved.
+ * @param pSnapshot Snapshot with the sensors.
+ * @param iHigh High threshold in degrees of Celsius.
+ * @param iLow Low threshold in degrees of Celsius.
+ * @return DS1820_OK if all sensors were set, DS1820_ERROR otherwise.
+ */
+DS1820_State DS1820_SnapshotAlarmSet(DS1820_Snapshot *pSnapshot, int iHigh, int iLow) {
+    DS1820_State iState = DS1820_OK;
+    int i;
+
+    for (i = 0; i < pSnapshot->iCount; i++) {
+        if (DS1820_TemperatureAlarmSet(pSnapshot->pBus, pSnapshot->stReading[i].iAddress, iHigh, iLow) != DS1820_OK)
+            iState = DS1820_ERROR;
+    }
+    return iState;
+}
+
+/**
+ * Read only sensors with temperature outside of their alarm window, call
+ * instead of DS1820_SnapshotRead.
+ * @param pSnapshot Snapshot to be read.
+ * @param callback Called from interrupt when all alarming sensors are
+ * read, may be 0.
+ * @return DS1820_OK if started, DS1820_ERROR if conversion was not started
+ * or failed, or alarm search could not be started.
+ */
+DS1820_State DS1820_SnapshotReadAlarms(DS1820_Snapshot *pSnapshot, DS1820_SnapshotCallback callback) {
+    OW_Bus *pBus = pSnapshot->pBus;
+    int i;
+
+    if (pSnapshot->iState != DS1820_SNAP_CONVERTED)
+        return DS1820_ERROR;
+
+    for (i = 0; i < pSnapshot->iCount; i++) {
+        pSnapshot->stReading[i].iStatus = OW_TR_PENDING;
+        pSnapshot->stReading[i].bAlarm = 0;
+    }
+
+    pSnapshot->callback = callback;
+    pSnapshot->bAlarmOnly = 1;
+    pSnapshot->iIndex = 0;
+    pSnapshot->iState = DS1820_SNAP_READING;
+
+    pAlarmSnapshot[pBus->iIndex] = pSnapshot;
+    if (OW_Search_As(pBus, OW_ALARM_SEARCH, 0, CB_SnapshotAlarm) != OW_OK) {
+        pSnapshot->iState = DS1820_SNAP_FAILED;
+        return DS1820_ERROR;
+    }
+    return DS1820_OK;
+}
+
+/**
+ * @return 1 if all sensors of the last conversion have been read.
+ */
+int DS1820_SnapshotReady(DS1820_Snapshot *pSnapshot) {
+    return pSnapshot->iState == DS1820_SNAP_READY;
+}
+
+/**
+ * Queue one transaction of the snapshot. Without flags nothing but the
+ * read slots is sent.
+ */
+static OW_State SnapshotSubmit(DS1820_Snapshot *pSnapshot, uint8_t iFlags, uint8_t iCommand,
+        uint8_t *pRead, uint8_t iReadLength, OW_TrCallback callback) {
+    OW_Transaction *pTr = &pSnapshot->stTransaction;
+
+    memset(pTr, 0, sizeof(OW_Transaction));
+    if (iCommand)
+        pTr->iFlags = OW_TR_SELECT | OW_TR_COMMAND | iFlags;
+    pTr->iAddress = OW_ADDRESS_ALL;
+    pTr->iCommand = iCommand;
+    pTr->pRead = pRead;
+    pTr->iReadLength = iReadLength;
+    pTr->callback = callback;
+    pTr->pContext = pSnapshot;
+
+    return OW_QueueSubmit(pSnapshot->pBus, pTr);
+}
+
+/**
+ * Longest conversion time of the sensors by their last known configuration.
+ */
+static int SnapshotConversionTime(DS1820_Snapshot *pSnapshot) {
+    int iTime = 0, iSensorTime, i;
+
+    for (i = 0; i < pSnapshot->iCount; i++) {
+        DS1820_Reading *pReading = &pSnapshot->stReading[i];
+
+        if (pReading->iConfig == 0 && (uint8_t) pReading->iAddress != DS1820_FAMILY_CODE)
+            return DS1820_CONVERSION_TIME_MS;
+        iSensorTime = DS1820_ConversionTime((uint8_t) pReading->iAddress, pReading->iConfig);
+        if (iSensorTime > iTime)
+            iTime = iSensorTime;
+    }
+    return iTime ? iTime : DS1820_CONVERSION_TIME_MS;
+}
+
+/**
+ * Queue scratchpad read of the next sensor, or finish the snapshot.
+ */
+static void SnapshotReadNext(DS1820_Snapshot *pSnapshot) {
+    OW_Transaction *pTr = &pSnapshot->stTransaction;
+    DS1820_Reading *pReading;
+
+    /* Sensors inside their alarm window are not read */
+    while (pSnapshot->bAlarmOnly && pSnapshot->iIndex < pSnapshot->iCount
+            && !pSnapshot->stReading[pSnapshot->iIndex].bAlarm)
+        pSnapshot->iIndex++;
+
+    if (pSnapshot->iIndex >= pSnapshot->iCount) {
+        pSnapshot->iSequence++;
+        pSnapshot->iState = DS1820_SNAP_READY;
+        if (pSnapshot->callback)
+            pSnapshot->callback(pSnapshot);
+        return;
+    }
+
+    pReading = &pSnapshot->stReading[pSnapshot->iIndex];
+
+    memset(pTr, 0, sizeof(OW_Transaction));
+    pTr->iFlags = OW_TR_SELECT | OW_TR_COMMAND | OW_TR_CRC8;
+    /* Single device does not need to be addressed */
+    pTr->iAddress = (pSnapshot->bSingleDevice && pSnapshot->iCount == 1) ? OW_ADDRESS_ALL : pReading->iAddress;
+    pTr->iCommand = SCRATCHPAD_READ;
+    pTr->pRead = pReading->iScratchpad;
+    pTr->iReadLength = sizeof(pReading->iScratchpad);
+    pTr->callback = CB_SnapshotRead;
+    pTr->pContext = pSnapshot;
+
+    if (OW_QueueSubmit(pSnapshot->pBus, pTr) != OW_OK) {
+        pReading->iStatus = OW_TR_FAILED;
+        pSnapshot->iIndex++;
+        SnapshotReadNext(pSnapshot);
+    }
+}
+
+static void CB_SnapshotPower(OW_Bus *pBus, OW_Transaction *pTransaction) {
+    DS1820_Snapshot *pSnapshot = pTransaction->pContext;
+
+    (void) pBus;
+    if (pTransaction->iStatus != OW_TR_DONE) {
+        pSnapshot->iState = DS1820_SNAP_FAILED;
+        return;
+    }
+
+    /* Any parasite powered device pulls the read slot low */
+    pSnapshot->iPowerType = (pSnapshot->iPoll & 0x01) ? DS1820_EXTERNAL_POWER : DS1820_PARASITE_POWER;
+
+    if (SnapshotSubmit(pSnapshot, pSnapshot->iPowerType == DS1820_PARASITE_POWER ? OW_TR_PULLUP : 0,
+            TEMPERATURE_CONVERT, 0, 0, CB_SnapshotConvert) != OW_OK)
+        pSnapshot->iState = DS1820_SNAP_FAILED;
+}
+
+static void CB_SnapshotConvert(OW_Bus *pBus, OW_Transaction *pTransaction) {
+    DS1820_Snapshot *pSnapshot = pTransaction->pContext;
+
+    (void) pBus;
+    if (pTransaction->iStatus == OW_TR_DONE)
+        pSnapshot->bConvertStarted = 1;
+    else
+        pSnapshot->iState = DS1820_SNAP_FAILED;
+}
+
+static void CB_SnapshotPoll(OW_Bus *pBus, OW_Transaction *pTransaction) {
+    DS1820_Snapshot *pSnapshot = pTransaction->pContext;
+
+    (void) pBus;
+    /* Sensors hold read slots low while converting, last slot is newest */
+    if (pTransaction->iStatus == OW_TR_DONE && (pSnapshot->iPoll & 0x80))
+        pSnapshot->iState = DS1820_SNAP_CONVERTED;
+    pSnapshot->bPollPending = 0;
+}
+
+static void CB_SnapshotRead(OW_Bus *pBus, OW_Transaction *pTransaction) {
+    DS1820_Snapshot *pSnapshot = pTransaction->pContext;
+    DS1820_Reading *pReading = &pSnapshot->stReading[pSnapshot->iIndex];
+
+    (void) pBus;
+    pReading->iStatus = pTransaction->iStatus;
+    if (pReading->iStatus == OW_TR_DONE
+            && !ds18_decode((uint8_t) pReading->iAddress, pReading->iScratchpad, &pReading->iTemperature))
+        pReading->iStatus = OW_TR_FAILED;
+    if (pReading->iStatus == OW_TR_DONE)
+        pReading->iConfig = pReading->iScratchpad[4];
+
+    pSnapshot->iIndex++;
+    SnapshotReadNext(pSnapshot);
+}
+
+static void CB_SnapshotAlarm(OW_Bus *pBus, uint64_t iROM) {
+    DS1820_Snapshot *pSnapshot = pAlarmSnapshot[pBus->iIndex];
+    int i;
+
+    /* Alarm search done, read the sensors found */
+    if (iROM == 0) {
+        SnapshotReadNext(pSnapshot);
+        return;
+    }
+
+    /* Devices not in the snapshot are ignored */
+    for (i = 0; i < pSnapshot->iCount; i++) {
+        if (pSnapshot->stReading[i].iAddress == iROM) {
+            pSnapshot->stReading[i].bAlarm = 1;
+            break;
+        }
+    }
+}
@@ -59,6 +59,8 @@ extern "C" {
 #include "stm32f4xx_gpio.h"
 #include "stm32f4xx_usart.h"
 #include "stm32f4xx_rcc.h"
+#include "stm32f4xx_dma.h"
+#include "swtimer.h"
 
     /* Enables parasite powered device support */
 #define OW_USE_PARASITE_POWER   1
@@ -66,10 +68,28 @@ extern "C" {
     /* Enables single pin communication */
 #define OW_USE_SINGLE_PIN       1
 
+    /* Enables DMA driven byte and block transfers */
+#define OW_USE_DMA              1
+
+    /* Buses in use, every bus needs its own USART. Each enabled bus gets its
+     * USART interrupt and, with OW_USE_DMA, its RX DMA stream interrupt. */
+//#define OW_USE_USART1
+//#define OW_USE_USART2
+#define OW_USE_USART3
+//#define OW_USE_UART4
+//#define OW_USE_UART5
+//#define OW_USE_USART6
+
+#ifndef OW_USE_SINGLE_PIN
+#error "1-Wire buses are driven in USART half duplex mode only"
+#endif
+
 /* Bus specific commands */
 #define OW_ROM_READ         0x33
 #define OW_ROM_MATCH        0x55
 #define OW_ROM_SKIP         0xCC
+#define OW_ROM_OD_MATCH     0x69
+#define OW_ROM_OD_SKIP      0x3C
 #define OW_ROM_SEARCH       0xF0
 #define OW_ALARM_SEARCH     0xEC
 
@@ -83,37 +103,72 @@ extern "C" {
 #define OW_OP_WRITE 2
 #define OW_OP_RESET 3
 #define OW_OP_FREE  4
+#define OW_OP_BLOCK 5
+#define OW_OP_TRIPLET 6
+
+/* Triplet result bits, see OW_Triplet_As */
+#define OW_TRIPLET_ID       0x01
+#define OW_TRIPLET_CMP_ID   0x02
+#define OW_TRIPLET_DIR      0x04
 
-#define OW_IRQn    USART3_IRQn
 #define OW_PREPRIO 0
 #define OW_SUBPRIO 0
 
+    /* USART baud rates, reset pulse is 0xF0 (5 bits low), slots are one byte.
+     * Overdrive: 76 us reset pulse, 1 us write-1/read low time, 9 us write-0 */
+#define OW_BAUD_RESET           9600
+#define OW_BAUD_SLOT            115200
+#define OW_BAUD_OD_RESET        66000
+#define OW_BAUD_OD_SLOT         1000000
 
+    /* TX pins, have to be USART TX pins */
+#define OW_USART1_TX_PORT       GPIOB
+#define OW_USART1_TX_PIN        GPIO_Pin_6
+#define OW_USART1_TX_SOURCE     GPIO_PinSource6
+#define OW_USART1_TX_CLOCK      RCC_AHB1Periph_GPIOB
 
-    /* Has to be USART TX pin */
-#define OW_TX_PIN_PORT          GPIOB
-#define OW_TX_PIN_PIN           GPIO_Pin_10
-#define OW_TX_PIN_SOURCE        GPIO_PinSource10
+#define OW_USART2_TX_PORT       GPIOA
+#define OW_USART2_TX_PIN        GPIO_Pin_2
+#define OW_USART2_TX_SOURCE     GPIO_PinSource2
+#define OW_USART2_TX_CLOCK      RCC_AHB1Periph_GPIOA
 
-#define USART_OW_IRQHandeler    USART3_IRQHandler
+#define OW_USART3_TX_PORT       GPIOB
+#define OW_USART3_TX_PIN        GPIO_Pin_10
+#define OW_USART3_TX_SOURCE     GPIO_PinSource10
+#define OW_USART3_TX_CLOCK      RCC_AHB1Periph_GPIOB
 
-#ifndef OW_USE_SINGLE_PIN
-    /* Has to be USART RX pin */
-#define OW_RX_PIN_PORT          GPIOD
-#define OW_RX_PIN_PIN           GPIO_Pin_9
-#define OW_RX_PIN_SOURCE        GPIO_PinSource9
+#define OW_UART4_TX_PORT        GPIOC
+#define OW_UART4_TX_PIN         GPIO_Pin_10
+#define OW_UART4_TX_SOURCE      GPIO_PinSource10
+#define OW_UART4_TX_CLOCK       RCC_AHB1Periph_GPIOC
+
+#define OW_UART5_TX_PORT        GPIOC
+#define OW_UART5_TX_PIN         GPIO_Pin_12
+#define OW_UART5_TX_SOURCE      GPIO_PinSource12
+#define OW_UART5_TX_CLOCK       RCC_AHB1Periph_GPIOC
+
+#define OW_USART6_TX_PORT       GPIOC
+#define OW_USART6_TX_PIN        GPIO_Pin_6
+#define OW_USART6_TX_SOURCE     GPIO_PinSource6
+#define OW_USART6_TX_CLOCK      RCC_AHB1Periph_GPIOC
+
+#ifdef OW_USE_DMA
+    /* Longest block in bytes, every byte takes 8 bytes of slot buffer */
+#define OW_DMA_MAX_BYTES        16
 #endif
 
-#define OW_USART                USART3
-#define OW_USART_AF             GPIO_AF_USART3
+    /* Transactions waiting per bus */
+#define OW_QUEUE_LENGTH         8
 
-#define OW_USART_CLOCK()        RCC_APB1PeriphClockCmd(RCC_APB1Periph_USART3, ENABLE)
+    /* Longest transaction frame: ROM select, command and all data bytes */
+#define OW_FRAME_MAX_BYTES      40
 
-#define OW_GPIO_TX_CLOCK()      RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOB, ENABLE)
+    /* Devices tracked per bus, see OW_Topology */
+#define OW_TOPOLOGY_MAX_DEVICES 32
 
-#ifndef OW_USE_SINGLE_PIN
-#define OW_GPIO_RX_CLOCK()      RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOB, ENABLE)
-#endif
+    /* Coroutine frames shared by all buses, see OW_Co */
+#define OW_CO_POOL_SIZE         8
+#define OW_CO_BUFFER_SIZE       16
 
     /**************************************************************************/
 
@@ -124,50 +179,323 @@ extern "C" {
         OW_NO_DEV = 0,
         OW_OK = 1,
         OW_BUSY=2,
+        OW_ERROR=3,
     } OW_State;
 
+    /* Bus identifiers, index into OW_Buses */
+    typedef enum _OW_BusId {
+#ifdef OW_USE_USART1
+        OW_BUS_USART1,
+#endif
+#ifdef OW_USE_USART2
+        OW_BUS_USART2,
+#endif
+#ifdef OW_USE_USART3
+        OW_BUS_USART3,
+#endif
+#ifdef OW_USE_UART4
+        OW_BUS_UART4,
+#endif
+#ifdef OW_USE_UART5
+        OW_BUS_UART5,
+#endif
+#ifdef OW_USE_USART6
+        OW_BUS_USART6,
+#endif
+        OW_BUS_COUNT
+    } OW_BusId;
+
+    typedef enum _OW_Speed {
+        OW_SPEED_STANDARD = 0,
+        OW_SPEED_OVERDRIVE = 1,
+    } OW_Speed;
+
+    typedef struct _OW_Bus OW_Bus;
+    typedef void (*OW_Callback)(OW_Bus *pBus);
+
+    /* Transaction flags */
+#define OW_TR_RESET     0x01    /* Reset pulse first, fails if nobody answers */
+#define OW_TR_ROM       0x02    /* Match ROM, or Skip ROM for OW_ADDRESS_ALL */
+#define OW_TR_COMMAND   0x04    /* Send iCommand after the ROM command */
+#define OW_TR_CRC8      0x08    /* Last read byte is CRC8 of the read data */
+#define OW_TR_PULLUP    0x10    /* Leave bus in strong pull-up when done */
+#define OW_TR_OVERDRIVE 0x20    /* Select with Overdrive Match/Skip ROM */
+#define OW_TR_SEARCH    0x40    /* One search pass after iCommand, ROM is read into pRead */
+#define OW_TR_SELECT    (OW_TR_RESET | OW_TR_ROM)
+
+    typedef enum _OW_TrStatus {
+        OW_TR_PENDING = 0,
+        OW_TR_DONE,
+        OW_TR_NO_DEV,
+        OW_TR_CRC_ERROR,
+        OW_TR_FAILED,
+    } OW_TrStatus;
+
+    typedef void (*OW_SearchCallback)(OW_Bus *pBus, uint64_t iROM);
+
+    typedef struct _OW_Transaction OW_Transaction;
+    typedef void (*OW_TrCallback)(OW_Bus *pBus, OW_Transaction *pTransaction);
+
+    /* Transaction descriptor, owned by the caller until the callback runs */
+    struct _OW_Transaction {
+        uint8_t iFlags;
+        uint8_t iCommand;
+        uint64_t iAddress;
+        const uint8_t *pWrite;
+        uint8_t iWriteLength;
+        uint8_t *pRead;
+        uint8_t iReadLength;
+        OW_TrCallback callback;
+        void *pContext;
+        volatile OW_TrStatus iStatus;
+    };
+
+    /* Fixed hardware assignment of one bus */
+    typedef struct _OW_BusHW {
+        USART_TypeDef *pUSART;
+        void (*USARTClockCmd)(uint32_t iPeriph, FunctionalState NewState);
+        uint32_t iUSARTClock;
+        uint8_t iAF;
+        IRQn_Type iIRQn;
+
+        GPIO_TypeDef *pTxPort;
+        uint16_t iTxPin;
+        uint8_t iTxSource;
+        uint32_t iTxClock;
+
+#ifdef OW_USE_DMA
+        uint32_t iDMAClock;
+        uint32_t iDMAChannel;
+        DMA_Stream_TypeDef *pDMATxStream;
+        DMA_Stream_TypeDef *pDMARxStream;
+        uint32_t iDMATxFlags;
+        uint32_t iDMARxFlags;
+        uint32_t iDMARxITTC;
+        IRQn_Type iDMAIRQn;
+#endif
+    } OW_BusHW;
+
+    /* Bus context, everything one running transaction needs */
+    struct _OW_Bus {
+        const OW_BusHW *pHW;
+        uint8_t iIndex;
+
+        /* Backup of BRR register for different communication speeds,
+         * indexed by OW_Speed */
+        uint16_t iBRRReset[2];
+        uint16_t iBRRSlot[2];
+        volatile OW_Speed iSpeed;
+
+        OW_Callback p_callback;
+        volatile int operation;
+        volatile int busy;
+        volatile int datlen;
+        volatile uint8_t rebuff;
+        volatile uint8_t cmdbuff;
+        volatile uint8_t iPresence;
+        volatile int iDoneFlag;
+
+        uint8_t *pBlockData;
+        uint8_t iBlockLength;
+#ifdef OW_USE_DMA
+        /* One USART byte per bit slot, TX reads it and RX overwrites it with the echo */
+        uint8_t iSlots[OW_DMA_MAX_BYTES * 8];
+        uint8_t iByteBuffer;
+#endif
+
+        /* Search related variables */
+        struct {
+            uint8_t iLastDeviceFlag;
+            uint8_t iLastDiscrepancy;
+            uint8_t iLastFamilyDiscrepancy;
+            uint64_t ROM;
+
+            /* Running pass */
+            uint8_t iBitNumber;
+            uint8_t iLastZero;
+            uint64_t iDiscrepancies;    /* Bits where devices differ */
+
+            /* Asynchronous enumeration, see OW_Search_As */
+            OW_Transaction stTransaction;
+            uint8_t iCommand;
+            uint8_t iFamilyCode;
+            OW_SearchCallback found;
+        } stSearch;
+
+
+        /* Transaction queue, drained from interrupt */
+        OW_Transaction *pQueue[OW_QUEUE_LENGTH];
+        volatile uint8_t iQueueHead;
+        volatile uint8_t iQueueTail;
+        OW_Transaction * volatile pCurrent;
+        uint8_t iFrame[OW_FRAME_MAX_BYTES];
+        uint8_t iFrameLength;
+        uint8_t iFramePos;
+        uint8_t iFrameReadPos;
+        uint8_t iChunkLength;
+        uint8_t iSpeedSwitchPos;
+    };
+
+    typedef enum _OW_TopologyEvent {
+        OW_DEV_ATTACHED = 0,
+        OW_DEV_DETACHED
+    } OW_TopologyEvent;
+
+    typedef void (*OW_TopologyCallback)(OW_Bus *pBus, uint64_t iROM, OW_TopologyEvent iEvent);
+
+    /* Known device set of one bus, see OneWire_Topology.c */
+    typedef struct _OW_Topology {
+        OW_Bus *pBus;
+        uint64_t iROM[OW_TOPOLOGY_MAX_DEVICES];
+        uint8_t iCount;
+        uint8_t iNext;
+        uint64_t iFound[OW_TOPOLOGY_MAX_DEVICES];
+        uint8_t iFoundCount;
+        volatile uint8_t bBusy;
+        uint32_t iFullSearches;
+        OW_TopologyCallback event;
+    } OW_Topology;
+
+    typedef struct _OW_Co OW_Co;
+    typedef void (*OW_CoFunction)(OW_Co *pCo);
+
+    /* Coroutine frame, see OneWire_Co.c. The flow keeps its state here, local
+     * variables do not survive an await. */
+    struct _OW_Co {
+        OW_Bus *pBus;
+        OW_CoFunction run;
+        void *pContext;
+        uint64_t iAddress;          /* For the flow, not used by the layer */
+        uint16_t iLine;             /* Resume point, 0 before the first run */
+        volatile uint8_t bUsed;
+        OW_TrStatus iStatus;        /* Result of the last await */
+        uint8_t iByte;
+        uint8_t iBuffer[OW_CO_BUFFER_SIZE];
+        OW_Transaction stTransaction;
+        SwTimer stTimer;
+    };
+
+    /* Failed start falls into the resume label on purpose */
+#if defined(__GNUC__) && __GNUC__ >= 7
+#define OW_CO_FALLTHROUGH           __attribute__((fallthrough))
+#else
+#define OW_CO_FALLTHROUGH           do { } while (0)
+#endif
+
+    /* Flow body delimiters, the body must not use switch around an await */
+#define OW_CO_BEGIN(pCo)            switch ((pCo)->iLine) { case 0:
+#define OW_CO_END(pCo)              } OW_CoExit(pCo); return
+#define OW_CO_EXIT(pCo)             do { OW_CoExit(pCo); return; } while (0)
+
+    /* Start an operation and return, the flow continues on the next line when
+     * it completes. If it can not be started the flow continues at once with
+     * iStatus OW_TR_FAILED. One await per source line. */
+#define OW_CO_AWAIT(pCo, start)                                     \
+    do {                                                            \
+        (pCo)->iLine = __LINE__;                                    \
+        if ((start) == OW_OK)                                       \
+            return;                                                 \
+        OW_CO_FALLTHROUGH;                                          \
+        case __LINE__:;                                             \
+    } while (0)
+
+    /* Single bus operations, each one is a separate queue transaction and
+     * other transactions may run in between. Only for a bus no other driver
+     * or flow uses, select and command belong into OW_CO_TRANSACT. */
+#define OW_CO_RESET(pCo)            OW_CO_AWAIT(pCo, OW_CoReset(pCo))
+#define OW_CO_WRITE_BYTE(pCo, b)    OW_CO_AWAIT(pCo, OW_CoWriteByte(pCo, b))
+#define OW_CO_WRITE(pCo, p, n)      OW_CO_AWAIT(pCo, OW_CoWrite(pCo, p, n))
+#define OW_CO_READ(pCo, p, n)       OW_CO_AWAIT(pCo, OW_CoRead(pCo, p, n))
+    /* Complete transaction, nothing else gets on the bus in between */
+#define OW_CO_TRANSACT(pCo, flags, addr, cmd, pw, nw, pr, nr) \
+    OW_CO_AWAIT(pCo, OW_CoTransact(pCo, flags, addr, cmd, pw, nw, pr, nr))
+#define OW_CO_DELAY(pCo, ms)        OW_CO_AWAIT(pCo, OW_CoDelay(pCo, ms))
+
+    extern OW_Bus OW_Buses[OW_BUS_COUNT];
+
+#define OW_BUS(id)                  (&OW_Buses[(id)])
 
     /* Hardware initialization */
    void OW_Init(void);
-   void Error_ow(void);
+   void OW_BusInit(OW_Bus *pBus);
+   void Error_ow(OW_Bus *pBus);
     /* Communication functions */
-   OW_State OW_ByteRead_As(void (*callback)(void));
-   uint8_t OW_ByteRead(void);
-	uint8_t OW_BitRead(void);
-	void callback_byteread(void);
-	void OW_BitWrite(const uint8_t bBit);
-	uint8_t OW_GetByteReadResult(void);
-	OW_State OW_ByteWrite_As(const uint8_t bByte,void (*callback)(void));
-	void OW_ByteWrite(const uint8_t bByte);
-	void callback_bytewrite(void);
-	void OW_StrongPullUp(void);
-	void OW_WeakPullUp(void);
-	OW_State OW_Reset_As(void (*callback)(void));
-	OW_State OW_Reset(void);
-	void callback_Reset(void);
-	OW_State OW_GetResetResult(void);
-//	void USART_OW_IRQHandeler(void);
+   OW_State OW_ByteRead_As(OW_Bus *pBus, OW_Callback callback);
+   uint8_t OW_ByteRead(OW_Bus *pBus);
+	uint8_t OW_BitRead(OW_Bus *pBus);
+	void callback_done(OW_Bus *pBus);
+	void OW_BitWrite(OW_Bus *pBus, const uint8_t bBit);
+	uint8_t OW_GetByteReadResult(OW_Bus *pBus);
+	OW_State OW_ByteWrite_As(OW_Bus *pBus, const uint8_t bByte, OW_Callback callback);
+	void OW_ByteWrite(OW_Bus *pBus, const uint8_t bByte);
+	void OW_StrongPullUp(OW_Bus *pBus);
+	void OW_WeakPullUp(OW_Bus *pBus);
+	OW_State OW_Reset_As(OW_Bus *pBus, OW_Callback callback);
+	OW_State OW_Reset(OW_Bus *pBus);
+	OW_State OW_GetResetResult(OW_Bus *pBus);
+	void OW_SpeedSet(OW_Bus *pBus, OW_Speed iSpeed);
+	OW_Speed OW_SpeedGet(OW_Bus *pBus);
+	OW_State OW_BlockTransfer_As(OW_Bus *pBus, uint8_t *pBlock, uint8_t iLength, OW_Callback callback);
+	OW_State OW_BlockTransfer(OW_Bus *pBus, uint8_t *pBlock, uint8_t iLength);
+	OW_State OW_Triplet_As(OW_Bus *pBus, uint8_t bDirection, OW_Callback callback);
+	uint8_t OW_GetTripletResult(OW_Bus *pBus);
+	void OW_IRQHandler(OW_Bus *pBus);
+#ifdef OW_USE_DMA
+	void OW_DMAIRQHandler(OW_Bus *pBus);
+#endif
 	
 
  /* 1-Wire search */
-    void OW_FamilySkipSetup(void);
+    void OW_FamilySkipSetup(OW_Bus *pBus);
     /* Utilities */
     uint8_t OW_CRCCalculate(uint8_t iCRC, uint8_t iValue);
 
    
-    uint64_t OW_SearchFirst(uint8_t iFamilyCode);
-    uint64_t OW_SearchNext(void);
+    uint64_t OW_SearchFirst(OW_Bus *pBus, uint8_t iFamilyCode);
+    uint64_t OW_SearchNext(OW_Bus *pBus);
+    OW_State OW_Verify(OW_Bus *pBus, uint64_t iAddress);
+    OW_State OW_Verify_As(OW_Bus *pBus, uint64_t iAddress, OW_TrCallback callback);
+    void OW_SearchSetup(OW_Bus *pBus, uint8_t iFamilyCode);
+    void OW_SearchPass(OW_Bus *pBus);
+    OW_State OW_Search_As(OW_Bus *pBus, uint8_t iCommand, uint8_t iFamilyCode, OW_SearchCallback found);
 
 	
 	
     /* Parasite powered devices support */
 
 
+    /* Transaction queue */
+    OW_State OW_QueueSubmit(OW_Bus *pBus, OW_Transaction *pTransaction);
+    void OW_QueueKick(OW_Bus *pBus);
+    void OW_QueueComplete(OW_Bus *pBus, OW_TrStatus iStatus);
+    int OW_QueueIdle(OW_Bus *pBus);
+    int OW_QueueQueued(OW_Bus *pBus, const OW_Transaction *pTransaction);
+
+    /* Topology tracking */
+    void OW_TopologyInit(OW_Topology *pTopology, OW_Bus *pBus, const uint64_t *Addresses, int iCount, OW_TopologyCallback event);
+    OW_State OW_TopologyCheck(OW_Topology *pTopology);
+    OW_State OW_TopologyRescan(OW_Topology *pTopology);
+    int OW_TopologyIdle(OW_Topology *pTopology);
+
+    /* Coroutines */
+    OW_Co *OW_CoCreate(OW_Bus *pBus, OW_CoFunction run, void *pContext);
+    void OW_CoStart(OW_Co *pCo);
+    void OW_CoExit(OW_Co *pCo);
+    int OW_CoActive(void);
+    OW_State OW_CoReset(OW_Co *pCo);
+    OW_State OW_CoWriteByte(OW_Co *pCo, uint8_t bByte);
+    OW_State OW_CoWrite(OW_Co *pCo, const uint8_t *pData, uint8_t iLength);
+    OW_State OW_CoRead(OW_Co *pCo, uint8_t *pData, uint8_t iLength);
+    OW_State OW_CoTransact(OW_Co *pCo, uint8_t iFlags, uint64_t iAddress, uint8_t iCommand,
+            const uint8_t *pWrite, uint8_t iWriteLength, uint8_t *pRead, uint8_t iReadLength);
+    OW_State OW_CoDelay(OW_Co *pCo, uint32_t iMs);
+
     /* ROM operations */
-    uint64_t OW_ROMRead(void);
-    void OW_ROMMatch(uint64_t iAddress, void (*callback)(void));
-    void CB_ROMMatch(void);
-    OW_State OW_ROMMatch_GetResult(void);
+    uint64_t OW_ROMRead(OW_Bus *pBus);
 	
 
+#ifdef	__cplusplus
+}
+#endif
+
 #endif //ONEWIRE_H
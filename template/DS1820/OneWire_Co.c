@@ -0,0 +1,198 @@
+/**
+ *******************************************************************************
+ * @file    OneWire_Co.c
+ * @brief   Coroutines over the 1-Wire transaction queue.
+ *
+ * @section info Additional Information
+ *          A device driver written as a chain of transaction callbacks is
+ *          hard to follow. A flow is a plain function written top to bottom
+ *          between OW_CO_BEGIN and OW_CO_END, every OW_CO_* await starts an
+ *          operation and returns. When the operation completes the function
+ *          is called again from the completion interrupt and continues after
+ *          that await, the result is in pCo->iStatus.
+ *
+ *          Frames come from a static pool, there is no heap and no stack per
+ *          flow. Local variables are lost at every await, a flow keeps its
+ *          state in the frame or in its context. Await macros expand to case
+ *          labels of one switch, so a flow can not await inside its own
+ *          switch statement and can have only one await per source line.
+ *
+ *          Every OW_CO_TRANSACT is one queue transaction: reset, ROM
+ *          select, command and data go out back to back and nothing else
+ *          gets on the bus in between. Flows of different sensors and the
+ *          snapshot can therefore share a bus, their transactions
+ *          interleave only at await points. OW_CO_RESET, OW_CO_WRITE and
+ *          OW_CO_READ are separate transactions each, a select done by them
+ *          is lost as soon as another transaction runs. They are meant for
+ *          a bus the flow has to itself.
+ *
+ *          Usage:
+ *              static void Flow(OW_Co *pCo) {
+ *                  OW_CO_BEGIN(pCo);
+ *                  OW_CO_TRANSACT(pCo, OW_TR_SELECT | OW_TR_COMMAND, pCo->iAddress,
+ *                          0x44, 0, 0, 0, 0);
+ *                  if (pCo->iStatus != OW_TR_DONE)
+ *                      OW_CO_EXIT(pCo);
+ *                  OW_CO_DELAY(pCo, 750);
+ *                  OW_CO_TRANSACT(pCo, OW_TR_SELECT | OW_TR_COMMAND | OW_TR_CRC8,
+ *                          pCo->iAddress, 0xBE, 0, 0, pCo->iBuffer, 9);
+ *                  ...
+ *                  OW_CO_END(pCo);
+ *              }
+ *
+ *              pCo = OW_CoCreate(pBus, Flow, pContext);
+ *              if (pCo)
+ *                  OW_CoStart(pCo);
+ *******************************************************************************
+ */
+
+#include "OneWire.h"
+#include "string.h"
+
+static OW_State OW_CoSubmit(OW_Co *pCo);
+static void CB_CoTransaction(OW_Bus *pBus, OW_Transaction *pTransaction);
+static void CB_CoTimer(SwTimer *pTimer);
+
+static OW_Co OW_CoPool[OW_CO_POOL_SIZE];
+
+/**
+ * Take a free frame from the pool, safe from interrupt.
+ * @param pBus Bus the flow talks to.
+ * @param run Flow function.
+ * @param pContext Passed to the flow in pCo->pContext.
+ * @return Frame, flow is not running until OW_CoStart. 0 if the pool is
+ * empty.
+ */
+OW_Co *OW_CoCreate(OW_Bus *pBus, OW_CoFunction run, void *pContext) {
+    OW_Co *pCo = 0;
+    uint32_t iPrimask;
+    int i;
+
+    iPrimask = __get_PRIMASK();
+    __disable_irq();
+    for (i = 0; i < OW_CO_POOL_SIZE; i++) {
+        if (!OW_CoPool[i].bUsed) {
+            pCo = &OW_CoPool[i];
+            pCo->bUsed = 1;
+            break;
+        }
+    }
+    __set_PRIMASK(iPrimask);
+
+    if (pCo == 0)
+        return 0;
+
+    memset(&pCo->stTransaction, 0, sizeof(OW_Transaction));
+    pCo->pBus = pBus;
+    pCo->run = run;
+    pCo->pContext = pContext;
+    pCo->iAddress = OW_ADDRESS_ALL;
+    pCo->iLine = 0;
+    pCo->iStatus = OW_TR_PENDING;
+    return pCo;
+}
+
+/**
+ * Run the flow up to its first await. The frame may be back in the pool
+ * when this returns, it must not be touched afterwards.
+ */
+void OW_CoStart(OW_Co *pCo) {
+    pCo->run(pCo);
+}
+
+/**
+ * Return frame to the pool, called by OW_CO_END and OW_CO_EXIT.
+ */
+void OW_CoExit(OW_Co *pCo) {
+    pCo->bUsed = 0;
+}
+
+/**
+ * @return Number of flows running.
+ */
+int OW_CoActive(void) {
+    int i, iCount = 0;
+
+    for (i = 0; i < OW_CO_POOL_SIZE; i++)
+        iCount += OW_CoPool[i].bUsed;
+    return iCount;
+}
+
+/**
+ * Reset pulse, iStatus is OW_TR_NO_DEV if nobody answered.
+ */
+OW_State OW_CoReset(OW_Co *pCo) {
+    return OW_CoTransact(pCo, OW_TR_RESET, OW_ADDRESS_ALL, 0, 0, 0, 0, 0);
+}
+
+OW_State OW_CoWriteByte(OW_Co *pCo, uint8_t bByte) {
+    pCo->iByte = bByte;
+    return OW_CoTransact(pCo, 0, OW_ADDRESS_ALL, 0, &pCo->iByte, 1, 0, 0);
+}
+
+/**
+ * @param pData Has to stay valid until the write completes.
+ */
+OW_State OW_CoWrite(OW_Co *pCo, const uint8_t *pData, uint8_t iLength) {
+    return OW_CoTransact(pCo, 0, OW_ADDRESS_ALL, 0, pData, iLength, 0, 0);
+}
+
+OW_State OW_CoRead(OW_Co *pCo, uint8_t *pData, uint8_t iLength) {
+    return OW_CoTransact(pCo, 0, OW_ADDRESS_ALL, 0, 0, 0, pData, iLength);
+}
+
+/**
+ * Queue one transaction in the frame descriptor, see OW_Transaction for
+ * the parameters.
+ */
+OW_State OW_CoTransact(OW_Co *pCo, uint8_t iFlags, uint64_t iAddress, uint8_t iCommand,
+        const uint8_t *pWrite, uint8_t iWriteLength, uint8_t *pRead, uint8_t iReadLength) {
+    OW_Transaction *pTr = &pCo->stTransaction;
+
+    pTr->iFlags = iFlags;
+    pTr->iAddress = iAddress;
+    pTr->iCommand = iCommand;
+    pTr->pWrite = pWrite;
+    pTr->iWriteLength = iWriteLength;
+    pTr->pRead = pRead;
+    pTr->iReadLength = iReadLength;
+    return OW_CoSubmit(pCo);
+}
+
+/**
+ * Wait without holding the bus, the flow continues from the timer
+ * interrupt.
+ */
+OW_State OW_CoDelay(OW_Co *pCo, uint32_t iMs) {
+    pCo->iStatus = OW_TR_PENDING;
+    SwTimer_Start(&pCo->stTimer, iMs * 1000, 0, CB_CoTimer, pCo);
+    return OW_OK;
+}
+
+static OW_State OW_CoSubmit(OW_Co *pCo) {
+    OW_State iState;
+
+    pCo->iStatus = OW_TR_PENDING;
+    pCo->stTransaction.callback = CB_CoTransaction;
+    pCo->stTransaction.pContext = pCo;
+
+    iState = OW_QueueSubmit(pCo->pBus, &pCo->stTransaction);
+    if (iState != OW_OK)
+        pCo->iStatus = OW_TR_FAILED;
+    return iState;
+}
+
+static void CB_CoTransaction(OW_Bus *pBus, OW_Transaction *pTransaction) {
+    OW_Co *pCo = pTransaction->pContext;
+
+    (void) pBus;
+    pCo->iStatus = pTransaction->iStatus;
+    pCo->run(pCo);
+}
+
+static void CB_CoTimer(SwTimer *pTimer) {
+    OW_Co *pCo = pTimer->pContext;
+
+    pCo->iStatus = OW_TR_DONE;
+    pCo->run(pCo);
+}
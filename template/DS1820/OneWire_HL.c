@@ -71,50 +71,23 @@
  */
 
 #include "OneWire.h"
+#include "owcrc.h"
+#include "dlog.h"
+#include "string.h"
 
 
 
-/* Search related variables */
-static struct {
-    uint8_t iLastDeviceFlag;
-    uint8_t iLastDiscrepancy;
-    uint8_t iLastFamilyDiscrepancy;
-    uint64_t ROM;
-} stSearch;
-
-
-
-/* CRC calculation table */
-static uint8_t CRCTable[] = {
-    0, 94, 188, 226, 97, 63, 221, 131, 194, 156, 126, 32, 163, 253, 31, 65,
-    157, 195, 33, 127, 252, 162, 64, 30, 95, 1, 227, 189, 62, 96, 130, 220,
-    35, 125, 159, 193, 66, 28, 254, 160, 225, 191, 93, 3, 128, 222, 60, 98,
-    190, 224, 2, 92, 223, 129, 99, 61, 124, 34, 192, 158, 29, 67, 161, 255,
-    70, 24, 250, 164, 39, 121, 155, 197, 132, 218, 56, 102, 229, 187, 89, 7,
-    219, 133, 103, 57, 186, 228, 6, 88, 25, 71, 165, 251, 120, 38, 196, 154,
-    101, 59, 217, 135, 4, 90, 184, 230, 167, 249, 27, 69, 198, 152, 122, 36,
-    248, 166, 68, 26, 153, 199, 37, 123, 58, 100, 134, 216, 91, 5, 231, 185,
-    140, 210, 48, 110, 237, 179, 81, 15, 78, 16, 242, 172, 47, 113, 147, 205,
-    17, 79, 173, 243, 112, 46, 204, 146, 211, 141, 111, 49, 178, 236, 14, 80,
-    175, 241, 19, 77, 206, 144, 114, 44, 109, 51, 209, 143, 12, 82, 176, 238,
-    50, 108, 142, 208, 83, 13, 239, 177, 240, 174, 76, 18, 145, 207, 45, 115,
-    202, 148, 118, 40, 171, 245, 23, 73, 8, 86, 180, 234, 105, 55, 213, 139,
-    87, 9, 235, 181, 54, 104, 138, 212, 149, 203, 41, 119, 244, 170, 72, 22,
-    233, 183, 85, 11, 136, 214, 52, 106, 43, 117, 151, 201, 74, 20, 246, 168,
-    116, 42, 200, 150, 21, 75, 169, 247, 182, 232, 10, 84, 215, 137, 107, 53
-};
-
 /**
  * Setup the search to skip the current device type on the next call of 
  * OW_SearchNext function.
  */
-void OW_FamilySkipSetup(void) {
+void OW_FamilySkipSetup(OW_Bus *pBus) {
     /* Set the last discrepancy to last family discrepancy */
-    stSearch.iLastDiscrepancy = stSearch.iLastFamilyDiscrepancy;
-    stSearch.iLastFamilyDiscrepancy = 0;
+    pBus->stSearch.iLastDiscrepancy = pBus->stSearch.iLastFamilyDiscrepancy;
+    pBus->stSearch.iLastFamilyDiscrepancy = 0;
 
     /* Check for end of list */
-    if (stSearch.iLastDiscrepancy == 0) stSearch.iLastDeviceFlag = 1;
+    if (pBus->stSearch.iLastDiscrepancy == 0) pBus->stSearch.iLastDeviceFlag = 1;
 }
 
 /**
@@ -124,221 +97,317 @@ void OW_FamilySkipSetup(void) {
  * @return Resulting CRC value.
  */
 uint8_t OW_CRCCalculate(uint8_t iCRC, uint8_t iValue) {
-    return CRCTable[iCRC ^ iValue];
+    return crc8_byte(iCRC, iValue);
 }
 
+static void OW_SearchStep(OW_Bus *pBus);
+static void CB_SearchTriplet(OW_Bus *pBus);
+static OW_State OW_SearchSubmit(OW_Bus *pBus, OW_TrCallback callback);
+static void CB_SearchFound(OW_Bus *pBus, OW_Transaction *pTransaction);
+static int OW_SearchBusy(OW_Bus *pBus);
+
 /**
- * Find the 'first' devices on the 1-Wire bus.
- * @param iFamilyCode Select family code filter or 0 for all. 
- * @return 64-bit device address or 0 if no device found.
+ * Reset search state so the next search pass finds the 'first' device.
+ * @param pBus Bus to be searched.
+ * @param iFamilyCode Select family code filter or 0 for all.
  */
-uint64_t OW_SearchFirst(uint8_t iFamilyCode) {
+void OW_SearchSetup(OW_Bus *pBus, uint8_t iFamilyCode) {
     if (iFamilyCode) {
-        stSearch.ROM = (uint64_t) iFamilyCode;
+        pBus->stSearch.ROM = (uint64_t) iFamilyCode;
 
-        stSearch.iLastDiscrepancy = 64;
-        stSearch.iLastFamilyDiscrepancy = 0;
-        stSearch.iLastDeviceFlag = 1;
+        pBus->stSearch.iLastDiscrepancy = 64;
+        pBus->stSearch.iLastFamilyDiscrepancy = 0;
+        pBus->stSearch.iLastDeviceFlag = 0;
     } else {
-        stSearch.ROM = 0;
-        stSearch.iLastDiscrepancy = 0;
-        stSearch.iLastDeviceFlag = 0;
-        stSearch.iLastFamilyDiscrepancy = 0;
+        pBus->stSearch.ROM = 0;
+        pBus->stSearch.iLastDiscrepancy = 0;
+        pBus->stSearch.iLastDeviceFlag = 0;
+        pBus->stSearch.iLastFamilyDiscrepancy = 0;
     }
+}
 
-    return OW_SearchNext();
+/**
+ * Run one pass of the 1-Wire Search Algorithm using the existing search
+ * state. Called by the transaction queue from interrupt once the search
+ * command of an OW_TR_SEARCH transaction has been sent; the pass is a
+ * chain of 64 triplets and ends the transaction by OW_QueueComplete.
+ */
+void OW_SearchPass(OW_Bus *pBus) {
+    /* Previous pass found the last device */
+    if (pBus->stSearch.iLastDeviceFlag) {
+        OW_QueueComplete(pBus, OW_TR_NO_DEV);
+        return;
+    }
+
+    pBus->stSearch.iBitNumber = 1;
+    pBus->stSearch.iLastZero = 0;
+    pBus->stSearch.iDiscrepancies = 0;
+    OW_SearchStep(pBus);
 }
 
 /**
- * Perform the 1-Wire Search Algorithm on the 1-Wire bus using the existing
- * search state.
- * @return 64-bit device address or 0 if no device found.
+ * Start triplet for the current bit of the running pass.
  */
-uint64_t OW_SearchNext(void) {
+static void OW_SearchStep(OW_Bus *pBus) {
+    uint8_t iBit = pBus->stSearch.iBitNumber;
     uint8_t iSearchDirection;
-    int iIDBit, iCmpIDBit;
-
-    /* Initialize for search */
-    uint8_t iROMByteMask = 1;
-    uint8_t iCRC = 0;
-    int iIDBitNumber = 1;
-    int iLastZero = 0;
-    int iROMByteNumber = 0;
-    int iSearchResult = 0;
-
-    /* If the last call was not the last one */
-    if (!stSearch.iLastDeviceFlag) {
-        /* 1-Wire reset */
-		OW_Reset();
-        if (OW_GetResetResult() == OW_NO_DEV) {
-        	/* Reset the search */
-            stSearch.iLastDiscrepancy = 0;
-            stSearch.iLastDeviceFlag = 0;
-            stSearch.iLastFamilyDiscrepancy = 0;
-            return 0;
-        }
-        /* Issue the search command */
-        OW_ByteWrite(OW_ROM_SEARCH);
-
-        /* Loop to do the search */
-        do {
-
-#ifdef OW_USE_PARASITE_POWER
-
-            OW_StrongPullUp();
-            __IO int i;
-            for (i = 0; i < 0xFFFF; i++);
-            OW_WeakPullUp();
-#endif
-
-            /* Read a bit and its complement */
-            iIDBit = OW_BitRead();
-            iCmpIDBit = OW_BitRead();
-
-            /* Check for no devices on 1-wire */
-            if ((iIDBit == 1) && (iCmpIDBit == 1))
-                break;
-            else {
-                /* All devices coupled have 0 or 1 */
-                if (iIDBit != iCmpIDBit)
-                    /* Bit write value for search */
-                    iSearchDirection = iIDBit;
-                else {
-                    /* if this discrepancy if before the Last Discrepancy
-                    on a previous next then pick the same as last time */
-                    if (iIDBitNumber < stSearch.iLastDiscrepancy)
-                        iSearchDirection = ((((uint8_t*) & stSearch.ROM)[iROMByteNumber] & iROMByteMask) > 0);
-                    else
-                        /* If equal to last pick 1, if not then pick 0 */
-                        iSearchDirection = (iIDBitNumber == stSearch.iLastDiscrepancy);
-
-                    /* If 0 was picked then record its position in iLastZero */
-                    if (iSearchDirection == 0) {
-                        iLastZero = iIDBitNumber;
-
-                        /* Check for Last discrepancy in family */
-                        if (iLastZero < 9)
-                            stSearch.iLastFamilyDiscrepancy = iLastZero;
-                    }
-                }
-
-                /* Set or clear the bit in the ROM byte with mask rom_byte_mask */
-                if (iSearchDirection == 1)
-                    ((uint8_t*) & stSearch.ROM)[iROMByteNumber] |= iROMByteMask;
-                else
-                    ((uint8_t*) & stSearch.ROM)[iROMByteNumber] &= ~iROMByteMask;
-
-                /* Set serial number search direction */
-                OW_BitWrite(iSearchDirection);
-                /* Increment the byte counter and shift the mask */
-                iIDBitNumber++;
-                iROMByteMask <<= 1;
-
-                /* If the mask is 0 then go to new ROM byte number and reset mask */
-                if (iROMByteMask == 0) {
-                    /* Accumulate the CRC */
-                    iCRC = OW_CRCCalculate(iCRC, ((uint8_t*) & stSearch.ROM)[iROMByteNumber]);
-                    iROMByteNumber++;
-                    iROMByteMask = 1;
-                }
-            }
-        } while (iROMByteNumber < 8); /* Loop until through all ROM bytes 0-7 */
-
-        /* If the search was successful then */
-        if (!((iIDBitNumber < 65) || (iCRC != 0))) {
-            stSearch.iLastDiscrepancy = iLastZero;
-
-            /* Check for last device */
-            if (stSearch.iLastDiscrepancy == 0)
-                stSearch.iLastDeviceFlag = 1;
-
-            iSearchResult = 1;
+
+    /* If this discrepancy is before the Last Discrepancy on a previous
+    next then pick the same as last time, if equal pick 1, else pick 0 */
+    if (iBit < pBus->stSearch.iLastDiscrepancy)
+        iSearchDirection = (pBus->stSearch.ROM >> (iBit - 1)) & 1;
+    else
+        iSearchDirection = (iBit == pBus->stSearch.iLastDiscrepancy);
+
+    if (OW_Triplet_As(pBus, iSearchDirection, CB_SearchTriplet) != OW_OK)
+        OW_QueueComplete(pBus, OW_TR_FAILED);
+}
+
+static void CB_SearchTriplet(OW_Bus *pBus) {
+    uint8_t iResult = OW_GetTripletResult(pBus);
+    uint8_t iBit = pBus->stSearch.iBitNumber;
+    uint64_t iMask = (uint64_t) 1 << (iBit - 1);
+    OW_Transaction *pTr = pBus->pCurrent;
+
+    /* Check for no devices on 1-wire */
+    if ((iResult & OW_TRIPLET_ID) && (iResult & OW_TRIPLET_CMP_ID)) {
+        OW_QueueComplete(pBus, OW_TR_NO_DEV);
+        return;
+    }
+
+    if (!(iResult & (OW_TRIPLET_ID | OW_TRIPLET_CMP_ID)))
+        pBus->stSearch.iDiscrepancies |= iMask;
+
+    /* Discrepancy resolved to 0, record its position */
+    if (!(iResult & (OW_TRIPLET_ID | OW_TRIPLET_CMP_ID | OW_TRIPLET_DIR))) {
+        pBus->stSearch.iLastZero = iBit;
+
+        /* Check for Last discrepancy in family */
+        if (iBit < 9)
+            pBus->stSearch.iLastFamilyDiscrepancy = iBit;
+    }
+
+    if (iResult & OW_TRIPLET_DIR)
+        pBus->stSearch.ROM |= iMask;
+    else
+        pBus->stSearch.ROM &= ~iMask;
+
+    if (iBit < 64) {
+        pBus->stSearch.iBitNumber++;
+        OW_SearchStep(pBus);
+        return;
+    }
+
+    /* If the search was successful then */
+    if (crc8_block(0, &pBus->stSearch.ROM, 8) != 0 || !((uint8_t*) & pBus->stSearch.ROM)[0]) {
+        OW_QueueComplete(pBus, OW_TR_CRC_ERROR);
+        return;
+    }
+
+    pBus->stSearch.iLastDiscrepancy = pBus->stSearch.iLastZero;
+
+    /* Check for last device */
+    if (pBus->stSearch.iLastDiscrepancy == 0)
+        pBus->stSearch.iLastDeviceFlag = 1;
+
+    if (pTr->pRead)
+        memcpy(pTr->pRead, (const void *) &pBus->stSearch.ROM, 8);
+
+    OW_QueueComplete(pBus, OW_TR_DONE);
+}
+
+/**
+ * The bus has one search descriptor and one search state. A pass still
+ * queued or running, e.g. after a blocking wait timed out, owns both.
+ * @return 1 if an enumeration or a pass is in progress.
+ */
+static int OW_SearchBusy(OW_Bus *pBus) {
+    return pBus->stSearch.found != 0 || OW_QueueQueued(pBus, &pBus->stSearch.stTransaction);
+}
+
+/**
+ * Queue one search pass on the bus search transaction.
+ */
+static OW_State OW_SearchSubmit(OW_Bus *pBus, OW_TrCallback callback) {
+    OW_Transaction *pTr = &pBus->stSearch.stTransaction;
+
+    if (OW_QueueQueued(pBus, pTr))
+        return OW_BUSY;
+
+    memset(pTr, 0, sizeof(OW_Transaction));
+    pTr->iFlags = OW_TR_RESET | OW_TR_COMMAND | OW_TR_SEARCH;
+    pTr->iCommand = pBus->stSearch.iCommand;
+    pTr->callback = callback;
+
+    return OW_QueueSubmit(pBus, pTr);
+}
+
+/**
+ * Enumerate devices on the bus without blocking. Every found device is
+ * reported by the callback from interrupt, the end of enumeration by the
+ * callback with zero ROM.
+ * @param pBus Bus to be searched.
+ * @param iCommand OW_ROM_SEARCH or OW_ALARM_SEARCH.
+ * @param iFamilyCode Select family code filter or 0 for all.
+ * @param found Called for every device found and once with 0 at the end.
+ * @return OW_OK if started, OW_BUSY if enumeration is already running on the
+ * bus or the queue is full.
+ */
+OW_State OW_Search_As(OW_Bus *pBus, uint8_t iCommand, uint8_t iFamilyCode, OW_SearchCallback found) {
+    OW_State iState;
+
+    if (OW_SearchBusy(pBus))
+        return OW_BUSY;
+
+    OW_SearchSetup(pBus, iFamilyCode);
+    pBus->stSearch.iCommand = iCommand;
+    pBus->stSearch.iFamilyCode = iFamilyCode;
+    pBus->stSearch.found = found;
+
+    iState = OW_SearchSubmit(pBus, CB_SearchFound);
+    if (iState != OW_OK)
+        pBus->stSearch.found = 0;
+    return iState;
+}
+
+static void CB_SearchFound(OW_Bus *pBus, OW_Transaction *pTransaction) {
+    OW_SearchCallback found = pBus->stSearch.found;
+    uint8_t iFamilyCode = pBus->stSearch.iFamilyCode;
+
+    if (pTransaction->iStatus == OW_TR_DONE) {
+        /* Targeted search runs into next family when this one is done */
+        if (!iFamilyCode || (uint8_t) pBus->stSearch.ROM == iFamilyCode) {
+            found(pBus, pBus->stSearch.ROM);
+
+            if (!pBus->stSearch.iLastDeviceFlag
+                    && OW_SearchSubmit(pBus, CB_SearchFound) == OW_OK)
+                return;
         }
     }
 
-    /* If no device found then reset counters so next 'search' will be like a first */
-    if (!iSearchResult || !((uint8_t*) & stSearch.ROM)[0]) {
-        stSearch.iLastDiscrepancy = 0;
-        stSearch.iLastDeviceFlag = 0;
-        stSearch.iLastFamilyDiscrepancy = 0;
+    /* Enumeration done, callback may start a new one */
+    pBus->stSearch.found = 0;
+    found(pBus, 0);
+}
+
+/**
+ * Find the 'first' devices on the 1-Wire bus.
+ * @param pBus Bus to be searched.
+ * @param iFamilyCode Select family code filter or 0 for all. 
+ * @return 64-bit device address or 0 if no device found or the search is
+ * in use.
+ */
+uint64_t OW_SearchFirst(OW_Bus *pBus, uint8_t iFamilyCode) {
+    if (OW_SearchBusy(pBus))
         return 0;
-    }
+    OW_SearchSetup(pBus, iFamilyCode);
 
-    return stSearch.ROM;
+    return OW_SearchNext(pBus);
 }
 
 /**
- * Read ROM address of device, works only for one device on the bus.
- * @return 64-bit device address.
+ * Perform the 1-Wire Search Algorithm on the 1-Wire bus using the existing
+ * search state. Blocking wrapper of one queued search pass.
+ * @return 64-bit device address or 0 if no device found.
  */
-uint64_t OW_ROMRead(void) {
-    uint64_t iRes = 0;
-    int i;
+uint64_t OW_SearchNext(OW_Bus *pBus) {
+    volatile int t = 0xffffff;
 
-    if (OW_Reset() == OW_NO_DEV)
-    	return 0;
+    /* Search transaction is in use by OW_Search_As or a pass that timed out */
+    if (OW_SearchBusy(pBus))
+        return 0;
 
-    OW_ByteWrite(OW_ROM_READ);
-    for (i = 0; i < 8; i++){
-        ((uint8_t*) & iRes)[i] = OW_ByteRead();
-    printf("ID %d\n",((uint8_t*) & iRes)[i] );
+    /* If the last call was the last one start over */
+    if (pBus->stSearch.iLastDeviceFlag) {
+        pBus->stSearch.iLastDiscrepancy = 0;
+        pBus->stSearch.iLastDeviceFlag = 0;
+        pBus->stSearch.iLastFamilyDiscrepancy = 0;
+        return 0;
     }
-    return iRes;
+
+    pBus->stSearch.iCommand = OW_ROM_SEARCH;
+    if (OW_SearchSubmit(pBus, 0) != OW_OK)
+        return 0;
+
+    while (pBus->stSearch.stTransaction.iStatus == OW_TR_PENDING && t > 0)
+        t--;
+    if (t == 0) {
+        Error_ow(pBus);
+        return 0;
+    }
+
+    if (pBus->stSearch.stTransaction.iStatus != OW_TR_DONE)
+        return 0;
+
+    return pBus->stSearch.ROM;
 }
 
 /**
- * Issue ROM match command.
+ * Check that a device is present by a search pass targeted at its ROM,
+ * other devices on the bus do not respond. Resets the search state.
+ * @param pBus Bus the device is connected to.
  * @param iAddress 64-bit device address.
- * @return OW_OK if device is present or OW_NO_DEV if not.
+ * @return OW_OK if the device is present, OW_NO_DEV otherwise, OW_BUSY if
+ * the search is in use.
  */
+OW_State OW_Verify(OW_Bus *pBus, uint64_t iAddress) {
+    uint64_t iFound;
+
+    if (OW_SearchBusy(pBus))
+        return OW_BUSY;
 
-static void (*RM_callback)(void);  //rommatch callback  pointer
- 
-static volatile int state_ROMMatch;
-static volatile int result_ROMMatch;
-static volatile uint64_t Address_i;
- 
-void OW_ROMMatch(uint64_t iAddress, void (*callback)(void))
-{
-	state_ROMMatch = 0;
-	Address_i=iAddress;
-	RM_callback = callback;
-	OW_Reset_As(CB_ROMMatch);
+    /* Search that takes the known branch on every discrepancy */
+    pBus->stSearch.ROM = iAddress;
+    pBus->stSearch.iLastDiscrepancy = 64;
+    pBus->stSearch.iLastDeviceFlag = 0;
+    pBus->stSearch.iLastFamilyDiscrepancy = 0;
+
+    iFound = OW_SearchNext(pBus);
+    /* A pass that timed out still owns the search state */
+    if (!OW_SearchBusy(pBus))
+        OW_SearchSetup(pBus, 0);
+
+    return (iFound == iAddress) ? OW_OK : OW_NO_DEV;
 }
 
-void CB_ROMMatch(void)
-{
-	static volatile int i = 0;
-	if(state_ROMMatch == 0){
-		state_ROMMatch = 1;
-		if(OW_GetResetResult() == OW_NO_DEV){
-			printf("NO Device or Bus Error\n");
-		}else{
-			if(Address_i == OW_ADDRESS_ALL){
-				OW_ByteWrite_As(OW_ROM_SKIP, CB_ROMMatch);
-			}else{
-				OW_ByteWrite_As(OW_ROM_MATCH, CB_ROMMatch);
-				i = 0;
-			}
-		}
-	}else if(state_ROMMatch == 1){
-		if(Address_i == OW_ADDRESS_ALL){
-			result_ROMMatch = OW_OK;
-			RM_callback();
-		}else if(i<8){
-			OW_ByteWrite_As(((uint8_t*) & Address_i)[i], CB_ROMMatch);
-			i++;
-		}
-		else{
-				result_ROMMatch = OW_OK;
-				state_ROMMatch = 2;
-				RM_callback();
-			}
-		}
+/**
+ * Start a search pass targeted at one ROM, see OW_Verify. The device is
+ * present if the pass completes with OW_TR_DONE and pBus->stSearch.ROM
+ * equals iAddress; stSearch.iDiscrepancies holds the branch points seen
+ * on its path.
+ * @param pBus Bus the device is connected to.
+ * @param iAddress 64-bit device address.
+ * @param callback Completion callback of the search transaction.
+ * @return OW_OK if queued, OW_BUSY if search is in use or queue is full.
+ */
+OW_State OW_Verify_As(OW_Bus *pBus, uint64_t iAddress, OW_TrCallback callback) {
+    if (OW_SearchBusy(pBus))
+        return OW_BUSY;
+
+    pBus->stSearch.ROM = iAddress;
+    pBus->stSearch.iLastDiscrepancy = 64;
+    pBus->stSearch.iLastDeviceFlag = 0;
+    pBus->stSearch.iLastFamilyDiscrepancy = 0;
+    pBus->stSearch.iCommand = OW_ROM_SEARCH;
+
+    return OW_SearchSubmit(pBus, callback);
 }
 
+/**
+ * Read ROM address of device, works only for one device on the bus.
+ * @return 64-bit device address.
+ */
+uint64_t OW_ROMRead(OW_Bus *pBus) {
+    uint64_t iRes = 0;
+    int i;
+
+    if (OW_Reset(pBus) == OW_NO_DEV)
+    	return 0;
 
-OW_State OW_ROMMatch_GetResult(void)
-{
-	return result_ROMMatch;
+    OW_ByteWrite(pBus, OW_ROM_READ);
+    for (i = 0; i < 8; i++){
+        ((uint8_t*) & iRes)[i] = OW_ByteRead(pBus);
+        DLOG2(DLOG_OW_ROM_BYTE, i, ((uint8_t*) & iRes)[i]);
+    }
+    return iRes;
 }
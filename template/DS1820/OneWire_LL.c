@@ -2,213 +2,468 @@
  * Hardware initialization.
  */
 #include "OneWire.h"
-/* Backup of BRR register for different communication speeds*/
-static uint16_t iUSART9600;
-static uint16_t iUSART115200;
+#include "dlog.h"
+
+#define OW_DMA_FLAGS(n)     (DMA_FLAG_TCIF##n | DMA_FLAG_HTIF##n | DMA_FLAG_TEIF##n | \
+                             DMA_FLAG_DMEIF##n | DMA_FLAG_FEIF##n)
+
+/* Hardware assignment of every enabled bus, DMA streams are fixed by the
+ * DMA request mapping of the USART */
+static const OW_BusHW OW_BusHWTable[OW_BUS_COUNT] = {
+#ifdef OW_USE_USART1
+    [OW_BUS_USART1] = {
+        USART1, RCC_APB2PeriphClockCmd, RCC_APB2Periph_USART1, GPIO_AF_USART1, USART1_IRQn,
+        OW_USART1_TX_PORT, OW_USART1_TX_PIN, OW_USART1_TX_SOURCE, OW_USART1_TX_CLOCK,
+#ifdef OW_USE_DMA
+        RCC_AHB1Periph_DMA2, DMA_Channel_4, DMA2_Stream7, DMA2_Stream2,
+        OW_DMA_FLAGS(7), OW_DMA_FLAGS(2), DMA_IT_TCIF2, DMA2_Stream2_IRQn,
+#endif
+    },
+#endif
+#ifdef OW_USE_USART2
+    [OW_BUS_USART2] = {
+        USART2, RCC_APB1PeriphClockCmd, RCC_APB1Periph_USART2, GPIO_AF_USART2, USART2_IRQn,
+        OW_USART2_TX_PORT, OW_USART2_TX_PIN, OW_USART2_TX_SOURCE, OW_USART2_TX_CLOCK,
+#ifdef OW_USE_DMA
+        RCC_AHB1Periph_DMA1, DMA_Channel_4, DMA1_Stream6, DMA1_Stream5,
+        OW_DMA_FLAGS(6), OW_DMA_FLAGS(5), DMA_IT_TCIF5, DMA1_Stream5_IRQn,
+#endif
+    },
+#endif
+#ifdef OW_USE_USART3
+    [OW_BUS_USART3] = {
+        USART3, RCC_APB1PeriphClockCmd, RCC_APB1Periph_USART3, GPIO_AF_USART3, USART3_IRQn,
+        OW_USART3_TX_PORT, OW_USART3_TX_PIN, OW_USART3_TX_SOURCE, OW_USART3_TX_CLOCK,
+#ifdef OW_USE_DMA
+        RCC_AHB1Periph_DMA1, DMA_Channel_4, DMA1_Stream3, DMA1_Stream1,
+        OW_DMA_FLAGS(3), OW_DMA_FLAGS(1), DMA_IT_TCIF1, DMA1_Stream1_IRQn,
+#endif
+    },
+#endif
+#ifdef OW_USE_UART4
+    [OW_BUS_UART4] = {
+        UART4, RCC_APB1PeriphClockCmd, RCC_APB1Periph_UART4, GPIO_AF_UART4, UART4_IRQn,
+        OW_UART4_TX_PORT, OW_UART4_TX_PIN, OW_UART4_TX_SOURCE, OW_UART4_TX_CLOCK,
+#ifdef OW_USE_DMA
+        RCC_AHB1Periph_DMA1, DMA_Channel_4, DMA1_Stream4, DMA1_Stream2,
+        OW_DMA_FLAGS(4), OW_DMA_FLAGS(2), DMA_IT_TCIF2, DMA1_Stream2_IRQn,
+#endif
+    },
+#endif
+#ifdef OW_USE_UART5
+    [OW_BUS_UART5] = {
+        UART5, RCC_APB1PeriphClockCmd, RCC_APB1Periph_UART5, GPIO_AF_UART5, UART5_IRQn,
+        OW_UART5_TX_PORT, OW_UART5_TX_PIN, OW_UART5_TX_SOURCE, OW_UART5_TX_CLOCK,
+#ifdef OW_USE_DMA
+        RCC_AHB1Periph_DMA1, DMA_Channel_4, DMA1_Stream7, DMA1_Stream0,
+        OW_DMA_FLAGS(7), OW_DMA_FLAGS(0), DMA_IT_TCIF0, DMA1_Stream0_IRQn,
+#endif
+    },
+#endif
+#ifdef OW_USE_USART6
+    [OW_BUS_USART6] = {
+        USART6, RCC_APB2PeriphClockCmd, RCC_APB2Periph_USART6, GPIO_AF_USART6, USART6_IRQn,
+        OW_USART6_TX_PORT, OW_USART6_TX_PIN, OW_USART6_TX_SOURCE, OW_USART6_TX_CLOCK,
+#ifdef OW_USE_DMA
+        RCC_AHB1Periph_DMA2, DMA_Channel_5, DMA2_Stream6, DMA2_Stream1,
+        OW_DMA_FLAGS(6), OW_DMA_FLAGS(1), DMA_IT_TCIF1, DMA2_Stream1_IRQn,
+#endif
+    },
+#endif
+};
+
+OW_Bus OW_Buses[OW_BUS_COUNT];
+
+#ifdef OW_USE_DMA
+static void OW_DMAInit(OW_Bus *pBus);
+static void OW_DMAStart(OW_Bus *pBus, uint8_t *pBlock, uint8_t iLength);
+#endif
+
+/**
+ * Initialize all enabled buses.
+ */
 void OW_Init(void) {
+    int i;
+
+    for (i = 0; i < OW_BUS_COUNT; i++) {
+        OW_Buses[i].pHW = &OW_BusHWTable[i];
+        OW_Buses[i].iIndex = i;
+        OW_BusInit(&OW_Buses[i]);
+    }
+}
+
+/**
+ * Initialize one bus, its pin, USART and DMA streams.
+ * @param pBus Bus to be initialized, pHW has to be set.
+ */
+void OW_BusInit(OW_Bus *pBus) {
     GPIO_InitTypeDef GPIO_InitStruct;
     USART_InitTypeDef USART_InitStructure;
+    NVIC_InitTypeDef NVIC_InitStructure;
+    const OW_BusHW *pHW = pBus->pHW;
 
-    /* Enable clock for periphetials */
-    OW_GPIO_TX_CLOCK();
-
-#ifndef OW_USE_SINGLE_PIN
-    OW_GPIO_RX_CLOCK();
-#endif
+    pBus->busy = 0;
+    pBus->operation = OW_OP_FREE;
 
-    OW_USART_CLOCK();
+    /* Enable clock for periphetials */
+    RCC_AHB1PeriphClockCmd(pHW->iTxClock, ENABLE);
+    pHW->USARTClockCmd(pHW->iUSARTClock, ENABLE);
 
     /* Alternate function config on TX pin */
-    GPIO_PinAFConfig(OW_TX_PIN_PORT, OW_TX_PIN_SOURCE, OW_USART_AF);
+    GPIO_PinAFConfig(pHW->pTxPort, pHW->iTxSource, pHW->iAF);
 
     /* TX pin configuration */
-    GPIO_InitStruct.GPIO_Pin = OW_TX_PIN_PIN;
+    GPIO_InitStruct.GPIO_Pin = pHW->iTxPin;
     GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF;
     GPIO_InitStruct.GPIO_OType = GPIO_OType_OD;
     GPIO_InitStruct.GPIO_Speed = GPIO_Speed_50MHz;
     GPIO_InitStruct.GPIO_PuPd = GPIO_PuPd_UP;
-    GPIO_Init(OW_TX_PIN_PORT, &GPIO_InitStruct);
+    GPIO_Init(pHW->pTxPort, &GPIO_InitStruct);
 
-	NVIC_InitTypeDef NVIC_InitStructure;
-	NVIC_InitStructure.NVIC_IRQChannel = OW_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannel = pHW->iIRQn;
 	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = OW_PREPRIO;
 	NVIC_InitStructure.NVIC_IRQChannelSubPriority = OW_SUBPRIO;
 	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
 	NVIC_Init(&NVIC_InitStructure);
 
-	USART_ITConfig(USART3,USART_IT_RXNE,ENABLE);
-
-
-
-#ifndef OW_USE_SINGLE_PIN 
-    /* Alternate function config on RX pin */
-    GPIO_PinAFConfig(OW_RX_PIN_PORT, OW_RX_PIN_SOURCE, OW_USART_AF);
-    GPIO_InitStruct.GPIO_Pin = OW_RX_PIN_PIN;
-    GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF;
-    GPIO_Init(OW_RX_PIN_PORT, &GPIO_InitStruct);
-#endif
+	USART_ITConfig(pHW->pUSART, USART_IT_RXNE, ENABLE);
 
     /* USART configuration */
     USART_StructInit(&USART_InitStructure);
-    
-    USART_InitStructure.USART_BaudRate = 115200;
+
+    USART_InitStructure.USART_BaudRate = OW_BAUD_RESET;
     USART_InitStructure.USART_WordLength = USART_WordLength_8b;
     USART_InitStructure.USART_StopBits = USART_StopBits_1;
     USART_InitStructure.USART_Parity = USART_Parity_No;
     USART_InitStructure.USART_HardwareFlowControl = USART_HardwareFlowControl_None;
     USART_InitStructure.USART_Mode = USART_Mode_Tx | USART_Mode_Rx;
-    USART_Init(OW_USART, &USART_InitStructure);
+    USART_Init(pHW->pUSART, &USART_InitStructure);
+
+    /* BRR register backups for every speed */
+    pBus->iBRRReset[OW_SPEED_STANDARD] = pHW->pUSART->BRR;
 
-    /* BRR register backup for 115200 Baud */
-    iUSART115200 = OW_USART->BRR;
+    USART_InitStructure.USART_BaudRate = OW_BAUD_OD_RESET;
+    USART_Init(pHW->pUSART, &USART_InitStructure);
+    pBus->iBRRReset[OW_SPEED_OVERDRIVE] = pHW->pUSART->BRR;
 
-    /* BRR register backup for 9600 Baud */
-    USART_InitStructure.USART_BaudRate = 9600;
-    USART_Init(OW_USART, &USART_InitStructure);
-    iUSART9600 = OW_USART->BRR;
+    USART_InitStructure.USART_BaudRate = OW_BAUD_OD_SLOT;
+    USART_Init(pHW->pUSART, &USART_InitStructure);
+    pBus->iBRRSlot[OW_SPEED_OVERDRIVE] = pHW->pUSART->BRR;
+
+    USART_InitStructure.USART_BaudRate = OW_BAUD_SLOT;
+    USART_Init(pHW->pUSART, &USART_InitStructure);
+    pBus->iBRRSlot[OW_SPEED_STANDARD] = pHW->pUSART->BRR;
+
+    pBus->iSpeed = OW_SPEED_STANDARD;
 
-#ifdef OW_USE_SINGLE_PIN 
     /* Half duplex enable, for single pin communication */
-    USART_HalfDuplexCmd(OW_USART, ENABLE);
+    USART_HalfDuplexCmd(pHW->pUSART, ENABLE);
+
+#ifdef OW_USE_DMA
+    OW_DMAInit(pBus);
 #endif
 
     /* USART enable */
-    USART_Cmd(OW_USART, ENABLE);
+    USART_Cmd(pHW->pUSART, ENABLE);
+}
+
+#ifdef OW_USE_DMA
+/**
+ * Configure TX and RX DMA streams of the bus USART. Memory address and
+ * length are set for every transfer in OW_DMAStart.
+ */
+static void OW_DMAInit(OW_Bus *pBus) {
+    DMA_InitTypeDef DMA_InitStructure;
+    NVIC_InitTypeDef NVIC_InitStructure;
+    const OW_BusHW *pHW = pBus->pHW;
+
+    RCC_AHB1PeriphClockCmd(pHW->iDMAClock, ENABLE);
+
+    DMA_DeInit(pHW->pDMATxStream);
+    DMA_DeInit(pHW->pDMARxStream);
+
+    DMA_StructInit(&DMA_InitStructure);
+    DMA_InitStructure.DMA_Channel = pHW->iDMAChannel;
+    DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t) & pHW->pUSART->DR;
+    DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t) pBus->iSlots;
+    DMA_InitStructure.DMA_BufferSize = 1;
+    DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+    DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_High;
+    DMA_InitStructure.DMA_FIFOMode = DMA_FIFOMode_Disable;
+
+    DMA_InitStructure.DMA_DIR = DMA_DIR_MemoryToPeripheral;
+    DMA_Init(pHW->pDMATxStream, &DMA_InitStructure);
+
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralToMemory;
+    DMA_Init(pHW->pDMARxStream, &DMA_InitStructure);
+
+    /* Only the RX stream interrupts, the last echo ends the block */
+    DMA_ITConfig(pHW->pDMARxStream, DMA_IT_TC, ENABLE);
+
+    NVIC_InitStructure.NVIC_IRQChannel = pHW->iDMAIRQn;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = OW_PREPRIO;
+    NVIC_InitStructure.NVIC_IRQChannelSubPriority = OW_SUBPRIO;
+    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_Init(&NVIC_InitStructure);
+}
+
+/**
+ * Expand block into bit slots and start both DMA streams.
+ * @param pBlock Bytes to be sent, received bytes are stored back here.
+ * @param iLength Number of bytes, at most OW_DMA_MAX_BYTES.
+ */
+static void OW_DMAStart(OW_Bus *pBus, uint8_t *pBlock, uint8_t iLength) {
+    int i, iBit;
+    uint8_t *pSlot = pBus->iSlots;
+    const OW_BusHW *pHW = pBus->pHW;
+
+    pBus->pBlockData = pBlock;
+    pBus->iBlockLength = iLength;
+    pBus->operation = OW_OP_BLOCK;
+
+    for (i = 0; i < iLength; i++)
+        for (iBit = 0; iBit < 8; iBit++)
+            *pSlot++ = (pBlock[i] & (1 << iBit)) ? OW_1 : OW_0;
+
+    /* Echoes are collected by DMA, not by the RXNE interrupt */
+    USART_ITConfig(pHW->pUSART, USART_IT_RXNE, DISABLE);
+    while (USART_GetFlagStatus(pHW->pUSART, USART_FLAG_RXNE) == SET)
+        USART_ReceiveData(pHW->pUSART);
+
+    DMA_ClearFlag(pHW->pDMATxStream, pHW->iDMATxFlags);
+    DMA_ClearFlag(pHW->pDMARxStream, pHW->iDMARxFlags);
+    DMA_MemoryTargetConfig(pHW->pDMATxStream, (uint32_t) pBus->iSlots, DMA_Memory_0);
+    DMA_MemoryTargetConfig(pHW->pDMARxStream, (uint32_t) pBus->iSlots, DMA_Memory_0);
+    DMA_SetCurrDataCounter(pHW->pDMATxStream, iLength * 8);
+    DMA_SetCurrDataCounter(pHW->pDMARxStream, iLength * 8);
+
+    /* RX first, so that no echo is lost */
+    DMA_Cmd(pHW->pDMARxStream, ENABLE);
+    DMA_Cmd(pHW->pDMATxStream, ENABLE);
+    USART_ClearFlag(pHW->pUSART, USART_FLAG_TC);
+    USART_DMACmd(pHW->pUSART, USART_DMAReq_Tx | USART_DMAReq_Rx, ENABLE);
+}
+#endif
+
+/**
+ * Wait until the transaction started on the bus calls callback_done.
+ * @return OW_OK if done in time, OW_NO_DEV on timeout.
+ */
+static OW_State OW_WaitDone(OW_Bus *pBus) {
+	volatile int t=0xffffff;
+	while(pBus->iDoneFlag == 0 && t>0){
+		 t--;
+	 }
+	 if(t==0){
+		 Error_ow(pBus);
+		 return OW_NO_DEV;
+	 }
+	 return OW_OK;
+}
+
+void callback_done(OW_Bus *pBus)
+{
+	pBus->iDoneFlag = 1;
 }
 
-static void (*p_callback)(void);
-static volatile int operation;
-static volatile int rebuff;//read buffer
-static volatile   uint8_t iPresence;
-volatile int busy=0;
-volatile int datlen;
-volatile int cmdbuff;
 /**
  * Read one byte.
  * @return Received byte.
  */
-volatile int read_done_flag = 0;
-OW_State OW_ByteRead_As(void (*callback)(void)) {
-	if(busy == 1){
-		printf("busy");
+OW_State OW_ByteRead_As(OW_Bus *pBus, OW_Callback callback) {
+	if(pBus->busy == 1){
 		return OW_BUSY;
 	}
 	else{
-	    rebuff = 0;
-	    p_callback=callback;
-		datlen = 0;
-		busy = 1;
-		operation = OW_OP_READ;
-	    USART_SendData(OW_USART, OW_1);
+	    pBus->rebuff = 0;
+	    pBus->p_callback=callback;
+		pBus->datlen = 0;
+		pBus->busy = 1;
+#ifdef OW_USE_DMA
+		pBus->iByteBuffer = 0xFF;
+		OW_DMAStart(pBus, &pBus->iByteBuffer, 1);
+#else
+		pBus->operation = OW_OP_READ;
+	    USART_SendData(pBus->pHW->pUSART, OW_1);
+#endif
 	}
 	return OW_OK;
 }
-uint8_t OW_ByteRead(void){
-	read_done_flag = 0;
-	volatile int t=0xffffff;
-	OW_ByteRead_As(callback_byteread);
-	while(read_done_flag == 0 && t>0){
-		 t--;
-	 }
-	 if(t==0){
-		 Error_ow();
-	 }
-	return OW_GetByteReadResult();
-}
-void callback_byteread(void){
-	read_done_flag=1;
+uint8_t OW_ByteRead(OW_Bus *pBus){
+	pBus->iDoneFlag = 0;
+	OW_ByteRead_As(pBus, callback_done);
+	OW_WaitDone(pBus);
+	return OW_GetByteReadResult(pBus);
 }
 
-uint8_t OW_BitRead(void) {
+uint8_t OW_BitRead(OW_Bus *pBus) {
+    USART_TypeDef *pUSART = pBus->pHW->pUSART;
+
     /* Make sure that all communication is done and receive buffer is cleared */
-    while (USART_GetFlagStatus(OW_USART, USART_FLAG_TC) == RESET);
-    while (USART_GetFlagStatus(OW_USART, USART_FLAG_RXNE) == SET)
-        USART_ReceiveData(OW_USART);  
+    while (USART_GetFlagStatus(pUSART, USART_FLAG_TC) == RESET);
+    while (USART_GetFlagStatus(pUSART, USART_FLAG_RXNE) == SET)
+        USART_ReceiveData(pUSART);
 
     /* Send byte */
-    USART_SendData(OW_USART, OW_1);
+    USART_SendData(pUSART, OW_1);
 
     /* Wait for response */
-    while (USART_GetFlagStatus(OW_USART, USART_FLAG_TC) == RESET);
+    while (USART_GetFlagStatus(pUSART, USART_FLAG_TC) == RESET);
 
     /* Receive data */
-    if (USART_ReceiveData(OW_USART) != OW_1) return 0;
+    if (USART_ReceiveData(pUSART) != OW_1) return 0;
 
     return 1;
 }
 
-void OW_BitWrite(const uint8_t bBit) {
+void OW_BitWrite(OW_Bus *pBus, const uint8_t bBit) {
+    USART_TypeDef *pUSART = pBus->pHW->pUSART;
     uint8_t bData = OW_0;
 
     if (bBit) bData = OW_1;
 
     /* Make sure that all communication is done */
-    while (USART_GetFlagStatus(OW_USART, USART_FLAG_RXNE) == SET)
-        USART_ReceiveData(OW_USART);
-    while (USART_GetFlagStatus(OW_USART, USART_FLAG_TC) == RESET);
+    while (USART_GetFlagStatus(pUSART, USART_FLAG_RXNE) == SET)
+        USART_ReceiveData(pUSART);
+    while (USART_GetFlagStatus(pUSART, USART_FLAG_TC) == RESET);
 
     /* Send byte */
-    USART_SendData(OW_USART, bData);
+    USART_SendData(pUSART, bData);
 }
 
-uint8_t OW_GetByteReadResult(void)
+uint8_t OW_GetByteReadResult(OW_Bus *pBus)
 {
-	return rebuff;
+	return pBus->rebuff;
 }
 
 /**
  * Write one byte.
  * @param bByte Byte to be transmited.
  */
-OW_State OW_ByteWrite_As(const uint8_t bByte,void (*callback)(void)) {
+OW_State OW_ByteWrite_As(OW_Bus *pBus, const uint8_t bByte, OW_Callback callback) {
 
-    if(busy){
-    	printf("busy");
+    if(pBus->busy){
     	return OW_BUSY;
     }else{
-    	cmdbuff=bByte;
-    	p_callback=callback;
-    	busy=1;
-    	datlen=0;
-    	operation=OW_OP_WRITE;
-    	USART_SendData(OW_USART, (cmdbuff & 0x01)?OW_1:OW_0);
+    	pBus->cmdbuff=bByte;
+    	pBus->p_callback=callback;
+    	pBus->busy=1;
+    	pBus->datlen=0;
+#ifdef OW_USE_DMA
+    	pBus->iByteBuffer = bByte;
+    	OW_DMAStart(pBus, &pBus->iByteBuffer, 1);
+#else
+    	pBus->operation=OW_OP_WRITE;
+    	USART_SendData(pBus->pHW->pUSART, (bByte & 0x01)?OW_1:OW_0);
+#endif
     }
 	return OW_OK;
 }
 
-volatile int write_done_flag = 0;
+void OW_ByteWrite(OW_Bus *pBus, const uint8_t bByte)
+{
+	pBus->iDoneFlag = 0;
+	OW_ByteWrite_As(pBus, bByte, callback_done);
+	OW_WaitDone(pBus);
+}
 
-void OW_ByteWrite(const uint8_t bByte)
+/**
+ * Exchange a block of bytes, send 0xFF to read a byte. With OW_USE_DMA all
+ * bit slots are streamed by DMA and only one interrupt is raised at the end.
+ * @param pBlock Bytes to be sent, received bytes are stored back here.
+ * @param iLength Number of bytes, with OW_USE_DMA at most OW_DMA_MAX_BYTES.
+ * @param callback Called from interrupt when the block is done.
+ * @return OW_OK if transfer started, OW_BUSY if bus is in use.
+ */
+OW_State OW_BlockTransfer_As(OW_Bus *pBus, uint8_t *pBlock, uint8_t iLength, OW_Callback callback) {
+	if(pBus->busy){
+		return OW_BUSY;
+	}
+#ifdef OW_USE_DMA
+	if(iLength == 0 || iLength > OW_DMA_MAX_BYTES){
+		return OW_ERROR;
+	}
+#else
+	if(iLength == 0){
+		return OW_ERROR;
+	}
+#endif
+	pBus->p_callback = callback;
+	pBus->busy = 1;
+#ifdef OW_USE_DMA
+	OW_DMAStart(pBus, pBlock, iLength);
+#else
+	pBus->pBlockData = pBlock;
+	pBus->iBlockLength = iLength;
+	pBus->datlen = 0;
+	pBus->operation = OW_OP_BLOCK;
+	USART_SendData(pBus->pHW->pUSART, (pBlock[0] & 0x01) ? OW_1 : OW_0);
+#endif
+	return OW_OK;
+}
+
+OW_State OW_BlockTransfer(OW_Bus *pBus, uint8_t *pBlock, uint8_t iLength)
 {
-	volatile int t=0xffffff;
-	write_done_flag = 0;
-	OW_ByteWrite_As(bByte, callback_bytewrite);
-	while(write_done_flag == 0 && t>0){
-		 t--;
-	 }
-	 if(t==0){
-		 Error_ow();
-	 }
+	OW_State iState;
+	pBus->iDoneFlag = 0;
+	iState = OW_BlockTransfer_As(pBus, pBlock, iLength, callback_done);
+	if(iState != OW_OK){
+		return iState;
+	}
+	return OW_WaitDone(pBus);
+}
+
+/**
+ * Search triplet: read a bit and its complement, then write the search
+ * direction. All three slots run from the RXNE interrupt.
+ * @param bDirection Direction to be written if both 0 and 1 were read.
+ * @param callback Called from interrupt when done, see OW_GetTripletResult.
+ * @return OW_OK if started, OW_BUSY if bus is in use.
+ */
+OW_State OW_Triplet_As(OW_Bus *pBus, uint8_t bDirection, OW_Callback callback) {
+    USART_TypeDef *pUSART = pBus->pHW->pUSART;
+
+	if(pBus->busy){
+		return OW_BUSY;
+	}
+	pBus->busy = 1;
+	pBus->p_callback = callback;
+	pBus->cmdbuff = bDirection;
+	pBus->rebuff = 0;
+	pBus->datlen = 0;
+	pBus->operation = OW_OP_TRIPLET;
+
+	USART_ITConfig(pUSART, USART_IT_RXNE, ENABLE);
+	while (USART_GetFlagStatus(pUSART, USART_FLAG_RXNE) == SET)
+		USART_ReceiveData(pUSART);
+	USART_SendData(pUSART, OW_1);
+	return OW_OK;
 }
 
-void callback_bytewrite(void)
+/**
+ * @return OW_TRIPLET_ID, OW_TRIPLET_CMP_ID and OW_TRIPLET_DIR bits of the
+ * last triplet.
+ */
+uint8_t OW_GetTripletResult(OW_Bus *pBus)
 {
-	write_done_flag = 1;
+	return pBus->rebuff;
 }
 
 /**
  * Set RX/TX pin into strong pull-up state.
  */
-void OW_StrongPullUp(void) {
+void OW_StrongPullUp(OW_Bus *pBus) {
 #ifdef OW_USE_PARASITE_POWER
+    const OW_BusHW *pHW = pBus->pHW;
 
-#ifdef OW_USE_SINGLE_PIN 
-//	USART_Cmd(OW_USART, DISABLE);
-    USART_HalfDuplexCmd(OW_USART, DISABLE);
-#endif
+    USART_HalfDuplexCmd(pHW->pUSART, DISABLE);
 
-    GPIO_SetBits(OW_TX_PIN_PORT, OW_TX_PIN_PIN);
-    OW_TX_PIN_PORT->OTYPER &= ~(OW_TX_PIN_PIN);
+    GPIO_SetBits(pHW->pTxPort, pHW->iTxPin);
+    pHW->pTxPort->OTYPER &= ~(pHW->iTxPin);
 
 #endif
 }
@@ -216,16 +471,14 @@ void OW_StrongPullUp(void) {
 /**
  * Set RX/TX pin into weak pull-up state.
  */
-void OW_WeakPullUp(void) {
+void OW_WeakPullUp(OW_Bus *pBus) {
 #ifdef OW_USE_PARASITE_POWER
+    const OW_BusHW *pHW = pBus->pHW;
 
-    GPIO_SetBits(OW_TX_PIN_PORT, OW_TX_PIN_PIN);
-    OW_TX_PIN_PORT->OTYPER |= OW_TX_PIN_PIN;
+    GPIO_SetBits(pHW->pTxPort, pHW->iTxPin);
+    pHW->pTxPort->OTYPER |= pHW->iTxPin;
 
-#ifdef OW_USE_SINGLE_PIN 
-//    USART_Cmd(OW_USART, ENABLE);
-    USART_HalfDuplexCmd(OW_USART, ENABLE);
-#endif
+    USART_HalfDuplexCmd(pHW->pUSART, ENABLE);
 
 #endif
 }
@@ -236,125 +489,251 @@ void OW_WeakPullUp(void) {
  * Communication reset and device presence detection.
  * @return OW_OK if device found or OW_NO_DEV if not.
  */
+OW_State OW_Reset_As(OW_Bus *pBus, OW_Callback callback) {
+    USART_TypeDef *pUSART = pBus->pHW->pUSART;
 
-
-volatile int reset_state;
-volatile int reset_done_flag=0;
-void (*PReset_callback)(void);
-OW_State OW_Reset_As(void (*callback)(void)) {
-	if(busy){
-		printf("busy");
+	if(pBus->busy){
 		return OW_BUSY;
 	}else{
-	busy=1;
-	operation = OW_OP_RESET;
-	PReset_callback=callback;
-	reset_state = 0;
-    /* Set USART baudrate to 9600 Baud */
-    OW_USART->BRR = iUSART9600;
+	pBus->busy=1;
+	pBus->operation = OW_OP_RESET;
+	pBus->p_callback=callback;
+    /* Reset pulse of current speed, standard speed reset also drops all
+     * devices out of overdrive */
+    pUSART->BRR = pBus->iBRRReset[pBus->iSpeed];
+    USART_ITConfig(pUSART, USART_IT_RXNE, ENABLE);
 
     /* Make sure that all communication is done and receive buffer is cleared */
-    USART_ClearFlag(OW_USART, USART_FLAG_TC);
-    while (USART_GetFlagStatus(OW_USART, USART_FLAG_RXNE) == SET)
-            USART_ReceiveData(OW_USART);
-    USART_SendData(OW_USART, OW_R);
+    USART_ClearFlag(pUSART, USART_FLAG_TC);
+    while (USART_GetFlagStatus(pUSART, USART_FLAG_RXNE) == SET)
+            USART_ReceiveData(pUSART);
+    USART_SendData(pUSART, OW_R);
 	}
-//	while(busy);
 	return OW_OK;
 }
 
-OW_State OW_Reset(void){
-	 reset_done_flag=0;
-     OW_Reset_As(callback_Reset);
-     volatile int t=0xffffff;
-	 while(reset_done_flag==0 && t>0){
-		 t--;
-	 }
-	 if(t==0){
-		 Error_ow();
-	 }
-	 return OW_GetResetResult();
+OW_State OW_Reset(OW_Bus *pBus){
+	 pBus->iDoneFlag=0;
+     OW_Reset_As(pBus, callback_done);
+     OW_WaitDone(pBus);
+	 return OW_GetResetResult(pBus);
 }
-void Error_ow(void){
-	if(operation == OW_OP_RESET){
-		printf("while_reset is wrong");
-	}else if(operation == OW_OP_READ){
-		printf("while_read is wrong");
-	}else if(operation == OW_OP_WRITE){
-		printf("while_write is wrong");
-	}
+/**
+ * Change speed of bus time slots and reset pulse. Devices have to be
+ * switched to overdrive by Overdrive Skip/Match ROM first, see
+ * OW_TR_OVERDRIVE.
+ * @param iSpeed OW_SPEED_STANDARD or OW_SPEED_OVERDRIVE.
+ */
+void OW_SpeedSet(OW_Bus *pBus, OW_Speed iSpeed) {
+    pBus->iSpeed = iSpeed;
+    if (!pBus->busy)
+        pBus->pHW->pUSART->BRR = pBus->iBRRSlot[iSpeed];
 }
 
-void callback_Reset(void){
-   reset_done_flag=1;
+OW_Speed OW_SpeedGet(OW_Bus *pBus) {
+    return pBus->iSpeed;
 }
 
-OW_State OW_GetResetResult(void)
+void Error_ow(OW_Bus *pBus){
+	if(pBus->operation == OW_OP_RESET){
+		DLOG1(DLOG_OW_RESET_ERROR, pBus->iIndex);
+	}else if(pBus->operation == OW_OP_READ){
+		DLOG1(DLOG_OW_READ_ERROR, pBus->iIndex);
+	}else if(pBus->operation == OW_OP_WRITE){
+		DLOG1(DLOG_OW_WRITE_ERROR, pBus->iIndex);
+	}else if(pBus->operation == OW_OP_BLOCK){
+		DLOG1(DLOG_OW_BLOCK_ERROR, pBus->iIndex);
+	}
+}
+
+OW_State OW_GetResetResult(OW_Bus *pBus)
 {
-	if ((iPresence != OW_R) && ((iPresence != 0x00))) 
+	if ((pBus->iPresence != OW_R) && ((pBus->iPresence != 0x00)))
 		return OW_OK;
 	else
 		return OW_NO_DEV;
 }
 
 
-void USART_OW_IRQHandeler(void)
+/**
+ * USART interrupt of one bus, drives reset and non-DMA bit slots.
+ */
+void OW_IRQHandler(OW_Bus *pBus)
 {
+	USART_TypeDef *pUSART = pBus->pHW->pUSART;
 	uint8_t bData = OW_0;
 	uint8_t recvData;
-	if(USART_GetITStatus(OW_USART, USART_IT_RXNE) == SET){
+	if(USART_GetITStatus(pUSART, USART_IT_RXNE) == SET){
 
-		recvData = USART_ReceiveData(OW_USART);
-        if(operation == OW_OP_FREE){
-        	busy=0;
+		recvData = USART_ReceiveData(pUSART);
+        if(pBus->operation == OW_OP_FREE){
+        	pBus->busy=0;
         }
-        else if(operation == OW_OP_WRITE){
-			if(datlen<7){
-				datlen++;
-				if(cmdbuff&(1<<datlen)){
+        else if(pBus->operation == OW_OP_WRITE){
+			if(pBus->datlen<7){
+				pBus->datlen++;
+				if(pBus->cmdbuff&(1<<pBus->datlen)){
 					bData = OW_1;
 				}else{
 					bData = OW_0;
 				}
-				USART_SendData(OW_USART,bData);
+				USART_SendData(pUSART,bData);
 			}else{
-				busy = 0;
-				operation = OW_OP_FREE;
-				p_callback();
+				pBus->busy = 0;
+				pBus->operation = OW_OP_FREE;
+				pBus->p_callback(pBus);
 			}
-		}else if (operation == OW_OP_READ){
+		}else if (pBus->operation == OW_OP_READ){
 			if (recvData == OW_1){
-				rebuff|=(1<<datlen);
+				pBus->rebuff|=(1<<pBus->datlen);
 			}
-			datlen++;
-			if(datlen < 8){
-				USART_SendData(OW_USART, OW_1);
+			pBus->datlen++;
+			if(pBus->datlen < 8){
+				USART_SendData(pUSART, OW_1);
 			}else{
-				busy = 0;
-				operation = OW_OP_FREE;
-				p_callback();
+				pBus->busy = 0;
+				pBus->operation = OW_OP_FREE;
+				pBus->p_callback(pBus);
 			}
-		}else if(operation == OW_OP_RESET){
-
-				if(reset_state == 0){
-				busy=0;
-				reset_state = 1;
-				iPresence = recvData;
-				OW_USART->BRR = iUSART115200;
-				operation = OW_OP_FREE;
-				PReset_callback();
-
-//			}else if(reset_state == 1){
-
+		}else if(pBus->operation == OW_OP_RESET){
+			pBus->busy=0;
+			pBus->iPresence = recvData;
+			/* Nobody answered overdrive reset, devices are back at standard speed */
+			if(pBus->iSpeed == OW_SPEED_OVERDRIVE && OW_GetResetResult(pBus) == OW_NO_DEV){
+				pBus->iSpeed = OW_SPEED_STANDARD;
+			}
+			pUSART->BRR = pBus->iBRRSlot[pBus->iSpeed];
+			pBus->operation = OW_OP_FREE;
+			pBus->p_callback(pBus);
+		}else if(pBus->operation == OW_OP_TRIPLET){
+			if(pBus->datlen == 0){
+				if(recvData == OW_1){
+					pBus->rebuff |= OW_TRIPLET_ID;
+				}
+				pBus->datlen = 1;
+				USART_SendData(pUSART, OW_1);
+			}else if(pBus->datlen == 1){
+				uint8_t bDirection;
+				if(recvData == OW_1){
+					pBus->rebuff |= OW_TRIPLET_CMP_ID;
+				}
+				/* All devices agree on the bit, or pick the requested branch */
+				if(((pBus->rebuff & OW_TRIPLET_ID) != 0) != ((pBus->rebuff & OW_TRIPLET_CMP_ID) != 0)){
+					bDirection = pBus->rebuff & OW_TRIPLET_ID;
+				}else{
+					bDirection = pBus->cmdbuff;
+				}
+				if(bDirection){
+					pBus->rebuff |= OW_TRIPLET_DIR;
+				}
+				pBus->datlen = 2;
+				USART_SendData(pUSART, bDirection ? OW_1 : OW_0);
 			}else{
-
-				busy=0;
-				//error
+				pBus->busy = 0;
+				pBus->operation = OW_OP_FREE;
+				pBus->p_callback(pBus);
+			}
+		}else if(pBus->operation == OW_OP_BLOCK){
+			/* Bit by bit block, each echo is stored over the sent bit */
+			uint8_t *pByte = &pBus->pBlockData[pBus->datlen >> 3];
+			uint8_t iMask = 1 << (pBus->datlen & 7);
+			if(recvData == OW_1){
+				*pByte |= iMask;
+			}else{
+				*pByte &= ~iMask;
+			}
+			pBus->datlen++;
+			if(pBus->datlen < pBus->iBlockLength * 8){
+				pByte = &pBus->pBlockData[pBus->datlen >> 3];
+				iMask = 1 << (pBus->datlen & 7);
+				USART_SendData(pUSART, (*pByte & iMask) ? OW_1 : OW_0);
+			}else{
+				pBus->busy = 0;
+				pBus->operation = OW_OP_FREE;
+				pBus->p_callback(pBus);
 			}
 		}else{
-			busy=0;
+			pBus->busy=0;
 
 			//error
 		}
+		OW_QueueKick(pBus);
+	}
+}
+
+#ifdef OW_USE_DMA
+/**
+ * RX DMA transfer complete, every bit slot of the block has been echoed.
+ */
+void OW_DMAIRQHandler(OW_Bus *pBus)
+{
+	const OW_BusHW *pHW = pBus->pHW;
+	int i, iBit;
+	uint8_t *pSlot = pBus->iSlots;
+
+	if(DMA_GetITStatus(pHW->pDMARxStream, pHW->iDMARxITTC) == SET){
+		DMA_ClearITPendingBit(pHW->pDMARxStream, pHW->iDMARxITTC);
+		USART_DMACmd(pHW->pUSART, USART_DMAReq_Tx | USART_DMAReq_Rx, DISABLE);
+
+		/* Slot reads as 1 only if nobody pulled the bus low */
+		for(i = 0; i < pBus->iBlockLength; i++){
+			uint8_t iByte = 0;
+			for(iBit = 0; iBit < 8; iBit++){
+				if(*pSlot++ == OW_1){
+					iByte |= (1 << iBit);
+				}
+			}
+			pBus->pBlockData[i] = iByte;
+		}
+		pBus->rebuff = pBus->iByteBuffer;
+
+		pBus->busy = 0;
+		pBus->operation = OW_OP_FREE;
+		pBus->p_callback(pBus);
+		OW_QueueKick(pBus);
 	}
 }
+#endif
+
+/* One interrupt entry per USART and per RX DMA stream */
+#ifdef OW_USE_USART1
+void USART1_IRQHandler(void) { OW_IRQHandler(&OW_Buses[OW_BUS_USART1]); }
+#ifdef OW_USE_DMA
+void DMA2_Stream2_IRQHandler(void) { OW_DMAIRQHandler(&OW_Buses[OW_BUS_USART1]); }
+#endif
+#endif
+
+#ifdef OW_USE_USART2
+void USART2_IRQHandler(void) { OW_IRQHandler(&OW_Buses[OW_BUS_USART2]); }
+#ifdef OW_USE_DMA
+void DMA1_Stream5_IRQHandler(void) { OW_DMAIRQHandler(&OW_Buses[OW_BUS_USART2]); }
+#endif
+#endif
+
+#ifdef OW_USE_USART3
+void USART3_IRQHandler(void) { OW_IRQHandler(&OW_Buses[OW_BUS_USART3]); }
+#ifdef OW_USE_DMA
+void DMA1_Stream1_IRQHandler(void) { OW_DMAIRQHandler(&OW_Buses[OW_BUS_USART3]); }
+#endif
+#endif
+
+#ifdef OW_USE_UART4
+void UART4_IRQHandler(void) { OW_IRQHandler(&OW_Buses[OW_BUS_UART4]); }
+#ifdef OW_USE_DMA
+void DMA1_Stream2_IRQHandler(void) { OW_DMAIRQHandler(&OW_Buses[OW_BUS_UART4]); }
+#endif
+#endif
+
+#ifdef OW_USE_UART5
+void UART5_IRQHandler(void) { OW_IRQHandler(&OW_Buses[OW_BUS_UART5]); }
+#ifdef OW_USE_DMA
+void DMA1_Stream0_IRQHandler(void) { OW_DMAIRQHandler(&OW_Buses[OW_BUS_UART5]); }
+#endif
+#endif
+
+#ifdef OW_USE_USART6
+void USART6_IRQHandler(void) { OW_IRQHandler(&OW_Buses[OW_BUS_USART6]); }
+#ifdef OW_USE_DMA
+void DMA2_Stream1_IRQHandler(void) { OW_DMAIRQHandler(&OW_Buses[OW_BUS_USART6]); }
+#endif
+#endif
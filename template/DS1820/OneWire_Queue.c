@@ -0,0 +1,282 @@
+/**
+ *******************************************************************************
+ * @file    OneWire_Queue.c
+ * @brief   Asynchronous 1-Wire transaction queue.
+ *
+ * @section info Additional Information
+ *          Every bus has a fixed length queue of transaction descriptors.
+ *          A transaction is reset, ROM select, command, write bytes and read
+ *          bytes; all bytes after the reset are sent as one block. The queue
+ *          is drained from the bus interrupts, the next transaction starts
+ *          right after the previous one completed, and every transaction
+ *          ends with its completion callback called from interrupt.
+ *
+ *          With OW_TR_OVERDRIVE the device is selected by Overdrive Skip or
+ *          Match ROM and the bus switches to overdrive right after the ROM
+ *          command byte. Bus stays in overdrive for following transactions
+ *          until OW_SpeedSet or until an overdrive reset finds no device.
+ *
+ *          With OW_TR_SEARCH the frame ends with the search command and one
+ *          pass of the ROM search runs as a chain of triplets, see
+ *          OW_SearchPass. The pass ends the transaction by OW_QueueComplete.
+ *
+ *          Descriptors are owned by the caller and must stay valid until the
+ *          callback runs. Transactions may be submitted from main loop or
+ *          from interrupt, including from a completion callback.
+ *******************************************************************************
+ */
+
+#include "OneWire.h"
+#include "owcrc.h"
+#include "string.h"
+
+static void OW_QueueStart(OW_Bus *pBus);
+static void OW_QueueFirstChunk(OW_Bus *pBus);
+static void OW_QueueNextChunk(OW_Bus *pBus);
+static void CB_QueueReset(OW_Bus *pBus);
+static void CB_QueueChunk(OW_Bus *pBus);
+static int OW_QueueFind(OW_Bus *pBus, const OW_Transaction *pTransaction);
+
+/**
+ * Number of frame bytes of a transaction, ROM select included.
+ */
+static int OW_FrameLength(const OW_Transaction *pTransaction) {
+    int iLength = pTransaction->iWriteLength;
+
+    /* Search pass reads the ROM bit by bit, not as frame bytes */
+    if (!(pTransaction->iFlags & OW_TR_SEARCH))
+        iLength += pTransaction->iReadLength;
+
+    if (pTransaction->iFlags & OW_TR_ROM)
+        iLength += (pTransaction->iAddress == OW_ADDRESS_ALL) ? 1 : 9;
+    if (pTransaction->iFlags & OW_TR_COMMAND)
+        iLength++;
+
+    return iLength;
+}
+
+/**
+ * Add transaction to the end of bus queue and start it if the bus is idle.
+ * @param pBus Bus to run the transaction on.
+ * @param pTransaction Transaction descriptor, has to stay valid until its
+ * callback is called.
+ * @return OW_OK if queued, OW_BUSY if queue is full or the descriptor is
+ * still queued, OW_ERROR if transaction does not fit into
+ * OW_FRAME_MAX_BYTES. A refused descriptor is OW_TR_FAILED unless it is
+ * still queued, then it is left alone.
+ */
+OW_State OW_QueueSubmit(OW_Bus *pBus, OW_Transaction *pTransaction) {
+    uint32_t iPrimask;
+    uint8_t iNext;
+
+    if (OW_FrameLength(pTransaction) > OW_FRAME_MAX_BYTES) {
+        pTransaction->iStatus = OW_TR_FAILED;
+        return OW_ERROR;
+    }
+
+    iPrimask = __get_PRIMASK();
+    __disable_irq();
+
+    if (OW_QueueFind(pBus, pTransaction)) {
+        __set_PRIMASK(iPrimask);
+        return OW_BUSY;
+    }
+    iNext = (pBus->iQueueTail + 1) % OW_QUEUE_LENGTH;
+    if (iNext == pBus->iQueueHead) {
+        pTransaction->iStatus = OW_TR_FAILED;
+        __set_PRIMASK(iPrimask);
+        return OW_BUSY;
+    }
+    /* Pending only once the slot is taken */
+    pTransaction->iStatus = OW_TR_PENDING;
+    pBus->pQueue[pBus->iQueueTail] = pTransaction;
+    pBus->iQueueTail = iNext;
+
+    OW_QueueKick(pBus);
+
+    __set_PRIMASK(iPrimask);
+    return OW_OK;
+}
+
+/**
+ * Start the first queued transaction if the bus is free. Called from bus
+ * interrupts after every completed operation.
+ */
+void OW_QueueKick(OW_Bus *pBus) {
+    if (pBus->pCurrent == 0 && !pBus->busy && pBus->iQueueHead != pBus->iQueueTail)
+        OW_QueueStart(pBus);
+}
+
+/**
+ * Check before a descriptor is reused, e.g. after a blocking wait timed out.
+ * @return 1 if the descriptor waits in the queue or is running.
+ */
+int OW_QueueQueued(OW_Bus *pBus, const OW_Transaction *pTransaction) {
+    uint32_t iPrimask;
+    int bQueued;
+
+    iPrimask = __get_PRIMASK();
+    __disable_irq();
+    bQueued = OW_QueueFind(pBus, pTransaction);
+    __set_PRIMASK(iPrimask);
+    return bQueued;
+}
+
+/**
+ * @return 1 if no transaction is running or waiting on the bus.
+ */
+int OW_QueueIdle(OW_Bus *pBus) {
+    return pBus->pCurrent == 0 && pBus->iQueueHead == pBus->iQueueTail;
+}
+
+/**
+ * Running transaction is the queue head, interrupts have to be disabled.
+ */
+static int OW_QueueFind(OW_Bus *pBus, const OW_Transaction *pTransaction) {
+    uint8_t i;
+
+    for (i = pBus->iQueueHead; i != pBus->iQueueTail; i = (i + 1) % OW_QUEUE_LENGTH)
+        if (pBus->pQueue[i] == pTransaction)
+            return 1;
+    return 0;
+}
+
+/**
+ * Build frame of the first queued transaction and start it.
+ */
+static void OW_QueueStart(OW_Bus *pBus) {
+    OW_Transaction *pTr = pBus->pQueue[pBus->iQueueHead];
+    uint8_t *pFrame = pBus->iFrame;
+
+    pBus->pCurrent = pTr;
+
+    if (pTr->iFlags & OW_TR_ROM) {
+        if (pTr->iAddress == OW_ADDRESS_ALL) {
+            *pFrame++ = OW_ROM_SKIP;
+        } else {
+            *pFrame++ = OW_ROM_MATCH;
+            memcpy(pFrame, (const void *) &pTr->iAddress, 8);
+            pFrame += 8;
+        }
+    }
+    if (pTr->iFlags & OW_TR_COMMAND)
+        *pFrame++ = pTr->iCommand;
+    if (pTr->iWriteLength) {
+        memcpy(pFrame, pTr->pWrite, pTr->iWriteLength);
+        pFrame += pTr->iWriteLength;
+    }
+    pBus->iFrameReadPos = pFrame - pBus->iFrame;
+    if (!(pTr->iFlags & OW_TR_SEARCH)) {
+        memset(pFrame, 0xFF, pTr->iReadLength);
+        pFrame += pTr->iReadLength;
+    }
+
+    pBus->iFrameLength = pFrame - pBus->iFrame;
+    pBus->iFramePos = 0;
+
+    /* Bus could be left powered by previous transaction */
+    OW_WeakPullUp(pBus);
+
+    if (pTr->iFlags & OW_TR_RESET) {
+        if (OW_Reset_As(pBus, CB_QueueReset) != OW_OK)
+            OW_QueueComplete(pBus, OW_TR_FAILED);
+    } else {
+        OW_QueueFirstChunk(pBus);
+    }
+}
+
+/**
+ * Pick ROM command for the current bus speed and send the first chunk.
+ * Speed is known only after the reset, overdrive reset without presence
+ * falls back to standard speed.
+ */
+static void OW_QueueFirstChunk(OW_Bus *pBus) {
+    OW_Transaction *pTr = pBus->pCurrent;
+
+    pBus->iSpeedSwitchPos = 0;
+    if ((pTr->iFlags & OW_TR_ROM) && (pTr->iFlags & OW_TR_OVERDRIVE)) {
+        uint8_t bSkip = (pTr->iAddress == OW_ADDRESS_ALL);
+
+        if (OW_SpeedGet(pBus) == OW_SPEED_STANDARD) {
+            pBus->iFrame[0] = bSkip ? OW_ROM_OD_SKIP : OW_ROM_OD_MATCH;
+            pBus->iSpeedSwitchPos = 1;
+        } else {
+            pBus->iFrame[0] = bSkip ? OW_ROM_SKIP : OW_ROM_MATCH;
+        }
+    }
+    OW_QueueNextChunk(pBus);
+}
+
+/**
+ * Send next part of the frame, or finish the transaction if all is sent.
+ */
+static void OW_QueueNextChunk(OW_Bus *pBus) {
+    uint8_t iLength = pBus->iFrameLength - pBus->iFramePos;
+
+    if (iLength == 0) {
+        if (pBus->pCurrent->iFlags & OW_TR_SEARCH)
+            OW_SearchPass(pBus);
+        else
+            OW_QueueComplete(pBus, OW_TR_DONE);
+        return;
+    }
+#ifdef OW_USE_DMA
+    if (iLength > OW_DMA_MAX_BYTES)
+        iLength = OW_DMA_MAX_BYTES;
+#endif
+    /* Overdrive ROM command goes alone at standard speed */
+    if (pBus->iSpeedSwitchPos > pBus->iFramePos
+            && iLength > pBus->iSpeedSwitchPos - pBus->iFramePos)
+        iLength = pBus->iSpeedSwitchPos - pBus->iFramePos;
+    pBus->iChunkLength = iLength;
+    if (OW_BlockTransfer_As(pBus, &pBus->iFrame[pBus->iFramePos], iLength, CB_QueueChunk) != OW_OK)
+        OW_QueueComplete(pBus, OW_TR_FAILED);
+}
+
+static void CB_QueueReset(OW_Bus *pBus) {
+    if (OW_GetResetResult(pBus) == OW_NO_DEV)
+        OW_QueueComplete(pBus, OW_TR_NO_DEV);
+    else
+        OW_QueueFirstChunk(pBus);
+}
+
+static void CB_QueueChunk(OW_Bus *pBus) {
+    pBus->iFramePos += pBus->iChunkLength;
+    if (pBus->iFramePos == pBus->iSpeedSwitchPos)
+        OW_SpeedSet(pBus, OW_SPEED_OVERDRIVE);
+    OW_QueueNextChunk(pBus);
+}
+
+/**
+ * Deliver read data, check CRC, remove transaction from the queue and call
+ * its callback. Called from interrupt when the running transaction ends.
+ * @param pBus Bus of the running transaction.
+ * @param iStatus Result of the transaction.
+ */
+void OW_QueueComplete(OW_Bus *pBus, OW_TrStatus iStatus) {
+    OW_Transaction *pTr = pBus->pCurrent;
+
+    if (pTr->iFlags & OW_TR_SEARCH) {
+        /* Failed pass restarts the search, ROM was stored by the pass */
+        if (iStatus != OW_TR_DONE) {
+            pBus->stSearch.iLastDiscrepancy = 0;
+            pBus->stSearch.iLastDeviceFlag = 0;
+            pBus->stSearch.iLastFamilyDiscrepancy = 0;
+        }
+    } else if (iStatus == OW_TR_DONE && pTr->iReadLength) {
+        memcpy(pTr->pRead, &pBus->iFrame[pBus->iFrameReadPos], pTr->iReadLength);
+
+        if ((pTr->iFlags & OW_TR_CRC8) && crc8_block(0, pTr->pRead, pTr->iReadLength) != 0)
+            iStatus = OW_TR_CRC_ERROR;
+    }
+
+    if (iStatus == OW_TR_DONE && (pTr->iFlags & OW_TR_PULLUP))
+        OW_StrongPullUp(pBus);
+
+    pTr->iStatus = iStatus;
+    pBus->iQueueHead = (pBus->iQueueHead + 1) % OW_QUEUE_LENGTH;
+    pBus->pCurrent = 0;
+
+    if (pTr->callback)
+        pTr->callback(pBus, pTr);
+}
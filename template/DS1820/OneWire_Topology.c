@@ -0,0 +1,203 @@
+/**
+ *******************************************************************************
+ * @file    OneWire_Topology.c
+ * @brief   Incremental detection of attached and detached 1-Wire devices.
+ *
+ * @section info Additional Information
+ *          The tracker keeps the set of known ROMs of one bus. Every call of
+ *          OW_TopologyCheck runs one search pass targeted at the next known
+ *          ROM (OW_Verify_As) instead of enumerating the whole bus:
+ *              - If the pass does not end at that ROM, the device is gone
+ *                and is reported as detached.
+ *              - Along its path the pass sees a discrepancy at every bit
+ *                where devices branch off. The known set tells which branch
+ *                points to expect, a branch point that no known device
+ *                explains means a new device and starts a full search.
+ *
+ *          Checking all known ROMs in turn covers every branch point of the
+ *          search tree, so any added device is found within one round. The
+ *          full search reports new devices as attached, and known devices it
+ *          did not find as detached if it completed without errors.
+ *
+ *          Events are reported from interrupt. The tracker uses the bus
+ *          search transaction, while an alarm search or any other pass
+ *          holds it the check returns OW_BUSY and runs next time.
+ *******************************************************************************
+ */
+
+#include "OneWire.h"
+#include "string.h"
+
+static OW_State OW_TopologySearch(OW_Topology *pTopology);
+static uint64_t OW_TopologyBranches(OW_Topology *pTopology, uint64_t iROM);
+static int OW_TopologyFind(const uint64_t *pList, int iCount, uint64_t iROM);
+static void OW_TopologyRemove(OW_Topology *pTopology, int iIndex);
+static void CB_TopologyVerify(OW_Bus *pBus, OW_Transaction *pTransaction);
+static void CB_TopologyFound(OW_Bus *pBus, uint64_t iROM);
+
+/* Tracker of every bus, search callbacks have no context */
+static OW_Topology *pTopologies[OW_BUS_COUNT];
+
+/**
+ * Initialize tracker with the devices known on the bus.
+ * @param pTopology Tracker to be initialized.
+ * @param pBus Bus to be tracked.
+ * @param Addresses Known devices, e.g. from a search or a registry.
+ * @param iCount Number of known devices.
+ * @param event Called from interrupt for every attached or detached device.
+ */
+void OW_TopologyInit(OW_Topology *pTopology, OW_Bus *pBus, const uint64_t *Addresses, int iCount, OW_TopologyCallback event) {
+    if (iCount > OW_TOPOLOGY_MAX_DEVICES)
+        iCount = OW_TOPOLOGY_MAX_DEVICES;
+
+    memset(pTopology, 0, sizeof(OW_Topology));
+    pTopology->pBus = pBus;
+    pTopology->event = event;
+    pTopology->iCount = iCount;
+    memcpy(pTopology->iROM, Addresses, iCount * sizeof(uint64_t));
+
+    pTopologies[pBus->iIndex] = pTopology;
+}
+
+/**
+ * Run one incremental check, a single search pass in most cases.
+ * @return OW_OK if started, OW_BUSY if previous check is running or the
+ * search is in use.
+ */
+OW_State OW_TopologyCheck(OW_Topology *pTopology) {
+    OW_State iState;
+
+    if (pTopology->bBusy)
+        return OW_BUSY;
+    pTopology->bBusy = 1;
+
+    /* Nothing to verify, first pass of a full search is as cheap */
+    if (pTopology->iCount == 0)
+        return OW_TopologySearch(pTopology);
+
+    if (pTopology->iNext >= pTopology->iCount)
+        pTopology->iNext = 0;
+
+    iState = OW_Verify_As(pTopology->pBus, pTopology->iROM[pTopology->iNext], CB_TopologyVerify);
+    if (iState != OW_OK)
+        pTopology->bBusy = 0;
+    return iState;
+}
+
+/**
+ * Enumerate the whole bus and report the differences to the known set.
+ * @return OW_OK if started, OW_BUSY if a check is running or the search is
+ * in use.
+ */
+OW_State OW_TopologyRescan(OW_Topology *pTopology) {
+    if (pTopology->bBusy)
+        return OW_BUSY;
+    pTopology->bBusy = 1;
+
+    return OW_TopologySearch(pTopology);
+}
+
+/**
+ * @return 1 if no check is running.
+ */
+int OW_TopologyIdle(OW_Topology *pTopology) {
+    return !pTopology->bBusy;
+}
+
+static OW_State OW_TopologySearch(OW_Topology *pTopology) {
+    OW_State iState;
+
+    pTopology->iFoundCount = 0;
+    pTopology->iFullSearches++;
+
+    iState = OW_Search_As(pTopology->pBus, OW_ROM_SEARCH, 0, CB_TopologyFound);
+    if (iState != OW_OK)
+        pTopology->bBusy = 0;
+    return iState;
+}
+
+/**
+ * Branch points expected on the search path of iROM: the lowest bit where
+ * it differs from every other known device.
+ */
+static uint64_t OW_TopologyBranches(OW_Topology *pTopology, uint64_t iROM) {
+    uint64_t iBranches = 0, iDiff;
+    int i;
+
+    for (i = 0; i < pTopology->iCount; i++) {
+        iDiff = pTopology->iROM[i] ^ iROM;
+        iBranches |= iDiff & (~iDiff + 1);
+    }
+    return iBranches;
+}
+
+static int OW_TopologyFind(const uint64_t *pList, int iCount, uint64_t iROM) {
+    int i;
+
+    for (i = 0; i < iCount; i++)
+        if (pList[i] == iROM)
+            return i;
+    return -1;
+}
+
+static void OW_TopologyRemove(OW_Topology *pTopology, int iIndex) {
+    uint64_t iROM = pTopology->iROM[iIndex];
+
+    pTopology->iCount--;
+    memmove(&pTopology->iROM[iIndex], &pTopology->iROM[iIndex + 1],
+            (pTopology->iCount - iIndex) * sizeof(uint64_t));
+
+    if (pTopology->event)
+        pTopology->event(pTopology->pBus, iROM, OW_DEV_DETACHED);
+}
+
+static void CB_TopologyVerify(OW_Bus *pBus, OW_Transaction *pTransaction) {
+    OW_Topology *pTopology = pTopologies[pBus->iIndex];
+    uint64_t iROM = pTopology->iROM[pTopology->iNext];
+
+    if (pTransaction->iStatus == OW_TR_DONE && pBus->stSearch.ROM == iROM) {
+        /* Unexplained branch point, somebody new is on the bus */
+        if (pBus->stSearch.iDiscrepancies & ~OW_TopologyBranches(pTopology, iROM)) {
+            OW_TopologySearch(pTopology);
+            return;
+        }
+        pTopology->iNext++;
+    } else if (pTransaction->iStatus == OW_TR_DONE || pTransaction->iStatus == OW_TR_NO_DEV) {
+        /* Path ended elsewhere or nobody answered */
+        OW_TopologyRemove(pTopology, pTopology->iNext);
+    }
+    /* CRC error or busy queue proves nothing, try again next time */
+
+    pTopology->bBusy = 0;
+}
+
+static void CB_TopologyFound(OW_Bus *pBus, uint64_t iROM) {
+    OW_Topology *pTopology = pTopologies[pBus->iIndex];
+    OW_TrStatus iStatus = pBus->stSearch.stTransaction.iStatus;
+    int i;
+
+    if (iROM) {
+        if (pTopology->iFoundCount < OW_TOPOLOGY_MAX_DEVICES)
+            pTopology->iFound[pTopology->iFoundCount++] = iROM;
+        return;
+    }
+
+    /* Known devices missing only if the search went through */
+    if (iStatus == OW_TR_DONE || (iStatus == OW_TR_NO_DEV && pTopology->iFoundCount == 0)) {
+        for (i = pTopology->iCount - 1; i >= 0; i--)
+            if (OW_TopologyFind(pTopology->iFound, pTopology->iFoundCount, pTopology->iROM[i]) < 0)
+                OW_TopologyRemove(pTopology, i);
+    }
+
+    for (i = 0; i < pTopology->iFoundCount; i++) {
+        if (OW_TopologyFind(pTopology->iROM, pTopology->iCount, pTopology->iFound[i]) >= 0
+                || pTopology->iCount >= OW_TOPOLOGY_MAX_DEVICES)
+            continue;
+        pTopology->iROM[pTopology->iCount++] = pTopology->iFound[i];
+        if (pTopology->event)
+            pTopology->event(pBus, pTopology->iFound[i], OW_DEV_ATTACHED);
+    }
+
+    pTopology->iNext = 0;
+    pTopology->bBusy = 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * canexport.h
+ *
+ * Sample export on CAN1 (PD0 RX, PD1 TX), 250 kbit/s, standard IDs.
+ *
+ * Data frame, ID CANEXPORT_DATA_ID(node):
+ *  0: frame sequence number
+ *  1: bus (bits 7..5, OW_BUS_x) and sensor index of the first value
+ *     (bits 4..0), all values of a frame come from one bus
+ *  2: up to 3 values of consecutive sensors, int16_t little endian in
+ *     1/16 degrees of Celsius, CANEXPORT_NO_VALUE if the read failed
+ * The frame length tells the number of values.
+ *
+ * Command frame, ID CANEXPORT_COMMAND_ID(node) or CANEXPORT_BROADCAST_ID:
+ *  0: CANEXPORT_CMD_x
+ *  1..7: arguments
+ * Only command IDs pass the acceptance filter.
+ */
+
+#ifndef CANEXPORT_H_
+#define CANEXPORT_H_
+
+#include "stdint.h"
+#include "samples.h"
+
+#define CANEXPORT_NODE				1
+#define CANEXPORT_DATA_ID(node)		(0x300 + (node))
+#define CANEXPORT_COMMAND_ID(node)	(0x200 + (node))
+#define CANEXPORT_BROADCAST_ID		0x27F
+
+#define CANEXPORT_VALUES			3			/* Values per frame */
+#define CANEXPORT_NO_VALUE			INT16_MIN
+#define CANEXPORT_SENSOR_MASK		0x1F		/* Sensor index bits of byte 1 */
+#define CANEXPORT_BUS_SHIFT			5			/* Bus number position in byte 1 */
+#define CANEXPORT_QUEUE_LENGTH		32			/* Frames, has to be a power of two */
+
+/* Commands */
+#define CANEXPORT_CMD_STOP			0x01		/* Stop sending data frames */
+#define CANEXPORT_CMD_START			0x02		/* Start sending data frames */
+
+/* One CAN frame payload */
+typedef struct _CanExport_Frame {
+	uint8_t iLength;
+	uint8_t iData[8];
+} CanExport_Frame;
+
+/* Called from interrupt for commands not handled by the module */
+typedef void (*CanExport_CommandCallback)(const CanExport_Frame *pFrame);
+
+void CanExport_Init(CanExport_CommandCallback callback);
+int CanExport_Send(const Sample *pSamples, int iCount);
+int CanExport_Enabled(void);
+int CanExport_Idle(void);
+uint32_t CanExport_Dropped(void);
+
+/* Frame coding, no hardware access */
+int CanExport_Pack(CanExport_Frame *pFrame, uint8_t iSequence, const Sample *pSamples, int iCount);
+int CanExport_Unpack(const CanExport_Frame *pFrame, uint8_t *pSequence, Sample *pSamples);
+
+#endif /* CANEXPORT_H_ */
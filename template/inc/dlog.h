@@ -0,0 +1,67 @@
+/*
+ * dlog.h
+ *
+ * Deferred binary logging. A call site stores a message ID and up to
+ * DLOG_MAX_ARGS integer arguments into a lock free buffer, which takes a
+ * few cycles and is safe in any interrupt. DLog_Flush, called from the
+ * main loop, sends the records out:
+ *  - with DLOG_BINARY defined as frames on ITM stimulus port 1, decoded on
+ *    the host by tools/dlog_decode with the format table below,
+ *  - otherwise formatted by printf on the usual port 0.
+ *
+ * Binary frame, little endian 32 bit words:
+ *  0: 0xA5 << 24 | argument count << 16 | message ID
+ *  1: DWT cycle counter at the call
+ *  2..: arguments
+ */
+
+#ifndef DLOG_H_
+#define DLOG_H_
+
+#include "stdint.h"
+
+/* Number of records, has to be a power of two */
+#define DLOG_SIZE				32
+#define DLOG_MAX_ARGS			2
+#define DLOG_ITM_PORT			1
+#define DLOG_FRAME_SYNC			0xA5
+
+/* Message ID and printf format of every message */
+#define DLOG_MESSAGES(X) \
+	X(DLOG_OW_RESET_ERROR,		"1-Wire bus %u: error while reset\n") \
+	X(DLOG_OW_READ_ERROR,		"1-Wire bus %u: error while read\n") \
+	X(DLOG_OW_WRITE_ERROR,		"1-Wire bus %u: error while write\n") \
+	X(DLOG_OW_BLOCK_ERROR,		"1-Wire bus %u: error while block\n") \
+	X(DLOG_OW_NO_DEVICE,		"1-Wire bus %u: no device or bus error\n") \
+	X(DLOG_OW_ROM_BYTE,			"ROM byte %u: %02x\n") \
+	X(DLOG_DS1820_JUMP,			"the temperature changs too much: %d and %d /16\n") \
+	X(DLOG_DS1820_CRC_ERROR,	"CRC is wrong, bus %u\n")
+
+#define DLOG_ENUM(id, format)	id,
+
+typedef enum _DLog_Id {
+	DLOG_NONE = 0,
+	DLOG_MESSAGES(DLOG_ENUM)
+	DLOG_COUNT
+} DLog_Id;
+
+/* One record, 16 bytes */
+typedef struct _DLog_Record {
+	volatile uint16_t iId;		/* DLOG_NONE until the record is complete */
+	uint8_t iArgs;
+	uint8_t iReserved;
+	uint32_t iTime;
+	uint32_t iArg[DLOG_MAX_ARGS];
+} DLog_Record;
+
+#define DLOG0(id)				DLog_Write((id), 0, 0, 0)
+#define DLOG1(id, a)			DLog_Write((id), 1, (uint32_t) (a), 0)
+#define DLOG2(id, a, b)			DLog_Write((id), 2, (uint32_t) (a), (uint32_t) (b))
+
+void DLog_Init(void);
+void DLog_Write(DLog_Id iId, int iArgs, uint32_t iArg0, uint32_t iArg1);
+int DLog_Flush(void);
+uint32_t DLog_Dropped(void);
+const char *DLog_Format(DLog_Id iId);
+
+#endif /* DLOG_H_ */
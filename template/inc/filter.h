@@ -0,0 +1,47 @@
+/*
+ * filter.h
+ *
+ * Per sensor plausibility filter: rate of change rejection, median of the
+ * last N values and exponential moving average. All sensors of a snapshot
+ * are filtered in one pass, two sensors per 32 bit word.
+ */
+
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include "stdint.h"
+
+/* Has to be even, sensors are processed in pairs */
+#define FILTER_MAX_SENSORS		32
+#define FILTER_MEDIAN_MAX		5
+
+/* Result flags */
+#define FILTER_FLAG_REJECTED	0x01	/* Rate limit exceeded, last value used */
+#define FILTER_FLAG_HELD		0x02	/* Input not valid, last value used */
+#define FILTER_FLAG_NO_DATA		0x04	/* No valid input yet, output is 0 */
+
+typedef struct _Filter_Config {
+	uint8_t iMedianLength;		/* 1 (off), 3 or 5 */
+	uint8_t iRejectLimit;		/* Rejections in a row after which a step is accepted, 0 = never */
+	int16_t iMaxRate;			/* Largest change per snapshot in input units, 0 = off */
+	uint16_t iEmaAlpha;			/* Weight of the new value, Q15, 0 or 32768 = off */
+} Filter_Config;
+
+/* Filter state, values are kept as packed pairs of int16_t */
+typedef struct _SensorFilter {
+	Filter_Config stConfig;
+	int iCount;
+	uint8_t iHistoryIndex;
+	uint32_t iHistory[FILTER_MEDIAN_MAX][FILTER_MAX_SENSORS / 2];
+	uint32_t iLast[FILTER_MAX_SENSORS / 2];
+	int32_t iEma[FILTER_MAX_SENSORS];			/* Q15 */
+	uint8_t iRejected[FILTER_MAX_SENSORS];
+	uint8_t bPrimed[FILTER_MAX_SENSORS];
+} SensorFilter;
+
+void Filter_Init(SensorFilter *pFilter, const Filter_Config *pConfig, int iCount);
+void Filter_Reset(SensorFilter *pFilter, int iSensor);
+int Filter_Run(SensorFilter *pFilter, const int32_t *pInput, const uint8_t *pValid,
+		int32_t *pOutput, uint8_t *pFlags);
+
+#endif /* FILTER_H_ */
@@ -0,0 +1,92 @@
+/*
+ * flashlog.h
+ *
+ * Circular sample log in internal flash, keeps the samples while the links
+ * are down. The sectors are filled in turn and the oldest one is erased
+ * for reuse, so all of them wear equally.
+ *
+ * Every sector is split into FLASHLOG_SLOT_SIZE byte slots. Slot 0 holds
+ * the sector header, every other slot one record. Samples are collected in
+ * RAM and programmed a full record at a time. Records fill a sector from
+ * slot 1 up and the first word of a written record is never 0xFFFFFFFF, so
+ * the first free slot is found by a binary search at boot. The sector
+ * after the one being written is erased ahead by FlashLog_Poll.
+ *
+ * Sector header, little endian:
+ *  0: FLASHLOG_MAGIC, written after the erase
+ *  4: erase count of the sector
+ *  8: sector sequence number, 0xFFFFFFFF while the sector is erased
+ * 12: sequence number of the first record
+ *
+ * Record, the record sequence number is that of the first record of the
+ * sector plus slot - 1:
+ *  0: number of samples, written last
+ *  2: CRC16 of the record from offset 4 on (1-Wire CRC16, see owcrc.h)
+ *  4: record sequence number
+ *  8: reserved
+ * 16: FLASHLOG_RECORD_SAMPLES samples as in samples.h
+ */
+
+#ifndef FLASHLOG_H_
+#define FLASHLOG_H_
+
+#include "stdint.h"
+#include "samples.h"
+
+#define FLASHLOG_SLOT_SIZE			128
+#define FLASHLOG_RECORD_SAMPLES		((FLASHLOG_SLOT_SIZE - 16) / sizeof(Sample))
+#define FLASHLOG_MAGIC				0x474F4C46
+#define FLASHLOG_MAX_SECTORS		8
+
+/* Flash sectors 8-10 reserved by stm32f407vg_flash.ld */
+#define FLASHLOG_ADDRESS			0x08080000
+#define FLASHLOG_FIRST_SECTOR		FLASH_Sector_8
+#define FLASHLOG_SECTOR_SIZE		0x20000
+#define FLASHLOG_SECTORS			3
+
+/* Flash access, reads go directly to memory at pBase */
+typedef struct _FlashLog_Medium {
+	const uint32_t *pBase;
+	uint32_t iSectorSize;
+	int iSectors;
+	void (*EraseStart)(int iSector);
+	int (*EraseBusy)(void);				/* 1 while erasing, ends the erase when done */
+	int (*Program)(uint32_t iOffset, uint32_t iWord);	/* Offset from pBase, 1 if done */
+} FlashLog_Medium;
+
+typedef struct _FlashLog_Header {
+	uint32_t iMagic;
+	uint32_t iEraseCount;
+	uint32_t iSequence;
+	uint32_t iFirstRecord;
+} FlashLog_Header;
+
+typedef struct _FlashLog_Record {
+	uint16_t iCount;
+	uint16_t iCRC;
+	uint32_t iSequence;
+	uint32_t iReserved[2];
+	Sample stSample[FLASHLOG_RECORD_SAMPLES];
+} FlashLog_Record;
+
+/* Read position, see FlashLog_Read */
+typedef struct _FlashLog_Cursor {
+	int iSector;				/* -1 if nothing to read */
+	uint32_t iSlot;
+	uint32_t iSectorSequence;
+} FlashLog_Cursor;
+
+/* STM32F407 sectors 8-10 and a RAM stand-in for host tests, see flashlog_ram.c */
+extern const FlashLog_Medium FlashLog_Internal;
+extern const FlashLog_Medium FlashLog_Ram;
+
+int FlashLog_Init(const FlashLog_Medium *pMedium);
+int FlashLog_Append(const Sample *pSamples, int iCount);
+void FlashLog_Poll(void);
+void FlashLog_CursorInit(FlashLog_Cursor *pCursor);
+int FlashLog_Read(FlashLog_Cursor *pCursor, Sample *pSamples, int iMaxSamples);
+uint32_t FlashLog_Dropped(void);
+uint32_t FlashLog_Errors(void);
+uint32_t FlashLog_EraseCount(int iSector);
+
+#endif /* FLASHLOG_H_ */
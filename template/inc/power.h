@@ -0,0 +1,32 @@
+/*
+ * power.h
+ *
+ * Idle policy. Short waits sleep with WFI, the clock and all peripherals
+ * keep running and any interrupt ends the sleep. Long waits with no
+ * transfer in flight use STOP mode, which stops every clock but the RTC,
+ * and the RTC wakeup timer on LSI ends them.
+ */
+
+#ifndef POWER_H_
+#define POWER_H_
+
+#include "stm32f4xx.h"
+#include "stdint.h"
+
+/* Sleep until cond gets false, cond is set from interrupt. Interrupts are
+ * disabled around the check, an interrupt pending at WFI ends it at once. */
+#define POWER_WAIT_WHILE(cond) do { \
+		__disable_irq(); \
+		while (cond) { \
+			__WFI(); \
+			__enable_irq(); \
+			__disable_irq(); \
+		} \
+		__enable_irq(); \
+	} while (0)
+
+void Power_Init(void);
+void Power_Sleep(uint32_t len);
+uint32_t Power_Stop(uint32_t ms);
+
+#endif /* POWER_H_ */
@@ -0,0 +1,45 @@
+/*
+ * registry.h
+ *
+ * Persistent registry of the 1-Wire sensors, kept in flash sector 11 so the
+ * bus does not have to be enumerated on every boot.
+ */
+
+#ifndef REGISTRY_H_
+#define REGISTRY_H_
+
+#include "stdint.h"
+#include "OneWire.h"
+
+#define REGISTRY_MAX_DEVICES	32
+
+/* Flash sector reserved for the registry by stm32f407vg_flash.ld */
+#define REGISTRY_SECTOR			FLASH_Sector_11
+#define REGISTRY_ADDRESS		0x080E0000
+#define REGISTRY_MAGIC			0x52474931
+#define REGISTRY_VERSION		1
+#define REGISTRY_NO_SLOT		0xFF
+
+/* One registered sensor, stored in flash */
+typedef struct _Registry_Device {
+	uint64_t iROM;
+	uint8_t iFamily;
+	uint8_t iResolution;		/* Bits, 0 if not configured */
+	uint8_t iPowerType;			/* DS1820_PARASITE_POWER, DS1820_EXTERNAL_POWER or 0 */
+	uint8_t iSlot;				/* User slot index, stable across rebuilds */
+	uint8_t bPresent;			/* Found at boot, not stored */
+	uint8_t iReserved[3];
+} Registry_Device;
+
+int Registry_Init(OW_Bus *pBus);
+int Registry_Load(void);
+int Registry_Validate(OW_Bus *pBus);
+int Registry_Rebuild(OW_Bus *pBus);
+int Registry_Save(void);
+int Registry_Update(const uint64_t *ROMs, int iCount);
+int Registry_Count(void);
+Registry_Device *Registry_Get(int i);
+Registry_Device *Registry_Find(uint64_t iROM);
+int Registry_Addresses(uint64_t *Addresses, int iMaxDevices);
+
+#endif /* REGISTRY_H_ */
@@ -0,0 +1,52 @@
+/*
+ * samples.h
+ *
+ * Single producer, single consumer ring of timestamped sensor samples.
+ * The producer (usually a 1-Wire completion interrupt) and the consumer
+ * (main loop: logging, telemetry) share no lock, each index is written by
+ * one side only.
+ */
+
+#ifndef SAMPLES_H_
+#define SAMPLES_H_
+
+#include "stdint.h"
+
+/* Number of samples, has to be a power of two */
+#define SAMPLE_RING_SIZE		64
+
+/* Sample flags */
+#define SAMPLE_FLAG_ALARM		0x01	/* Sensor answered the alarm search */
+#define SAMPLE_FLAG_REJECTED	0x02	/* Implausible reading replaced by the filter */
+#define SAMPLE_FLAG_HELD		0x04	/* Read failed, value repeated by the filter */
+
+/* One sample, 16 bytes */
+typedef struct _Sample {
+	uint8_t iSensor;			/* Sensor index within the bus */
+	uint8_t iBus;				/* OW_BUS_USARTx */
+	uint8_t iStatus;			/* OW_TrStatus of the read */
+	uint8_t iFlags;				/* SAMPLE_FLAG_x */
+	int32_t iValue;				/* 1/16 degrees of Celsius for thermometers */
+	uint32_t iTimestamp;		/* Acquisition time in ms */
+	uint32_t iSequence;			/* Snapshot number */
+} Sample;
+
+typedef struct _SampleRing {
+	volatile uint32_t iHead;	/* Written by the producer only */
+	volatile uint32_t iTail;	/* Written by the consumer only */
+	volatile uint32_t iDropped;	/* Samples lost because the ring was full */
+	Sample stSample[SAMPLE_RING_SIZE];
+} SampleRing;
+
+void SampleRing_Init(SampleRing *pRing);
+
+/* Producer side */
+int SampleRing_Push(SampleRing *pRing, const Sample *pSample);
+
+/* Consumer side */
+int SampleRing_Count(SampleRing *pRing);
+int SampleRing_Read(SampleRing *pRing, Sample *pSamples, int iMaxSamples);
+int SampleRing_Peek(SampleRing *pRing, const Sample **ppSamples);
+void SampleRing_Release(SampleRing *pRing, int iCount);
+
+#endif /* SAMPLES_H_ */
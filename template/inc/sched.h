@@ -0,0 +1,49 @@
+/*
+ * sched.h
+ *
+ * Cooperative run-to-completion scheduler for the main loop. Tasks are
+ * statically allocated functions that are called with the events posted
+ * to them since their last run and return when done, they never wait.
+ * Events are posted from tasks or interrupts. Of all tasks with events
+ * the one with the lowest priority number runs first, a running task is
+ * never preempted by another task. With nothing to run the idle function
+ * is called.
+ *
+ * Each task counts its runs and the DWT cycles spent in it.
+ */
+
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include "stdint.h"
+#include "swtimer.h"
+
+#define SCHED_MAX_TASKS			8
+#define SCHED_EV_TIMER			0x80000000		/* Posted by Sched_TimerStart */
+
+typedef struct _Sched_Task Sched_Task;
+typedef void (*Sched_Function)(Sched_Task *pTask, uint32_t iEvents);
+
+/* Called with interrupts disabled, has to return after any interrupt */
+typedef void (*Sched_IdleFunction)(void);
+
+struct _Sched_Task {
+	const char *pName;
+	Sched_Function run;
+	uint8_t iPriority;			/* 0 is the highest */
+	uint8_t iIndex;				/* Position in the run order */
+	volatile uint32_t iEvents;	/* Posted, not yet handled */
+	uint32_t iRuns;
+	uint64_t iCycles;			/* Spent in run */
+	uint32_t iMaxCycles;		/* Longest run */
+};
+
+int Sched_Add(Sched_Task *pTask, const char *pName, Sched_Function run, int iPriority);
+void Sched_Post(Sched_Task *pTask, uint32_t iEvents);
+void Sched_TimerStart(SwTimer *pTimer, Sched_Task *pTask, uint32_t iDelay, uint32_t iPeriod);
+int Sched_RunOnce(void);
+void Sched_Run(Sched_IdleFunction idle);
+uint64_t Sched_IdleCycles(void);
+void Sched_Report(void);
+
+#endif /* SCHED_H_ */
@@ -0,0 +1,31 @@
+/*
+ * sdcard.h
+ *
+ * SD card on SDIO, 4 bit bus at 24 MHz. Writes run by DMA2 Stream3 and are
+ * completed by SD_Poll, reads are polled and meant for startup only.
+ * Pins: PC8-PC11 D0-D3, PC12 CK, PD2 CMD.
+ */
+
+#ifndef SDCARD_H_
+#define SDCARD_H_
+
+#include "stdint.h"
+
+#define SD_BLOCK_SIZE		512
+
+typedef enum _SD_State {
+	SD_OK = 0,
+	SD_BUSY,
+	SD_ERROR,
+	SD_TIMEOUT,
+	SD_CRC_ERROR,
+	SD_NO_CARD
+} SD_State;
+
+SD_State SD_Init(void);
+uint32_t SD_BlockCount(void);
+SD_State SD_ReadBlock(uint32_t iBlock, uint32_t *pBuffer);
+SD_State SD_WriteBlocks_As(uint32_t iBlock, const uint32_t *pBuffer, int iCount);
+SD_State SD_Poll(void);
+
+#endif /* SDCARD_H_ */
@@ -0,0 +1,55 @@
+/*
+ * sdlog.h
+ *
+ * Sample log on a raw SD card area. Samples are collected into 512 byte
+ * blocks, SDLOG_BUFFER_BLOCKS blocks form one buffer and go to the card by
+ * one DMA multi block write while the other buffer is being filled. The
+ * area is used as a ring, the newest data overwrites the oldest.
+ *
+ * The area is the first partition of type SDLOG_PARTITION_TYPE in the MBR.
+ * A card with other partitions or with a file system in block 0 is not
+ * touched. A card without either is taken as a whole from
+ * SDLOG_FIRST_BLOCK.
+ *
+ * Block layout, little endian:
+ *  0: SDLOG_MAGIC
+ *  4: block sequence number, counts from the first block ever written
+ *  8: number of samples
+ * 10: CRC16 of the block with this field 0 (1-Wire CRC16, see owcrc.h)
+ * 12: reserved
+ * 16: SDLOG_BLOCK_SAMPLES samples as in samples.h
+ */
+
+#ifndef SDLOG_H_
+#define SDLOG_H_
+
+#include "stdint.h"
+#include "samples.h"
+#include "sdcard.h"
+
+/* Log area on a card without partition table, the first MiB is left
+ * free */
+#define SDLOG_FIRST_BLOCK		2048
+/* Non-FS data, e.g. "sfdisk --part-type /dev/sdX 1 da" */
+#define SDLOG_PARTITION_TYPE	0xDA
+#define SDLOG_BUFFER_BLOCKS		4
+#define SDLOG_MAGIC				0x474F4C53
+#define SDLOG_BLOCK_SAMPLES		((SD_BLOCK_SIZE - 16) / sizeof(Sample))
+
+typedef struct _SdLog_Block {
+	uint32_t iMagic;
+	uint32_t iSequence;
+	uint16_t iCount;
+	uint16_t iCRC;
+	uint32_t iReserved;
+	Sample stSample[SDLOG_BLOCK_SAMPLES];
+} SdLog_Block;
+
+SD_State SdLog_Init(void);
+int SdLog_Write(const Sample *pSamples, int iCount);
+void SdLog_Poll(void);
+int SdLog_Idle(void);
+uint32_t SdLog_Dropped(void);
+uint32_t SdLog_Errors(void);
+
+#endif /* SDLOG_H_ */
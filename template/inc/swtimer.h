@@ -0,0 +1,35 @@
+/*
+ * swtimer.h
+ *
+ * One-shot and periodic software timers on the microsecond clock of
+ * timer_delay.c. Active timers are kept sorted by deadline and the clock
+ * compare interrupt is set to the first one, so nothing runs between
+ * deadlines. Callbacks run from that interrupt and may start or stop
+ * timers, including their own.
+ */
+
+#ifndef SWTIMER_H_
+#define SWTIMER_H_
+
+#include "stdint.h"
+
+typedef struct _SwTimer SwTimer;
+typedef void (*SwTimerCallback)(SwTimer *pTimer);
+
+struct _SwTimer {
+	uint32_t iDeadline;			/* Time_us of the next expiry */
+	uint32_t iPeriod;			/* Microseconds, 0 for one-shot */
+	SwTimerCallback callback;
+	void *pContext;				/* For the callback */
+	SwTimer *pNext;
+	volatile uint8_t bActive;
+};
+
+/* Delays and periods have to stay below 2^31 us, about 35 minutes */
+void SwTimer_Start(SwTimer *pTimer, uint32_t iDelay, uint32_t iPeriod, SwTimerCallback callback, void *pContext);
+void SwTimer_Stop(SwTimer *pTimer);
+int SwTimer_Active(const SwTimer *pTimer);
+int SwTimer_NextDeadline(uint32_t *pDeadline);
+void SwTimer_Run(void);
+
+#endif /* SWTIMER_H_ */
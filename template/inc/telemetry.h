@@ -0,0 +1,44 @@
+/*
+ * telemetry.h
+ *
+ * Binary sample telemetry on USART2 TX (PA2), sent by DMA1 Stream6 from two
+ * frame buffers: one is on the wire while the next batch is encoded into
+ * the other.
+ *
+ * Frame payload, little endian:
+ *  0: TELEMETRY_TYPE_SAMPLES
+ *  1: number of samples
+ *  2: frame sequence number, 16 bit
+ *  4: samples, 16 bytes each as in samples.h
+ *  n: CRC16 of the bytes before (1-Wire CRC16, see owcrc.h), 16 bit
+ * The payload is COBS encoded and ends with a 0 byte, so a receiver syncs
+ * on the next 0 after any error. Telemetry_FrameParse decodes frames and is
+ * free of hardware access, the same file builds on the host.
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include "stdint.h"
+#include "samples.h"
+
+#define TELEMETRY_BAUDRATE			460800
+#define TELEMETRY_BATCH				16			/* Samples per frame */
+#define TELEMETRY_TYPE_SAMPLES		0x01
+
+#define TELEMETRY_HEADER_LENGTH		4
+#define TELEMETRY_PAYLOAD_MAX		(TELEMETRY_HEADER_LENGTH + TELEMETRY_BATCH * sizeof(Sample) + 2)
+/* COBS adds one byte per 254 and the delimiter */
+#define TELEMETRY_FRAME_MAX			(TELEMETRY_PAYLOAD_MAX + TELEMETRY_PAYLOAD_MAX / 254 + 2)
+
+void Telemetry_Init(void);
+int Telemetry_Send(const Sample *pSamples, int iCount);
+int Telemetry_Idle(void);
+uint32_t Telemetry_Frames(void);
+
+/* Frame coding, no hardware access */
+int Telemetry_FrameBuild(uint8_t *pFrame, uint16_t iSequence, const Sample *pSamples, int iCount);
+int Telemetry_FrameParse(const uint8_t *pFrame, int iLength, uint16_t *pSequence,
+		Sample *pSamples, int iMaxSamples);
+
+#endif /* TELEMETRY_H_ */
@@ -8,7 +8,19 @@
 #ifndef TIMER_DELAY_H_
 #define TIMER_DELAY_H_
 
+#include "stdint.h"
+
 void TIM_Delay_Init(void);
+uint32_t Time_us(void);
+uint64_t Time_us64(void);
+uint32_t Time_ms(void);
+void Delay_Cycles(uint32_t cycles);
+void Delay_us(uint32_t len);
 void Delay_ms(int len);
+void Time_Skip(uint32_t len);
+
+/* Compare interrupt of the clock, used by swtimer.c */
+void Time_AlarmSet(uint32_t at);
+void Time_AlarmCancel(void);
 
 #endif /* TIMER_DELAY_H_ */
@@ -0,0 +1,45 @@
+/**
+ *******************************************************************************
+ * @file    ds18temp.h
+ * @brief   Fixed-point temperature decoding of 1-Wire thermometers.
+ *
+ * @section info Additional Information
+ *          Temperatures are signed integers in 1/16 degrees of Celsius, the
+ *          native resolution of all supported families:
+ *              - 0x10 DS18S20, extended resolution from COUNT_REMAIN.
+ *              - 0x22 DS1822 and 0x28 DS18B20, undefined low bits of 9 to
+ *                11 bit resolution cleared.
+ *              - 0x3B MAX31850, 0.25 degree resolution, fault bit checked.
+ *          Unknown family code 0 is decoded as DS18B20.
+ *******************************************************************************
+ */
+
+#ifndef DS18TEMP_H
+#define DS18TEMP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdint.h"
+
+#define DS18_FAMILY_DS18S20     0x10
+#define DS18_FAMILY_DS1822      0x22
+#define DS18_FAMILY_DS18B20     0x28
+#define DS18_FAMILY_MAX31850    0x3B
+
+    /* Power-on value of the temperature register, 85 degrees */
+#define DS18_TEMP16_POWER_ON    (85 * 16)
+
+    /* Conversions from 1/16 degrees, rounding toward zero */
+#define DS18_TEMP16_TO_MILLI(t) ((int32_t) (t) * 625 / 10)
+#define DS18_TEMP16_TO_TENTHS(t) ((int32_t) (t) * 10 / 16)
+
+    int ds18_decode(uint8_t iFamilyCode, const uint8_t *pScratchpad, int32_t *pTemp16);
+    int ds18_supported(uint8_t iFamilyCode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DS18TEMP_H */
@@ -0,0 +1,105 @@
+/**
+ *******************************************************************************
+ * @file    owcrc.h
+ * @brief   Dallas/Maxim 1-Wire CRC8 and CRC16 shared by both 1-Wire stacks.
+ *
+ * @section info Additional Information
+ *          CRC8 is the ROM and scratchpad CRC (X^8 + X^5 + X^4 + 1), CRC16 the
+ *          memory page CRC (X^16 + X^15 + X^2 + 1), both LSB first and
+ *          starting from 0. Checking data followed by its CRC gives 0, CRC16
+ *          of 1-Wire pages is stored inverted and gives 0xB001.
+ *
+ *          Variants selected at compile time:
+ *              - table: one 256 entry lookup per byte, 768 bytes of tables.
+ *              - nibble: two 16 entry lookups per byte, 96 bytes of tables.
+ *              - slice: table plus slice-by-4 block functions, four
+ *                independent lookups per 4 bytes, 3072 bytes of tables.
+ *                Pays off on EEPROM pages, a 9 byte scratchpad gains little.
+ *
+ *          With CRC_USE_CCM the tables live in CCM RAM, which has no flash
+ *          wait states and is not shared with the DMA transfers on the bus
+ *          matrix. crc_benchmark measures both functions with the DWT cycle
+ *          counter.
+ *******************************************************************************
+ */
+
+#ifndef OWCRC_H
+#define OWCRC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdint.h"
+
+    /* Full 256 entry tables, define CRC_USE_NIBBLE for 16 entry nibble tables */
+#ifndef CRC_USE_NIBBLE
+#define CRC_USE_TABLE   1
+#endif
+    /* Slice-by-4 block functions, needs CRC_USE_TABLE */
+//#define CRC_USE_SLICE   1
+    /* Tables in CCM RAM, define CRC_NO_CCM to keep them in flash */
+#ifndef CRC_NO_CCM
+#define CRC_USE_CCM     1
+#endif
+    /* Include crc_benchmark, the periodic task report prints its result */
+//#define CRC_BENCHMARK   1
+
+#ifdef CRC_USE_CCM
+#define CRC_FAST_DATA   const __attribute__((section(".ccmram")))
+#else
+#define CRC_FAST_DATA   const
+#endif
+
+#ifdef CRC_USE_TABLE
+    extern CRC_FAST_DATA uint8_t crc8_table[256];
+    extern CRC_FAST_DATA uint16_t crc16_table[256];
+#ifdef CRC_USE_SLICE
+    extern CRC_FAST_DATA uint8_t crc8_slice[3][256];
+    extern CRC_FAST_DATA uint16_t crc16_slice[3][256];
+#endif
+#else
+    extern CRC_FAST_DATA uint8_t crc8_nibble[2][16];
+    extern CRC_FAST_DATA uint16_t crc16_nibble[2][16];
+#endif
+
+    /**
+     * Add one byte to CRC8.
+     */
+    static inline uint8_t crc8_byte(uint8_t crc, uint8_t data) {
+        uint8_t x = crc ^ data;
+#ifdef CRC_USE_TABLE
+        return crc8_table[x];
+#else
+        return crc8_nibble[0][x & 0x0F] ^ crc8_nibble[1][x >> 4];
+#endif
+    }
+
+    /**
+     * Add one byte to CRC16.
+     */
+    static inline uint16_t crc16_byte(uint16_t crc, uint8_t data) {
+        uint8_t x = (uint8_t) crc ^ data;
+#ifdef CRC_USE_TABLE
+        return (crc >> 8) ^ crc16_table[x];
+#else
+        return (crc >> 8) ^ crc16_nibble[0][x & 0x0F] ^ crc16_nibble[1][x >> 4];
+#endif
+    }
+
+    uint8_t crc8_block(uint8_t crc, const void *pData, int iLength);
+    uint16_t crc16_block(uint16_t crc, const void *pData, int iLength);
+
+#if defined(CRC_USE_SLICE) && !defined(CRC_USE_TABLE)
+#error "CRC_USE_SLICE needs CRC_USE_TABLE"
+#endif
+
+#ifdef CRC_BENCHMARK
+    void crc_benchmark(uint32_t *pCycles8, uint32_t *pCycles16);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OWCRC_H */
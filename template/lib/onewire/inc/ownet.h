@@ -55,6 +55,8 @@
 
 #ifdef __STM32__
 	#define SMALL_MEMORY_TARGET
+	// one port per USART listed in stm32_ow.h
+	#define MAX_PORTNUM 2
 #endif
 
 #ifdef __MC68K__
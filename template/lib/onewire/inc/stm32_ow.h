@@ -10,11 +10,10 @@
 
 #include "stm32f4xx.h"
 
+// port 0
 #define OW0_USART						USART1
 #define OW0_USART_INIT_CLK				RCC_APB2PeriphClockCmd
 #define OW0_USART_CLK					RCC_APB2Periph_USART1
-#define OW0_USART_RESET_BAUD_RATE		9600
-#define OW0_USART_IO_BAUD_RATE			115200
 
 #define OW0_GPIO						GPIOB
 #define OW0_GPIO_INIT_CLK				RCC_AHB1PeriphClockCmd
@@ -23,6 +22,48 @@
 #define OW0_GPIO_PinSource				GPIO_PinSource6
 #define OW0_GPIO_AF					GPIO_AF_USART1
 
+// port 1
+#define OW1_USART						USART6
+#define OW1_USART_INIT_CLK				RCC_APB2PeriphClockCmd
+#define OW1_USART_CLK					RCC_APB2Periph_USART6
 
+#define OW1_GPIO						GPIOC
+#define OW1_GPIO_INIT_CLK				RCC_AHB1PeriphClockCmd
+#define OW1_GPIO_CLK					RCC_AHB1Periph_GPIOC
+#define OW1_GPIO_Pin					GPIO_Pin_6
+#define OW1_GPIO_PinSource				GPIO_PinSource6
+#define OW1_GPIO_AF					GPIO_AF_USART6
+
+// common to all ports
+#define OW_USART_RESET_BAUD_RATE		9600
+#define OW_USART_IO_BAUD_RATE			115200
+#define OW_USART_OD_RESET_BAUD_RATE		66000
+#define OW_USART_OD_IO_BAUD_RATE		1000000
+
+// hardware of one port, indexed by portnum
+typedef struct {
+	USART_TypeDef *usart;
+	void (*usart_init_clk)(uint32_t, FunctionalState);
+	uint32_t usart_clk;
+	GPIO_TypeDef *gpio;
+	void (*gpio_init_clk)(uint32_t, FunctionalState);
+	uint32_t gpio_clk;
+	uint16_t gpio_pin;
+	uint8_t gpio_pin_source;
+	uint8_t gpio_af;
+} OW_PortDef;
+
+// run time state of one port, BRR backups are indexed by speed
+typedef struct {
+	uint16_t brr_reset[2];	// BRR backup for the reset pulse
+	uint16_t brr_io[2];		// BRR backup for the time slots
+	SMALLINT speed;			// MODE_NORMAL or MODE_OVERDRIVE
+} OW_PortState;
+
+extern const OW_PortDef ow_port[MAX_PORTNUM];
+extern OW_PortState ow_port_state[MAX_PORTNUM];
+
+// TRUE if portnum is a configured port
+#define OW_PORT_VALID(portnum)			((portnum) >= 0 && (portnum) < MAX_PORTNUM)
 
 #endif /* STM32_OW_H_ */
@@ -0,0 +1,81 @@
+/**
+ *******************************************************************************
+ * @file    ds18temp.c
+ * @brief   Fixed-point temperature decoding of 1-Wire thermometers.
+ *******************************************************************************
+ */
+
+#include "ds18temp.h"
+
+/* Scratchpad layout */
+#define SPAD_TEMP_LSB       0
+#define SPAD_TEMP_MSB       1
+#define SPAD_CONFIG         4
+#define SPAD_COUNT_REMAIN   6
+#define SPAD_COUNT_PER_C    7
+
+/* MAX31850 fault flag in the temperature LSB */
+#define MAX31850_FAULT      0x01
+
+/**
+ * Decode temperature from scratchpad.
+ * @param iFamilyCode Family code of the device, low byte of its ROM.
+ * @param pScratchpad Scratchpad read from the device, CRC already checked.
+ * @param pTemp16 Temperature in 1/16 degrees of Celsius.
+ * @return 1 if decoded, 0 for unknown family, DS18S20 without valid count
+ * per degree or MAX31850 fault.
+ */
+int ds18_decode(uint8_t iFamilyCode, const uint8_t *pScratchpad, int32_t *pTemp16) {
+    int16_t iRaw = (int16_t) (pScratchpad[SPAD_TEMP_LSB] | (pScratchpad[SPAD_TEMP_MSB] << 8));
+    int32_t iCountPerC;
+
+    switch (iFamilyCode) {
+        case DS18_FAMILY_DS18S20:
+            /* T = TEMP_READ - 0.25 + (COUNT_PER_C - COUNT_REMAIN) / COUNT_PER_C,
+             * TEMP_READ is the 0.5 degree value with the 0.5 bit truncated */
+            iCountPerC = pScratchpad[SPAD_COUNT_PER_C];
+            if (iCountPerC == 0)
+                return 0;
+            *pTemp16 = (int32_t) (iRaw >> 1) * 16 - 4
+                    + (iCountPerC - pScratchpad[SPAD_COUNT_REMAIN]) * 16 / iCountPerC;
+            return 1;
+
+        case 0:
+        case DS18_FAMILY_DS1822:
+        case DS18_FAMILY_DS18B20:
+            /* Bits below the configured resolution are undefined */
+            switch ((pScratchpad[SPAD_CONFIG] >> 5) & 0x03) {
+                case 0:
+                    iRaw &= ~7;
+                    break;
+                case 1:
+                    iRaw &= ~3;
+                    break;
+                case 2:
+                    iRaw &= ~1;
+                    break;
+            }
+            *pTemp16 = iRaw;
+            return 1;
+
+        case DS18_FAMILY_MAX31850:
+            if (pScratchpad[SPAD_TEMP_LSB] & MAX31850_FAULT)
+                return 0;
+            /* 14 bit value in 0.25 degrees starting at bit 2 */
+            *pTemp16 = iRaw & ~3;
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Check for a thermometer, other families share the bus, e.g. DS2431.
+ * @param iFamilyCode Family code of the device, low byte of its ROM.
+ * @return 1 if ds18_decode supports the family.
+ */
+int ds18_supported(uint8_t iFamilyCode) {
+    return iFamilyCode == DS18_FAMILY_DS18S20 || iFamilyCode == DS18_FAMILY_DS1822
+            || iFamilyCode == DS18_FAMILY_DS18B20 || iFamilyCode == DS18_FAMILY_MAX31850;
+}
@@ -67,33 +67,33 @@ long msGettick(void);
 //
 SMALLINT owTouchReset(int portnum)
 {
-	if(portnum == 0){
-		USART_Cmd(OW0_USART, DISABLE);
-		USART_InitTypeDef USART_InitStructure;
-		USART_InitStructure.USART_BaudRate = OW0_USART_RESET_BAUD_RATE;
-		USART_InitStructure.USART_HardwareFlowControl = USART_HardwareFlowControl_None;
-		USART_InitStructure.USART_Mode = USART_Mode_Rx | USART_Mode_Tx;
-		USART_InitStructure.USART_Parity = USART_Parity_No;
-		USART_InitStructure.USART_StopBits = USART_StopBits_1;
-		USART_InitStructure.USART_WordLength = USART_WordLength_8b;
-		USART_Init(OW0_USART, &USART_InitStructure);
-		USART_Cmd(OW0_USART, ENABLE);
+	if(OW_PORT_VALID(portnum)){
+		USART_TypeDef *usart = ow_port[portnum].usart;
+		OW_PortState *state = &ow_port_state[portnum];
 
-		USART_ClearFlag(OW0_USART, USART_FLAG_RXNE);
-		USART_SendData(OW0_USART, 0xF0);
+		// switch to reset speed using the BRR backups taken in owAcquire,
+		// the reset is sent at the current speed
+		USART_Cmd(usart, DISABLE);
+		usart->BRR = state->brr_reset[state->speed];
+		USART_Cmd(usart, ENABLE);
+
+		USART_ClearFlag(usart, USART_FLAG_RXNE);
+		USART_SendData(usart, 0xF0);
 		volatile int t = 10000000;
-		while(!USART_GetFlagStatus(OW0_USART, USART_FLAG_RXNE) && t>0)
+		while(!USART_GetFlagStatus(usart, USART_FLAG_RXNE) && t>0)
 			t--;//To prevent dead loop
 
-		USART_Cmd(OW0_USART, DISABLE);
-		USART_InitStructure.USART_BaudRate = OW0_USART_IO_BAUD_RATE;
-		USART_Init(OW0_USART, &USART_InitStructure);
-		USART_Cmd(OW0_USART, ENABLE);
+		SMALLINT present = (t > 0 && USART_ReceiveData(usart) != 0xF0);
 
-		if(t > 0 && USART_ReceiveData(OW0_USART) != 0xF0)
-			return TRUE;
-		else
-			return FALSE;
+		// nobody answered overdrive reset, devices are back at normal speed
+		if(!present)
+			state->speed = MODE_NORMAL;
+
+		USART_Cmd(usart, DISABLE);
+		usart->BRR = state->brr_io[state->speed];
+		USART_Cmd(usart, ENABLE);
+
+		return present ? TRUE : FALSE;
 	}else{
 		return FALSE;
 	}
@@ -114,18 +114,20 @@ SMALLINT owTouchReset(int portnum)
 //
 SMALLINT owTouchBit(int portnum, SMALLINT sendbit)
 {
-	if(portnum == 0){
-		USART_ClearFlag(OW0_USART, USART_FLAG_RXNE);
+	if(OW_PORT_VALID(portnum)){
+		USART_TypeDef *usart = ow_port[portnum].usart;
+
+		USART_ClearFlag(usart, USART_FLAG_RXNE);
 		if(sendbit&0x01){
-			USART_SendData(OW0_USART, 0xFF);
+			USART_SendData(usart, 0xFF);
 		}else{
-			USART_SendData(OW0_USART, 0x00);
+			USART_SendData(usart, 0x00);
 		}
 		volatile int t = 1000000;
-		while(!USART_GetFlagStatus(OW0_USART, USART_FLAG_RXNE) && t > 0)
+		while(!USART_GetFlagStatus(usart, USART_FLAG_RXNE) && t > 0)
 			t--;//To prevent dead loop
 
-		if(USART_ReceiveData(OW0_USART) == 0xFF)
+		if(USART_ReceiveData(usart) == 0xFF)
 			return 1;
 		else
 			return 0;
@@ -149,7 +151,7 @@ SMALLINT owTouchBit(int portnum, SMALLINT sendbit)
 SMALLINT owTouchByte(int portnum, SMALLINT sendbyte)
 {
 	int i;
-	if(portnum == 0){
+	if(OW_PORT_VALID(portnum)){
 		SMALLINT ret = 0;
 		for(i = 0; i<8; ++i)
 		{
@@ -206,8 +208,19 @@ SMALLINT owReadByte(int portnum)
 //
 SMALLINT owSpeed(int portnum, SMALLINT new_speed)
 {
-	// add platform specific code here
-	return 0;
+	if(OW_PORT_VALID(portnum)){
+		OW_PortState *state = &ow_port_state[portnum];
+
+		state->speed = (new_speed == MODE_OVERDRIVE) ? MODE_OVERDRIVE : MODE_NORMAL;
+
+		// wait for the last slot before changing the baud rate
+		while(!USART_GetFlagStatus(ow_port[portnum].usart, USART_FLAG_TC));
+		ow_port[portnum].usart->BRR = state->brr_io[state->speed];
+
+		return state->speed;
+	}else{
+		return MODE_NORMAL;
+	}
 }
 
 //--------------------------------------------------------------------------
@@ -258,10 +271,10 @@ void msDelay(int len)
 //--------------------------------------------------------------------------
 // Get the current millisecond tick count.  Does not have to represent
 // an actual time, it just needs to be an incrementing timer.
+// Milliseconds since TIM_Delay_Init, see timer_delay.c.
 //
 long msGettick(void)
 {
-	static long t = 0;
-	return t++;
+	return (long)Time_ms();
 }
 
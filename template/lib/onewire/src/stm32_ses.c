@@ -41,6 +41,16 @@
 SMALLINT owAcquire(int, char *);
 void owRelease(int);
 
+// hardware of every port, see stm32_ow.h
+const OW_PortDef ow_port[MAX_PORTNUM] = {
+	{ OW0_USART, OW0_USART_INIT_CLK, OW0_USART_CLK,
+	  OW0_GPIO, OW0_GPIO_INIT_CLK, OW0_GPIO_CLK, OW0_GPIO_Pin, OW0_GPIO_PinSource, OW0_GPIO_AF },
+	{ OW1_USART, OW1_USART_INIT_CLK, OW1_USART_CLK,
+	  OW1_GPIO, OW1_GPIO_INIT_CLK, OW1_GPIO_CLK, OW1_GPIO_Pin, OW1_GPIO_PinSource, OW1_GPIO_AF },
+};
+
+OW_PortState ow_port_state[MAX_PORTNUM];
+
 //---------------------------------------------------------------------------
 // Attempt to acquire a 1-Wire net
 //
@@ -55,31 +65,48 @@ SMALLINT owAcquire(int portnum, char *port_zstr)
 	RCC_APB2PeriphClockCmd(RCC_APB2Periph_SYSCFG, ENABLE);
 	TIM_Delay_Init();
 
-	if(portnum == 0){
-		OW0_GPIO_INIT_CLK(OW0_GPIO_CLK, ENABLE);
-		OW0_USART_INIT_CLK(OW0_USART_CLK, ENABLE);
+	if(OW_PORT_VALID(portnum)){
+		const OW_PortDef *port = &ow_port[portnum];
+
+		port->gpio_init_clk(port->gpio_clk, ENABLE);
+		port->usart_init_clk(port->usart_clk, ENABLE);
 
-		GPIO_PinAFConfig(OW0_GPIO, OW0_GPIO_PinSource, OW0_GPIO_AF);
+		GPIO_PinAFConfig(port->gpio, port->gpio_pin_source, port->gpio_af);
 
 		GPIO_InitTypeDef GPIO_InitStructure;
 		GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF;
 		GPIO_InitStructure.GPIO_OType = GPIO_OType_OD;
-		GPIO_InitStructure.GPIO_Pin = OW0_GPIO_Pin;
+		GPIO_InitStructure.GPIO_Pin = port->gpio_pin;
 		GPIO_InitStructure.GPIO_PuPd = GPIO_PuPd_UP;
 		GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
-		GPIO_Init(OW0_GPIO, &GPIO_InitStructure);
+		GPIO_Init(port->gpio, &GPIO_InitStructure);
 
 		USART_InitTypeDef USART_InitStructure;
-		USART_InitStructure.USART_BaudRate = OW0_USART_IO_BAUD_RATE;
+		USART_InitStructure.USART_BaudRate = OW_USART_RESET_BAUD_RATE;
 		USART_InitStructure.USART_HardwareFlowControl = USART_HardwareFlowControl_None;
 		USART_InitStructure.USART_Mode = USART_Mode_Rx | USART_Mode_Tx;
 		USART_InitStructure.USART_Parity = USART_Parity_No;
 		USART_InitStructure.USART_StopBits = USART_StopBits_1;
 		USART_InitStructure.USART_WordLength = USART_WordLength_8b;
-		USART_Init(OW0_USART, &USART_InitStructure);
-		USART_HalfDuplexCmd(OW0_USART, ENABLE);
+		USART_Init(port->usart, &USART_InitStructure);
+		ow_port_state[portnum].brr_reset[MODE_NORMAL] = port->usart->BRR;
+
+		USART_InitStructure.USART_BaudRate = OW_USART_OD_RESET_BAUD_RATE;
+		USART_Init(port->usart, &USART_InitStructure);
+		ow_port_state[portnum].brr_reset[MODE_OVERDRIVE] = port->usart->BRR;
+
+		USART_InitStructure.USART_BaudRate = OW_USART_OD_IO_BAUD_RATE;
+		USART_Init(port->usart, &USART_InitStructure);
+		ow_port_state[portnum].brr_io[MODE_OVERDRIVE] = port->usart->BRR;
+
+		// normal time slot speed is left configured
+		USART_InitStructure.USART_BaudRate = OW_USART_IO_BAUD_RATE;
+		USART_Init(port->usart, &USART_InitStructure);
+		ow_port_state[portnum].brr_io[MODE_NORMAL] = port->usart->BRR;
+		ow_port_state[portnum].speed = MODE_NORMAL;
+		USART_HalfDuplexCmd(port->usart, ENABLE);
 
-		USART_Cmd(OW0_USART, ENABLE);
+		USART_Cmd(port->usart, ENABLE);
 
 		return TRUE;
 	}else{
@@ -95,8 +122,8 @@ SMALLINT owAcquire(int portnum, char *port_zstr)
 //
 void owRelease(int portnum)
 {
-	if(portnum == 0){
-		USART_Cmd(OW0_USART, DISABLE);
+	if(OW_PORT_VALID(portnum)){
+		USART_Cmd(ow_port[portnum].usart, DISABLE);
 	}
 }
 
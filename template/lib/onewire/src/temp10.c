@@ -33,6 +33,7 @@
 //
 #include "ownet.h"
 #include "temp10.h"
+#include "ds18temp.h"
 
 //----------------------------------------------------------------------
 // Read the temperature of a DS1920/DS1820
@@ -51,27 +52,47 @@ int ReadTemperature(int portnum, uchar *SerialNum, float *Temp)
 {
    uchar rt=FALSE;
    uchar send_block[30],lastcrc8;
-   int send_cnt, tsht, i, loop=0;
-   float tmp,cr,cpc;
+   int send_cnt, i, loop=0;
+   int32_t t16;
+   SMALLINT parasite;
 
    // set the device serial number to the counter device
    owSerialNum(portnum,SerialNum,FALSE);
 
+   // read power supply, a parasite powered device pulls the read slot low
+   if (!owAccess(portnum) || !owWriteByte(portnum,0xB4))
+      return FALSE;
+   parasite = !owTouchBit(portnum,1);
+
    for (loop = 0; loop < 2; loop ++)
    {
       // access the device
       if (owAccess(portnum))
       {
-         // send the convert command and start power delivery
-         if (!owWriteBytePower(portnum,0x44))
-            return FALSE;
+         if (parasite)
+         {
+            // send the convert command and start power delivery
+            if (!owWriteBytePower(portnum,0x44))
+               return FALSE;
+
+            // sleep for 1 second
+            msDelay(1000);
 
-         // sleep for 1 second
-         msDelay(1000);
+            // turn off the 1-Wire Net strong pull-up
+            if (owLevel(portnum,MODE_NORMAL) != MODE_NORMAL)
+               return FALSE;
+         }
+         else
+         {
+            // send the convert command
+            if (!owWriteByte(portnum,0x44))
+               return FALSE;
 
-         // turn off the 1-Wire Net strong pull-up
-         if (owLevel(portnum,MODE_NORMAL) != MODE_NORMAL)
-            return FALSE;
+            // device reads 0 until the conversion is done, give up
+            // after 1 second
+            for (i = 0; i < 1000 && !owTouchBit(portnum,1); i++)
+               msDelay(1);
+         }
 
          // access the device
          if (owAccess(portnum))
@@ -96,21 +117,13 @@ int ReadTemperature(int portnum, uchar *SerialNum, float *Temp)
                // verify CRC8 is correct
                if (lastcrc8 == 0x00)
                {
-                  // calculate the high-res temperature
-                  tsht = send_block[1]/2;
-                  if (send_block[2] & 0x01)
-                     tsht |= -128;
-                  tmp = (float)(tsht);
-                  cr = send_block[7];
-                  cpc = send_block[8];
-                  if (((cpc - cr) == 1) && (loop == 0))
+                  // calculate the high-res temperature from COUNT_REMAIN
+                  if (((send_block[8] - send_block[7]) == 1) && (loop == 0))
                      continue;
-                  if (cpc == 0)
+                  if (!ds18_decode(DS18_FAMILY_DS18S20,&send_block[1],&t16))
                      return FALSE;
-                  else
-                     tmp = tmp - (float)0.25 + (cpc - cr)/cpc;
 
-                  *Temp = tmp;
+                  *Temp = (float)t16 / 16;
                   // success
                   rt = TRUE;
                   break;
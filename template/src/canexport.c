@@ -0,0 +1,231 @@
+/*
+ * canexport.c
+ *
+ * CAN1 driver of the sample export. Data frames wait in a software queue
+ * and are moved into the three TX mailboxes by CanExport_Send and by the
+ * mailbox empty interrupt. Transmit FIFO priority keeps the mailboxes in
+ * request order, so the sequence numbers arrive in order. The acceptance
+ * filter passes only the command IDs of this node into FIFO 0.
+ */
+
+#include "stm32f4xx.h"
+#include "canexport.h"
+
+#define CANEXPORT_CAN				CAN1
+#define CANEXPORT_CAN_CLOCK			RCC_APB1Periph_CAN1
+#define CANEXPORT_PORT				GPIOD
+#define CANEXPORT_PORT_CLOCK		RCC_AHB1Periph_GPIOD
+#define CANEXPORT_RX_PIN			GPIO_Pin_0
+#define CANEXPORT_RX_SOURCE			GPIO_PinSource0
+#define CANEXPORT_TX_PIN			GPIO_Pin_1
+#define CANEXPORT_TX_SOURCE			GPIO_PinSource1
+#define CANEXPORT_FILTER			0
+#define CANEXPORT_PREPRIO			2
+#define CANEXPORT_SUBPRIO			0
+
+/* 42 MHz APB1 / 12 / (1 + 10 + 3) tq = 250 kbit/s */
+#define CANEXPORT_PRESCALER			12
+
+#define CANEXPORT_QUEUE_MASK		(CANEXPORT_QUEUE_LENGTH - 1)
+
+#if (CANEXPORT_QUEUE_LENGTH & CANEXPORT_QUEUE_MASK) != 0
+#error "CANEXPORT_QUEUE_LENGTH has to be a power of two"
+#endif
+
+static CanExport_Frame Queue[CANEXPORT_QUEUE_LENGTH];
+static volatile uint32_t iHead;		/* Written by CanExport_Send */
+static volatile uint32_t iTail;		/* Written with interrupts disabled */
+static volatile uint32_t iDropped;
+static volatile uint8_t bEnabled = 1;
+static uint8_t iSequence;
+static CanExport_CommandCallback CommandCallback;
+
+/* Fill free mailboxes, interrupts have to be disabled */
+static void CanExport_Kick(void)
+{
+	CanTxMsg stMessage;
+	CanExport_Frame *pFrame;
+	int i;
+
+	stMessage.StdId = CANEXPORT_DATA_ID(CANEXPORT_NODE);
+	stMessage.ExtId = 0;
+	stMessage.IDE = CAN_Id_Standard;
+	stMessage.RTR = CAN_RTR_Data;
+
+	while (iTail != iHead) {
+		pFrame = &Queue[iTail & CANEXPORT_QUEUE_MASK];
+		stMessage.DLC = pFrame->iLength;
+		for (i = 0; i < pFrame->iLength; i++)
+			stMessage.Data[i] = pFrame->iData[i];
+		if (CAN_Transmit(CANEXPORT_CAN, &stMessage) == CAN_TxStatus_NoMailBox)
+			return;
+		iTail++;
+	}
+}
+
+void CanExport_Init(CanExport_CommandCallback callback)
+{
+	GPIO_InitTypeDef GPIO_InitStruct;
+	CAN_InitTypeDef CAN_InitStructure;
+	CAN_FilterInitTypeDef CAN_FilterInitStructure;
+	NVIC_InitTypeDef NVIC_InitStructure;
+
+	CommandCallback = callback;
+
+	RCC_AHB1PeriphClockCmd(CANEXPORT_PORT_CLOCK, ENABLE);
+	RCC_APB1PeriphClockCmd(CANEXPORT_CAN_CLOCK, ENABLE);
+
+	GPIO_PinAFConfig(CANEXPORT_PORT, CANEXPORT_RX_SOURCE, GPIO_AF_CAN1);
+	GPIO_PinAFConfig(CANEXPORT_PORT, CANEXPORT_TX_SOURCE, GPIO_AF_CAN1);
+	GPIO_InitStruct.GPIO_Pin = CANEXPORT_RX_PIN | CANEXPORT_TX_PIN;
+	GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF;
+	GPIO_InitStruct.GPIO_OType = GPIO_OType_PP;
+	GPIO_InitStruct.GPIO_Speed = GPIO_Speed_50MHz;
+	GPIO_InitStruct.GPIO_PuPd = GPIO_PuPd_UP;
+	GPIO_Init(CANEXPORT_PORT, &GPIO_InitStruct);
+
+	CAN_DeInit(CANEXPORT_CAN);
+	CAN_StructInit(&CAN_InitStructure);
+	CAN_InitStructure.CAN_ABOM = ENABLE;
+	CAN_InitStructure.CAN_AWUM = ENABLE;
+	CAN_InitStructure.CAN_TXFP = ENABLE;
+	CAN_InitStructure.CAN_Mode = CAN_Mode_Normal;
+	CAN_InitStructure.CAN_SJW = CAN_SJW_1tq;
+	CAN_InitStructure.CAN_BS1 = CAN_BS1_10tq;
+	CAN_InitStructure.CAN_BS2 = CAN_BS2_3tq;
+	CAN_InitStructure.CAN_Prescaler = CANEXPORT_PRESCALER;
+	CAN_Init(CANEXPORT_CAN, &CAN_InitStructure);
+
+	/* 16 bit list mode, the identifier is in bits 5-15 */
+	CAN_FilterInitStructure.CAN_FilterNumber = CANEXPORT_FILTER;
+	CAN_FilterInitStructure.CAN_FilterMode = CAN_FilterMode_IdList;
+	CAN_FilterInitStructure.CAN_FilterScale = CAN_FilterScale_16bit;
+	CAN_FilterInitStructure.CAN_FilterIdHigh = CANEXPORT_COMMAND_ID(CANEXPORT_NODE) << 5;
+	CAN_FilterInitStructure.CAN_FilterIdLow = CANEXPORT_BROADCAST_ID << 5;
+	CAN_FilterInitStructure.CAN_FilterMaskIdHigh = CANEXPORT_COMMAND_ID(CANEXPORT_NODE) << 5;
+	CAN_FilterInitStructure.CAN_FilterMaskIdLow = CANEXPORT_BROADCAST_ID << 5;
+	CAN_FilterInitStructure.CAN_FilterFIFOAssignment = CAN_Filter_FIFO0;
+	CAN_FilterInitStructure.CAN_FilterActivation = ENABLE;
+	CAN_FilterInit(&CAN_FilterInitStructure);
+
+	CAN_ITConfig(CANEXPORT_CAN, CAN_IT_TME | CAN_IT_FMP0, ENABLE);
+
+	NVIC_InitStructure.NVIC_IRQChannel = CAN1_TX_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = CANEXPORT_PREPRIO;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = CANEXPORT_SUBPRIO;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&NVIC_InitStructure);
+	NVIC_InitStructure.NVIC_IRQChannel = CAN1_RX0_IRQn;
+	NVIC_Init(&NVIC_InitStructure);
+}
+
+/*
+ * Pack samples into data frames and start sending, call from one context
+ * only. Frames that do not fit into the queue are dropped and counted.
+ * Returns number of samples queued.
+ */
+int CanExport_Send(const Sample *pSamples, int iCount)
+{
+	uint32_t iPrimask;
+	int iDone = 0, n;
+
+	if (!bEnabled)
+		return iCount;
+
+	while (iDone < iCount) {
+		if (iHead - iTail >= CANEXPORT_QUEUE_LENGTH) {
+			iDropped++;
+			break;
+		}
+		n = CanExport_Pack(&Queue[iHead & CANEXPORT_QUEUE_MASK], iSequence, &pSamples[iDone], iCount - iDone);
+		iSequence++;
+		iHead++;
+		iDone += n;
+	}
+
+	iPrimask = __get_PRIMASK();
+	__disable_irq();
+	CanExport_Kick();
+	__set_PRIMASK(iPrimask);
+
+	return iDone;
+}
+
+/*
+ * Returns 1 unless stopped by CANEXPORT_CMD_STOP.
+ */
+int CanExport_Enabled(void)
+{
+	return bEnabled;
+}
+
+/*
+ * Returns 1 if all frames are on the bus. Error passive or bus-off means
+ * nobody acknowledges, the frames would be retried forever and keep STOP
+ * mode away. They are aborted and counted as dropped instead.
+ */
+int CanExport_Idle(void)
+{
+	uint32_t iPrimask;
+	uint8_t iMailbox;
+
+	if (CANEXPORT_CAN->ESR & (CAN_ESR_EPVF | CAN_ESR_BOFF)) {
+		iPrimask = __get_PRIMASK();
+		__disable_irq();
+		iDropped += iHead - iTail;
+		iTail = iHead;
+		for (iMailbox = 0; iMailbox < 3; iMailbox++)
+			CAN_CancelTransmit(CANEXPORT_CAN, iMailbox);
+		__set_PRIMASK(iPrimask);
+		/* A frame on the wire ends by itself, mailbox empty wakes WFI */
+		if (CANEXPORT_CAN->ESR & CAN_ESR_BOFF)
+			return 1;
+	}
+	return iTail == iHead && (CANEXPORT_CAN->TSR & CAN_TSR_TME) == CAN_TSR_TME;
+}
+
+/*
+ * Returns number of frames lost because the queue was full or nobody
+ * acknowledged them.
+ */
+uint32_t CanExport_Dropped(void)
+{
+	return iDropped;
+}
+
+void CAN1_TX_IRQHandler(void)
+{
+	/* Clears request completed of all three mailboxes */
+	CAN_ClearITPendingBit(CANEXPORT_CAN, CAN_IT_TME);
+	CanExport_Kick();
+}
+
+void CAN1_RX0_IRQHandler(void)
+{
+	CanRxMsg stMessage;
+	CanExport_Frame stFrame;
+	int i;
+
+	while (CAN_MessagePending(CANEXPORT_CAN, CAN_FIFO0)) {
+		CAN_Receive(CANEXPORT_CAN, CAN_FIFO0, &stMessage);
+		if (stMessage.DLC == 0 || stMessage.RTR != CAN_RTR_Data)
+			continue;
+
+		switch (stMessage.Data[0]) {
+			case CANEXPORT_CMD_STOP:
+				bEnabled = 0;
+				break;
+			case CANEXPORT_CMD_START:
+				bEnabled = 1;
+				break;
+			default:
+				if (!CommandCallback)
+					break;
+				stFrame.iLength = stMessage.DLC;
+				for (i = 0; i < stMessage.DLC && i < 8; i++)
+					stFrame.iData[i] = stMessage.Data[i];
+				CommandCallback(&stFrame);
+				break;
+		}
+	}
+}
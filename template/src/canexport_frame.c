@@ -0,0 +1,73 @@
+/*
+ * canexport_frame.c
+ *
+ * Packing of samples into 8 byte CAN data frames.
+ */
+
+#include "string.h"
+#include "canexport.h"
+#include "DS1820.h"
+
+/* Bus numbers take 3 bits, there are at most 6 buses */
+#if DS1820_SNAPSHOT_MAX_SENSORS > CANEXPORT_SENSOR_MASK + 1
+#error "Sensor index does not fit into byte 1 of the data frame"
+#endif
+
+/*
+ * Pack up to CANEXPORT_VALUES samples of consecutive sensors of one bus.
+ * Returns number of samples used, at least 1 if iCount > 0.
+ */
+int CanExport_Pack(CanExport_Frame *pFrame, uint8_t iSequence, const Sample *pSamples, int iCount)
+{
+	int32_t iValue;
+	int i;
+
+	if (iCount <= 0)
+		return 0;
+
+	pFrame->iData[0] = iSequence;
+	pFrame->iData[1] = (pSamples[0].iBus << CANEXPORT_BUS_SHIFT) | (pSamples[0].iSensor & CANEXPORT_SENSOR_MASK);
+	for (i = 0; i < iCount && i < CANEXPORT_VALUES; i++) {
+		if (i > 0 && (pSamples[i].iSensor != pSamples[0].iSensor + i
+				|| pSamples[i].iBus != pSamples[0].iBus))
+			break;
+
+		iValue = CANEXPORT_NO_VALUE;
+		if (pSamples[i].iStatus == OW_TR_DONE || (pSamples[i].iFlags & SAMPLE_FLAG_HELD)) {
+			/* Valid values never collide with the marker */
+			iValue = pSamples[i].iValue;
+			if (iValue > INT16_MAX)
+				iValue = INT16_MAX;
+			if (iValue <= CANEXPORT_NO_VALUE)
+				iValue = CANEXPORT_NO_VALUE + 1;
+		}
+
+		pFrame->iData[2 + 2 * i] = (uint16_t) iValue;
+		pFrame->iData[3 + 2 * i] = (uint16_t) iValue >> 8;
+	}
+	pFrame->iLength = 2 + 2 * i;
+	return i;
+}
+
+/*
+ * Unpack data frame, sets iSensor, iBus, iValue and iStatus of the samples.
+ * Returns number of samples, -1 if the frame is malformed.
+ */
+int CanExport_Unpack(const CanExport_Frame *pFrame, uint8_t *pSequence, Sample *pSamples)
+{
+	int i, iCount;
+
+	if (pFrame->iLength < 4 || pFrame->iLength > 8 || (pFrame->iLength & 1))
+		return -1;
+
+	iCount = (pFrame->iLength - 2) / 2;
+	*pSequence = pFrame->iData[0];
+	for (i = 0; i < iCount; i++) {
+		memset(&pSamples[i], 0, sizeof(Sample));
+		pSamples[i].iSensor = (pFrame->iData[1] & CANEXPORT_SENSOR_MASK) + i;
+		pSamples[i].iBus = pFrame->iData[1] >> CANEXPORT_BUS_SHIFT;
+		pSamples[i].iValue = (int16_t) (pFrame->iData[2 + 2 * i] | (pFrame->iData[3 + 2 * i] << 8));
+		pSamples[i].iStatus = pSamples[i].iValue == CANEXPORT_NO_VALUE ? OW_TR_FAILED : OW_TR_DONE;
+	}
+	return iCount;
+}
@@ -0,0 +1,138 @@
+/*
+ * dlog.c
+ *
+ * Writers may interrupt each other, so a record is reserved by an
+ * exclusive increment of the reserve index and marked complete by its ID,
+ * written last. The single reader (DLog_Flush) stops at the first
+ * incomplete record. Nothing disables interrupts and nothing waits, a full
+ * buffer drops the record and counts it.
+ */
+
+#include "stm32f4xx.h"
+#include "stdio.h"
+#include "dlog.h"
+
+#define DLOG_MASK			(DLOG_SIZE - 1)
+
+#if (DLOG_SIZE & DLOG_MASK) != 0
+#error "DLOG_SIZE has to be a power of two"
+#endif
+
+#define DLOG_FORMAT(id, format)	format,
+
+static const char *const Formats[DLOG_COUNT] = {
+	"",
+	DLOG_MESSAGES(DLOG_FORMAT)
+};
+
+static DLog_Record Records[DLOG_SIZE];
+static volatile uint32_t iReserve;		/* Next record to be written */
+static volatile uint32_t iTail;			/* Next record to be sent */
+static volatile uint32_t iDropped;
+
+static void DLog_AtomicIncrement(volatile uint32_t *pValue)
+{
+	do {
+	} while (__STREXW(__LDREXW(pValue) + 1, pValue));
+}
+
+/*
+ * Start the cycle counter used for timestamps.
+ */
+void DLog_Init(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/*
+ * Store one message, use the DLOGx macros. Safe from any context.
+ */
+void DLog_Write(DLog_Id iId, int iArgs, uint32_t iArg0, uint32_t iArg1)
+{
+	DLog_Record *pRecord;
+	uint32_t iIndex;
+
+	do {
+		iIndex = __LDREXW(&iReserve);
+		if (iIndex - iTail >= DLOG_SIZE) {
+			__CLREX();
+			DLog_AtomicIncrement(&iDropped);
+			return;
+		}
+	} while (__STREXW(iIndex + 1, &iReserve));
+
+	pRecord = &Records[iIndex & DLOG_MASK];
+	pRecord->iArgs = iArgs;
+	pRecord->iTime = DWT->CYCCNT;
+	pRecord->iArg[0] = iArg0;
+	pRecord->iArg[1] = iArg1;
+	/* Record has to be complete before the reader sees the ID */
+	__DMB();
+	pRecord->iId = iId;
+}
+
+#ifdef DLOG_BINARY
+static void DLog_Send(uint32_t iWord)
+{
+	if (!(ITM->TCR & ITM_TCR_ITMENA_Msk) || !(ITM->TER & (1UL << DLOG_ITM_PORT)))
+		return;
+	while (ITM->PORT[DLOG_ITM_PORT].u32 == 0);
+	ITM->PORT[DLOG_ITM_PORT].u32 = iWord;
+}
+#endif
+
+/*
+ * Send all complete records, call from the main loop only.
+ * Returns number of records sent.
+ */
+int DLog_Flush(void)
+{
+	DLog_Record *pRecord;
+	int iCount = 0;
+	uint16_t iId;
+
+	while (iTail != iReserve) {
+		pRecord = &Records[iTail & DLOG_MASK];
+		iId = pRecord->iId;
+		/* Writer was interrupted before it finished, try next time */
+		if (iId == DLOG_NONE)
+			break;
+		__DMB();
+
+#ifdef DLOG_BINARY
+		{
+			int i;
+
+			DLog_Send((uint32_t) DLOG_FRAME_SYNC << 24 | (uint32_t) pRecord->iArgs << 16 | iId);
+			DLog_Send(pRecord->iTime);
+			for (i = 0; i < pRecord->iArgs; i++)
+				DLog_Send(pRecord->iArg[i]);
+		}
+#else
+		printf(DLog_Format(iId), pRecord->iArg[0], pRecord->iArg[1]);
+#endif
+
+		pRecord->iId = DLOG_NONE;
+		/* Record has to be released before the writers may reuse it */
+		__DMB();
+		iTail++;
+		iCount++;
+	}
+	return iCount;
+}
+
+/*
+ * Returns number of records lost because the buffer was full.
+ */
+uint32_t DLog_Dropped(void)
+{
+	return iDropped;
+}
+
+const char *DLog_Format(DLog_Id iId)
+{
+	if (iId >= DLOG_COUNT)
+		return "";
+	return Formats[iId];
+}
@@ -0,0 +1,209 @@
+/*
+ * filter.c
+ *
+ * Fixed point sensor filter on the Cortex-M4 SIMD instructions. Values are
+ * int16_t, two sensors share one word and every stage handles both halves
+ * at once:
+ *  - compare: __SSUB16 sets the GE flag of each half, __SEL then picks per
+ *    half, so min, max and abs need no branches,
+ *  - rate: |new - last| against the limit, __SEL keeps the last value in
+ *    the rejected halves,
+ *  - median: sorting network of min/max pairs over the history rows,
+ *  - EMA: one __SMLAD per sensor computes y + a * x - a * y.
+ * The rows of the history advance together for all sensors, a sensor
+ * without valid input repeats its last value.
+ */
+
+#include "stm32f4xx.h"
+#include "string.h"
+#include "filter.h"
+
+#define FILTER_PAIRS		(FILTER_MAX_SENSORS / 2)
+#define FILTER_Q15_ONE		32768
+
+#define LO(w)				((int16_t) (w))
+#define HI(w)				((int16_t) ((w) >> 16))
+#define PAIR(lo, hi)		__PKHBT((uint32_t) (lo), (uint32_t) (hi), 16)
+
+/* Sort both halves of a and b, a gets the smaller values */
+#define SORT2(a, b)	do { \
+		uint32_t t_ = (a); \
+		__SSUB16((a), (b)); \
+		(a) = __SEL((b), t_); \
+		(b) = __SEL(t_, (b)); \
+	} while (0)
+
+#if (FILTER_MAX_SENSORS & 1) != 0
+#error "FILTER_MAX_SENSORS has to be even"
+#endif
+
+static int16_t Filter_Saturate(int32_t iValue)
+{
+	if (iValue > INT16_MAX)
+		return INT16_MAX;
+	if (iValue < INT16_MIN)
+		return INT16_MIN;
+	return iValue;
+}
+
+static uint32_t Filter_Median(SensorFilter *pFilter, int iPair)
+{
+	uint32_t p0, p1, p2, p3, p4;
+
+	p0 = pFilter->iHistory[0][iPair];
+	p1 = pFilter->iHistory[1][iPair];
+	p2 = pFilter->iHistory[2][iPair];
+
+	if (pFilter->stConfig.iMedianLength == 3) {
+		SORT2(p0, p1);
+		SORT2(p1, p2);
+		SORT2(p0, p1);
+		return p1;
+	}
+
+	p3 = pFilter->iHistory[3][iPair];
+	p4 = pFilter->iHistory[4][iPair];
+	SORT2(p0, p1);
+	SORT2(p3, p4);
+	SORT2(p0, p3);
+	SORT2(p1, p4);
+	SORT2(p1, p2);
+	SORT2(p2, p3);
+	SORT2(p1, p2);
+	return p2;
+}
+
+static void Filter_SetLane(uint32_t *pPair, int iHigh, int16_t iValue)
+{
+	if (iHigh)
+		*pPair = PAIR(LO(*pPair), iValue);
+	else
+		*pPair = PAIR(iValue, HI(*pPair));
+}
+
+/*
+ * Prepare filter for iCount sensors.
+ */
+void Filter_Init(SensorFilter *pFilter, const Filter_Config *pConfig, int iCount)
+{
+	memset(pFilter, 0, sizeof(SensorFilter));
+	pFilter->stConfig = *pConfig;
+	if (pFilter->stConfig.iMedianLength != 3 && pFilter->stConfig.iMedianLength != 5)
+		pFilter->stConfig.iMedianLength = 1;
+	if (pFilter->stConfig.iEmaAlpha >= FILTER_Q15_ONE)
+		pFilter->stConfig.iEmaAlpha = 0;
+	pFilter->iCount = iCount < FILTER_MAX_SENSORS ? iCount : FILTER_MAX_SENSORS;
+}
+
+/*
+ * Forget the history of one sensor, e.g. after it was replaced. The next
+ * valid input starts it again.
+ */
+void Filter_Reset(SensorFilter *pFilter, int iSensor)
+{
+	if (iSensor >= 0 && iSensor < FILTER_MAX_SENSORS)
+		pFilter->bPrimed[iSensor] = 0;
+}
+
+/*
+ * Filter one snapshot of all sensors.
+ * pInput: raw values, e.g. 1/16 degrees of Celsius.
+ * pValid: nonzero for inputs read successfully.
+ * pOutput: filtered values.
+ * pFlags: FILTER_FLAG_x of every sensor, may be 0.
+ * Returns number of rejected inputs.
+ */
+int Filter_Run(SensorFilter *pFilter, const int32_t *pInput, const uint8_t *pValid,
+		int32_t *pOutput, uint8_t *pFlags)
+{
+	const Filter_Config *pConfig = &pFilter->stConfig;
+	uint32_t iLimit = PAIR(pConfig->iMaxRate, pConfig->iMaxRate);
+	uint32_t iCoeff = PAIR(pConfig->iEmaAlpha, -(int32_t) pConfig->iEmaAlpha);
+	int iPairs = (pFilter->iCount + 1) / 2;
+	int p, h, i, r, iRejected = 0;
+	uint8_t iFlags[2];
+
+	for (p = 0; p < iPairs; p++) {
+		uint32_t x = pFilter->iLast[p], iDelta, iNeg, iAbs, iMask, iMedian;
+
+		/* Pack inputs, invalid ones repeat the last value */
+		for (h = 0; h < 2; h++) {
+			i = 2 * p + h;
+			iFlags[h] = 0;
+			if (i >= pFilter->iCount || !pValid[i]) {
+				iFlags[h] = pFilter->bPrimed[i] ? FILTER_FLAG_HELD : FILTER_FLAG_NO_DATA;
+				continue;
+			}
+			Filter_SetLane(&x, h, Filter_Saturate(pInput[i]));
+			if (!pFilter->bPrimed[i]) {
+				/* First value fills the history */
+				for (r = 0; r < FILTER_MEDIAN_MAX; r++)
+					Filter_SetLane(&pFilter->iHistory[r][p], h, Filter_Saturate(pInput[i]));
+				Filter_SetLane(&pFilter->iLast[p], h, Filter_Saturate(pInput[i]));
+				pFilter->iEma[i] = Filter_Saturate(pInput[i]) * FILTER_Q15_ONE;
+				pFilter->iRejected[i] = 0;
+				pFilter->bPrimed[i] = 1;
+			}
+		}
+
+		/* Rate of change, keep last value where |x - last| > limit */
+		if (pConfig->iMaxRate > 0) {
+			iDelta = __QSUB16(x, pFilter->iLast[p]);
+			iNeg = __QSUB16(0, iDelta);
+			__SSUB16(iDelta, iNeg);
+			iAbs = __SEL(iDelta, iNeg);
+			__SSUB16(iLimit, iAbs);
+			iMask = __SEL(0xFFFFFFFF, 0);
+			x = __SEL(x, pFilter->iLast[p]);
+
+			for (h = 0; h < 2; h++) {
+				i = 2 * p + h;
+				if (i >= pFilter->iCount)
+					break;
+				if ((iMask >> (16 * h)) & 0xFFFF) {
+					if (!iFlags[h])
+						pFilter->iRejected[i] = 0;
+					continue;
+				}
+				/* Lasting step is real, accept it */
+				if (pConfig->iRejectLimit && ++pFilter->iRejected[i] >= pConfig->iRejectLimit) {
+					Filter_SetLane(&x, h, Filter_Saturate(pInput[i]));
+					pFilter->iRejected[i] = 0;
+				} else {
+					iFlags[h] |= FILTER_FLAG_REJECTED;
+					iRejected++;
+				}
+			}
+		}
+		pFilter->iLast[p] = x;
+
+		/* Median of the history */
+		pFilter->iHistory[pFilter->iHistoryIndex][p] = x;
+		iMedian = pConfig->iMedianLength > 1 ? Filter_Median(pFilter, p) : x;
+
+		for (h = 0; h < 2; h++) {
+			i = 2 * p + h;
+			if (i >= pFilter->iCount)
+				break;
+			if (!pFilter->bPrimed[i]) {
+				pOutput[i] = 0;
+			} else if (pConfig->iEmaAlpha) {
+				int32_t iEma = pFilter->iEma[i];
+				int16_t iValue = h ? HI(iMedian) : LO(iMedian);
+
+				/* y + a * x - a * y in one dual multiply accumulate */
+				iEma = (int32_t) __SMLAD(PAIR(iValue, iEma >> 15), iCoeff, (uint32_t) iEma);
+				pFilter->iEma[i] = iEma;
+				pOutput[i] = iEma >> 15;
+			} else {
+				pOutput[i] = h ? HI(iMedian) : LO(iMedian);
+			}
+			if (pFlags)
+				pFlags[i] = iFlags[h];
+		}
+	}
+
+	if (pConfig->iMedianLength > 1)
+		pFilter->iHistoryIndex = (pFilter->iHistoryIndex + 1) % pConfig->iMedianLength;
+	return iRejected;
+}
@@ -0,0 +1,369 @@
+/*
+ * flashlog.c
+ *
+ * Flash log logic, all flash access goes through the medium so this file
+ * builds on the host as well.
+ *
+ * The sector being written holds the highest sector sequence number, the
+ * one after it is erased ahead so a full sector can be left without
+ * waiting. A record is programmed payload first and count last, a record
+ * torn by a reset has a free looking first word and is skipped at boot.
+ */
+
+#include "string.h"
+#include "flashlog.h"
+#include "owcrc.h"
+
+#define FLASHLOG_FREE		0xFFFFFFFF
+
+typedef char FlashLog_HeaderSize[(sizeof(FlashLog_Header) <= FLASHLOG_SLOT_SIZE) ? 1 : -1];
+typedef char FlashLog_RecordSize[(sizeof(FlashLog_Record) <= FLASHLOG_SLOT_SIZE) ? 1 : -1];
+
+static const FlashLog_Medium *pMedium;
+static uint32_t iSlots;			/* Slots per sector */
+static int iSector = -1;		/* Sector being written, -1 if none yet */
+static uint32_t iSlot;			/* Next slot of it */
+static uint32_t iSectorSequence;
+static uint32_t iSequence;		/* Sequence number of the next record */
+static int iErasing = -1;
+static int bNextReady;			/* Sector after iSector erased */
+static uint32_t iDropped;
+static uint32_t iErrors;
+static uint32_t iEraseCounts[FLASHLOG_MAX_SECTORS];
+static FlashLog_Record Pending;
+
+static uint32_t FlashLog_Offset(int iSec, uint32_t iSl)
+{
+	return iSec * pMedium->iSectorSize + iSl * FLASHLOG_SLOT_SIZE;
+}
+
+static const uint32_t *FlashLog_Slot(int iSec, uint32_t iSl)
+{
+	return pMedium->pBase + FlashLog_Offset(iSec, iSl) / 4;
+}
+
+static const FlashLog_Header *FlashLog_SectorHeader(int iSec)
+{
+	return (const FlashLog_Header *) FlashLog_Slot(iSec, 0);
+}
+
+/* Sector holding records, erased and torn ones do not count */
+static int FlashLog_InUse(int iSec)
+{
+	const FlashLog_Header *pHeader = FlashLog_SectorHeader(iSec);
+
+	return iSec != iErasing && pHeader->iMagic == FLASHLOG_MAGIC && pHeader->iSequence != FLASHLOG_FREE;
+}
+
+static int FlashLog_Next(void)
+{
+	return (iSector < 0) ? 0 : (iSector + 1) % pMedium->iSectors;
+}
+
+static int FlashLog_SlotBlank(int iSec, uint32_t iSl)
+{
+	const uint32_t *pWord = FlashLog_Slot(iSec, iSl);
+	int i;
+
+	for (i = 0; i < FLASHLOG_SLOT_SIZE / 4; i++)
+		if (pWord[i] != FLASHLOG_FREE)
+			return 0;
+	return 1;
+}
+
+static uint16_t FlashLog_CRC(const FlashLog_Record *pRecord)
+{
+	return crc16_block(0, &pRecord->iSequence, sizeof(FlashLog_Record) - 4);
+}
+
+static int FlashLog_ProgramWords(uint32_t iOffset, const uint32_t *pWords, int iCount)
+{
+	int i, bOK = 1;
+
+	for (i = 0; i < iCount; i++)
+		if (pWords[i] != FLASHLOG_FREE && !pMedium->Program(iOffset + i * 4, pWords[i]))
+			bOK = 0;
+	return bOK;
+}
+
+/* Switch writing to the erased sector after the current one */
+static int FlashLog_StartSector(void)
+{
+	int iNext = FlashLog_Next();
+	uint32_t iOffset = FlashLog_Offset(iNext, 0);
+
+	if (!bNextReady)
+		return 0;
+
+	/* Sequence number last, it makes the sector the newest one */
+	if (!pMedium->Program(iOffset + 12, iSequence) || !pMedium->Program(iOffset + 8, iSectorSequence + 1))
+		iErrors++;
+
+	iSector = iNext;
+	iSectorSequence++;
+	iSlot = 1;
+	bNextReady = 0;
+	return 1;
+}
+
+/*
+ * Program the pending record if it is full.
+ * Returns 0 if it has to wait for an erase.
+ */
+static int FlashLog_Store(void)
+{
+	const uint32_t *pWords = (const uint32_t *) &Pending;
+
+	if (Pending.iCount < FLASHLOG_RECORD_SAMPLES)
+		return 1;
+	if (iErasing >= 0)
+		return 0;
+	if ((iSector < 0 || iSlot >= iSlots) && !FlashLog_StartSector())
+		return 0;
+
+	Pending.iSequence = iSequence;
+	Pending.iReserved[0] = Pending.iReserved[1] = 0;
+	Pending.iCRC = FlashLog_CRC(&Pending);
+
+	/* Count word last, the record is valid once it is there */
+	if (!FlashLog_ProgramWords(FlashLog_Offset(iSector, iSlot) + 4, pWords + 1, sizeof(Pending) / 4 - 1)
+			|| !pMedium->Program(FlashLog_Offset(iSector, iSlot), pWords[0]))
+		iErrors++;
+
+	iSlot++;
+	iSequence++;
+	memset(&Pending, 0, sizeof(Pending));
+	return 1;
+}
+
+/*
+ * Find the newest sector and its first free slot.
+ * Returns 1 if the log is usable.
+ */
+int FlashLog_Init(const FlashLog_Medium *pMediumInit)
+{
+	const FlashLog_Header *pHeader;
+	uint32_t iLow, iHigh, iMiddle;
+	int i;
+
+	pMedium = 0;
+	iSector = -1;
+	iSlot = 0;
+	iSectorSequence = 0;
+	iSequence = 0;
+	iErasing = -1;
+	bNextReady = 0;
+	memset(&Pending, 0, sizeof(Pending));
+	memset(iEraseCounts, 0, sizeof(iEraseCounts));
+
+	if (pMediumInit->iSectors < 2 || pMediumInit->iSectors > FLASHLOG_MAX_SECTORS
+			|| pMediumInit->iSectorSize < 2 * FLASHLOG_SLOT_SIZE)
+		return 0;
+	pMedium = pMediumInit;
+	iSlots = pMedium->iSectorSize / FLASHLOG_SLOT_SIZE;
+
+	for (i = 0; i < pMedium->iSectors; i++) {
+		pHeader = FlashLog_SectorHeader(i);
+		if (pHeader->iMagic != FLASHLOG_MAGIC)
+			continue;
+		iEraseCounts[i] = pHeader->iEraseCount;
+		if (FlashLog_InUse(i) && (iSector < 0 || pHeader->iSequence > iSectorSequence)) {
+			iSector = i;
+			iSectorSequence = pHeader->iSequence;
+		}
+	}
+
+	if (iSector >= 0) {
+		/* Written slots are contiguous from slot 1, slot 0 is the header */
+		iLow = 0;
+		iHigh = iSlots;
+		while (iHigh - iLow > 1) {
+			iMiddle = iLow + (iHigh - iLow) / 2;
+			if (*FlashLog_Slot(iSector, iMiddle) != FLASHLOG_FREE)
+				iLow = iMiddle;
+			else
+				iHigh = iMiddle;
+		}
+		/* Torn record, its slot can not be programmed again */
+		for (iSlot = iHigh; iSlot < iSlots && !FlashLog_SlotBlank(iSector, iSlot); iSlot++)
+			;
+		iSequence = FlashLog_SectorHeader(iSector)->iFirstRecord + iSlot - 1;
+	}
+
+	pHeader = FlashLog_SectorHeader(FlashLog_Next());
+	bNextReady = pHeader->iMagic == FLASHLOG_MAGIC && pHeader->iSequence == FLASHLOG_FREE;
+	return 1;
+}
+
+/*
+ * Append samples, call from one context only. Samples go to flash a full
+ * record at a time, those arriving while the pending record waits for an
+ * erase are dropped and counted.
+ * Returns number of samples stored.
+ */
+int FlashLog_Append(const Sample *pSamples, int iCount)
+{
+	int iDone = 0, n;
+
+	if (!pMedium) {
+		iDropped += iCount;
+		return 0;
+	}
+
+	while (iDone < iCount) {
+		if (Pending.iCount == FLASHLOG_RECORD_SAMPLES && !FlashLog_Store()) {
+			iDropped += iCount - iDone;
+			break;
+		}
+		n = FLASHLOG_RECORD_SAMPLES - Pending.iCount;
+		if (n > iCount - iDone)
+			n = iCount - iDone;
+		memcpy(&Pending.stSample[Pending.iCount], &pSamples[iDone], n * sizeof(Sample));
+		Pending.iCount += n;
+		iDone += n;
+	}
+
+	FlashLog_Store();
+	return iDone;
+}
+
+/*
+ * Finish and start erases ahead of the write position, call regularly from
+ * the main loop.
+ *
+ * The STM32F407 has a single flash bank, instruction fetches stall while a
+ * sector erases. Call it where the stall does no harm, e.g. right after a
+ * snapshot was read out.
+ */
+void FlashLog_Poll(void)
+{
+	const FlashLog_Header *pHeader;
+	uint32_t iOffset;
+	int iNext;
+
+	if (!pMedium)
+		return;
+
+	if (iErasing >= 0) {
+		if (pMedium->EraseBusy())
+			return;
+		/* Magic last, it marks the erase as complete */
+		iOffset = FlashLog_Offset(iErasing, 0);
+		if (!pMedium->Program(iOffset + 4, iEraseCounts[iErasing]) || !pMedium->Program(iOffset, FLASHLOG_MAGIC))
+			iErrors++;
+		iErasing = -1;
+		bNextReady = 1;
+	}
+
+	FlashLog_Store();
+
+	if (bNextReady)
+		return;
+
+	/* The oldest records go, the erase count survives in the header */
+	iNext = FlashLog_Next();
+	pHeader = FlashLog_SectorHeader(iNext);
+	if (pHeader->iMagic == FLASHLOG_MAGIC)
+		iEraseCounts[iNext] = pHeader->iEraseCount;
+	iEraseCounts[iNext]++;
+	iErasing = iNext;
+	pMedium->EraseStart(iNext);
+}
+
+static int FlashLog_FindSector(uint32_t iSeq)
+{
+	int i;
+
+	for (i = 0; i < pMedium->iSectors; i++)
+		if (FlashLog_InUse(i) && FlashLog_SectorHeader(i)->iSequence == iSeq)
+			return i;
+	return -1;
+}
+
+/*
+ * Point cursor at the oldest record.
+ */
+void FlashLog_CursorInit(FlashLog_Cursor *pCursor)
+{
+	int i;
+
+	pCursor->iSector = -1;
+	pCursor->iSlot = 1;
+	pCursor->iSectorSequence = 0;
+	if (!pMedium)
+		return;
+
+	for (i = 0; i < pMedium->iSectors; i++) {
+		if (FlashLog_InUse(i) && (pCursor->iSector < 0
+				|| FlashLog_SectorHeader(i)->iSequence < pCursor->iSectorSequence)) {
+			pCursor->iSector = i;
+			pCursor->iSectorSequence = FlashLog_SectorHeader(i)->iSequence;
+		}
+	}
+}
+
+/*
+ * Copy whole records from the cursor on, oldest first. A cursor whose
+ * sector was erased meanwhile continues at the oldest record.
+ * Returns number of samples copied, 0 at the end of the log.
+ */
+int FlashLog_Read(FlashLog_Cursor *pCursor, Sample *pSamples, int iMaxSamples)
+{
+	const FlashLog_Record *pRecord;
+	int iDone = 0, iNext;
+
+	while (pMedium && pCursor->iSector >= 0) {
+		if (!FlashLog_InUse(pCursor->iSector)
+				|| FlashLog_SectorHeader(pCursor->iSector)->iSequence != pCursor->iSectorSequence) {
+			FlashLog_CursorInit(pCursor);
+			continue;
+		}
+		if (pCursor->iSector == iSector && pCursor->iSlot >= iSlot)
+			break;
+		if (pCursor->iSlot >= iSlots) {
+			if ((iNext = FlashLog_FindSector(pCursor->iSectorSequence + 1)) < 0)
+				break;
+			pCursor->iSector = iNext;
+			pCursor->iSlot = 1;
+			pCursor->iSectorSequence++;
+			continue;
+		}
+
+		/* Torn and failed records are skipped */
+		pRecord = (const FlashLog_Record *) FlashLog_Slot(pCursor->iSector, pCursor->iSlot);
+		if (pRecord->iCount <= FLASHLOG_RECORD_SAMPLES && pRecord->iCRC == FlashLog_CRC(pRecord)) {
+			if (pRecord->iCount > iMaxSamples - iDone)
+				break;
+			memcpy(&pSamples[iDone], pRecord->stSample, pRecord->iCount * sizeof(Sample));
+			iDone += pRecord->iCount;
+		}
+		pCursor->iSlot++;
+	}
+	return iDone;
+}
+
+/*
+ * Returns number of samples lost waiting for an erase.
+ */
+uint32_t FlashLog_Dropped(void)
+{
+	return iDropped;
+}
+
+/*
+ * Returns number of failed programming operations.
+ */
+uint32_t FlashLog_Errors(void)
+{
+	return iErrors;
+}
+
+/*
+ * Returns number of erases of the sector seen by the log.
+ */
+uint32_t FlashLog_EraseCount(int iSec)
+{
+	if (iSec < 0 || iSec >= FLASHLOG_MAX_SECTORS)
+		return 0;
+	return iEraseCounts[iSec];
+}
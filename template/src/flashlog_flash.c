@@ -0,0 +1,52 @@
+/*
+ * flashlog_flash.c
+ *
+ * Flash log medium on the internal flash sectors reserved for it. The
+ * erase is started by hand, FLASH_EraseSector would wait for its end.
+ */
+
+#include "stm32f4xx.h"
+#include "flashlog.h"
+
+#define FLASHLOG_FLASH_ERRORS	(FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR \
+		| FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR)
+
+static void FlashLog_EraseStart(int iSector)
+{
+	FLASH_Unlock();
+	FLASH_ClearFlag(FLASH_FLAG_EOP | FLASHLOG_FLASH_ERRORS);
+
+	FLASH->CR &= ~(FLASH_CR_PSIZE | FLASH_CR_SNB);
+	FLASH->CR |= FLASH_PSIZE_WORD | FLASH_CR_SER | (FLASHLOG_FIRST_SECTOR + iSector * FLASH_Sector_1);
+	FLASH->CR |= FLASH_CR_STRT;
+}
+
+static int FlashLog_EraseBusy(void)
+{
+	if (FLASH_GetFlagStatus(FLASH_FLAG_BSY) == SET)
+		return 1;
+
+	FLASH->CR &= ~(FLASH_CR_SER | FLASH_CR_SNB);
+	FLASH_Lock();
+	return 0;
+}
+
+static int FlashLog_Program(uint32_t iOffset, uint32_t iWord)
+{
+	FLASH_Status iStatus;
+
+	FLASH_Unlock();
+	FLASH_ClearFlag(FLASH_FLAG_EOP | FLASHLOG_FLASH_ERRORS);
+	iStatus = FLASH_ProgramWord(FLASHLOG_ADDRESS + iOffset, iWord);
+	FLASH_Lock();
+	return iStatus == FLASH_COMPLETE;
+}
+
+const FlashLog_Medium FlashLog_Internal = {
+	(const uint32_t *) FLASHLOG_ADDRESS,
+	FLASHLOG_SECTOR_SIZE,
+	FLASHLOG_SECTORS,
+	FlashLog_EraseStart,
+	FlashLog_EraseBusy,
+	FlashLog_Program
+};
@@ -0,0 +1,48 @@
+/*
+ * flashlog_ram.c
+ *
+ * Flash log medium in RAM for tests on the host. It behaves like NOR
+ * flash: erase sets all bits, programming can only clear them, and an
+ * erase takes FLASHLOG_RAM_ERASE_POLLS calls of EraseBusy.
+ */
+
+#include "string.h"
+#include "flashlog.h"
+
+#define FLASHLOG_RAM_SECTOR_SIZE	2048
+#define FLASHLOG_RAM_SECTORS		4
+#define FLASHLOG_RAM_ERASE_POLLS	2
+
+static uint32_t Memory[FLASHLOG_RAM_SECTORS * FLASHLOG_RAM_SECTOR_SIZE / 4];
+static int iErasePolls;
+
+static void FlashLog_RamEraseStart(int iSector)
+{
+	memset(&Memory[iSector * FLASHLOG_RAM_SECTOR_SIZE / 4], 0xFF, FLASHLOG_RAM_SECTOR_SIZE);
+	iErasePolls = FLASHLOG_RAM_ERASE_POLLS;
+}
+
+static int FlashLog_RamEraseBusy(void)
+{
+	if (iErasePolls == 0)
+		return 0;
+	iErasePolls--;
+	return 1;
+}
+
+static int FlashLog_RamProgram(uint32_t iOffset, uint32_t iWord)
+{
+	if ((iOffset & 3) || iOffset >= sizeof(Memory) || iErasePolls)
+		return 0;
+	Memory[iOffset / 4] &= iWord;
+	return Memory[iOffset / 4] == iWord;
+}
+
+const FlashLog_Medium FlashLog_Ram = {
+	Memory,
+	FLASHLOG_RAM_SECTOR_SIZE,
+	FLASHLOG_RAM_SECTORS,
+	FlashLog_RamEraseStart,
+	FlashLog_RamEraseBusy,
+	FlashLog_RamProgram
+};
@@ -8,10 +8,88 @@
 
 #include "OneWire.h"
 
+#include "registry.h"
+
+#include "samples.h"
+
+#include "filter.h"
+
+#include "dlog.h"
+
+#include "telemetry.h"
+
+#include "canexport.h"
+
+#include "sdlog.h"
+
+#include "flashlog.h"
+
+#include "owcrc.h"
+
+#include "power.h"
+
+#include "sched.h"
+
 #include "stdio.h"
 
-#define MaxDevices 5
+#define MaxDevices DS1820_SNAPSHOT_MAX_SENSORS
+#define Resolution_bits 10
+#define CyclePeriod_ms 1000
+#define ReportCycles 60
+
+/* Task events */
+#define EV_CYCLE		0x01
+#define EV_READ_DONE	0x02
+#define EV_SNAPSHOT		0x04
+#define EV_SAMPLES		0x08
+#define EV_LOG			0x10
+#define EV_BUS_IDLE		0x20
+#define EV_REPORT		0x40
+#define EV_CONFIG_DONE	0x80
+
+typedef enum {
+	ACQ_IDLE = 0,
+	ACQ_CONVERTING,
+	ACQ_READING,
+	ACQ_TOPOLOGY,
+	ACQ_CONFIGURING
+} Acquire_State;
+
+/* Consumers of the sample ring */
+enum {
+	OUT_TELEMETRY = 0,
+	OUT_CAN,
+	OUT_LOG,
+	OUT_COUNT
+};
+
 uint64_t Address[MaxDevices];
+OW_Bus *pBus;
+DS1820_Snapshot Snapshot;
+OW_Topology Topology;
+volatile int topology_changed = 0;
+volatile Acquire_State acquire_state = ACQ_IDLE;
+int flash_log = 0;
+SampleRing Samples;
+int out_done[OUT_COUNT];		/* Samples past the ring tail a consumer took */
+uint32_t out_lost[OUT_COUNT];	/* Samples a consumer skipped to free the ring */
+SensorFilter Filter;
+/* Median of 3, steps over 5 degrees accepted after 3 snapshots */
+const Filter_Config FilterConfig = { 3, 3, 5 * 16, 0 };
+
+Sched_Task AcquireTask, FilterTask, ExportTask, LogTask;
+SwTimer cycle_timer, acquire_timer, export_timer, log_timer;
+
+/* Sensors are configured one after the other from the completion interrupt */
+DS1820_Sensor config_sensor;
+SwTimer config_timer;
+uint64_t config_rom[MaxDevices];
+uint8_t config_bits[MaxDevices];	/* Resolution reached, 0 if failed */
+int config_index, config_count, sensor_count;
+volatile int config_busy = 0;
+int registry_dirty = 0;			/* Registry changed at run time, saved while the bus is idle */
+
+void Config_Next(void);
 
 void LED_Set(int led)
 {
@@ -22,26 +100,395 @@ void LED_Set(int led)
 	}
 }
 
-int main()
+/* Called from interrupt when the snapshot is read */
+void Snapshot_Done(DS1820_Snapshot *pSnapshot)
 {
-	float temp=0;
+	(void) pSnapshot;
+	Sched_Post(&AcquireTask, EV_READ_DONE);
+}
+
+/* Called from interrupt at the start of every cycle */
+void CB_Cycle(SwTimer *pTimer)
+{
+	(void) pTimer;
+	Sched_Post(&AcquireTask, EV_CYCLE);
+}
+
+void Topology_Event(OW_Bus *pBus, uint64_t iROM, OW_TopologyEvent iEvent)
+{
+	(void) pBus;
+	(void) iROM;
+	(void) iEvent;
+	topology_changed = 1;
+}
+
+/* Resolution the sensor keeps in EEPROM once configured */
+int Sensor_Resolution(uint64_t rom)
+{
+	return (uint8_t) rom == DS1820_FAMILY_CODE ? 9 : Resolution_bits;
+}
+
+/* Registered sensors with the resolution on record need no configuration */
+int Sensor_Configured(uint64_t rom)
+{
+	Registry_Device *pDevice = Registry_Find(rom);
+
+	return pDevice && pDevice->iResolution == Sensor_Resolution(rom);
+}
+
+/* Power type on record if all sensors have one, DS1820_ERROR otherwise */
+DS1820_State Sensor_PowerType(const uint64_t *roms, int count)
+{
+	DS1820_State power = DS1820_EXTERNAL_POWER;
+	Registry_Device *pDevice;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		pDevice = Registry_Find(roms[i]);
+		if (!pDevice || (pDevice->iPowerType != DS1820_PARASITE_POWER
+				&& pDevice->iPowerType != DS1820_EXTERNAL_POWER))
+			return DS1820_ERROR;
+		if (pDevice->iPowerType == DS1820_PARASITE_POWER)
+			power = DS1820_PARASITE_POWER;
+	}
+	return power;
+}
+
+void Config_Skip(void)
+{
+	config_index++;
+	Config_Next();
+}
+
+void CB_ConfigTimer(SwTimer *pTimer)
+{
+	(void) pTimer;
+	Config_Skip();
+}
+
+/* The EEPROM write needs the bus idle for 10 ms */
+void CB_ConfigStored(OW_Bus *pBus, DS1820_Sensor *pSensor)
+{
+	(void) pBus;
+	if (DS1820_SensorResult(pSensor) == DS1820_OK)
+		config_bits[config_index] = Resolution_bits;
+	SwTimer_Start(&config_timer, 10000, 0, CB_ConfigTimer, 0);
+}
+
+void CB_ConfigWritten(OW_Bus *pBus, DS1820_Sensor *pSensor)
+{
+	if (DS1820_SensorResult(pSensor) != DS1820_OK
+			|| DS1820_ConfigurationStore_As(pBus, pSensor, CB_ConfigStored) != DS1820_OK)
+		Config_Skip();
+}
+
+/* Thresholds are read first, the configuration write would lose them. A
+ * sensor already at the resolution is not written, EEPROM wears out. */
+void CB_ConfigRead(OW_Bus *pBus, DS1820_Sensor *pSensor)
+{
+	if (DS1820_SensorResult(pSensor) != DS1820_OK) {
+		Config_Skip();
+		return;
+	}
+	if (DS1820_ResolutionGet(pSensor) == Sensor_Resolution(pSensor->iAddress)) {
+		config_bits[config_index] = DS1820_ResolutionGet(pSensor);
+		Config_Skip();
+		return;
+	}
+	if (DS1820_ResolutionSet_As(pBus, pSensor, Resolution_bits, CB_ConfigWritten) != DS1820_OK)
+		Config_Skip();
+}
+
+/* Start on the next sensor, EV_CONFIG_DONE when all are through */
+void Config_Next(void)
+{
+	while (config_index < config_count) {
+		config_bits[config_index] = 0;
+		DS1820_SensorInit(&config_sensor, config_rom[config_index]);
+		if (DS1820_TemperatureAlarmGet_As(pBus, &config_sensor, CB_ConfigRead) == DS1820_OK)
+			return;
+		config_index++;
+	}
+	config_busy = 0;
+	Sched_Post(&AcquireTask, EV_CONFIG_DONE);
+}
 
+/* Resolution reached by the configuration goes into the registry */
+void Config_Record(void)
+{
+	Registry_Device *pDevice;
+	int i;
+
+	for (i = 0; i < config_count; i++) {
+		pDevice = Registry_Find(config_rom[i]);
+		if (pDevice && config_bits[i])
+			pDevice->iResolution = config_bits[i];
+	}
+}
+
+/* Configure the sensors of Address[] not configured yet */
+void Config_Start(int count)
+{
+	int i;
+
+	config_count = 0;
+	for (i = 0; i < count; i++)
+		if (!Sensor_Configured(Address[i]))
+			config_rom[config_count++] = Address[i];
+	config_index = 0;
+	config_busy = 1;
+	Config_Next();
+}
+
+/* Nothing in flight that STOP mode would cut off */
+int Transfers_Idle(void)
+{
+	return Telemetry_Idle() && SdLog_Idle() && CanExport_Idle();
+}
+
+/* Convert, read and check the bus once per cycle, the bus is free for
+ * other users in ACQ_IDLE */
+void Task_Acquire(Sched_Task *pTask, uint32_t iEvents)
+{
+	static uint32_t cycles = 0;
+	uint32_t left;
+	int i;
+	if ((iEvents & EV_CYCLE) && acquire_state == ACQ_IDLE) {
+		if (DS1820_SnapshotConvert(&Snapshot, Time_ms()) == DS1820_OK) {
+			acquire_state = ACQ_CONVERTING;
+			Sched_TimerStart(&acquire_timer, pTask, 1000, 0);
+		}
+		if (++cycles % ReportCycles == 0)
+			Sched_Post(&LogTask, EV_REPORT);
+	}
+
+	if ((iEvents & SCHED_EV_TIMER) && acquire_state == ACQ_CONVERTING) {
+		if (Snapshot.iState != DS1820_SNAP_CONVERTING || DS1820_SnapshotPoll(&Snapshot, Time_ms())) {
+			if (DS1820_SnapshotRead(&Snapshot, Snapshot_Done) == DS1820_OK) {
+				acquire_state = ACQ_READING;
+			} else {
+				/* Convert found nobody on the bus */
+				DLOG1(DLOG_OW_NO_DEVICE, pBus->iIndex);
+				acquire_state = ACQ_IDLE;
+			}
+		} else {
+			/* Parasite power holds the bus for the whole conversion, idle may
+			 * STOP until then. Sensors with own supply are polled every ms. */
+			left = Snapshot.iTimestamp + Snapshot.iConversionTime - Time_ms();
+			if (Snapshot.iPowerType == DS1820_PARASITE_POWER && Snapshot.bConvertStarted
+					&& (int32_t) left > 1)
+				Sched_TimerStart(&acquire_timer, pTask, left * 1000, 0);
+			else
+				Sched_TimerStart(&acquire_timer, pTask, 1000, 0);
+		}
+	}
+
+	if ((iEvents & EV_READ_DONE) && acquire_state == ACQ_READING) {
+		for (i = 0; i < Snapshot.iCount && Snapshot.stReading[i].iStatus != OW_TR_DONE; i++)
+			;
+		if (Snapshot.iCount > 0 && i == Snapshot.iCount)
+			DLOG1(DLOG_OW_NO_DEVICE, pBus->iIndex);
+		Sched_Post(&FilterTask, EV_SNAPSHOT);
+		/* One targeted search pass per cycle, full search only on change */
+		OW_TopologyCheck(&Topology);
+		acquire_state = ACQ_TOPOLOGY;
+		Sched_TimerStart(&acquire_timer, pTask, 1000, 0);
+	}
+
+	if ((iEvents & SCHED_EV_TIMER) && acquire_state == ACQ_TOPOLOGY) {
+		if (!OW_TopologyIdle(&Topology)) {
+			Sched_TimerStart(&acquire_timer, pTask, 1000, 0);
+			return;
+		}
+		if (topology_changed) {
+			topology_changed = 0;
+			/* Full search result, other families included */
+			Registry_Update(Topology.iROM, Topology.iCount);
+			registry_dirty = 1;
+			sensor_count = Registry_Addresses(Address, MaxDevices);
+			acquire_state = ACQ_CONFIGURING;
+			Config_Start(sensor_count);
+			return;
+		}
+		acquire_state = ACQ_IDLE;
+		Sched_Post(&LogTask, EV_BUS_IDLE);
+	}
+
+	if ((iEvents & EV_CONFIG_DONE) && acquire_state == ACQ_CONFIGURING) {
+		printf("sensors changed, %d on bus\n", sensor_count);
+		Config_Record();
+		DS1820_SnapshotInit(&Snapshot, pBus, Address, sensor_count);
+		Snapshot.iPowerType = Sensor_PowerType(Address, sensor_count);
+		/* Topology changes only after a full search */
+		Snapshot.bSingleDevice = Topology.iCount == 1;
+		Filter_Init(&Filter, &FilterConfig, sensor_count);
+		acquire_state = ACQ_IDLE;
+		Sched_Post(&LogTask, EV_BUS_IDLE);
+	}
+}
+
+/* Filter the snapshot read last into samples */
+void Task_Filter(Sched_Task *pTask, uint32_t iEvents)
+{
+	static int32_t input[DS1820_SNAPSHOT_MAX_SENSORS], output[DS1820_SNAPSHOT_MAX_SENSORS];
+	static uint8_t valid[DS1820_SNAPSHOT_MAX_SENSORS], flags[DS1820_SNAPSHOT_MAX_SENSORS];
+	DS1820_Snapshot *pSnapshot = &Snapshot;
+	Sample stSample;
+	int i;
+
+	(void) pTask;
+	(void) iEvents;
+	for (i = 0; i < pSnapshot->iCount; i++) {
+		input[i] = pSnapshot->stReading[i].iTemperature;
+		valid[i] = pSnapshot->stReading[i].iStatus == OW_TR_DONE;
+	}
+	Filter_Run(&Filter, input, valid, output, flags);
+
+	for (i = 0; i < pSnapshot->iCount; i++) {
+		stSample.iSensor = i;
+		stSample.iBus = pSnapshot->pBus->iIndex;
+		stSample.iStatus = pSnapshot->stReading[i].iStatus;
+		stSample.iFlags = pSnapshot->stReading[i].bAlarm ? SAMPLE_FLAG_ALARM : 0;
+		if (flags[i] & FILTER_FLAG_REJECTED)
+			stSample.iFlags |= SAMPLE_FLAG_REJECTED;
+		if (flags[i] & FILTER_FLAG_HELD)
+			stSample.iFlags |= SAMPLE_FLAG_HELD;
+		stSample.iValue = output[i];
+		stSample.iTimestamp = pSnapshot->iTimestamp;
+		stSample.iSequence = pSnapshot->iSequence;
+		SampleRing_Push(&Samples, &stSample);
+	}
+	Sched_Post(&ExportTask, EV_SAMPLES);
+}
+
+int Export_Send(int out, const Sample *batch, int n)
+{
+	switch (out) {
+	case OUT_TELEMETRY:
+		return Telemetry_Send(batch, n);
+	case OUT_CAN:
+		return CanExport_Send(batch, n);
+	default:
+		return flash_log ? FlashLog_Append(batch, n) : SdLog_Write(batch, n);
+	}
+}
+
+/* Samples leave by DMA and CAN and go to the log, every consumer at its own
+ * pace. The ring is released as far as all of them got, what is not taken
+ * is retried shortly. A consumer that holds the ring past half full loses
+ * its share. */
+void Task_Export(Sched_Task *pTask, uint32_t iEvents)
+{
+	const Sample *batch;
+	int n, out, done;
+
+	(void) iEvents;
+	while ((n = SampleRing_Peek(&Samples, &batch)) > 0) {
+		done = n;
+		for (out = 0; out < OUT_COUNT; out++) {
+			if (out_done[out] < n)
+				out_done[out] += Export_Send(out, batch + out_done[out], n - out_done[out]);
+			if (out_done[out] < done)
+				done = out_done[out];
+		}
+		if (done == 0) {
+			if (SampleRing_Count(&Samples) < SAMPLE_RING_SIZE / 2)
+				break;
+			for (out = 0; out < OUT_COUNT; out++) {
+				out_lost[out] += n - out_done[out];
+				out_done[out] = n;
+			}
+			done = n;
+		}
+		for (out = 0; out < OUT_COUNT; out++)
+			out_done[out] -= done;
+		SampleRing_Release(&Samples, done);
+	}
+	if (SampleRing_Peek(&Samples, &batch) > 0)
+		Sched_TimerStart(&export_timer, pTask, 2000, 0);
+	Sched_Post(&LogTask, EV_LOG);
+}
+
+void Task_Log(Sched_Task *pTask, uint32_t iEvents)
+{
+#ifdef CRC_BENCHMARK
+	uint32_t crc8_cycles, crc16_cycles;
+#endif
+
+	if (iEvents & EV_REPORT) {
+		Sched_Report();
+#ifdef CRC_BENCHMARK
+		crc_benchmark(&crc8_cycles, &crc16_cycles);
+		printf("crc 32 bytes: crc8 %lu, crc16 %lu cycles\n", (unsigned long) crc8_cycles,
+				(unsigned long) crc16_cycles);
+#endif
+		printf("export lost: telemetry %lu, can %lu, log %lu\n", (unsigned long) out_lost[OUT_TELEMETRY],
+				(unsigned long) out_lost[OUT_CAN], (unsigned long) out_lost[OUT_LOG]);
+	}
+	DLog_Flush();
+
+	SdLog_Poll();
+	if (!SdLog_Idle())
+		Sched_TimerStart(&log_timer, pTask, 2000, 0);
+
+	/* Sector erase stalls the CPU, only while the bus is idle */
+	if (flash_log && (iEvents & EV_BUS_IDLE))
+		FlashLog_Poll();
+	if (registry_dirty && (iEvents & EV_BUS_IDLE)) {
+		registry_dirty = 0;
+		Registry_Save();
+	}
+}
+
+/* Called with interrupts disabled when no task has events */
+void Idle(void)
+{
+	/* STOP ends before the next timer, the bus needs no clock while idle
+	 * or held in strong pull-up */
+	if ((acquire_state == ACQ_IDLE || (acquire_state == ACQ_CONVERTING
+			&& Snapshot.iPowerType == DS1820_PARASITE_POWER && Snapshot.bConvertStarted))
+			&& Transfers_Idle() && Power_Stop(CyclePeriod_ms))
+		return;
+	__WFI();
+}
+
+int main()
+{
+	pBus = OW_BUS(OW_BUS_USART3);
 	TIM_Delay_Init();
+	Power_Init();
 
+	DLog_Init();
+	SampleRing_Init(&Samples);
+	Telemetry_Init();
+	CanExport_Init(0);
+	/* Internal flash takes the log only without card, it wears out */
+	if (SdLog_Init() != SD_OK) {
+		printf("SD card log disabled, logging to flash\n");
+		flash_log = FlashLog_Init(&FlashLog_Internal);
+	}
 	DS1820_Init();
 
-	while (1) {
-	    if(OW_GetResetResult()!=OW_OK){
-	         printf("NO Device or Bus Error\n");
-		    }
-		DS1820_Search(Address,MaxDevices);
-		DS1820_TemperatureConvert(Address[0]);
-		Delay_ms(500);
-		DS1820_TemperatureGet(Address[0]);
-		Delay_ms(500);
-		temp=DS1820_TemperatureResult(Address[0]);
-		printf("temp1%.2f\n",temp);
-	}
+	Sched_Add(&AcquireTask, "acquire", Task_Acquire, 0);
+	Sched_Add(&FilterTask, "filter", Task_Filter, 1);
+	Sched_Add(&ExportTask, "export", Task_Export, 2);
+	Sched_Add(&LogTask, "log", Task_Log, 3);
+
+	/* Resolution and power type on record are used as they are, only new
+	 * sensors are configured and written back */
+	Registry_Init(pBus);
+	sensor_count = Registry_Addresses(Address, MaxDevices);
+	Config_Start(sensor_count);
+	POWER_WAIT_WHILE(config_busy);
+	Config_Record();
+	Registry_Save();
+	DS1820_SnapshotInit(&Snapshot, pBus, Address, sensor_count);
+	Snapshot.iPowerType = Sensor_PowerType(Address, sensor_count);
+	Filter_Init(&Filter, &FilterConfig, sensor_count);
+	OW_TopologyInit(&Topology, pBus, Address, sensor_count, Topology_Event);
+
+	SwTimer_Start(&cycle_timer, 0, CyclePeriod_ms * 1000, CB_Cycle, 0);
+	Sched_Run(Idle);
 }
 
 void assert_failed(uint8_t* file, uint32_t line)
@@ -0,0 +1,171 @@
+/*
+ * power.c
+ *
+ * STOP mode keeps RAM, registers and pin states, so the bus stays in
+ * strong pull-up through a parasite powered conversion. On wakeup the
+ * system clock is HSI. Bus prescalers, flash latency and PLL settings are
+ * kept, so switching back to the PLL restores the exact clocks and the
+ * USART baud rate registers stay valid.
+ *
+ * TIM5 stops with the other clocks. The wakeup timer runs from LSI, which
+ * is measured against TIM5 once by Power_Init, and the sleep is added to
+ * the clock afterwards (Time_Skip). LSI drifts with temperature, the
+ * clock is advanced by 1/16 less than measured so deadlines based on it
+ * never come early.
+ */
+
+#include "stm32f4xx.h"
+#include "power.h"
+#include "timer_delay.h"
+#include "swtimer.h"
+
+#define POWER_PREPRIO			2
+#define POWER_SUBPRIO			0
+
+#define POWER_CAL_TICKS			128			/* About 64 ms at LSI / 16 */
+#define POWER_STOP_MIN_TICKS	8			/* Below wakeup costs more than it saves */
+#define POWER_STOP_MAX_TICKS	0x10000
+
+static uint32_t iTickNs;					/* Wakeup timer period, 0 if LSI failed */
+static volatile uint8_t bWakeup;
+
+static void Power_RestoreClocks(void)
+{
+	RCC_HSEConfig(RCC_HSE_ON);
+	while (RCC_GetFlagStatus(RCC_FLAG_HSERDY) == RESET);
+	RCC_PLLCmd(ENABLE);
+	while (RCC_GetFlagStatus(RCC_FLAG_PLLRDY) == RESET);
+	RCC_SYSCLKConfig(RCC_SYSCLKSource_PLLCLK);
+	while (RCC_GetSYSCLKSource() != 0x08);
+}
+
+static void Power_WakeupStart(uint32_t iTicks)
+{
+	RTC_WakeUpCmd(DISABLE);
+	RTC_SetWakeUpCounter(iTicks - 1);
+	RTC_ClearFlag(RTC_FLAG_WUTF);
+	EXTI_ClearITPendingBit(EXTI_Line22);
+	RTC_WakeUpCmd(ENABLE);
+}
+
+static void CB_PowerSleep(SwTimer *pTimer)
+{
+	(void) pTimer;
+	/* The interrupt itself ends WFI */
+}
+
+/*
+ * Start LSI and the RTC wakeup timer and measure its period, call after
+ * TIM_Delay_Init. Blocks for about 64 ms.
+ */
+void Power_Init(void)
+{
+	EXTI_InitTypeDef EXTI_InitStructure;
+	NVIC_InitTypeDef NVIC_InitStructure;
+	uint32_t iStart;
+
+	RCC_APB1PeriphClockCmd(RCC_APB1Periph_PWR, ENABLE);
+	PWR_BackupAccessCmd(ENABLE);
+	RCC_LSICmd(ENABLE);
+	iStart = Time_us();
+	while (RCC_GetFlagStatus(RCC_FLAG_LSIRDY) == RESET)
+		if (Time_us() - iStart > 10000)
+			return;
+	RCC_RTCCLKConfig(RCC_RTCCLKSource_LSI);
+	RCC_RTCCLKCmd(ENABLE);
+	RTC_WaitForSynchro();
+	RTC_WakeUpClockConfig(RTC_WakeUpClock_RTCCLK_Div16);
+
+	/* LSI is anywhere between 17 and 47 kHz */
+	Power_WakeupStart(POWER_CAL_TICKS);
+	iStart = Time_us();
+	while (RTC_GetFlagStatus(RTC_FLAG_WUTF) == RESET)
+		if (Time_us() - iStart > 1000000)
+			return;
+	iTickNs = (Time_us() - iStart) * 1000 / POWER_CAL_TICKS;
+	RTC_WakeUpCmd(DISABLE);
+
+	EXTI_InitStructure.EXTI_Line = EXTI_Line22;
+	EXTI_InitStructure.EXTI_Mode = EXTI_Mode_Interrupt;
+	EXTI_InitStructure.EXTI_Trigger = EXTI_Trigger_Rising;
+	EXTI_InitStructure.EXTI_LineCmd = ENABLE;
+	EXTI_Init(&EXTI_InitStructure);
+	RTC_ITConfig(RTC_IT_WUT, ENABLE);
+
+	NVIC_InitStructure.NVIC_IRQChannel = RTC_WKUP_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = POWER_PREPRIO;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = POWER_SUBPRIO;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&NVIC_InitStructure);
+}
+
+/*
+ * Wait len us with the core in sleep, for waits with transfers running.
+ */
+void Power_Sleep(uint32_t len)
+{
+	SwTimer stTimer;
+	uint32_t iStart = Time_us();
+
+	stTimer.bActive = 0;
+	SwTimer_Start(&stTimer, len + 1, 0, CB_PowerSleep, 0);
+	POWER_WAIT_WHILE(Time_us() - iStart <= len);
+	SwTimer_Stop(&stTimer);
+}
+
+/*
+ * Wait up to ms in STOP mode, never past the first software timer. Every
+ * DMA transfer and peripheral transmission has to be finished, the
+ * caller checks that. May be called with interrupts disabled, a pending
+ * interrupt then keeps it from sleeping.
+ * Returns time credited to the clock in ms, 0 if STOP was not worth it or
+ * another interrupt prevented it.
+ */
+uint32_t Power_Stop(uint32_t ms)
+{
+	uint32_t iDeadline, iTicks, iSlept;
+	int32_t iLeft;
+
+	if (iTickNs == 0)
+		return 0;
+
+	/* Software timers need TIM5, wake up before the first one */
+	if (SwTimer_NextDeadline(&iDeadline)) {
+		iLeft = (int32_t) (iDeadline - Time_us());
+		if (iLeft <= 0)
+			return 0;
+		if ((uint32_t) iLeft / 1000 < ms)
+			ms = iLeft / 1000;
+	}
+
+	iTicks = (uint64_t) ms * 1000000 / iTickNs;
+	if (iTicks < POWER_STOP_MIN_TICKS)
+		return 0;
+	if (iTicks > POWER_STOP_MAX_TICKS)
+		iTicks = POWER_STOP_MAX_TICKS;
+
+	bWakeup = 0;
+	Power_WakeupStart(iTicks);
+	PWR_EnterSTOPMode(PWR_Regulator_LowPower, PWR_STOPEntry_WFI);
+	Power_RestoreClocks();
+	RTC_WakeUpCmd(DISABLE);
+
+	/* A pending interrupt skips STOP, the clock kept running then. With
+	 * interrupts disabled the wakeup interrupt did not run yet. */
+	if (!bWakeup && RTC_GetFlagStatus(RTC_FLAG_WUTF) == RESET)
+		return 0;
+
+	iSlept = (uint64_t) iTicks * iTickNs / 1000;
+	iSlept -= iSlept / 16;
+	Time_Skip(iSlept);
+	return iSlept / 1000;
+}
+
+void RTC_WKUP_IRQHandler(void)
+{
+	if (RTC_GetITStatus(RTC_IT_WUT) == SET) {
+		RTC_ClearITPendingBit(RTC_IT_WUT);
+		bWakeup = 1;
+	}
+	EXTI_ClearITPendingBit(EXTI_Line22);
+}
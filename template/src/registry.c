@@ -0,0 +1,260 @@
+/*
+ * registry.c
+ *
+ * Persistent registry of the 1-Wire sensors.
+ *
+ * At boot the registry is loaded from flash and every registered ROM is
+ * checked by a search pass targeted at that ROM (OW_Verify), which is much
+ * faster than enumerating the bus. The full search runs only if there is
+ * no valid registry or a registered sensor is missing; known sensors keep
+ * their slot index, new ones get the next free slot.
+ */
+
+#include "stm32f4xx.h"
+#include "string.h"
+#include "registry.h"
+#include "DS1820.h"
+#include "owcrc.h"
+
+/* Registry image as stored in flash */
+typedef struct _Registry_Image {
+	uint32_t iMagic;
+	uint8_t iVersion;
+	uint8_t iCount;
+	uint8_t iCRC;
+	uint8_t iReserved;
+	Registry_Device stDevice[REGISTRY_MAX_DEVICES];
+} Registry_Image;
+
+static Registry_Image Registry;
+
+static uint8_t Registry_CRC(const Registry_Image *pImage)
+{
+	uint8_t iCRC = crc8_byte(0, pImage->iCount);
+
+	return crc8_block(iCRC, pImage->stDevice, pImage->iCount * sizeof(Registry_Device));
+}
+
+static uint8_t Registry_FreeSlot(void)
+{
+	uint8_t iSlot = 0;
+	int i;
+
+	for (i = 0; i < Registry.iCount; i++)
+		if (Registry.stDevice[i].iSlot != REGISTRY_NO_SLOT && Registry.stDevice[i].iSlot >= iSlot)
+			iSlot = Registry.stDevice[i].iSlot + 1;
+	return iSlot;
+}
+
+/*
+ * Load registry and check presence of all registered sensors, rebuild it
+ * by full search if anything is wrong.
+ * Returns number of sensors present.
+ */
+int Registry_Init(OW_Bus *pBus)
+{
+	int iCount = Registry_Load();
+
+	if (iCount > 0 && Registry_Validate(pBus) == iCount)
+		return iCount;
+
+	iCount = Registry_Rebuild(pBus);
+	Registry_Save();
+	return iCount;
+}
+
+/*
+ * Copy registry from flash into RAM.
+ * Returns number of registered sensors, -1 if flash holds no valid registry.
+ */
+int Registry_Load(void)
+{
+	const Registry_Image *pFlash = (const Registry_Image *) REGISTRY_ADDRESS;
+	int i;
+
+	if (pFlash->iMagic != REGISTRY_MAGIC || pFlash->iVersion != REGISTRY_VERSION
+			|| pFlash->iCount > REGISTRY_MAX_DEVICES || Registry_CRC(pFlash) != pFlash->iCRC) {
+		memset(&Registry, 0, sizeof(Registry));
+		return -1;
+	}
+
+	memcpy(&Registry, pFlash, sizeof(Registry));
+	for (i = 0; i < Registry.iCount; i++)
+		Registry.stDevice[i].bPresent = 0;
+	return Registry.iCount;
+}
+
+/*
+ * Targeted presence check of every registered sensor.
+ * Returns number of sensors present.
+ */
+int Registry_Validate(OW_Bus *pBus)
+{
+	int i, iPresent = 0;
+
+	OW_WeakPullUp(pBus);
+	for (i = 0; i < Registry.iCount; i++) {
+		Registry.stDevice[i].bPresent = (OW_Verify(pBus, Registry.stDevice[i].iROM) == OW_OK);
+		iPresent += Registry.stDevice[i].bPresent;
+	}
+	return iPresent;
+}
+
+/*
+ * Enumerate the bus and rebuild the registry. Sensors no longer present
+ * are dropped, known ones keep slot and resolution.
+ * Returns number of sensors found.
+ */
+int Registry_Rebuild(OW_Bus *pBus)
+{
+	static uint64_t Found[REGISTRY_MAX_DEVICES];
+	static Registry_Device stDevice[REGISTRY_MAX_DEVICES];
+	int i, iCount;
+
+	iCount = DS1820_Search(pBus, Found, REGISTRY_MAX_DEVICES);
+
+	for (i = 0; i < iCount; i++) {
+		Registry_Device *pKnown = Registry_Find(Found[i]);
+
+		if (pKnown) {
+			stDevice[i] = *pKnown;
+		} else {
+			memset(&stDevice[i], 0, sizeof(Registry_Device));
+			stDevice[i].iROM = Found[i];
+			stDevice[i].iFamily = (uint8_t) Found[i];
+			stDevice[i].iSlot = REGISTRY_NO_SLOT;
+		}
+		/* Power supply read is a thermometer command */
+		if (ds18_supported((uint8_t) Found[i]))
+			stDevice[i].iPowerType = DS1820_PowerTypeGet(pBus, Found[i]);
+		stDevice[i].bPresent = 1;
+	}
+
+	/* Slots of new sensors are assigned after the known ones are in place */
+	memcpy(Registry.stDevice, stDevice, iCount * sizeof(Registry_Device));
+	Registry.iCount = iCount;
+	for (i = 0; i < iCount; i++) {
+		if (Registry.stDevice[i].iSlot == REGISTRY_NO_SLOT)
+			Registry.stDevice[i].iSlot = Registry_FreeSlot();
+	}
+	return iCount;
+}
+
+/*
+ * Take the device set of a full search made at run time. Presence follows
+ * the set, new devices are added with the next free slot. Nothing is
+ * written, call Registry_Save where the flash stall does no harm.
+ * Returns number of devices added.
+ */
+int Registry_Update(const uint64_t *ROMs, int iCount)
+{
+	Registry_Device *pDevice;
+	int i, iAdded = 0;
+
+	for (i = 0; i < Registry.iCount; i++)
+		Registry.stDevice[i].bPresent = 0;
+
+	for (i = 0; i < iCount; i++) {
+		pDevice = Registry_Find(ROMs[i]);
+		if (pDevice == 0) {
+			if (Registry.iCount >= REGISTRY_MAX_DEVICES)
+				continue;
+			pDevice = &Registry.stDevice[Registry.iCount++];
+			memset(pDevice, 0, sizeof(Registry_Device));
+			pDevice->iROM = ROMs[i];
+			pDevice->iFamily = (uint8_t) ROMs[i];
+			pDevice->iSlot = REGISTRY_NO_SLOT;
+			pDevice->iSlot = Registry_FreeSlot();
+			iAdded++;
+		}
+		pDevice->bPresent = 1;
+	}
+	return iAdded;
+}
+
+/*
+ * Write registry into flash, the sector is erased only if the content
+ * changed.
+ * Returns 1 if the flash holds the registry, 0 on flash error.
+ */
+int Registry_Save(void)
+{
+	const uint32_t *pData;
+	uint32_t iAddress = REGISTRY_ADDRESS;
+	static Registry_Image stImage;
+	unsigned int i;
+
+	/* Entries past iCount are left over from a larger registry, they are
+	 * zeroed so they neither get stored nor force an erase */
+	memset(&stImage, 0, sizeof(stImage));
+	memcpy(stImage.stDevice, Registry.stDevice, Registry.iCount * sizeof(Registry_Device));
+	stImage.iMagic = REGISTRY_MAGIC;
+	stImage.iVersion = REGISTRY_VERSION;
+	stImage.iCount = Registry.iCount;
+	for (i = 0; i < Registry.iCount; i++)
+		stImage.stDevice[i].bPresent = 0;
+	stImage.iCRC = Registry_CRC(&stImage);
+
+	if (memcmp((const void *) REGISTRY_ADDRESS, &stImage, sizeof(stImage)) == 0)
+		return 1;
+
+	FLASH_Unlock();
+	FLASH_ClearFlag(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR
+			| FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+
+	if (FLASH_EraseSector(REGISTRY_SECTOR, VoltageRange_3) != FLASH_COMPLETE) {
+		FLASH_Lock();
+		return 0;
+	}
+
+	pData = (const uint32_t *) &stImage;
+	for (i = 0; i < sizeof(stImage) / 4; i++, iAddress += 4) {
+		if (FLASH_ProgramWord(iAddress, pData[i]) != FLASH_COMPLETE) {
+			FLASH_Lock();
+			return 0;
+		}
+	}
+
+	FLASH_Lock();
+	return 1;
+}
+
+int Registry_Count(void)
+{
+	return Registry.iCount;
+}
+
+Registry_Device *Registry_Get(int i)
+{
+	if (i < 0 || i >= Registry.iCount)
+		return 0;
+	return &Registry.stDevice[i];
+}
+
+/*
+ * Returns registered sensor with that ROM, 0 if there is none.
+ */
+Registry_Device *Registry_Find(uint64_t iROM)
+{
+	int i;
+
+	for (i = 0; i < Registry.iCount; i++)
+		if (Registry.stDevice[i].iROM == iROM)
+			return &Registry.stDevice[i];
+	return 0;
+}
+
+/*
+ * Copy ROMs of present thermometers, e.g. for DS1820_SnapshotInit. Other
+ * families on the bus are registered but left out.
+ * Returns number of addresses stored.
+ */
+int Registry_Addresses(uint64_t *Addresses, int iMaxDevices)
+{
+	int i, iCount = 0;
+
+	for (i = 0; i < Registry.iCount && iCount < iMaxDevices; i++)
+		if (Registry.stDevice[i].bPresent && ds18_supported(Registry.stDevice[i].iFamily))
+			Addresses[iCount++] = Registry.stDevice[i].iROM;
+	return iCount;
+}
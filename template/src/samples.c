@@ -0,0 +1,100 @@
+/*
+ * samples.c
+ *
+ * Lock free sample ring. Head and tail run freely and are masked on
+ * access, so the ring holds all SAMPLE_RING_SIZE samples. A sample is
+ * written completely before the head moves past it, and read completely
+ * before the tail releases it; the barriers keep that order visible to
+ * the other side. A full ring drops the new sample and counts it, the
+ * producer never waits for the consumer.
+ */
+
+#include "stm32f4xx.h"
+#include "string.h"
+#include "samples.h"
+
+#define SAMPLE_RING_MASK	(SAMPLE_RING_SIZE - 1)
+
+#if (SAMPLE_RING_SIZE & SAMPLE_RING_MASK) != 0
+#error "SAMPLE_RING_SIZE has to be a power of two"
+#endif
+
+void SampleRing_Init(SampleRing *pRing)
+{
+	memset(pRing, 0, sizeof(SampleRing));
+}
+
+/*
+ * Append one sample, call from a single context only (e.g. one interrupt).
+ * Returns 1 if stored, 0 if the ring is full and the sample was dropped.
+ */
+int SampleRing_Push(SampleRing *pRing, const Sample *pSample)
+{
+	uint32_t iHead = pRing->iHead;
+
+	if (iHead - pRing->iTail >= SAMPLE_RING_SIZE) {
+		pRing->iDropped++;
+		return 0;
+	}
+
+	pRing->stSample[iHead & SAMPLE_RING_MASK] = *pSample;
+	/* Sample has to be in memory before the consumer can see it */
+	__DMB();
+	pRing->iHead = iHead + 1;
+	return 1;
+}
+
+/*
+ * Returns number of samples waiting for the consumer.
+ */
+int SampleRing_Count(SampleRing *pRing)
+{
+	return pRing->iHead - pRing->iTail;
+}
+
+/*
+ * Copy up to iMaxSamples oldest samples and release them.
+ * Returns number of samples copied.
+ */
+int SampleRing_Read(SampleRing *pRing, Sample *pSamples, int iMaxSamples)
+{
+	const Sample *pBlock;
+	int iCount = 0, n;
+
+	/* Ring may wrap, take it in two contiguous blocks */
+	while (iCount < iMaxSamples && (n = SampleRing_Peek(pRing, &pBlock)) > 0) {
+		if (n > iMaxSamples - iCount)
+			n = iMaxSamples - iCount;
+		memcpy(&pSamples[iCount], pBlock, n * sizeof(Sample));
+		SampleRing_Release(pRing, n);
+		iCount += n;
+	}
+	return iCount;
+}
+
+/*
+ * Zero copy access for batch consumers, e.g. DMA transfers. Samples stay
+ * valid until they are given back by SampleRing_Release.
+ * Returns number of contiguous samples at *ppSamples.
+ */
+int SampleRing_Peek(SampleRing *pRing, const Sample **ppSamples)
+{
+	uint32_t iTail = pRing->iTail;
+	uint32_t iCount = pRing->iHead - iTail;
+	uint32_t iContiguous = SAMPLE_RING_SIZE - (iTail & SAMPLE_RING_MASK);
+
+	/* Head is read before the samples it covers */
+	__DMB();
+	*ppSamples = &pRing->stSample[iTail & SAMPLE_RING_MASK];
+	return iCount < iContiguous ? iCount : iContiguous;
+}
+
+/*
+ * Give iCount oldest samples back to the producer.
+ */
+void SampleRing_Release(SampleRing *pRing, int iCount)
+{
+	/* Samples have to be read before the producer may overwrite them */
+	__DMB();
+	pRing->iTail += iCount;
+}
@@ -0,0 +1,170 @@
+/*
+ * sched.c
+ *
+ * Bit i of iReady tells that the task at position i of the run order has
+ * events. Both words are updated by LDREX/STREX, so interrupts can post
+ * at any time without a critical section.
+ */
+
+#include "stm32f4xx.h"
+#include "stdio.h"
+#include "sched.h"
+
+#define SCHED_CYCLES()		(DWT->CYCCNT)
+
+static Sched_Task *Tasks[SCHED_MAX_TASKS];
+static int iTasks;
+static volatile uint32_t iReady;
+static uint64_t iIdleCycles;
+
+static void Sched_AtomicOr(volatile uint32_t *pValue, uint32_t iBits)
+{
+	do {
+	} while (__STREXW(__LDREXW(pValue) | iBits, pValue));
+}
+
+static uint32_t Sched_AtomicClear(volatile uint32_t *pValue, uint32_t iBits)
+{
+	uint32_t iOld;
+
+	do {
+		iOld = __LDREXW(pValue);
+	} while (__STREXW(iOld & ~iBits, pValue));
+	return iOld;
+}
+
+static void CB_SchedTimer(SwTimer *pTimer)
+{
+	Sched_Post((Sched_Task *) pTimer->pContext, SCHED_EV_TIMER);
+}
+
+/*
+ * Initialize task and add it in priority order, call before the first
+ * Sched_Post.
+ * Returns 1 if added, 0 if the table is full.
+ */
+int Sched_Add(Sched_Task *pTask, const char *pName, Sched_Function run, int iPriority)
+{
+	int i;
+
+	if (iTasks >= SCHED_MAX_TASKS)
+		return 0;
+
+	pTask->pName = pName;
+	pTask->run = run;
+	pTask->iPriority = iPriority;
+	pTask->iEvents = 0;
+	pTask->iRuns = 0;
+	pTask->iCycles = 0;
+	pTask->iMaxCycles = 0;
+
+	/* Behind tasks of the same priority */
+	for (i = iTasks; i > 0 && Tasks[i - 1]->iPriority > pTask->iPriority; i--) {
+		Tasks[i] = Tasks[i - 1];
+		Tasks[i]->iIndex = i;
+	}
+	Tasks[i] = pTask;
+	pTask->iIndex = i;
+	iTasks++;
+	return 1;
+}
+
+/*
+ * Post events to task, safe from any context.
+ */
+void Sched_Post(Sched_Task *pTask, uint32_t iEvents)
+{
+	Sched_AtomicOr(&pTask->iEvents, iEvents);
+	Sched_AtomicOr(&iReady, 1 << pTask->iIndex);
+}
+
+/*
+ * Post SCHED_EV_TIMER to task after iDelay us and then every iPeriod us
+ * if that is not 0, see SwTimer_Start.
+ */
+void Sched_TimerStart(SwTimer *pTimer, Sched_Task *pTask, uint32_t iDelay, uint32_t iPeriod)
+{
+	SwTimer_Start(pTimer, iDelay, iPeriod, CB_SchedTimer, pTask);
+}
+
+/*
+ * Run the first task with events.
+ * Returns 0 if no task had any.
+ */
+int Sched_RunOnce(void)
+{
+	Sched_Task *pTask;
+	uint32_t iEvents, iStart, iCycles;
+	int i;
+
+	for (i = 0; i < iTasks && !(iReady & (1 << i)); i++)
+		;
+	if (i == iTasks)
+		return 0;
+
+	/* Events posted from here on run the task once more */
+	pTask = Tasks[i];
+	Sched_AtomicClear(&iReady, 1 << i);
+	iEvents = Sched_AtomicClear(&pTask->iEvents, 0xFFFFFFFF);
+	if (!iEvents)
+		return 1;
+
+	iStart = SCHED_CYCLES();
+	pTask->run(pTask, iEvents);
+	iCycles = SCHED_CYCLES() - iStart;
+
+	pTask->iRuns++;
+	pTask->iCycles += iCycles;
+	if (iCycles > pTask->iMaxCycles)
+		pTask->iMaxCycles = iCycles;
+	return 1;
+}
+
+/*
+ * Run tasks forever. Idle is checked with interrupts disabled, so an event
+ * posted just before is not slept over. Without idle function the core
+ * sleeps with WFI.
+ */
+void Sched_Run(Sched_IdleFunction idle)
+{
+	uint32_t iStart;
+
+	while (1) {
+		if (Sched_RunOnce())
+			continue;
+
+		iStart = SCHED_CYCLES();
+		__disable_irq();
+		if (!iReady) {
+			if (idle)
+				idle();
+			else
+				__WFI();
+		}
+		__enable_irq();
+		iIdleCycles += SCHED_CYCLES() - iStart;
+	}
+}
+
+/*
+ * Returns cycles spent in idle, the clock stops in STOP mode and these
+ * are not counted.
+ */
+uint64_t Sched_IdleCycles(void)
+{
+	return iIdleCycles;
+}
+
+/*
+ * Print run-time statistics of all tasks.
+ */
+void Sched_Report(void)
+{
+	int i;
+
+	for (i = 0; i < iTasks; i++)
+		printf("%-10s %8lu runs %10lu kcycles max %lu\n", Tasks[i]->pName,
+				(unsigned long) Tasks[i]->iRuns, (unsigned long) (Tasks[i]->iCycles / 1000),
+				(unsigned long) Tasks[i]->iMaxCycles);
+	printf("%-10s %25lu kcycles\n", "idle", (unsigned long) (iIdleCycles / 1000));
+}
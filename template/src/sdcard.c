@@ -0,0 +1,402 @@
+/*
+ * sdcard.c
+ *
+ * Minimal SD/SDHC driver: card identification at 400 kHz, 4 bit bus at
+ * 24 MHz, polled single block read and DMA multi block write.
+ *
+ * A write is started by SD_WriteBlocks_As: ACMD23 pre-erases the blocks,
+ * CMD25 opens the transfer and DMA2 Stream3 feeds the SDIO FIFO under
+ * peripheral flow control. The SDIO interrupt reports the end of data,
+ * SD_Poll then sends CMD12 and asks the card with CMD13 once per call
+ * until it finished programming, so the caller never waits for the card.
+ */
+
+#include "stm32f4xx.h"
+#include "sdcard.h"
+
+/* Commands */
+#define SD_CMD_GO_IDLE_STATE		0
+#define SD_CMD_ALL_SEND_CID			2
+#define SD_CMD_SEND_RELATIVE_ADDR	3
+#define SD_CMD_SET_BUS_WIDTH		6		/* Application command */
+#define SD_CMD_SELECT_CARD			7
+#define SD_CMD_SEND_IF_COND			8
+#define SD_CMD_SEND_CSD				9
+#define SD_CMD_STOP_TRANSMISSION	12
+#define SD_CMD_SEND_STATUS			13
+#define SD_CMD_SET_BLOCKLEN			16
+#define SD_CMD_READ_SINGLE_BLOCK	17
+#define SD_CMD_SET_WR_BLK_ERASE		23		/* Application command */
+#define SD_CMD_WRITE_SINGLE_BLOCK	24
+#define SD_CMD_WRITE_MULTIPLE_BLOCK	25
+#define SD_CMD_SD_SEND_OP_COND		41		/* Application command */
+#define SD_CMD_APP_CMD				55
+
+#define SD_CHECK_PATTERN			0x000001AA
+#define SD_OCR_BUSY					0x80000000
+#define SD_OCR_HIGH_CAPACITY		0x40000000
+#define SD_OCR_VOLTAGE				0x00100000	/* 3.2-3.3 V */
+#define SD_STATUS_READY_FOR_DATA	0x00000100
+#define SD_STATUS_STATE(r1)			(((r1) >> 9) & 0x0F)
+#define SD_STATE_TRAN				4
+
+/* SDIOCLK 48 MHz / (div + 2) */
+#define SD_CLKDIV_INIT				118
+#define SD_CLKDIV_TRANSFER			0
+
+#define SD_TIMEOUT_LOOPS			0x00100000
+#define SD_OP_COND_TRIES			0x0000FFFF
+#define SD_DATA_TIMEOUT				0xFFFFFFFF
+
+#define SD_STATIC_FLAGS				0x000005FF
+#define SD_DATA_ERRORS				(SDIO_FLAG_DCRCFAIL | SDIO_FLAG_DTIMEOUT | \
+									SDIO_FLAG_TXUNDERR | SDIO_FLAG_RXOVERR | SDIO_FLAG_STBITERR)
+
+#define SD_DMA_STREAM				DMA2_Stream3
+#define SD_DMA_CHANNEL				DMA_Channel_4
+#define SD_DMA_FLAGS				(DMA_FLAG_TCIF3 | DMA_FLAG_HTIF3 | DMA_FLAG_TEIF3 | \
+									DMA_FLAG_DMEIF3 | DMA_FLAG_FEIF3)
+#define SD_PREPRIO					2
+#define SD_SUBPRIO					0
+
+typedef enum _SD_Transfer {
+	SD_IDLE = 0,
+	SD_WRITING,
+	SD_PROGRAMMING
+} SD_Transfer;
+
+static uint32_t iRCA;
+static uint32_t iBlockCount;
+static uint8_t bHighCapacity;
+static uint8_t bMultiBlock;
+static volatile SD_Transfer iTransfer;
+static volatile SD_State iTransferResult;
+
+static SD_State SD_Command(uint32_t iIndex, uint32_t iArgument, uint32_t iResponse, int bCheckCRC)
+{
+	SDIO_CmdInitTypeDef SDIO_CmdInitStructure;
+	uint32_t iStatus;
+	int t = SD_TIMEOUT_LOOPS;
+
+	SDIO_ClearFlag(SD_STATIC_FLAGS);
+	SDIO_CmdInitStructure.SDIO_Argument = iArgument;
+	SDIO_CmdInitStructure.SDIO_CmdIndex = iIndex;
+	SDIO_CmdInitStructure.SDIO_Response = iResponse;
+	SDIO_CmdInitStructure.SDIO_Wait = SDIO_Wait_No;
+	SDIO_CmdInitStructure.SDIO_CPSM = SDIO_CPSM_Enable;
+	SDIO_SendCommand(&SDIO_CmdInitStructure);
+
+	do {
+		iStatus = SDIO->STA;
+		if (iResponse == SDIO_Response_No && (iStatus & SDIO_FLAG_CMDSENT))
+			return SD_OK;
+		if (iStatus & SDIO_FLAG_CTIMEOUT)
+			return SD_TIMEOUT;
+		if (iStatus & SDIO_FLAG_CCRCFAIL)
+			/* R3 carries no CRC */
+			return bCheckCRC ? SD_CRC_ERROR : SD_OK;
+		if (iStatus & SDIO_FLAG_CMDREND)
+			return SD_OK;
+	} while (--t > 0);
+
+	return SD_TIMEOUT;
+}
+
+static SD_State SD_AppCommand(uint32_t iIndex, uint32_t iArgument, int bCheckCRC)
+{
+	SD_State iState;
+
+	if ((iState = SD_Command(SD_CMD_APP_CMD, iRCA << 16, SDIO_Response_Short, 1)) != SD_OK)
+		return iState;
+	return SD_Command(iIndex, iArgument, SDIO_Response_Short, bCheckCRC);
+}
+
+static void SD_Bus(uint8_t iClockDiv, uint32_t iBusWide)
+{
+	SDIO_InitTypeDef SDIO_InitStructure;
+
+	SDIO_InitStructure.SDIO_ClockDiv = iClockDiv;
+	SDIO_InitStructure.SDIO_ClockEdge = SDIO_ClockEdge_Rising;
+	SDIO_InitStructure.SDIO_ClockBypass = SDIO_ClockBypass_Disable;
+	SDIO_InitStructure.SDIO_ClockPowerSave = SDIO_ClockPowerSave_Disable;
+	SDIO_InitStructure.SDIO_BusWide = iBusWide;
+	SDIO_InitStructure.SDIO_HardwareFlowControl = SDIO_HardwareFlowControl_Disable;
+	SDIO_Init(&SDIO_InitStructure);
+}
+
+static void SD_HardwareInit(void)
+{
+	GPIO_InitTypeDef GPIO_InitStruct;
+	NVIC_InitTypeDef NVIC_InitStructure;
+	int i;
+
+	RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOC | RCC_AHB1Periph_GPIOD | RCC_AHB1Periph_DMA2, ENABLE);
+	RCC_APB2PeriphClockCmd(RCC_APB2Periph_SDIO, ENABLE);
+
+	for (i = GPIO_PinSource8; i <= GPIO_PinSource12; i++)
+		GPIO_PinAFConfig(GPIOC, i, GPIO_AF_SDIO);
+	GPIO_PinAFConfig(GPIOD, GPIO_PinSource2, GPIO_AF_SDIO);
+
+	GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF;
+	GPIO_InitStruct.GPIO_OType = GPIO_OType_PP;
+	GPIO_InitStruct.GPIO_Speed = GPIO_Speed_50MHz;
+	GPIO_InitStruct.GPIO_PuPd = GPIO_PuPd_UP;
+	GPIO_InitStruct.GPIO_Pin = GPIO_Pin_8 | GPIO_Pin_9 | GPIO_Pin_10 | GPIO_Pin_11;
+	GPIO_Init(GPIOC, &GPIO_InitStruct);
+	GPIO_InitStruct.GPIO_Pin = GPIO_Pin_2;
+	GPIO_Init(GPIOD, &GPIO_InitStruct);
+	GPIO_InitStruct.GPIO_Pin = GPIO_Pin_12;
+	GPIO_InitStruct.GPIO_PuPd = GPIO_PuPd_NOPULL;
+	GPIO_Init(GPIOC, &GPIO_InitStruct);
+
+	/* Below the 1-Wire interrupts, bit slots must not be delayed */
+	NVIC_InitStructure.NVIC_IRQChannel = SDIO_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = SD_PREPRIO;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = SD_SUBPRIO;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&NVIC_InitStructure);
+}
+
+/*
+ * Identify the card and switch to 4 bit transfers, blocking.
+ * Returns SD_OK or SD_NO_CARD, SD_ERROR if the card is not usable.
+ */
+SD_State SD_Init(void)
+{
+	uint32_t iResponse, iCSD[4], iCSize;
+	uint32_t iOpCond = SD_OCR_VOLTAGE;
+	int i;
+
+	SD_HardwareInit();
+	SDIO_DeInit();
+	SD_Bus(SD_CLKDIV_INIT, SDIO_BusWide_1b);
+	SDIO_SetPowerState(SDIO_PowerState_ON);
+	SDIO_ClockCmd(ENABLE);
+
+	iRCA = 0;
+	iTransfer = SD_IDLE;
+	iBlockCount = 0;
+
+	if (SD_Command(SD_CMD_GO_IDLE_STATE, 0, SDIO_Response_No, 1) != SD_OK)
+		return SD_NO_CARD;
+
+	/* Version 2 cards echo the check pattern and may be high capacity */
+	if (SD_Command(SD_CMD_SEND_IF_COND, SD_CHECK_PATTERN, SDIO_Response_Short, 1) == SD_OK
+			&& (SDIO_GetResponse(SDIO_RESP1) & 0xFFF) == SD_CHECK_PATTERN)
+		iOpCond |= SD_OCR_HIGH_CAPACITY;
+
+	for (i = 0; i < SD_OP_COND_TRIES; i++) {
+		if (SD_AppCommand(SD_CMD_SD_SEND_OP_COND, iOpCond, 0) != SD_OK)
+			return SD_NO_CARD;
+		iResponse = SDIO_GetResponse(SDIO_RESP1);
+		if (iResponse & SD_OCR_BUSY)
+			break;
+	}
+	if (i == SD_OP_COND_TRIES)
+		return SD_ERROR;
+	bHighCapacity = (iResponse & SD_OCR_HIGH_CAPACITY) != 0;
+
+	if (SD_Command(SD_CMD_ALL_SEND_CID, 0, SDIO_Response_Long, 1) != SD_OK
+			|| SD_Command(SD_CMD_SEND_RELATIVE_ADDR, 0, SDIO_Response_Short, 1) != SD_OK)
+		return SD_ERROR;
+	iRCA = SDIO_GetResponse(SDIO_RESP1) >> 16;
+
+	if (SD_Command(SD_CMD_SEND_CSD, iRCA << 16, SDIO_Response_Long, 1) != SD_OK)
+		return SD_ERROR;
+	for (i = 0; i < 4; i++)
+		iCSD[i] = SDIO_GetResponse(SDIO_RESP1 + 4 * i);
+
+	if ((iCSD[0] >> 30) == 1) {
+		/* CSD 2.0, C_SIZE in 512 KiB units */
+		iCSize = ((iCSD[1] & 0x3F) << 16) | (iCSD[2] >> 16);
+		iBlockCount = (iCSize + 1) << 10;
+	} else {
+		/* CSD 1.0, (C_SIZE + 1) * 2^(C_SIZE_MULT + 2) blocks of READ_BL_LEN */
+		iCSize = ((iCSD[1] & 0x3FF) << 2) | (iCSD[2] >> 30);
+		iBlockCount = (iCSize + 1) << (((iCSD[2] >> 15) & 0x07) + 2 + ((iCSD[1] >> 16) & 0x0F) - 9);
+	}
+
+	if (SD_Command(SD_CMD_SELECT_CARD, iRCA << 16, SDIO_Response_Short, 1) != SD_OK
+			|| SD_Command(SD_CMD_SET_BLOCKLEN, SD_BLOCK_SIZE, SDIO_Response_Short, 1) != SD_OK
+			|| SD_AppCommand(SD_CMD_SET_BUS_WIDTH, 2, 1) != SD_OK)
+		return SD_ERROR;
+
+	SD_Bus(SD_CLKDIV_TRANSFER, SDIO_BusWide_4b);
+	return SD_OK;
+}
+
+/*
+ * Returns card capacity in blocks, 0 if no card.
+ */
+uint32_t SD_BlockCount(void)
+{
+	return iBlockCount;
+}
+
+/*
+ * Read one block, blocking, not while a write is running.
+ */
+SD_State SD_ReadBlock(uint32_t iBlock, uint32_t *pBuffer)
+{
+	SDIO_DataInitTypeDef SDIO_DataInitStructure;
+	uint32_t iStatus;
+	SD_State iState;
+	int i, iWords = 0, t = SD_TIMEOUT_LOOPS;
+
+	if (iTransfer != SD_IDLE)
+		return SD_BUSY;
+
+	SDIO->DCTRL = 0;
+	SDIO_DataInitStructure.SDIO_DataTimeOut = SD_DATA_TIMEOUT;
+	SDIO_DataInitStructure.SDIO_DataLength = SD_BLOCK_SIZE;
+	SDIO_DataInitStructure.SDIO_DataBlockSize = SDIO_DataBlockSize_512b;
+	SDIO_DataInitStructure.SDIO_TransferDir = SDIO_TransferDir_ToSDIO;
+	SDIO_DataInitStructure.SDIO_TransferMode = SDIO_TransferMode_Block;
+	SDIO_DataInitStructure.SDIO_DPSM = SDIO_DPSM_Enable;
+	SDIO_DataConfig(&SDIO_DataInitStructure);
+
+	iState = SD_Command(SD_CMD_READ_SINGLE_BLOCK, bHighCapacity ? iBlock : iBlock * SD_BLOCK_SIZE,
+			SDIO_Response_Short, 1);
+	if (iState != SD_OK)
+		return iState;
+
+	do {
+		iStatus = SDIO->STA;
+		if (iStatus & SD_DATA_ERRORS) {
+			SDIO_ClearFlag(SD_STATIC_FLAGS);
+			return (iStatus & SDIO_FLAG_DCRCFAIL) ? SD_CRC_ERROR : SD_ERROR;
+		}
+		if (iStatus & SDIO_FLAG_RXFIFOHF) {
+			for (i = 0; i < 8 && iWords < SD_BLOCK_SIZE / 4; i++)
+				pBuffer[iWords++] = SDIO_ReadData();
+		} else if ((iStatus & SDIO_FLAG_RXDAVL) && iWords < SD_BLOCK_SIZE / 4) {
+			pBuffer[iWords++] = SDIO_ReadData();
+		} else if (iStatus & SDIO_FLAG_DATAEND) {
+			break;
+		}
+	} while (--t > 0);
+
+	SDIO_ClearFlag(SD_STATIC_FLAGS);
+	return (t > 0 && iWords == SD_BLOCK_SIZE / 4) ? SD_OK : SD_TIMEOUT;
+}
+
+/*
+ * Start writing iCount consecutive blocks from a word aligned buffer, which
+ * has to stay untouched until SD_Poll returns something else than SD_BUSY.
+ * Returns SD_OK if started, SD_BUSY if a write is running.
+ */
+SD_State SD_WriteBlocks_As(uint32_t iBlock, const uint32_t *pBuffer, int iCount)
+{
+	SDIO_DataInitTypeDef SDIO_DataInitStructure;
+	DMA_InitTypeDef DMA_InitStructure;
+	SD_State iState;
+
+	if (iTransfer != SD_IDLE || (SD_DMA_STREAM->CR & DMA_SxCR_EN))
+		return SD_BUSY;
+	if (iBlockCount == 0)
+		return SD_NO_CARD;
+
+	bMultiBlock = iCount > 1;
+	SDIO->DCTRL = 0;
+
+	/* Pre-erase speeds up multi block writes */
+	if (bMultiBlock && (iState = SD_AppCommand(SD_CMD_SET_WR_BLK_ERASE, iCount, 1)) != SD_OK)
+		return iState;
+
+	DMA_ClearFlag(SD_DMA_STREAM, SD_DMA_FLAGS);
+	DMA_DeInit(SD_DMA_STREAM);
+	DMA_InitStructure.DMA_Channel = SD_DMA_CHANNEL;
+	DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t) &SDIO->FIFO;
+	DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t) pBuffer;
+	DMA_InitStructure.DMA_DIR = DMA_DIR_MemoryToPeripheral;
+	DMA_InitStructure.DMA_BufferSize = 1;
+	DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
+	DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Word;
+	DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+	DMA_InitStructure.DMA_Priority = DMA_Priority_Medium;
+	DMA_InitStructure.DMA_FIFOMode = DMA_FIFOMode_Enable;
+	DMA_InitStructure.DMA_FIFOThreshold = DMA_FIFOThreshold_Full;
+	DMA_InitStructure.DMA_MemoryBurst = DMA_MemoryBurst_INC4;
+	DMA_InitStructure.DMA_PeripheralBurst = DMA_PeripheralBurst_INC4;
+	DMA_Init(SD_DMA_STREAM, &DMA_InitStructure);
+	/* SDIO counts the data and ends the DMA transfer */
+	DMA_FlowControllerConfig(SD_DMA_STREAM, DMA_FlowCtrl_Peripheral);
+	DMA_Cmd(SD_DMA_STREAM, ENABLE);
+
+	iState = SD_Command(bMultiBlock ? SD_CMD_WRITE_MULTIPLE_BLOCK : SD_CMD_WRITE_SINGLE_BLOCK,
+			bHighCapacity ? iBlock : iBlock * SD_BLOCK_SIZE, SDIO_Response_Short, 1);
+	if (iState != SD_OK) {
+		DMA_Cmd(SD_DMA_STREAM, DISABLE);
+		return iState;
+	}
+
+	iTransferResult = SD_BUSY;
+	iTransfer = SD_WRITING;
+	SDIO_ClearFlag(SD_STATIC_FLAGS);
+	SDIO_ITConfig(SDIO_IT_DATAEND | SD_DATA_ERRORS, ENABLE);
+	SDIO_DMACmd(ENABLE);
+
+	SDIO_DataInitStructure.SDIO_DataTimeOut = SD_DATA_TIMEOUT;
+	SDIO_DataInitStructure.SDIO_DataLength = iCount * SD_BLOCK_SIZE;
+	SDIO_DataInitStructure.SDIO_DataBlockSize = SDIO_DataBlockSize_512b;
+	SDIO_DataInitStructure.SDIO_TransferDir = SDIO_TransferDir_ToCard;
+	SDIO_DataInitStructure.SDIO_TransferMode = SDIO_TransferMode_Block;
+	SDIO_DataInitStructure.SDIO_DPSM = SDIO_DPSM_Enable;
+	SDIO_DataConfig(&SDIO_DataInitStructure);
+
+	return SD_OK;
+}
+
+/*
+ * Advance the running write, call regularly from the main loop.
+ * Returns SD_BUSY while the write runs, then its result once, SD_OK when
+ * idle.
+ */
+SD_State SD_Poll(void)
+{
+	uint32_t iStatus;
+
+	switch (iTransfer) {
+		case SD_WRITING:
+			if (iTransferResult == SD_BUSY)
+				return SD_BUSY;
+			SDIO_DMACmd(DISABLE);
+			if (iTransferResult != SD_OK)
+				DMA_Cmd(SD_DMA_STREAM, DISABLE);
+			if (bMultiBlock)
+				SD_Command(SD_CMD_STOP_TRANSMISSION, 0, SDIO_Response_Short, 1);
+			iTransfer = SD_PROGRAMMING;
+			return SD_BUSY;
+
+		case SD_PROGRAMMING:
+			/* Card keeps the data line low while it programs */
+			if (SD_Command(SD_CMD_SEND_STATUS, iRCA << 16, SDIO_Response_Short, 1) != SD_OK)
+				return SD_BUSY;
+			iStatus = SDIO_GetResponse(SDIO_RESP1);
+			if (!(iStatus & SD_STATUS_READY_FOR_DATA) || SD_STATUS_STATE(iStatus) != SD_STATE_TRAN
+					|| (SD_DMA_STREAM->CR & DMA_SxCR_EN))
+				return SD_BUSY;
+			iTransfer = SD_IDLE;
+			return iTransferResult;
+
+		default:
+			return SD_OK;
+	}
+}
+
+void SDIO_IRQHandler(void)
+{
+	uint32_t iStatus = SDIO->STA;
+
+	if (iStatus & SD_DATA_ERRORS)
+		iTransferResult = (iStatus & SDIO_FLAG_DCRCFAIL) ? SD_CRC_ERROR : SD_ERROR;
+	else if (iStatus & SDIO_FLAG_DATAEND)
+		iTransferResult = SD_OK;
+	else
+		return;
+
+	SDIO_ITConfig(SDIO_IT_DATAEND | SD_DATA_ERRORS, DISABLE);
+	SDIO_ClearFlag(SD_STATIC_FLAGS);
+}
@@ -0,0 +1,277 @@
+/*
+ * sdlog.c
+ *
+ * At startup the end of the log is found by a binary search over the
+ * block sequence numbers: up to the write position block i holds sequence
+ * number seq(0) + i, the blocks behind it are older or empty. Writes
+ * always cover whole buffers, so the log resumes at a buffer boundary.
+ *
+ * Block 0 is checked before anything is written. A boot sector signature
+ * with a file system name or a BIOS parameter block is a volume without
+ * partition table. Otherwise the signature marks an MBR, whose partition
+ * entries are searched for the log partition.
+ */
+
+#include "string.h"
+#include "sdlog.h"
+#include "owcrc.h"
+
+/* Block has to fill exactly one card block */
+typedef char SdLog_BlockSize[(sizeof(SdLog_Block) == SD_BLOCK_SIZE) ? 1 : -1];
+
+typedef enum _SdLog_BufferState {
+	SDLOG_FILLING = 0,
+	SDLOG_FULL,
+	SDLOG_WRITING
+} SdLog_BufferState;
+
+typedef struct _SdLog_Buffer {
+	volatile SdLog_BufferState iState;
+	int iBlocks;				/* Completed blocks */
+	SdLog_Block stBlock[SDLOG_BUFFER_BLOCKS];
+} SdLog_Buffer;
+
+static SdLog_Buffer Buffers[2];
+static int iFilling;			/* Buffer being filled */
+static int iWriting = -1;		/* Buffer on the way to the card */
+static int iWriteNext;			/* Buffer to go to the card next, they alternate */
+static uint32_t iAreaFirst;		/* First card block of the log area */
+static uint32_t iAreaBlocks;	/* Size of the log area, 0 if no card */
+static uint32_t iPosition;		/* Next block within the area */
+static uint32_t iSequence;		/* Sequence number of the next block */
+static uint32_t iDropped;
+static uint32_t iErrors;
+
+static uint16_t SdLog_CRC(SdLog_Block *pBlock)
+{
+	uint16_t iCRC = pBlock->iCRC;
+	uint16_t iResult;
+
+	pBlock->iCRC = 0;
+	iResult = crc16_block(0, pBlock, sizeof(SdLog_Block));
+	pBlock->iCRC = iCRC;
+	return iResult;
+}
+
+static uint32_t SdLog_Get32(const uint8_t *pData)
+{
+	return pData[0] | pData[1] << 8 | pData[2] << 16 | (uint32_t) pData[3] << 24;
+}
+
+/* Find the log area, pBlock is used as buffer. Returns SD_ERROR if the
+ * card holds a file system or partitions but no log partition. */
+static SD_State SdLog_FindArea(SdLog_Block *pBlock, uint32_t *pFirst, uint32_t *pCount)
+{
+	const uint8_t *pData = (const uint8_t *) pBlock;
+	const uint8_t *pEntry;
+	SD_State iState;
+	int i;
+
+	if ((iState = SD_ReadBlock(0, (uint32_t *) pBlock)) != SD_OK)
+		return iState;
+
+	/* Raw card, blank or logged to before */
+	if (pData[510] != 0x55 || pData[511] != 0xAA) {
+		*pFirst = SDLOG_FIRST_BLOCK;
+		*pCount = SD_BlockCount() > SDLOG_FIRST_BLOCK ? SD_BlockCount() - SDLOG_FIRST_BLOCK : 0;
+		return SD_OK;
+	}
+
+	/* Volume boot record: exFAT, NTFS or a FAT BPB with 512 byte sectors */
+	if (memcmp(&pData[3], "EXFAT   ", 8) == 0 || memcmp(&pData[3], "NTFS    ", 8) == 0
+			|| ((pData[0] == 0xEB || pData[0] == 0xE9) && pData[11] == 0x00 && pData[12] == 0x02))
+		return SD_ERROR;
+
+	for (i = 0; i < 4; i++) {
+		pEntry = &pData[446 + 16 * i];
+		if (pEntry[4] == SDLOG_PARTITION_TYPE) {
+			*pFirst = SdLog_Get32(&pEntry[8]);
+			*pCount = SdLog_Get32(&pEntry[12]);
+			if (*pFirst == 0 || *pFirst >= SD_BlockCount() || *pCount > SD_BlockCount() - *pFirst)
+				return SD_ERROR;
+			return SD_OK;
+		}
+	}
+	return SD_ERROR;
+}
+
+/* Read block of the area, returns 1 if it is a valid log block */
+static int SdLog_ReadBlock(uint32_t iBlock, SdLog_Block *pBlock)
+{
+	if (SD_ReadBlock(iAreaFirst + iBlock, (uint32_t *) pBlock) != SD_OK)
+		return 0;
+	return pBlock->iMagic == SDLOG_MAGIC && pBlock->iCount <= SDLOG_BLOCK_SAMPLES
+			&& SdLog_CRC(pBlock) == pBlock->iCRC;
+}
+
+/*
+ * Initialize the card and find the end of the log, blocking.
+ * Returns SD_OK if logging, otherwise samples are accepted and dropped.
+ */
+SD_State SdLog_Init(void)
+{
+	SdLog_Block *pBlock = &Buffers[1].stBlock[0];
+	uint32_t iFirst, iLow, iHigh, iMiddle, iCount;
+	SD_State iState;
+
+	memset(Buffers, 0, sizeof(Buffers));
+	iFilling = 0;
+	iWriteNext = 0;
+	iWriting = -1;
+	iAreaBlocks = 0;
+	iPosition = 0;
+	iSequence = 0;
+
+	if ((iState = SD_Init()) != SD_OK)
+		return iState;
+	if ((iState = SdLog_FindArea(pBlock, &iAreaFirst, &iCount)) != SD_OK)
+		return iState;
+	if (iCount <= SDLOG_BUFFER_BLOCKS)
+		return SD_ERROR;
+	iAreaBlocks = iCount - iCount % SDLOG_BUFFER_BLOCKS;
+
+	if (!SdLog_ReadBlock(0, pBlock))
+		return SD_OK;
+	iFirst = pBlock->iSequence;
+
+	/* Last block continuing the sequence of block 0 */
+	iLow = 0;
+	iHigh = iAreaBlocks;
+	while (iHigh - iLow > 1) {
+		iMiddle = iLow + (iHigh - iLow) / 2;
+		if (SdLog_ReadBlock(iMiddle, pBlock) && pBlock->iSequence - iFirst == iMiddle)
+			iLow = iMiddle;
+		else
+			iHigh = iMiddle;
+	}
+
+	iPosition = iLow + 1;
+	iPosition += (SDLOG_BUFFER_BLOCKS - iPosition % SDLOG_BUFFER_BLOCKS) % SDLOG_BUFFER_BLOCKS;
+	iSequence = iFirst + iPosition;
+	if (iPosition >= iAreaBlocks)
+		iPosition = 0;
+
+	memset(pBlock, 0, sizeof(SdLog_Block));
+	return SD_OK;
+}
+
+/*
+ * Append samples, call from one context only. Never waits for the card,
+ * samples that find both buffers waiting for it are dropped and counted.
+ * Returns number of samples stored.
+ */
+int SdLog_Write(const Sample *pSamples, int iCount)
+{
+	SdLog_Buffer *pBuffer;
+	SdLog_Block *pBlock;
+	int iDone = 0, n;
+
+	if (iAreaBlocks == 0) {
+		iDropped += iCount;
+		return iCount;
+	}
+
+	while (iDone < iCount) {
+		pBuffer = &Buffers[iFilling];
+		if (pBuffer->iState != SDLOG_FILLING) {
+			iDropped += iCount - iDone;
+			break;
+		}
+
+		pBlock = &pBuffer->stBlock[pBuffer->iBlocks];
+		n = SDLOG_BLOCK_SAMPLES - pBlock->iCount;
+		if (n > iCount - iDone)
+			n = iCount - iDone;
+		memcpy(&pBlock->stSample[pBlock->iCount], &pSamples[iDone], n * sizeof(Sample));
+		pBlock->iCount += n;
+		iDone += n;
+
+		if (pBlock->iCount < SDLOG_BLOCK_SAMPLES)
+			break;
+
+		pBlock->iMagic = SDLOG_MAGIC;
+		pBlock->iSequence = iSequence++;
+		pBlock->iReserved = 0;
+		pBlock->iCRC = 0;
+		pBlock->iCRC = SdLog_CRC(pBlock);
+
+		if (++pBuffer->iBlocks == SDLOG_BUFFER_BLOCKS) {
+			pBuffer->iState = SDLOG_FULL;
+			iFilling ^= 1;
+		}
+	}
+
+	SdLog_Poll();
+	return iDone;
+}
+
+/*
+ * Hand full buffers to the card, call regularly from the main loop.
+ *
+ * A failed write is repeated at the same position. Skipping it would leave
+ * a gap of stale blocks inside the ring, and the end search at the next
+ * boot could resume in that gap and overwrite newer data behind it. While
+ * the card keeps failing both buffers fill up and samples are dropped.
+ */
+void SdLog_Poll(void)
+{
+	SdLog_Buffer *pBuffer;
+	SD_State iState;
+
+	if (iAreaBlocks == 0)
+		return;
+
+	if (iWriting >= 0) {
+		if ((iState = SD_Poll()) == SD_BUSY)
+			return;
+
+		pBuffer = &Buffers[iWriting];
+		iWriting = -1;
+		if (iState != SD_OK) {
+			iErrors++;
+			pBuffer->iState = SDLOG_FULL;
+		} else {
+			memset(pBuffer->stBlock, 0, sizeof(pBuffer->stBlock));
+			pBuffer->iBlocks = 0;
+			pBuffer->iState = SDLOG_FILLING;
+			iWriteNext ^= 1;
+			iPosition += SDLOG_BUFFER_BLOCKS;
+			if (iPosition >= iAreaBlocks)
+				iPosition = 0;
+		}
+	}
+
+	/* Buffers go out in the order they were filled */
+	pBuffer = &Buffers[iWriteNext];
+	if (pBuffer->iState != SDLOG_FULL)
+		return;
+	if (SD_WriteBlocks_As(iAreaFirst + iPosition, (const uint32_t *) pBuffer->stBlock,
+			SDLOG_BUFFER_BLOCKS) != SD_OK)
+		return;
+	pBuffer->iState = SDLOG_WRITING;
+	iWriting = iWriteNext;
+}
+
+/*
+ * Returns 1 if no buffer is on the way to the card.
+ */
+int SdLog_Idle(void)
+{
+	return iWriting < 0;
+}
+
+/*
+ * Returns number of samples lost because no buffer was free.
+ */
+uint32_t SdLog_Dropped(void)
+{
+	return iDropped;
+}
+
+/*
+ * Returns number of failed buffer writes, each one was repeated.
+ */
+uint32_t SdLog_Errors(void)
+{
+	return iErrors;
+}
@@ -0,0 +1,132 @@
+/*
+ * swtimer.c
+ *
+ * The list is changed with interrupts disabled, deadlines are compared by
+ * their signed difference so the clock may wrap.
+ */
+
+#include "stm32f4xx.h"
+#include "swtimer.h"
+#include "timer_delay.h"
+
+static SwTimer *pHead;
+
+static void SwTimer_Insert(SwTimer *pTimer)
+{
+	SwTimer **ppLink = &pHead;
+
+	/* Behind timers with the same deadline, they were started first */
+	while (*ppLink && (int32_t) ((*ppLink)->iDeadline - pTimer->iDeadline) <= 0)
+		ppLink = &(*ppLink)->pNext;
+	pTimer->pNext = *ppLink;
+	*ppLink = pTimer;
+	pTimer->bActive = 1;
+}
+
+static void SwTimer_Remove(SwTimer *pTimer)
+{
+	SwTimer **ppLink = &pHead;
+
+	while (*ppLink && *ppLink != pTimer)
+		ppLink = &(*ppLink)->pNext;
+	if (*ppLink)
+		*ppLink = pTimer->pNext;
+	pTimer->bActive = 0;
+}
+
+static void SwTimer_Arm(void)
+{
+	if (pHead)
+		Time_AlarmSet(pHead->iDeadline);
+	else
+		Time_AlarmCancel();
+}
+
+/*
+ * (Re)start timer, it expires iDelay us from now and then every iPeriod us
+ * if that is not 0. Safe from any context.
+ */
+void SwTimer_Start(SwTimer *pTimer, uint32_t iDelay, uint32_t iPeriod, SwTimerCallback callback, void *pContext)
+{
+	uint32_t iPrimask = __get_PRIMASK();
+
+	__disable_irq();
+	if (pTimer->bActive)
+		SwTimer_Remove(pTimer);
+	pTimer->iDeadline = Time_us() + iDelay;
+	pTimer->iPeriod = iPeriod;
+	pTimer->callback = callback;
+	pTimer->pContext = pContext;
+	SwTimer_Insert(pTimer);
+	SwTimer_Arm();
+	__set_PRIMASK(iPrimask);
+}
+
+/*
+ * Stop timer, its callback is not called after this returns unless it is
+ * already running.
+ */
+void SwTimer_Stop(SwTimer *pTimer)
+{
+	uint32_t iPrimask = __get_PRIMASK();
+
+	__disable_irq();
+	if (pTimer->bActive) {
+		SwTimer_Remove(pTimer);
+		SwTimer_Arm();
+	}
+	__set_PRIMASK(iPrimask);
+}
+
+int SwTimer_Active(const SwTimer *pTimer)
+{
+	return pTimer->bActive;
+}
+
+/*
+ * Deadline of the first timer, e.g. for deciding how long to sleep.
+ * Returns 0 if no timer runs.
+ */
+int SwTimer_NextDeadline(uint32_t *pDeadline)
+{
+	uint32_t iPrimask = __get_PRIMASK();
+	int bActive;
+
+	__disable_irq();
+	bActive = pHead != 0;
+	if (bActive)
+		*pDeadline = pHead->iDeadline;
+	__set_PRIMASK(iPrimask);
+	return bActive;
+}
+
+/*
+ * Call callbacks of expired timers, called from the clock compare
+ * interrupt.
+ */
+void SwTimer_Run(void)
+{
+	SwTimer *pTimer;
+	uint32_t iNow;
+
+	__disable_irq();
+	iNow = Time_us();
+	while (pHead && (int32_t) (pHead->iDeadline - iNow) <= 0) {
+		pTimer = pHead;
+		pHead = pTimer->pNext;
+		pTimer->bActive = 0;
+		if (pTimer->iPeriod) {
+			/* Periods missed while late are skipped, not caught up */
+			pTimer->iDeadline += pTimer->iPeriod;
+			if ((int32_t) (pTimer->iDeadline - iNow) <= 0)
+				pTimer->iDeadline = iNow + pTimer->iPeriod;
+			SwTimer_Insert(pTimer);
+		}
+		__enable_irq();
+		pTimer->callback(pTimer);
+		__disable_irq();
+		iNow = Time_us();
+	}
+	SwTimer_Arm();
+	__enable_irq();
+}
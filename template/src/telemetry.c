@@ -0,0 +1,191 @@
+/*
+ * telemetry.c
+ *
+ * USART2 TX with DMA, double buffered. Telemetry_Send encodes a batch into
+ * a free buffer and starts it if the line is idle, the transfer complete
+ * interrupt starts the other buffer if it is waiting. The CPU never waits
+ * for the USART, a batch is refused while both buffers are busy.
+ */
+
+#include "stm32f4xx.h"
+#include "telemetry.h"
+#include "OneWire.h"
+
+#ifdef OW_USE_USART2
+#error "USART2 is used by the telemetry, disable the 1-Wire bus on it"
+#endif
+
+#define TELEMETRY_USART				USART2
+#define TELEMETRY_USART_CLOCK		RCC_APB1Periph_USART2
+#define TELEMETRY_TX_PORT			GPIOA
+#define TELEMETRY_TX_PIN			GPIO_Pin_2
+#define TELEMETRY_TX_SOURCE			GPIO_PinSource2
+#define TELEMETRY_TX_CLOCK			RCC_AHB1Periph_GPIOA
+#define TELEMETRY_DMA_CLOCK			RCC_AHB1Periph_DMA1
+#define TELEMETRY_DMA_STREAM		DMA1_Stream6
+#define TELEMETRY_DMA_CHANNEL		DMA_Channel_4
+#define TELEMETRY_DMA_FLAGS			(DMA_FLAG_TCIF6 | DMA_FLAG_HTIF6 | DMA_FLAG_TEIF6 | \
+									DMA_FLAG_DMEIF6 | DMA_FLAG_FEIF6)
+#define TELEMETRY_DMA_IRQn			DMA1_Stream6_IRQn
+#define TELEMETRY_PREPRIO			2
+#define TELEMETRY_SUBPRIO			0
+
+typedef enum _Telemetry_BufferState {
+	TELEMETRY_FREE = 0,
+	TELEMETRY_READY,
+	TELEMETRY_SENDING
+} Telemetry_BufferState;
+
+typedef struct _Telemetry_Buffer {
+	volatile Telemetry_BufferState iState;
+	uint16_t iLength;
+	uint8_t Frame[TELEMETRY_FRAME_MAX];
+} Telemetry_Buffer;
+
+static Telemetry_Buffer Buffers[2];
+static uint16_t iSequence;
+static volatile uint32_t iFrames;
+
+/* Start a ready buffer, interrupts have to be disabled */
+static void Telemetry_Start(void)
+{
+	Telemetry_Buffer *pBuffer;
+	int i;
+
+	if (TELEMETRY_DMA_STREAM->CR & DMA_SxCR_EN)
+		return;
+
+	/* Send starts a batch at once if idle, so at most one is waiting */
+	for (i = 0; i < 2; i++) {
+		pBuffer = &Buffers[i];
+		if (pBuffer->iState != TELEMETRY_READY)
+			continue;
+
+		pBuffer->iState = TELEMETRY_SENDING;
+		DMA_ClearFlag(TELEMETRY_DMA_STREAM, TELEMETRY_DMA_FLAGS);
+		DMA_MemoryTargetConfig(TELEMETRY_DMA_STREAM, (uint32_t) pBuffer->Frame, DMA_Memory_0);
+		DMA_SetCurrDataCounter(TELEMETRY_DMA_STREAM, pBuffer->iLength);
+		DMA_Cmd(TELEMETRY_DMA_STREAM, ENABLE);
+		return;
+	}
+}
+
+void Telemetry_Init(void)
+{
+	GPIO_InitTypeDef GPIO_InitStruct;
+	USART_InitTypeDef USART_InitStructure;
+	DMA_InitTypeDef DMA_InitStructure;
+	NVIC_InitTypeDef NVIC_InitStructure;
+
+	RCC_AHB1PeriphClockCmd(TELEMETRY_TX_CLOCK | TELEMETRY_DMA_CLOCK, ENABLE);
+	RCC_APB1PeriphClockCmd(TELEMETRY_USART_CLOCK, ENABLE);
+
+	GPIO_PinAFConfig(TELEMETRY_TX_PORT, TELEMETRY_TX_SOURCE, GPIO_AF_USART2);
+	GPIO_InitStruct.GPIO_Pin = TELEMETRY_TX_PIN;
+	GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF;
+	GPIO_InitStruct.GPIO_OType = GPIO_OType_PP;
+	GPIO_InitStruct.GPIO_Speed = GPIO_Speed_50MHz;
+	GPIO_InitStruct.GPIO_PuPd = GPIO_PuPd_UP;
+	GPIO_Init(TELEMETRY_TX_PORT, &GPIO_InitStruct);
+
+	USART_StructInit(&USART_InitStructure);
+	USART_InitStructure.USART_BaudRate = TELEMETRY_BAUDRATE;
+	USART_InitStructure.USART_Mode = USART_Mode_Tx;
+	USART_Init(TELEMETRY_USART, &USART_InitStructure);
+	USART_DMACmd(TELEMETRY_USART, USART_DMAReq_Tx, ENABLE);
+	USART_Cmd(TELEMETRY_USART, ENABLE);
+
+	DMA_DeInit(TELEMETRY_DMA_STREAM);
+	DMA_StructInit(&DMA_InitStructure);
+	DMA_InitStructure.DMA_Channel = TELEMETRY_DMA_CHANNEL;
+	DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t) & TELEMETRY_USART->DR;
+	DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t) Buffers[0].Frame;
+	DMA_InitStructure.DMA_DIR = DMA_DIR_MemoryToPeripheral;
+	DMA_InitStructure.DMA_BufferSize = 1;
+	DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+	DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+	DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+	DMA_InitStructure.DMA_Priority = DMA_Priority_Low;
+	DMA_InitStructure.DMA_FIFOMode = DMA_FIFOMode_Disable;
+	DMA_Init(TELEMETRY_DMA_STREAM, &DMA_InitStructure);
+	DMA_ITConfig(TELEMETRY_DMA_STREAM, DMA_IT_TC, ENABLE);
+
+	/* Below the 1-Wire interrupts, bit slots must not be delayed */
+	NVIC_InitStructure.NVIC_IRQChannel = TELEMETRY_DMA_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = TELEMETRY_PREPRIO;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = TELEMETRY_SUBPRIO;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&NVIC_InitStructure);
+}
+
+/*
+ * Queue one frame of up to TELEMETRY_BATCH samples, call from one context
+ * only.
+ * Returns number of samples taken, 0 if both buffers are busy.
+ */
+int Telemetry_Send(const Sample *pSamples, int iCount)
+{
+	Telemetry_Buffer *pBuffer = 0;
+	uint32_t iPrimask;
+	int i;
+
+	if (iCount <= 0)
+		return 0;
+	if (iCount > TELEMETRY_BATCH)
+		iCount = TELEMETRY_BATCH;
+
+	for (i = 0; i < 2; i++) {
+		if (Buffers[i].iState == TELEMETRY_FREE) {
+			pBuffer = &Buffers[i];
+			break;
+		}
+	}
+	if (!pBuffer)
+		return 0;
+
+	pBuffer->iLength = Telemetry_FrameBuild(pBuffer->Frame, iSequence++, pSamples, iCount);
+
+	iPrimask = __get_PRIMASK();
+	__disable_irq();
+	pBuffer->iState = TELEMETRY_READY;
+	Telemetry_Start();
+	__set_PRIMASK(iPrimask);
+
+	return iCount;
+}
+
+/*
+ * Returns 1 if nothing is being sent, including the last bytes the DMA
+ * left in the USART.
+ */
+int Telemetry_Idle(void)
+{
+	return Buffers[0].iState == TELEMETRY_FREE && Buffers[1].iState == TELEMETRY_FREE
+			&& USART_GetFlagStatus(TELEMETRY_USART, USART_FLAG_TC) == SET;
+}
+
+/*
+ * Returns number of frames sent.
+ */
+uint32_t Telemetry_Frames(void)
+{
+	return iFrames;
+}
+
+void DMA1_Stream6_IRQHandler(void)
+{
+	int i;
+
+	if (DMA_GetITStatus(TELEMETRY_DMA_STREAM, DMA_IT_TCIF6) == RESET)
+		return;
+	DMA_ClearITPendingBit(TELEMETRY_DMA_STREAM, DMA_IT_TCIF6);
+
+	for (i = 0; i < 2; i++) {
+		if (Buffers[i].iState == TELEMETRY_SENDING)
+			Buffers[i].iState = TELEMETRY_FREE;
+	}
+	iFrames++;
+	Telemetry_Start();
+}
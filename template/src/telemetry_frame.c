@@ -0,0 +1,108 @@
+/*
+ * telemetry_frame.c
+ *
+ * COBS framing of telemetry batches. The encoder replaces every 0 byte by
+ * the distance to the next one, so a frame holds no 0 but its delimiter.
+ */
+
+#include "string.h"
+#include "telemetry.h"
+#include "owcrc.h"
+
+static int Cobs_Encode(const uint8_t *pData, int iLength, uint8_t *pOut)
+{
+	int iCode = 0, iOut = 1, i;
+	uint8_t n = 1;
+
+	for (i = 0; i < iLength; i++) {
+		if (pData[i] != 0) {
+			pOut[iOut++] = pData[i];
+			n++;
+		}
+		/* Block ends at a 0 or after 254 data bytes */
+		if (pData[i] == 0 || n == 0xFF) {
+			pOut[iCode] = n;
+			iCode = iOut++;
+			n = 1;
+		}
+	}
+	pOut[iCode] = n;
+	return iOut;
+}
+
+static int Cobs_Decode(const uint8_t *pData, int iLength, uint8_t *pOut, int iMaxLength)
+{
+	int i = 0, iOut = 0, j;
+	uint8_t n;
+
+	while (i < iLength) {
+		n = pData[i++];
+		if (n == 0 || i + n - 1 > iLength || iOut + n - 1 > iMaxLength)
+			return -1;
+		for (j = 1; j < n; j++)
+			pOut[iOut++] = pData[i++];
+		if (n != 0xFF && i < iLength) {
+			if (iOut >= iMaxLength)
+				return -1;
+			pOut[iOut++] = 0;
+		}
+	}
+	return iOut;
+}
+
+/*
+ * Encode up to TELEMETRY_BATCH samples into pFrame, which has to hold
+ * TELEMETRY_FRAME_MAX bytes.
+ * Returns frame length including the delimiter.
+ */
+int Telemetry_FrameBuild(uint8_t *pFrame, uint16_t iSequence, const Sample *pSamples, int iCount)
+{
+	static uint8_t Payload[TELEMETRY_PAYLOAD_MAX];
+	uint16_t iCRC;
+	int iLength;
+
+	if (iCount > TELEMETRY_BATCH)
+		iCount = TELEMETRY_BATCH;
+
+	Payload[0] = TELEMETRY_TYPE_SAMPLES;
+	Payload[1] = iCount;
+	Payload[2] = iSequence;
+	Payload[3] = iSequence >> 8;
+	memcpy(&Payload[TELEMETRY_HEADER_LENGTH], pSamples, iCount * sizeof(Sample));
+	iLength = TELEMETRY_HEADER_LENGTH + iCount * sizeof(Sample);
+
+	iCRC = crc16_block(0, Payload, iLength);
+	Payload[iLength++] = iCRC;
+	Payload[iLength++] = iCRC >> 8;
+
+	iLength = Cobs_Encode(Payload, iLength, pFrame);
+	pFrame[iLength++] = 0;
+	return iLength;
+}
+
+/*
+ * Decode one frame, with or without its delimiter.
+ * Returns number of samples, -1 if the frame is broken.
+ */
+int Telemetry_FrameParse(const uint8_t *pFrame, int iLength, uint16_t *pSequence,
+		Sample *pSamples, int iMaxSamples)
+{
+	uint8_t Payload[TELEMETRY_PAYLOAD_MAX];
+	int iCount;
+
+	if (iLength > 0 && pFrame[iLength - 1] == 0)
+		iLength--;
+
+	iLength = Cobs_Decode(pFrame, iLength, Payload, sizeof(Payload));
+	if (iLength < TELEMETRY_HEADER_LENGTH + 2 || crc16_block(0, Payload, iLength) != 0)
+		return -1;
+
+	iCount = Payload[1];
+	if (Payload[0] != TELEMETRY_TYPE_SAMPLES
+			|| iLength != (int) (TELEMETRY_HEADER_LENGTH + iCount * sizeof(Sample) + 2) || iCount > iMaxSamples)
+		return -1;
+
+	*pSequence = Payload[2] | (Payload[3] << 8);
+	memcpy(pSamples, &Payload[TELEMETRY_HEADER_LENGTH], iCount * sizeof(Sample));
+	return iCount;
+}
@@ -7,6 +7,8 @@
 
 #include "ownet.h"
 #include "findtype.h"
+#include "owcrc.h"
+#include "ds18temp.h"
 #include "stdio.h"
 
 #define TEMP_MAX_SENSOR_COUNT 10
@@ -30,7 +32,8 @@ int Temp_Init()
 int Temp_DoRead(int iSensor)
 {
 	uchar send_block[30], lastcrc8;
-	int send_cnt, tsht = 0, i, loop = 0;
+	int send_cnt, i, loop = 0;
+	int32_t tsht = 0;
 //	LED_Set(6);
 	if(iSensor >= NumDevices)
 		return 0;
@@ -65,11 +68,8 @@ int Temp_DoRead(int iSensor)
 					// verify CRC8 is correct
 					if (lastcrc8 == 0x00) {
 						// calculate the high-res temperature
-						tsht = send_block[2] << 8;
-						tsht = tsht | send_block[1];
-						if (tsht & 0x00001000)
-							tsht = tsht | 0xffff0000;
-						if(!(tsht == 1360 && LastTemperature[iSensor] == 0)){
+						ds18_decode(DS18_FAMILY_DS18B20, &send_block[1], &tsht);
+						if(!(tsht == DS18_TEMP16_POWER_ON && LastTemperature[iSensor] == 0)){
 							LastTemperature[iSensor] = tsht;
 						}else{
 							tsht = 0;
@@ -96,27 +96,12 @@ void RomReadCode(uchar RomCode[])
 
 uchar CrcByte(uchar abyte)
 {
-	uchar i,crc=0;
-	uchar GEN=0x8c;
-	for(i=0;i<8;i++)
-	{
-		if((crc^abyte)&0x01)
-		{
-			crc>>=1;
-			crc^=GEN;
-		}
-		else crc>>=1;
-		abyte>>=1;
-	}
-	return crc;
+	return crc8_byte(0, abyte);
 }
 
 uchar CrcCheck(uchar *p,uchar len)
 {
-	uchar crc=0;
-	while(len--)
-		crc=CrcByte(crc^*p++);
-	return crc;
+	return crc8_block(0, p, len);
 }
 
 void TempSimpleRead()
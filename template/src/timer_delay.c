@@ -1,52 +1,151 @@
-//A timer is used to generate accurate time delay
-//The timer is prescaled at 1MHz and the max value of counter is 10000, so the period is 10ms
+//A 32-bit timer counts microseconds from TIM_Delay_Init on and never stops.
+//Delays compare against it instead of counting loops, the overflow interrupt
+//extends it to 64 bits and compare channel 1 drives the software timers.
 
 #include "stm32f4xx.h"
+#include "timer_delay.h"
+#include "swtimer.h"
 
-#define TIM_DELAY						TIM12
-#define TIM_DELAY_CLK					RCC_APB1Periph_TIM12
+#define TIM_DELAY						TIM5
+#define TIM_DELAY_CLK					RCC_APB1Periph_TIM5
 #define TIM_DELAY_INIT_CLK				RCC_APB1PeriphClockCmd
 #define TIM_DELAY_SPEED				(SystemCoreClock/2)
-#define TIM_DELAY_COUNTER_MAX_VALUE	10000
+#define TIM_DELAY_IRQn					TIM5_IRQn
+#define TIM_DELAY_PREPRIO				2
+#define TIM_DELAY_SUBPRIO				0
+
+static volatile uint32_t overflows;
 
 void TIM_Delay_Init(void)
 {
 	static int configrued = 0;
 	if (!configrued) {
-		TIM_DELAY_INIT_CLK(TIM_DELAY_CLK, ENABLE);
 		TIM_TimeBaseInitTypeDef TIM_TimeBaseInitStructure;
+		NVIC_InitTypeDef NVIC_InitStructure;
+
+		TIM_DELAY_INIT_CLK(TIM_DELAY_CLK, ENABLE);
 		TIM_TimeBaseInitStructure.TIM_ClockDivision = TIM_CKD_DIV1;
 		TIM_TimeBaseInitStructure.TIM_CounterMode = TIM_CounterMode_Up;
 		TIM_TimeBaseInitStructure.TIM_Prescaler = TIM_DELAY_SPEED / 1000000 - 1;
-		TIM_TimeBaseInitStructure.TIM_Period = TIM_DELAY_COUNTER_MAX_VALUE - 1;
+		TIM_TimeBaseInitStructure.TIM_Period = 0xFFFFFFFF;
 		TIM_TimeBaseInitStructure.TIM_RepetitionCounter = 0;
 		TIM_TimeBaseInit(TIM_DELAY, &TIM_TimeBaseInitStructure);
+		//The update event loading the prescaler is no overflow
+		TIM_ClearFlag(TIM_DELAY, TIM_FLAG_Update);
+		TIM_ITConfig(TIM_DELAY, TIM_IT_Update, ENABLE);
+
+		//Below the 1-Wire interrupts, bit slots must not be delayed
+		NVIC_InitStructure.NVIC_IRQChannel = TIM_DELAY_IRQn;
+		NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = TIM_DELAY_PREPRIO;
+		NVIC_InitStructure.NVIC_IRQChannelSubPriority = TIM_DELAY_SUBPRIO;
+		NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+		NVIC_Init(&NVIC_InitStructure);
 
 		TIM_Cmd(TIM_DELAY, ENABLE);
+
+		//Cycle counter for the short delays
+		CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+		DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+		configrued = 1;
 	}
 }
 
+//Microseconds, wraps after 71 minutes, compare by difference
+uint32_t Time_us(void)
+{
+	return TIM_DELAY->CNT;
+}
+
+uint64_t Time_us64(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	uint32_t high, low;
+
+	__disable_irq();
+	high = overflows;
+	low = TIM_DELAY->CNT;
+	//Overflow not yet counted by the interrupt
+	if ((TIM_DELAY->SR & TIM_SR_UIF) && low < 0x80000000)
+		high++;
+	__set_PRIMASK(primask);
+	return ((uint64_t) high << 32) | low;
+}
+
+uint32_t Time_ms(void)
+{
+	return (uint32_t) (Time_us64() / 1000);
+}
+
+//Core clock cycles, for delays below a few microseconds
+void Delay_Cycles(uint32_t cycles)
+{
+	uint32_t start = DWT->CYCCNT;
+
+	while (DWT->CYCCNT - start < cycles);
+}
+
+//At least len microseconds, up to 35 minutes
+void Delay_us(uint32_t len)
+{
+	uint32_t start = Time_us();
+
+	while (Time_us() - start <= len);
+}
+
 void Delay_ms(int len)
 {
+	uint32_t start = Time_us();
 
-	while(len > 0){
-		int start_time = TIM_GetCounter(TIM_DELAY);
-		int end_time = start_time+1000;
-		if(end_time >= TIM_DELAY_COUNTER_MAX_VALUE)
-			end_time -= TIM_DELAY_COUNTER_MAX_VALUE;
-		int tmp = 1000000;//To prevent dead loop
-		while(1){
-			int t = TIM_GetCounter(TIM_DELAY);
-			if(t >= start_time+1000)
-				break;
-			if(t < start_time && end_time > start_time)
-				break;
-			if(t < start_time && t >= end_time)
-				break;
-			tmp --;
-			if(tmp == 0)
-				break;
-		}
+	//Counted from the start, time spent in interrupts does not add up
+	while (len > 0) {
+		while (Time_us() - start <= 1000);
+		start += 1000;
 		len--;
 	}
 }
+
+//Advance the clock by time it did not count, e.g. in STOP mode
+void Time_Skip(uint32_t len)
+{
+	uint32_t primask = __get_PRIMASK();
+	uint32_t before, now;
+
+	__disable_irq();
+	before = TIM_DELAY->CNT;
+	now = before + len;
+	if (now < before)
+		overflows++;
+	TIM_SetCounter(TIM_DELAY, now);
+	//A compare value jumped over never matches
+	if ((TIM_DELAY->DIER & TIM_IT_CC1) && (int32_t) (TIM_DELAY->CCR1 - now) <= 0)
+		TIM_GenerateEvent(TIM_DELAY, TIM_EventSource_CC1);
+	__set_PRIMASK(primask);
+}
+
+//Request the compare interrupt at the given Time_us
+void Time_AlarmSet(uint32_t at)
+{
+	TIM_SetCompare1(TIM_DELAY, at);
+	TIM_ClearITPendingBit(TIM_DELAY, TIM_IT_CC1);
+	TIM_ITConfig(TIM_DELAY, TIM_IT_CC1, ENABLE);
+	//Compare value passed before it was written
+	if ((int32_t) (at - Time_us()) <= 0)
+		TIM_GenerateEvent(TIM_DELAY, TIM_EventSource_CC1);
+}
+
+void Time_AlarmCancel(void)
+{
+	TIM_ITConfig(TIM_DELAY, TIM_IT_CC1, DISABLE);
+}
+
+void TIM5_IRQHandler(void)
+{
+	if (TIM_GetITStatus(TIM_DELAY, TIM_IT_Update) == SET) {
+		TIM_ClearITPendingBit(TIM_DELAY, TIM_IT_Update);
+		overflows++;
+	}
+	if (TIM_GetITStatus(TIM_DELAY, TIM_IT_CC1) == SET) {
+		TIM_ClearITPendingBit(TIM_DELAY, TIM_IT_CC1);
+		SwTimer_Run();
+	}
+}
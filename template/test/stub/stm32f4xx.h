@@ -0,0 +1,94 @@
+/*
+ * stm32f4xx.h
+ *
+ * Host stand-in for the device header, C versions of the Cortex-M4 SIMD
+ * intrinsics used by filter.c. The GE flags of __SSUB16 are kept in a
+ * variable for __SEL, as the core does in the APSR.
+ *
+ * PRIMASK and the DWT cycle counter are plain variables, the test that
+ * needs them defines StubPrimask and StubDWT. LDREX/STREX never fail, a
+ * host test has no interrupts. Peripheral types are opaque, enough for the
+ * bus descriptions in OneWire.h.
+ */
+
+#ifndef STM32F4XX_STUB_H
+#define STM32F4XX_STUB_H
+
+#include <stdint.h>
+
+static uint32_t iStubGE;
+
+static inline int16_t Stub_Saturate16(int32_t v)
+{
+	return v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+}
+
+static inline uint32_t __SSUB16(uint32_t a, uint32_t b)
+{
+	int32_t lo = (int16_t) a - (int16_t) b;
+	int32_t hi = (int16_t) (a >> 16) - (int16_t) (b >> 16);
+
+	iStubGE = (lo >= 0 ? 0x3 : 0) | (hi >= 0 ? 0xC : 0);
+	return (uint16_t) lo | ((uint32_t) (uint16_t) hi << 16);
+}
+
+static inline uint32_t __SEL(uint32_t a, uint32_t b)
+{
+	return ((iStubGE & 0x3 ? a : b) & 0x0000FFFF) | ((iStubGE & 0xC ? a : b) & 0xFFFF0000);
+}
+
+static inline uint32_t __QSUB16(uint32_t a, uint32_t b)
+{
+	return (uint16_t) Stub_Saturate16((int16_t) a - (int16_t) b)
+			| ((uint32_t) (uint16_t) Stub_Saturate16((int16_t) (a >> 16) - (int16_t) (b >> 16)) << 16);
+}
+
+static inline uint32_t __SMLAD(uint32_t x, uint32_t y, uint32_t acc)
+{
+	return (uint32_t) ((int32_t) acc + (int16_t) x * (int16_t) y
+			+ (int16_t) (x >> 16) * (int16_t) (y >> 16));
+}
+
+typedef struct {
+	volatile uint32_t CYCCNT;
+} Stub_DWT_Type;
+
+typedef struct Stub_Peripheral GPIO_TypeDef;
+typedef struct Stub_Peripheral USART_TypeDef;
+typedef struct Stub_Peripheral DMA_Stream_TypeDef;
+typedef int IRQn_Type;
+typedef enum { DISABLE = 0, ENABLE = !DISABLE } FunctionalState;
+
+extern uint32_t StubPrimask;
+extern Stub_DWT_Type StubDWT;
+
+#define DWT					(&StubDWT)
+
+static inline uint32_t __get_PRIMASK(void)
+{
+	return StubPrimask;
+}
+
+static inline void __set_PRIMASK(uint32_t iPrimask)
+{
+	StubPrimask = iPrimask;
+}
+
+#define __disable_irq()		(StubPrimask = 1)
+#define __enable_irq()		(StubPrimask = 0)
+#define __WFI()				do { } while (0)
+
+static inline uint32_t __LDREXW(volatile uint32_t *pAddress)
+{
+	return *pAddress;
+}
+
+static inline uint32_t __STREXW(uint32_t iValue, volatile uint32_t *pAddress)
+{
+	*pAddress = iValue;
+	return 0;
+}
+
+#define __PKHBT(a, b, s)	((((uint32_t) (a)) & 0x0000FFFF) | ((((uint32_t) (b)) << (s)) & 0xFFFF0000))
+
+#endif /* STM32F4XX_STUB_H */
@@ -0,0 +1,12 @@
+/*
+ * stm32f4xx_usart.h
+ *
+ * Host stand-in, OneWire.h only needs the types of stm32f4xx.h.
+ */
+
+#ifndef STM32F4XX_USART_STUB_H
+#define STM32F4XX_USART_STUB_H
+
+#include "stm32f4xx.h"
+
+#endif /* STM32F4XX_USART_STUB_H */
@@ -0,0 +1,106 @@
+/*
+ * test_canexport.c
+ *
+ * Host test of the CAN data frame coding: round trip, frame breaks at a
+ * sensor index gap or a bus change, the no value marker, clamping of the
+ * values and malformed frame lengths.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "canexport.h"
+#include "OneWire.h"
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL line %d: %s\n", __LINE__, #cond); failures++; } } while (0)
+
+static void Set(Sample *pSample, int iBus, int iSensor, int32_t iValue)
+{
+	memset(pSample, 0, sizeof(Sample));
+	pSample->iBus = iBus;
+	pSample->iSensor = iSensor;
+	pSample->iStatus = OW_TR_DONE;
+	pSample->iValue = iValue;
+}
+
+int main(void)
+{
+	CanExport_Frame stFrame;
+	Sample stIn[4], stOut[CANEXPORT_VALUES];
+	uint8_t iSequence;
+	int i;
+
+	/* Round trip of a full frame */
+	Set(&stIn[0], 2, 5, -200);
+	Set(&stIn[1], 2, 6, 0);
+	Set(&stIn[2], 2, 7, 1234);
+	Set(&stIn[3], 2, 8, 99);
+	CHECK(CanExport_Pack(&stFrame, 0x42, stIn, 4) == CANEXPORT_VALUES);
+	CHECK(stFrame.iLength == 8);
+	CHECK(CanExport_Unpack(&stFrame, &iSequence, stOut) == CANEXPORT_VALUES);
+	CHECK(iSequence == 0x42);
+	for (i = 0; i < CANEXPORT_VALUES; i++) {
+		CHECK(stOut[i].iBus == 2);
+		CHECK(stOut[i].iSensor == stIn[i].iSensor);
+		CHECK(stOut[i].iValue == stIn[i].iValue);
+		CHECK(stOut[i].iStatus == OW_TR_DONE);
+	}
+
+	/* Nothing to pack, a single value */
+	CHECK(CanExport_Pack(&stFrame, 0, stIn, 0) == 0);
+	CHECK(CanExport_Pack(&stFrame, 1, &stIn[3], 1) == 1);
+	CHECK(stFrame.iLength == 4);
+	CHECK(CanExport_Unpack(&stFrame, &iSequence, stOut) == 1);
+	CHECK(stOut[0].iSensor == 8 && stOut[0].iValue == 99);
+
+	/* Gap in the sensor index ends the frame */
+	Set(&stIn[2], 2, 9, 1234);
+	CHECK(CanExport_Pack(&stFrame, 2, stIn, 3) == 2);
+	CHECK(stFrame.iLength == 6);
+	CHECK(CanExport_Pack(&stFrame, 3, &stIn[2], 1) == 1);
+	CHECK(CanExport_Unpack(&stFrame, &iSequence, stOut) == 1);
+	CHECK(stOut[0].iSensor == 9 && stOut[0].iBus == 2);
+
+	/* So does the next bus, which is told apart on the receiver side */
+	Set(&stIn[0], 0, 3, 10);
+	Set(&stIn[1], 1, 4, 20);
+	CHECK(CanExport_Pack(&stFrame, 4, stIn, 2) == 1);
+	CHECK(CanExport_Unpack(&stFrame, &iSequence, stOut) == 1);
+	CHECK(stOut[0].iBus == 0 && stOut[0].iSensor == 3);
+	CHECK(CanExport_Pack(&stFrame, 5, &stIn[1], 1) == 1);
+	CHECK(CanExport_Unpack(&stFrame, &iSequence, stOut) == 1);
+	CHECK(stOut[0].iBus == 1 && stOut[0].iSensor == 4 && stOut[0].iValue == 20);
+
+	/* Failed read gives the marker, a held value is sent */
+	Set(&stIn[0], 1, 0, 555);
+	stIn[0].iStatus = OW_TR_FAILED;
+	Set(&stIn[1], 1, 1, 666);
+	stIn[1].iStatus = OW_TR_FAILED;
+	stIn[1].iFlags = SAMPLE_FLAG_HELD;
+	CHECK(CanExport_Pack(&stFrame, 6, stIn, 2) == 2);
+	CHECK(CanExport_Unpack(&stFrame, &iSequence, stOut) == 2);
+	CHECK(stOut[0].iValue == CANEXPORT_NO_VALUE && stOut[0].iStatus == OW_TR_FAILED);
+	CHECK(stOut[1].iValue == 666 && stOut[1].iStatus == OW_TR_DONE);
+
+	/* Out of range values are clamped, never onto the marker */
+	Set(&stIn[0], 0, 0, 40000);
+	Set(&stIn[1], 0, 1, -40000);
+	Set(&stIn[2], 0, 2, INT16_MIN);
+	CHECK(CanExport_Pack(&stFrame, 7, stIn, 3) == 3);
+	CHECK(CanExport_Unpack(&stFrame, &iSequence, stOut) == 3);
+	CHECK(stOut[0].iValue == INT16_MAX);
+	CHECK(stOut[1].iValue == INT16_MIN + 1 && stOut[1].iStatus == OW_TR_DONE);
+	CHECK(stOut[2].iValue == INT16_MIN + 1 && stOut[2].iStatus == OW_TR_DONE);
+
+	/* Only 4, 6 and 8 bytes are data frames */
+	for (i = 0; i <= 9; i++) {
+		stFrame.iLength = i;
+		CHECK(CanExport_Unpack(&stFrame, &iSequence, stOut) == (i >= 4 && i <= 8 && !(i & 1) ? (i - 2) / 2 : -1));
+	}
+
+	if (failures)
+		return 1;
+	printf("canexport: ok\n");
+	return 0;
+}
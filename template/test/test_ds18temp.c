@@ -0,0 +1,125 @@
+/*
+ * test_ds18temp.c
+ *
+ * Host test of ds18_decode over the temperature/data tables of the DS18S20,
+ * DS18B20/DS1822 and MAX31850 datasheets.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "ds18temp.h"
+
+/* Configuration register of the DS18B20 for 9 to 12 bits */
+#define CONFIG(bits)	((((bits) - 9) << 5) | 0x1F)
+
+typedef struct {
+	uint8_t iFamily;
+	uint16_t iRaw;			/* Temperature register */
+	uint8_t iConfig;
+	uint8_t iCountRemain;	/* DS18S20 only */
+	uint8_t iCountPerC;
+	int iResult;			/* Expected return of ds18_decode */
+	int32_t iTemp16;		/* Expected temperature if decoded */
+	const char *pName;
+} Row;
+
+static const Row Rows[] = {
+	/* DS18B20 12 bit, datasheet table 1 */
+	{ 0x28, 0x07D0, CONFIG(12), 0, 0, 1, 125 * 16, "+125" },
+	{ 0x28, 0x0550, CONFIG(12), 0, 0, 1, 85 * 16, "+85 power-on" },
+	{ 0x28, 0x0191, CONFIG(12), 0, 0, 1, 401, "+25.0625" },
+	{ 0x28, 0x00A2, CONFIG(12), 0, 0, 1, 162, "+10.125" },
+	{ 0x28, 0x0008, CONFIG(12), 0, 0, 1, 8, "+0.5" },
+	{ 0x28, 0x0000, CONFIG(12), 0, 0, 1, 0, "0" },
+	{ 0x28, 0xFFF8, CONFIG(12), 0, 0, 1, -8, "-0.5" },
+	{ 0x28, 0xFF5E, CONFIG(12), 0, 0, 1, -162, "-10.125" },
+	{ 0x28, 0xFE6F, CONFIG(12), 0, 0, 1, -401, "-25.0625" },
+	{ 0x28, 0xFC90, CONFIG(12), 0, 0, 1, -55 * 16, "-55" },
+
+	/* DS1822 uses the same format */
+	{ 0x22, 0x0191, CONFIG(12), 0, 0, 1, 401, "DS1822 +25.0625" },
+	{ 0x22, 0xFE6F, CONFIG(12), 0, 0, 1, -401, "DS1822 -25.0625" },
+
+	/* Lower resolutions, undefined low bits set */
+	{ 0x28, 0x0197, CONFIG(9), 0, 0, 1, 400, "9 bit +25.0" },
+	{ 0x28, 0xFFFF, CONFIG(9), 0, 0, 1, -8, "9 bit -0.5" },
+	{ 0x28, 0xFC97, CONFIG(9), 0, 0, 1, -55 * 16, "9 bit -55" },
+	{ 0x28, 0x01A3, CONFIG(10), 0, 0, 1, 416, "10 bit +26.0" },
+	{ 0x28, 0xFF5F, CONFIG(10), 0, 0, 1, -164, "10 bit -10.25" },
+	{ 0x22, 0x00A3, CONFIG(11), 0, 0, 1, 162, "DS1822 11 bit +10.125" },
+	{ 0x22, 0xFE6F, CONFIG(11), 0, 0, 1, -402, "DS1822 11 bit -25.125" },
+
+	/* Unknown family is decoded as DS18B20 */
+	{ 0x00, 0xFF5E, CONFIG(12), 0, 0, 1, -162, "family 0 -10.125" },
+
+	/* DS18S20, datasheet table 1 with COUNT_REMAIN of the exact value */
+	{ 0x10, 0x00AA, 0, 0x0C, 0x10, 1, 85 * 16, "S20 +85 power-on" },
+	{ 0x10, 0x0032, 0, 0x0C, 0x10, 1, 25 * 16, "S20 +25" },
+	{ 0x10, 0x0001, 0, 0x04, 0x10, 1, 8, "S20 +0.5" },
+	{ 0x10, 0x0000, 0, 0x0C, 0x10, 1, 0, "S20 0" },
+	{ 0x10, 0xFFFF, 0, 0x04, 0x10, 1, -8, "S20 -0.5" },
+	{ 0x10, 0xFFCE, 0, 0x0C, 0x10, 1, -25 * 16, "S20 -25" },
+	{ 0x10, 0xFF92, 0, 0x0C, 0x10, 1, -55 * 16, "S20 -55" },
+	/* Extended resolution */
+	{ 0x10, 0x0032, 0, 0x0B, 0x10, 1, 401, "S20 +25.0625" },
+	{ 0x10, 0xFFEB, 0, 0x02, 0x10, 1, -166, "S20 -10.375" },
+	{ 0x10, 0x0032, 0, 0x0C, 0x00, 0, 0, "S20 no COUNT_PER_C" },
+
+	/* MAX31850, datasheet table 4 */
+	{ 0x3B, 0x6400, 0, 0, 0, 1, 1600 * 16, "MAX +1600" },
+	{ 0x3B, 0x3E80, 0, 0, 0, 1, 1000 * 16, "MAX +1000" },
+	{ 0x3B, 0x064C, 0, 0, 0, 1, 1612, "MAX +100.75" },
+	{ 0x3B, 0x0190, 0, 0, 0, 1, 25 * 16, "MAX +25" },
+	{ 0x3B, 0x0000, 0, 0, 0, 1, 0, "MAX 0" },
+	{ 0x3B, 0xFFFC, 0, 0, 0, 1, -4, "MAX -0.25" },
+	{ 0x3B, 0xFFF0, 0, 0, 0, 1, -16, "MAX -1" },
+	{ 0x3B, 0xF060, 0, 0, 0, 1, -250 * 16, "MAX -250" },
+	{ 0x3B, 0x0192, 0, 0, 0, 1, 25 * 16, "MAX reserved bit" },
+	{ 0x3B, 0x0191, 0, 0, 0, 0, 0, "MAX fault" },
+
+	{ 0x42, 0x0191, CONFIG(12), 0, 0, 0, 0, "unknown family" },
+};
+
+int main(void)
+{
+	uint8_t spad[9];
+	int32_t iTemp;
+	int i, iResult, failures = 0;
+
+	for (i = 0; i < (int) (sizeof(Rows) / sizeof(Rows[0])); i++) {
+		const Row *r = &Rows[i];
+
+		memset(spad, 0xFF, sizeof(spad));
+		spad[0] = r->iRaw;
+		spad[1] = r->iRaw >> 8;
+		spad[4] = r->iConfig;
+		spad[6] = r->iCountRemain;
+		spad[7] = r->iCountPerC;
+
+		iTemp = 0x7FFFFFFF;
+		iResult = ds18_decode(r->iFamily, spad, &iTemp);
+		if (iResult != r->iResult || (iResult && iTemp != r->iTemp16)) {
+			printf("FAIL %s: returned %d, %ld/16\n", r->pName, iResult, (long) iTemp);
+			failures++;
+		}
+	}
+
+	/* Thermometers only, not the EEPROM families sharing the bus */
+	if (!ds18_supported(0x10) || !ds18_supported(0x22) || !ds18_supported(0x28) || !ds18_supported(0x3B)
+			|| ds18_supported(0x00) || ds18_supported(0x2D) || ds18_supported(0x42)) {
+		printf("FAIL family check\n");
+		failures++;
+	}
+
+	/* Conversions round toward zero */
+	if (DS18_TEMP16_TO_MILLI(401) != 25062 || DS18_TEMP16_TO_MILLI(-162) != -10125
+			|| DS18_TEMP16_TO_TENTHS(-162) != -101 || DS18_TEMP16_TO_TENTHS(DS18_TEMP16_POWER_ON) != 850) {
+		printf("FAIL conversions\n");
+		failures++;
+	}
+
+	if (failures)
+		return 1;
+	printf("ds18temp: ok\n");
+	return 0;
+}
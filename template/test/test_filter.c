@@ -0,0 +1,141 @@
+/*
+ * test_filter.c
+ *
+ * Host test of the sensor filter with C versions of the SIMD intrinsics,
+ * see stub/stm32f4xx.h: median against a plain sort, rate rejection and
+ * step acceptance, held and missing inputs, EMA convergence.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "filter.h"
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL line %d: %s\n", __LINE__, #cond); failures++; } } while (0)
+
+static int32_t Median(const int32_t *pValues, int n)
+{
+	int32_t v[FILTER_MEDIAN_MAX], t;
+	int i, j;
+
+	for (i = 0; i < n; i++)
+		v[i] = pValues[i];
+	for (i = 0; i < n; i++)
+		for (j = i + 1; j < n; j++)
+			if (v[j] < v[i]) {
+				t = v[i];
+				v[i] = v[j];
+				v[j] = t;
+			}
+	return v[n / 2];
+}
+
+/* Median of 3 and 5 over random values, all sensors of a full filter */
+static void TestMedian(int iLength)
+{
+	static SensorFilter stFilter;
+	Filter_Config stConfig = { 0, 0, 0, 0 };
+	static int32_t iHistory[200][FILTER_MAX_SENSORS];
+	int32_t iOutput[FILTER_MAX_SENSORS];
+	uint8_t bValid[FILTER_MAX_SENSORS], iFlags[FILTER_MAX_SENSORS];
+	int32_t iWindow[FILTER_MEDIAN_MAX];
+	int k, s, i;
+
+	stConfig.iMedianLength = iLength;
+	Filter_Init(&stFilter, &stConfig, FILTER_MAX_SENSORS);
+	for (s = 0; s < FILTER_MAX_SENSORS; s++)
+		bValid[s] = 1;
+
+	for (k = 0; k < 200; k++) {
+		for (s = 0; s < FILTER_MAX_SENSORS; s++)
+			iHistory[k][s] = rand() % 4001 - 2000;
+		CHECK(Filter_Run(&stFilter, iHistory[k], bValid, iOutput, iFlags) == 0);
+		if (k < iLength - 1)
+			continue;
+		for (s = 0; s < FILTER_MAX_SENSORS; s++) {
+			for (i = 0; i < iLength; i++)
+				iWindow[i] = iHistory[k - i][s];
+			CHECK(iOutput[s] == Median(iWindow, iLength));
+			CHECK(iFlags[s] == 0);
+		}
+	}
+}
+
+/* Spike rejected, persistent step accepted after the reject limit */
+static void TestRate(void)
+{
+	static SensorFilter stFilter;
+	const Filter_Config stConfig = { 1, 3, 16, 0 };
+	static const int32_t iInput[] = { 400, 401, 900, 402, 1000, 1000, 1000, 1000, 1000 };
+	static const int32_t iExpect[] = { 400, 401, 401, 402, 402, 402, 1000, 1000, 1000 };
+	static const uint8_t iExpectFlags[] = { 0, 0, FILTER_FLAG_REJECTED, 0, FILTER_FLAG_REJECTED,
+			FILTER_FLAG_REJECTED, 0, 0, 0 };
+	int32_t iIn[2], iOut[2];
+	uint8_t bValid[2] = { 1, 1 }, iFlags[2];
+	int k;
+
+	Filter_Init(&stFilter, &stConfig, 2);
+	for (k = 0; k < (int) (sizeof(iInput) / sizeof(iInput[0])); k++) {
+		iIn[0] = iInput[k];
+		iIn[1] = -iInput[k];
+		Filter_Run(&stFilter, iIn, bValid, iOut, iFlags);
+		CHECK(iOut[0] == iExpect[k] && iFlags[0] == iExpectFlags[k]);
+		CHECK(iOut[1] == -iExpect[k] && iFlags[1] == iExpectFlags[k]);
+	}
+}
+
+/* Invalid input repeats the last value, or gives 0 before the first one */
+static void TestHeld(void)
+{
+	static SensorFilter stFilter;
+	const Filter_Config stConfig = { 3, 3, 16, 0 };
+	int32_t iIn[2] = { 500, 0 }, iOut[2];
+	uint8_t bValid[2] = { 1, 0 }, iFlags[2];
+
+	Filter_Init(&stFilter, &stConfig, 2);
+	Filter_Run(&stFilter, iIn, bValid, iOut, iFlags);
+	CHECK(iOut[0] == 500 && iFlags[0] == 0);
+	CHECK(iOut[1] == 0 && (iFlags[1] & FILTER_FLAG_NO_DATA));
+
+	bValid[0] = 0;
+	iIn[0] = 9999;
+	Filter_Run(&stFilter, iIn, bValid, iOut, iFlags);
+	CHECK(iOut[0] == 500 && (iFlags[0] & FILTER_FLAG_HELD));
+}
+
+/* EMA with alpha 1/8 approaches a step without overshoot */
+static void TestEma(void)
+{
+	static SensorFilter stFilter;
+	const Filter_Config stConfig = { 1, 0, 0, 4096 };
+	int32_t iIn[2] = { 0, -1600 }, iOut[2], iPrevious = 0;
+	uint8_t bValid[2] = { 1, 1 }, iFlags[2];
+	int k;
+
+	Filter_Init(&stFilter, &stConfig, 2);
+	Filter_Run(&stFilter, iIn, bValid, iOut, iFlags);
+	iIn[0] = 1600;
+	for (k = 0; k < 60; k++) {
+		Filter_Run(&stFilter, iIn, bValid, iOut, iFlags);
+		CHECK(iOut[0] >= iPrevious && iOut[0] <= 1600);
+		CHECK(iOut[1] == -1600);
+		iPrevious = iOut[0];
+	}
+	CHECK(iOut[0] >= 1590);
+}
+
+int main(void)
+{
+	srand(4321);
+	TestMedian(3);
+	TestMedian(5);
+	TestRate();
+	TestHeld();
+	TestEma();
+
+	if (failures)
+		return 1;
+	printf("filter: ok\n");
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * test_flashlog.c
+ *
+ * Host test of the flash log on the RAM medium of flashlog_ram.c: append
+ * and read back, recovery after a reset, wrapping over all sectors with
+ * equal wear, and skipping a torn slot.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "flashlog.h"
+
+static uint32_t iNext;
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL line %d: %s\n", __LINE__, #cond); failures++; } } while (0)
+
+/* Samples with consecutive sequence numbers and a value derived from it */
+static int Push(int iCount)
+{
+	Sample stSample[FLASHLOG_RECORD_SAMPLES];
+	int i, iStored;
+
+	for (i = 0; i < iCount; i++) {
+		memset(&stSample[i], 0, sizeof(Sample));
+		stSample[i].iSequence = iNext + i;
+		stSample[i].iValue = (iNext + i) * 3;
+	}
+	iStored = FlashLog_Append(stSample, iCount);
+	iNext += iStored;
+	return iStored;
+}
+
+static void PollAll(void)
+{
+	int i;
+
+	for (i = 0; i < 10; i++)
+		FlashLog_Poll();
+}
+
+/* Read the whole log, returns number of samples, *pLast the newest one */
+static int ReadAll(uint32_t *pLast)
+{
+	FlashLog_Cursor stCursor;
+	Sample stSample[64];
+	int i, n, iTotal = 0;
+
+	FlashLog_CursorInit(&stCursor);
+	while ((n = FlashLog_Read(&stCursor, stSample, 64)) > 0) {
+		for (i = 0; i < n; i++) {
+			if (iTotal + i > 0)
+				CHECK(stSample[i].iSequence == *pLast + 1);
+			CHECK(stSample[i].iValue == (int32_t) stSample[i].iSequence * 3);
+			*pLast = stSample[i].iSequence;
+		}
+		iTotal += n;
+	}
+	return iTotal;
+}
+
+/* Spoil one word of the first blank slot of the sector being written */
+static int TearSlot(void)
+{
+	uint32_t *pMemory = (uint32_t *) FlashLog_Ram.pBase;
+	const int iSlotWords = FLASHLOG_SLOT_SIZE / 4;
+	const int iSectorWords = FlashLog_Ram.iSectorSize / 4;
+	const FlashLog_Header *pHeader;
+	int i, j, bBlank;
+
+	for (i = 0; i < FlashLog_Ram.iSectors * iSectorWords; i += iSlotWords) {
+		if (i % iSectorWords == 0)
+			continue;
+		pHeader = (const FlashLog_Header *) &pMemory[i / iSectorWords * iSectorWords];
+		if (pHeader->iMagic != FLASHLOG_MAGIC || pHeader->iSequence == 0xFFFFFFFF)
+			continue;
+		for (bBlank = 1, j = 0; j < iSlotWords; j++)
+			if (pMemory[i + j] != 0xFFFFFFFF)
+				bBlank = 0;
+		if (bBlank) {
+			pMemory[i + 5] = 0x1234;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(void)
+{
+	uint32_t iLast = 0, iMin, iMax;
+	int i;
+
+	/* Fresh medium, sectors get erased by the poll */
+	CHECK(FlashLog_Init(&FlashLog_Ram));
+	PollAll();
+	for (i = 0; i < 7; i++)
+		CHECK(Push(3) == 3);
+	PollAll();
+	CHECK(ReadAll(&iLast) == 21 && iLast == 20);
+
+	/* Reset keeps everything programmed */
+	CHECK(FlashLog_Init(&FlashLog_Ram));
+	for (i = 0; i < 7; i++)
+		CHECK(Push(FLASHLOG_RECORD_SAMPLES) == FLASHLOG_RECORD_SAMPLES);
+	CHECK(ReadAll(&iLast) == 21 + 7 * FLASHLOG_RECORD_SAMPLES && iLast == iNext - 1);
+
+	/* Wrap many times, the newest samples survive and wear is even */
+	for (i = 0; i < 500; i++) {
+		Push(FLASHLOG_RECORD_SAMPLES);
+		FlashLog_Poll();
+	}
+	PollAll();
+	CHECK(ReadAll(&iLast) > 0 && iLast == iNext - 1);
+	CHECK(FlashLog_Errors() == 0);
+	iMin = iMax = FlashLog_EraseCount(0);
+	for (i = 1; i < FlashLog_Ram.iSectors; i++) {
+		if (FlashLog_EraseCount(i) < iMin)
+			iMin = FlashLog_EraseCount(i);
+		if (FlashLog_EraseCount(i) > iMax)
+			iMax = FlashLog_EraseCount(i);
+	}
+	CHECK(iMin > 0 && iMax - iMin <= 1);
+
+	/* Torn slot is skipped after a reset, nothing older is lost */
+	CHECK(FlashLog_Init(&FlashLog_Ram));
+	CHECK(TearSlot());
+	CHECK(FlashLog_Init(&FlashLog_Ram));
+	for (i = 0; i < 3; i++)
+		CHECK(Push(FLASHLOG_RECORD_SAMPLES) == FLASHLOG_RECORD_SAMPLES);
+	CHECK(ReadAll(&iLast) > 0 && iLast == iNext - 1);
+
+	if (failures)
+		return 1;
+	printf("flashlog: ok\n");
+	return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * test_owco.c
+ *
+ * Host test of the 1-Wire coroutines on a stubbed transaction queue and
+ * timer: completion before the submitting call has returned, completion
+ * from a later interrupt, a full queue at the start and in the middle of a
+ * flow, and an empty frame pool.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "OneWire.h"
+
+uint32_t StubPrimask;
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL line %d: %s\n", __LINE__, #cond); failures++; } } while (0)
+
+/* Queue stand-in: completes at once, later by Complete, or is full */
+enum { QUEUE_LATER, QUEUE_AT_ONCE, QUEUE_FULL };
+
+static int iMode;
+static OW_Transaction *Pending[OW_CO_POOL_SIZE];
+static int iPending, iInSubmit;
+static SwTimer *Timers[OW_CO_POOL_SIZE];
+static int iTimers;
+
+OW_State OW_QueueSubmit(OW_Bus *pBus, OW_Transaction *pTransaction)
+{
+	if (iMode == QUEUE_FULL || iPending == OW_CO_POOL_SIZE) {
+		pTransaction->iStatus = OW_TR_FAILED;
+		return OW_BUSY;
+	}
+	pTransaction->iStatus = OW_TR_PENDING;
+	if (iMode == QUEUE_AT_ONCE) {
+		/* Completion interrupt comes before the submit returns */
+		iInSubmit++;
+		pTransaction->iStatus = OW_TR_DONE;
+		pTransaction->callback(pBus, pTransaction);
+		iInSubmit--;
+		return OW_OK;
+	}
+	Pending[iPending++] = pTransaction;
+	return OW_OK;
+}
+
+/* Oldest transaction leaves the queue before its callback, as on the bus */
+static void Complete(OW_Bus *pBus, OW_TrStatus iStatus)
+{
+	OW_Transaction *pTransaction = Pending[0];
+
+	iPending--;
+	memmove(&Pending[0], &Pending[1], iPending * sizeof(Pending[0]));
+	pTransaction->iStatus = iStatus;
+	pTransaction->callback(pBus, pTransaction);
+}
+
+void SwTimer_Start(SwTimer *pTimer, uint32_t iDelay, uint32_t iPeriod, SwTimerCallback callback, void *pContext)
+{
+	(void) iDelay;
+	pTimer->iPeriod = iPeriod;
+	pTimer->callback = callback;
+	pTimer->pContext = pContext;
+	if (iMode == QUEUE_AT_ONCE)
+		callback(pTimer);
+	else
+		Timers[iTimers++] = pTimer;
+}
+
+static void Expire(void)
+{
+	SwTimer *pTimer;
+
+	while (iTimers) {
+		pTimer = Timers[--iTimers];
+		pTimer->callback(pTimer);
+	}
+}
+
+/* Result of every await, whether it ran inside a submit */
+typedef struct {
+	char Trace[8];
+	int iNotes;
+	int iNested;
+} Context;
+
+static void Note(Context *pContext, OW_Co *pCo)
+{
+	static const char Status[] = "PDNCF";
+
+	pContext->Trace[pContext->iNotes++] = Status[pCo->iStatus];
+	pContext->iNested += iInSubmit > 0;
+}
+
+/* Convert, wait and read, as a thermometer driver does */
+static void Flow(OW_Co *pCo)
+{
+	Context *pContext = pCo->pContext;
+
+	OW_CO_BEGIN(pCo);
+	OW_CO_TRANSACT(pCo, OW_TR_SELECT | OW_TR_COMMAND, pCo->iAddress, 0x44, 0, 0, 0, 0);
+	Note(pContext, pCo);
+	if (pCo->iStatus != OW_TR_DONE)
+		OW_CO_EXIT(pCo);
+	OW_CO_DELAY(pCo, 750);
+	Note(pContext, pCo);
+	OW_CO_TRANSACT(pCo, OW_TR_SELECT | OW_TR_COMMAND | OW_TR_CRC8, pCo->iAddress, 0xBE, 0, 0, pCo->iBuffer, 9);
+	Note(pContext, pCo);
+	OW_CO_END(pCo);
+}
+
+static OW_Co *Start(OW_Bus *pBus, Context *pContext)
+{
+	OW_Co *pCo;
+
+	memset(pContext, 0, sizeof(Context));
+	pCo = OW_CoCreate(pBus, Flow, pContext);
+	if (pCo) {
+		pCo->iAddress = 0x28;
+		OW_CoStart(pCo);
+	}
+	return pCo;
+}
+
+int main(void)
+{
+	static OW_Bus stBus;
+	Context stContext, Contexts[OW_CO_POOL_SIZE];
+	int i;
+
+	/* Every step completes inside its own submit, the flow still ends once */
+	iMode = QUEUE_AT_ONCE;
+	CHECK(Start(&stBus, &stContext) != 0);
+	CHECK(strcmp(stContext.Trace, "DDD") == 0);
+	CHECK(stContext.iNested == 3);
+	CHECK(iInSubmit == 0 && OW_CoActive() == 0);
+
+	/* Completion from a later interrupt, the flow gives up on no device */
+	iMode = QUEUE_LATER;
+	CHECK(Start(&stBus, &stContext) != 0);
+	CHECK(OW_CoActive() == 1 && iPending == 1 && stContext.iNotes == 0);
+	Complete(&stBus, OW_TR_NO_DEV);
+	CHECK(strcmp(stContext.Trace, "N") == 0);
+	CHECK(OW_CoActive() == 0 && iPending == 0);
+
+	/* Whole flow, delay in between */
+	Start(&stBus, &stContext);
+	Complete(&stBus, OW_TR_DONE);
+	CHECK(strcmp(stContext.Trace, "D") == 0 && iTimers == 1 && iPending == 0);
+	Expire();
+	CHECK(strcmp(stContext.Trace, "DD") == 0 && iPending == 1);
+	Complete(&stBus, OW_TR_DONE);
+	CHECK(strcmp(stContext.Trace, "DDD") == 0 && stContext.iNested == 0);
+	CHECK(OW_CoActive() == 0);
+
+	/* Full queue: the flow continues at once with OW_TR_FAILED */
+	iMode = QUEUE_FULL;
+	CHECK(Start(&stBus, &stContext) != 0);
+	CHECK(strcmp(stContext.Trace, "F") == 0 && OW_CoActive() == 0);
+
+	/* Queue fills up while the flow waits */
+	iMode = QUEUE_LATER;
+	Start(&stBus, &stContext);
+	Complete(&stBus, OW_TR_DONE);
+	iMode = QUEUE_FULL;
+	Expire();
+	CHECK(strcmp(stContext.Trace, "DDF") == 0 && OW_CoActive() == 0);
+
+	/* Empty pool refuses new flows until one ends */
+	iMode = QUEUE_LATER;
+	for (i = 0; i < OW_CO_POOL_SIZE; i++)
+		CHECK(Start(&stBus, &Contexts[i]) != 0);
+	CHECK(OW_CoActive() == OW_CO_POOL_SIZE);
+	CHECK(Start(&stBus, &stContext) == 0);
+	Complete(&stBus, OW_TR_NO_DEV);
+	CHECK(strcmp(Contexts[0].Trace, "N") == 0);
+	CHECK(Start(&stBus, &stContext) != 0);
+	while (iPending)
+		Complete(&stBus, OW_TR_NO_DEV);
+	CHECK(strcmp(stContext.Trace, "N") == 0 && strcmp(Contexts[OW_CO_POOL_SIZE - 1].Trace, "N") == 0);
+	CHECK(OW_CoActive() == 0);
+
+	if (failures)
+		return 1;
+	printf("owco: ok\n");
+	return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * test_owcrc.c
+ *
+ * Host test of owcrc against the CRC code it replaced: the Dallas table of
+ * crcutil.c and OneWire_HL.c, the bitwise CrcByte of temp.c and the odd
+ * parity docrc16 of crcutil.c. Built once per variant by the Makefile.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "owcrc.h"
+
+#ifndef VARIANT
+#define VARIANT "table"
+#endif
+
+static const uint8_t dscrc_table[] = {
+        0, 94,188,226, 97, 63,221,131,194,156,126, 32,163,253, 31, 65,
+      157,195, 33,127,252,162, 64, 30, 95,  1,227,189, 62, 96,130,220,
+       35,125,159,193, 66, 28,254,160,225,191, 93,  3,128,222, 60, 98,
+      190,224,  2, 92,223,129, 99, 61,124, 34,192,158, 29, 67,161,255,
+       70, 24,250,164, 39,121,155,197,132,218, 56,102,229,187, 89,  7,
+      219,133,103, 57,186,228,  6, 88, 25, 71,165,251,120, 38,196,154,
+      101, 59,217,135,  4, 90,184,230,167,249, 27, 69,198,152,122, 36,
+      248,166, 68, 26,153,199, 37,123, 58,100,134,216, 91,  5,231,185,
+      140,210, 48,110,237,179, 81, 15, 78, 16,242,172, 47,113,147,205,
+       17, 79,173,243,112, 46,204,146,211,141,111, 49,178,236, 14, 80,
+      175,241, 19, 77,206,144,114, 44,109, 51,209,143, 12, 82,176,238,
+       50,108,142,208, 83, 13,239,177,240,174, 76, 18,145,207, 45,115,
+      202,148,118, 40,171,245, 23, 73,  8, 86,180,234,105, 55,213,139,
+       87,  9,235,181, 54,104,138,212,149,203, 41,119,244,170, 72, 22,
+      233,183, 85, 11,136,214, 52,106, 43,117,151,201, 74, 20,246,168,
+      116, 42,200,150, 21, 75,169,247,182,232, 10, 84,215,137,107, 53};
+
+static uint8_t ref_crc8_table(uint8_t crc, const uint8_t *p, int len)
+{
+	while (len--)
+		crc = dscrc_table[crc ^ *p++];
+	return crc;
+}
+
+/* CrcByte/CrcCheck of temp.c, generator 0x8C */
+static uint8_t ref_crc8_bitwise(uint8_t crc, const uint8_t *p, int len)
+{
+	uint8_t i, b;
+
+	while (len--) {
+		b = crc ^ *p++;
+		crc = 0;
+		for (i = 0; i < 8; i++) {
+			if ((crc ^ b) & 0x01)
+				crc = (crc >> 1) ^ 0x8C;
+			else
+				crc >>= 1;
+			b >>= 1;
+		}
+	}
+	return crc;
+}
+
+static const short oddparity[16] = { 0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0 };
+
+/* docrc16 of crcutil.c */
+static uint16_t ref_crc16_parity(uint16_t crc, const uint8_t *p, int len)
+{
+	uint16_t cdata;
+
+	while (len--) {
+		cdata = (*p++ ^ (crc & 0xff)) & 0xff;
+		crc >>= 8;
+		if (oddparity[cdata & 0xf] ^ oddparity[cdata >> 4])
+			crc ^= 0xc001;
+		cdata <<= 6;
+		crc ^= cdata;
+		cdata <<= 1;
+		crc ^= cdata;
+	}
+	return crc;
+}
+
+static int failures;
+
+static void check(int ok, const char *what, int len)
+{
+	if (!ok) {
+		printf("FAIL %s, length %d\n", what, len);
+		failures++;
+	}
+}
+
+int main(void)
+{
+	static uint8_t buf[300];
+	uint8_t crc8;
+	uint16_t crc16;
+	int i, n, len, off;
+
+	srand(12345);
+	for (n = 0; n < 2000; n++) {
+		len = rand() % 257;
+		off = rand() % 4;			/* Unaligned starts */
+		crc8 = rand();
+		crc16 = rand();
+		for (i = 0; i < len; i++)
+			buf[off + i] = rand();
+
+		check(crc8_block(crc8, buf + off, len) == ref_crc8_table(crc8, buf + off, len), "crc8 vs table", len);
+		check(crc8_block(crc8, buf + off, len) == ref_crc8_bitwise(crc8, buf + off, len), "crc8 vs bitwise", len);
+		check(crc16_block(crc16, buf + off, len) == ref_crc16_parity(crc16, buf + off, len), "crc16 vs odd parity", len);
+		if (len > 0)
+			check(crc8_byte(crc8, buf[off]) == ref_crc8_table(crc8, buf + off, 1), "crc8_byte", 1);
+	}
+
+	/* ROM with its own CRC checks to 0 */
+	buf[0] = 0x28; buf[1] = 0xFF; buf[2] = 0x4C; buf[3] = 0x61;
+	buf[4] = 0x70; buf[5] = 0x16; buf[6] = 0x04;
+	buf[7] = ref_crc8_table(0, buf, 7);
+	check(crc8_block(0, buf, 8) == 0, "ROM check", 8);
+
+	/* Inverted CRC16 appended to a page gives 0xB001 */
+	for (i = 0; i < 32; i++)
+		buf[i] = i * 37;
+	crc16 = ~crc16_block(0, buf, 32);
+	buf[32] = crc16;
+	buf[33] = crc16 >> 8;
+	check(crc16_block(0, buf, 34) == 0xB001, "page check", 34);
+
+	if (failures)
+		return 1;
+	printf("%s: ok\n", VARIANT);
+	return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * test_sched.c
+ *
+ * Host test of the scheduler: run order by priority, merging of posted
+ * events, posts from a running task, timer events, and the run and cycle
+ * accounting on a stubbed DWT counter.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "stm32f4xx.h"
+#include "sched.h"
+
+uint32_t StubPrimask;
+Stub_DWT_Type StubDWT;
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL line %d: %s\n", __LINE__, #cond); failures++; } } while (0)
+
+/* The scheduler only needs the timer to call back, it does so at once */
+void SwTimer_Start(SwTimer *pTimer, uint32_t iDelay, uint32_t iPeriod, SwTimerCallback callback, void *pContext)
+{
+	(void) iDelay;
+	pTimer->iPeriod = iPeriod;
+	pTimer->pContext = pContext;
+	callback(pTimer);
+}
+
+static Sched_Task stHigh, stLowA, stLowB, stSpare[SCHED_MAX_TASKS];
+
+/* Run log: task name and events of each run */
+static char Order[16];
+static uint32_t Events[16];
+static int iRuns;
+
+/* Events above 0xFF are the cycles the run takes */
+static void Task(Sched_Task *pTask, uint32_t iEvents)
+{
+	if (iRuns < (int) sizeof(Order) - 1) {
+		Order[iRuns] = pTask->pName[0];
+		Events[iRuns++] = iEvents;
+	}
+	Order[iRuns] = 0;
+	StubDWT.CYCCNT += iEvents >> 8 & 0xFFFF;
+
+	/* A posts to H and to itself while running */
+	if (pTask == &stLowA && (iEvents & 0x01)) {
+		Sched_Post(&stHigh, 0x10);
+		Sched_Post(&stLowA, 0x20);
+	}
+}
+
+static void RunAll(void)
+{
+	int i;
+
+	iRuns = 0;
+	Order[0] = 0;
+	for (i = 0; i < 10 && Sched_RunOnce(); i++)
+		;
+}
+
+int main(void)
+{
+	SwTimer stTimer;
+	int i;
+
+	/* Added out of order, same priority keeps the order of adding */
+	CHECK(Sched_Add(&stLowA, "A", Task, 5));
+	CHECK(Sched_Add(&stHigh, "H", Task, 1));
+	CHECK(Sched_Add(&stLowB, "B", Task, 5));
+	CHECK(stHigh.iIndex == 0 && stLowA.iIndex == 1 && stLowB.iIndex == 2);
+	CHECK(Sched_RunOnce() == 0);
+
+	/* Highest priority first, whoever posted first */
+	Sched_Post(&stLowB, 0x02);
+	Sched_Post(&stLowA, 0x04);
+	Sched_Post(&stHigh, 0x08);
+	RunAll();
+	CHECK(strcmp(Order, "HAB") == 0);
+	CHECK(Sched_RunOnce() == 0);
+
+	/* Posts before a run are merged into one call */
+	Sched_Post(&stLowB, 0x02);
+	Sched_Post(&stLowB, 0x04);
+	Sched_Post(&stLowB, 0x02);
+	RunAll();
+	CHECK(strcmp(Order, "B") == 0 && Events[0] == 0x06);
+
+	/* Posts from a running task: the higher task goes before A runs again */
+	Sched_Post(&stLowA, 0x01);
+	Sched_Post(&stLowB, 0x02);
+	RunAll();
+	CHECK(strcmp(Order, "AHAB") == 0);
+	CHECK(Events[0] == 0x01 && Events[1] == 0x10 && Events[2] == 0x20 && Events[3] == 0x02);
+
+	/* Timer posts its event bit */
+	Sched_TimerStart(&stTimer, &stLowB, 1000, 0);
+	RunAll();
+	CHECK(strcmp(Order, "B") == 0 && Events[0] == SCHED_EV_TIMER);
+
+	/* Runs and cycles, also across a counter wrap */
+	stHigh.iRuns = 0;
+	stHigh.iCycles = 0;
+	stHigh.iMaxCycles = 0;
+	StubDWT.CYCCNT = 0xFFFFFF00;
+	Sched_Post(&stHigh, 300 << 8);
+	RunAll();
+	Sched_Post(&stHigh, 1000 << 8);
+	RunAll();
+	Sched_Post(&stHigh, 200 << 8);
+	RunAll();
+	CHECK(stHigh.iRuns == 3);
+	CHECK(stHigh.iCycles == 1500);
+	CHECK(stHigh.iMaxCycles == 1000);
+	CHECK(stLowA.iRuns == 3 && stLowB.iRuns == 4);
+
+	/* Table is full at SCHED_MAX_TASKS */
+	for (i = 3; i < SCHED_MAX_TASKS; i++)
+		CHECK(Sched_Add(&stSpare[i], "S", Task, 9));
+	CHECK(!Sched_Add(&stSpare[0], "S", Task, 0));
+	CHECK(stHigh.iIndex == 0);
+
+	if (failures)
+		return 1;
+	printf("sched: ok\n");
+	return 0;
+}
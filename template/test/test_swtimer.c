@@ -0,0 +1,166 @@
+/*
+ * test_swtimer.c
+ *
+ * Host test of the software timers on a stubbed microsecond clock: order
+ * across the clock wrap, periodic timers after a late run, and stopping
+ * and restarting timers from inside a callback.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "stm32f4xx.h"
+#include "swtimer.h"
+#include "timer_delay.h"
+
+uint32_t StubPrimask;
+Stub_DWT_Type StubDWT;
+
+static uint32_t iNow, iAlarm;
+static int bAlarm;
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL line %d: %s\n", __LINE__, #cond); failures++; } } while (0)
+
+uint32_t Time_us(void)
+{
+	return iNow;
+}
+
+void Time_AlarmSet(uint32_t at)
+{
+	iAlarm = at;
+	bAlarm = 1;
+}
+
+void Time_AlarmCancel(void)
+{
+	bAlarm = 0;
+}
+
+/* Expiry log, pContext names the timer */
+static char Fired[16];
+static int iFired;
+
+static void Fire(SwTimer *pTimer)
+{
+	CHECK(!StubPrimask);
+	if (iFired < (int) sizeof(Fired) - 1)
+		Fired[iFired++] = *(const char *) pTimer->pContext;
+	Fired[iFired] = 0;
+}
+
+static void Run(uint32_t iAt)
+{
+	iNow = iAt;
+	iFired = 0;
+	Fired[0] = 0;
+	SwTimer_Run();
+	CHECK(!StubPrimask);
+}
+
+static SwTimer stA, stB, stC;
+
+/* Stops itself on the third expiry */
+static int iCalls;
+
+static void StopSelf(SwTimer *pTimer)
+{
+	Fire(pTimer);
+	if (++iCalls == 3)
+		SwTimer_Stop(pTimer);
+}
+
+/* One-shot that comes back 100 us later, twice */
+static void Restart(SwTimer *pTimer)
+{
+	Fire(pTimer);
+	if (++iCalls < 3)
+		SwTimer_Start(pTimer, 100, 0, Restart, pTimer->pContext);
+}
+
+/* Stops the other timer that expires at the same time */
+static void StopB(SwTimer *pTimer)
+{
+	Fire(pTimer);
+	SwTimer_Stop(&stB);
+}
+
+int main(void)
+{
+	uint32_t iDeadline;
+
+	/* Nothing runs */
+	CHECK(!SwTimer_NextDeadline(&iDeadline));
+
+	/* Deadlines on both sides of the wrap, in deadline order */
+	iNow = 0xFFFFFF00;
+	SwTimer_Start(&stA, 0x200, 0, Fire, "A");
+	SwTimer_Start(&stB, 0x80, 0, Fire, "B");
+	SwTimer_Start(&stC, 0x200, 0, Fire, "C");
+	CHECK(!StubPrimask);
+	CHECK(SwTimer_NextDeadline(&iDeadline) && iDeadline == 0xFFFFFF80);
+	CHECK(bAlarm && iAlarm == 0xFFFFFF80);
+	Run(0xFFFFFF7F);
+	CHECK(strcmp(Fired, "") == 0);
+	Run(0xFFFFFF80);
+	CHECK(strcmp(Fired, "B") == 0);
+	CHECK(!SwTimer_Active(&stB) && SwTimer_Active(&stA));
+	CHECK(bAlarm && iAlarm == 0x100);
+	Run(0x50);
+	CHECK(strcmp(Fired, "") == 0);
+	/* Same deadline: started first, expires first */
+	Run(0x120);
+	CHECK(strcmp(Fired, "AC") == 0);
+	CHECK(!bAlarm && !SwTimer_NextDeadline(&iDeadline));
+
+	/* Periodic: one call per late run, missed periods are skipped */
+	iNow = 0;
+	SwTimer_Start(&stA, 1000, 1000, Fire, "A");
+	Run(1000);
+	CHECK(strcmp(Fired, "A") == 0 && iAlarm == 2000);
+	Run(2500);
+	CHECK(strcmp(Fired, "A") == 0 && iAlarm == 3000);
+	Run(10500);
+	CHECK(strcmp(Fired, "A") == 0 && iAlarm == 11500);
+	CHECK(SwTimer_Active(&stA));
+	SwTimer_Stop(&stA);
+	CHECK(!SwTimer_Active(&stA) && !bAlarm);
+
+	/* Periodic timer stopping itself from its callback */
+	iCalls = 0;
+	iNow = 0xFFFFFFF0;
+	SwTimer_Start(&stA, 0x10, 0x10, StopSelf, "A");
+	Run(0);
+	Run(0x10);
+	CHECK(SwTimer_Active(&stA));
+	Run(0x20);
+	CHECK(strcmp(Fired, "A") == 0 && iCalls == 3);
+	CHECK(!SwTimer_Active(&stA) && !bAlarm);
+	Run(0x30);
+	CHECK(strcmp(Fired, "") == 0);
+
+	/* One-shot restarting itself from its callback */
+	iCalls = 0;
+	iNow = 0;
+	SwTimer_Start(&stA, 100, 0, Restart, "A");
+	Run(100);
+	CHECK(SwTimer_Active(&stA) && iAlarm == 200);
+	Run(250);
+	CHECK(strcmp(Fired, "A") == 0 && SwTimer_Active(&stA) && iAlarm == 350);
+	Run(350);
+	CHECK(strcmp(Fired, "A") == 0 && iCalls == 3 && !SwTimer_Active(&stA) && !bAlarm);
+
+	/* Stopped by an earlier callback of the same run, never called */
+	iNow = 0;
+	SwTimer_Start(&stA, 10, 0, StopB, "A");
+	SwTimer_Start(&stB, 10, 0, Fire, "B");
+	SwTimer_Start(&stC, 20, 0, Fire, "C");
+	Run(20);
+	CHECK(strcmp(Fired, "AC") == 0);
+	CHECK(!bAlarm);
+
+	if (failures)
+		return 1;
+	printf("swtimer: ok\n");
+	return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * test_telemetry.c
+ *
+ * Host test of the telemetry frame coding: round trip of every batch size,
+ * no 0 byte before the delimiter, a payload longer than one COBS block,
+ * and rejection of corrupted and truncated frames.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "telemetry.h"
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL line %d: %s\n", __LINE__, #cond); failures++; } } while (0)
+
+/* Samples with plenty of 0 bytes */
+static void Fill(Sample *pSamples, int iCount)
+{
+	int i;
+
+	for (i = 0; i < iCount; i++) {
+		memset(&pSamples[i], 0, sizeof(Sample));
+		pSamples[i].iSensor = i;
+		pSamples[i].iBus = i & 1;
+		pSamples[i].iValue = i * 100 - 500;
+		pSamples[i].iTimestamp = 1000 * i;
+		pSamples[i].iSequence = i << 16;
+	}
+}
+
+/* Only the delimiter may be 0 */
+static int Delimited(const uint8_t *pFrame, int iLength)
+{
+	int i;
+
+	for (i = 0; i < iLength - 1; i++)
+		if (pFrame[i] == 0)
+			return 0;
+	return iLength > 0 && pFrame[iLength - 1] == 0;
+}
+
+int main(void)
+{
+	Sample stIn[TELEMETRY_BATCH], stOut[TELEMETRY_BATCH];
+	uint8_t Frame[TELEMETRY_FRAME_MAX], Spoilt[TELEMETRY_FRAME_MAX];
+	uint16_t iSequence;
+	int i, n, iLength;
+
+	/* Round trip of 0..TELEMETRY_BATCH samples, with and without delimiter */
+	Fill(stIn, TELEMETRY_BATCH);
+	for (n = 0; n <= TELEMETRY_BATCH; n++) {
+		iLength = Telemetry_FrameBuild(Frame, 0x0100 + n, stIn, n);
+		CHECK(iLength <= (int) TELEMETRY_FRAME_MAX);
+		CHECK(Delimited(Frame, iLength));
+		memset(stOut, 0xEE, sizeof(stOut));
+		CHECK(Telemetry_FrameParse(Frame, iLength, &iSequence, stOut, TELEMETRY_BATCH) == n);
+		CHECK(iSequence == 0x0100 + n);
+		CHECK(memcmp(stIn, stOut, n * sizeof(Sample)) == 0);
+		CHECK(Telemetry_FrameParse(Frame, iLength - 1, &iSequence, stOut, TELEMETRY_BATCH) == n);
+	}
+
+	/* Larger batches are cut, smaller buffers refuse the frame */
+	iLength = Telemetry_FrameBuild(Frame, 1, stIn, TELEMETRY_BATCH + 5);
+	CHECK(Telemetry_FrameParse(Frame, iLength, &iSequence, stOut, TELEMETRY_BATCH) == TELEMETRY_BATCH);
+	CHECK(Telemetry_FrameParse(Frame, iLength, &iSequence, stOut, TELEMETRY_BATCH - 1) == -1);
+
+	/* No 0 in the payload: the first block holds 254 bytes, the rest follows */
+	memset(stIn, 0xA5, sizeof(stIn));
+	iLength = Telemetry_FrameBuild(Frame, 0x0203, stIn, TELEMETRY_BATCH);
+	CHECK(Frame[0] == 0xFF);
+	CHECK(iLength <= (int) TELEMETRY_FRAME_MAX);
+	CHECK(Delimited(Frame, iLength));
+	CHECK(Telemetry_FrameParse(Frame, iLength, &iSequence, stOut, TELEMETRY_BATCH) == TELEMETRY_BATCH);
+	CHECK(iSequence == 0x0203);
+	CHECK(memcmp(stIn, stOut, sizeof(stIn)) == 0);
+
+	/* Any single corrupted byte fails the frame */
+	for (i = 0; i < iLength - 1; i++) {
+		memcpy(Spoilt, Frame, iLength);
+		Spoilt[i] ^= 0x10;
+		CHECK(Telemetry_FrameParse(Spoilt, iLength, &iSequence, stOut, TELEMETRY_BATCH) == -1);
+	}
+
+	/* So does every truncation, also of a frame with 0 bytes */
+	for (i = 0; i < iLength - 1; i++)
+		CHECK(Telemetry_FrameParse(Frame, i, &iSequence, stOut, TELEMETRY_BATCH) == -1);
+	Fill(stIn, TELEMETRY_BATCH);
+	iLength = Telemetry_FrameBuild(Frame, 7, stIn, TELEMETRY_BATCH);
+	for (i = 0; i < iLength - 1; i++)
+		CHECK(Telemetry_FrameParse(Frame, i, &iSequence, stOut, TELEMETRY_BATCH) == -1);
+
+	if (failures)
+		return 1;
+	printf("telemetry: ok\n");
+	return 0;
+}
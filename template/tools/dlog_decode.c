@@ -0,0 +1,147 @@
+/*
+ * dlog_decode.c
+ *
+ * Host decoder of the DLOG_BINARY frames, see dlog.h. Reads a SWO capture
+ * of the ITM packet stream, e.g. from "tpiu config internal swo.bin uart
+ * off 168000000" of OpenOCD, picks the 32 bit writes to DLOG_ITM_PORT and
+ * prints the messages with the format table of the firmware.
+ *
+ * Usage: dlog_decode [-w] [-f MHz] [file]
+ *  -w      input holds only the little endian words of the port
+ *  -f MHz  core clock for the timestamps, default 168
+ */
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "dlog.h"
+
+#define DLOG_FORMAT(id, format)	format,
+
+static const char *const Formats[DLOG_COUNT] = {
+	"",
+	DLOG_MESSAGES(DLOG_FORMAT)
+};
+
+/* Frame being assembled */
+static uint32_t iFrame[2 + DLOG_MAX_ARGS];
+static int iWords, iLength;
+
+static double fClockMHz = 168;
+static uint32_t iLastTime;
+static uint64_t iCycles;
+static int bFirst = 1;
+static unsigned long iSkipped, iFrames;
+
+static void Frame_Print(void)
+{
+	uint32_t iId = iFrame[0] & 0xFFFF;
+	uint32_t iArg[DLOG_MAX_ARGS] = { 0 };
+	int i;
+
+	/* DWT cycle counter wraps every 25 s at 168 MHz */
+	if (!bFirst)
+		iCycles += (uint32_t) (iFrame[1] - iLastTime);
+	bFirst = 0;
+	iLastTime = iFrame[1];
+
+	for (i = 2; i < iLength; i++)
+		iArg[i - 2] = iFrame[i];
+	printf("%12.3f ms  ", iCycles / (fClockMHz * 1000));
+	printf(Formats[iId], iArg[0], iArg[1]);
+	iFrames++;
+}
+
+/* Resynchronizes on the next valid header after a broken frame */
+static void Frame_Word(uint32_t iWord)
+{
+	uint32_t iId, iArgs;
+
+	if (iWords == 0) {
+		iId = iWord & 0xFFFF;
+		iArgs = (iWord >> 16) & 0xFF;
+		if ((iWord >> 24) != DLOG_FRAME_SYNC || iId == DLOG_NONE || iId >= DLOG_COUNT
+				|| iArgs > DLOG_MAX_ARGS) {
+			iSkipped++;
+			return;
+		}
+		iLength = 2 + iArgs;
+	}
+	iFrame[iWords++] = iWord;
+	if (iWords == iLength) {
+		Frame_Print();
+		iWords = 0;
+	}
+}
+
+static void Decode_Words(FILE *pIn)
+{
+	unsigned char bWord[4];
+
+	while (fread(bWord, 1, 4, pIn) == 4)
+		Frame_Word(bWord[0] | bWord[1] << 8 | bWord[2] << 16 | (uint32_t) bWord[3] << 24);
+}
+
+/* ITM packets: header, size in bits 0-1, software source if bit 2 is
+ * clear, port in bits 3-7. Everything else is skipped. */
+static void Decode_Itm(FILE *pIn)
+{
+	uint32_t iWord;
+	int c, i, iSize;
+
+	while ((c = getc(pIn)) != EOF) {
+		/* Synchronization and overflow */
+		if (c == 0x00 || c == 0x80 || c == 0x70)
+			continue;
+		/* Timestamp and extension packets, bit 7 continues */
+		if ((c & 0x03) == 0) {
+			while ((c & 0x80) && (c = getc(pIn)) != EOF)
+				;
+			continue;
+		}
+
+		iSize = (c & 0x03) == 3 ? 4 : (c & 0x03);
+		iWord = 0;
+		for (i = 0; i < iSize; i++) {
+			int b = getc(pIn);
+
+			if (b == EOF)
+				return;
+			iWord |= (uint32_t) b << (8 * i);
+		}
+		if (!(c & 0x04) && (c >> 3) == DLOG_ITM_PORT && iSize == 4)
+			Frame_Word(iWord);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	FILE *pIn = stdin;
+	int bWords = 0, i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-w") == 0) {
+			bWords = 1;
+		} else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			fClockMHz = atof(argv[++i]);
+		} else if (argv[i][0] == '-' || pIn != stdin) {
+			fprintf(stderr, "usage: %s [-w] [-f MHz] [file]\n", argv[0]);
+			return 2;
+		} else if ((pIn = fopen(argv[i], "rb")) == 0) {
+			perror(argv[i]);
+			return 1;
+		}
+	}
+	if (fClockMHz <= 0) {
+		fprintf(stderr, "clock has to be positive\n");
+		return 2;
+	}
+
+	if (bWords)
+		Decode_Words(pIn);
+	else
+		Decode_Itm(pIn);
+
+	fprintf(stderr, "%lu messages, %lu words skipped\n", iFrames, iSkipped);
+	return 0;
+}